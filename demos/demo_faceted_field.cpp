@@ -0,0 +1,96 @@
+#include "core/soltrace_system.h"
+#include <iostream>
+#include <cmath>
+#include <string>
+
+using namespace OptixCSP;
+
+// field of faceted heliostats around a tower. "prototype" mode uses a single faceted prototype (facets
+// canted on-axis once) with one instance per heliostat, "elements" mode places every facet as its own
+// element with the same world pose, which is how faceted heliostats had to be modeled before.
+int main(int argc, char* argv[]) {
+
+	if (argc < 2) {
+		std::cout << "Usage: " << argv[0] << " <prototype|elements> [num_heliostats] [num_rays]" << std::endl;
+		return 1;
+	}
+
+	bool use_prototype = std::string(argv[1]) == "prototype";
+	int num_heliostats = (argc > 2) ? std::stoi(argv[2]) : 10000;
+	int num_rays = (argc > 3) ? std::stoi(argv[3]) : 1000000;
+
+	SolTraceSystem system(num_rays);
+
+	// 5 x 5 facets of 1.2 x 1.2 m, canted for the mean slant range of the field
+	int facets_per_side = 5;
+	double facet_size = 1.2;
+	double facet_gap = 0.02;
+	double spacing = 12.0;
+	double focal_length = 150.0;
+
+	Vec3d receiver_origin(0.0, 0.0, 100.0);
+
+	auto prototype = std::make_shared<ElementPrototype>(std::make_shared<SurfaceFlat>(),
+		std::make_shared<ApertureRectangle>(facet_size, facet_size));
+	prototype->set_facet_grid(facets_per_side, facets_per_side, facet_gap, facet_gap);
+	prototype->set_on_axis_canting(focal_length);
+	uint32_t prototype_index = use_prototype ? system.add_prototype(prototype) : 0;
+
+	int side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(num_heliostats))));
+	for (int i = 0; i < num_heliostats; i++) {
+		double x = (i % side - side / 2) * spacing;
+		double y = (i / side - side / 2) * spacing + 50.0;
+		Vec3d origin(x, y, 0.0);
+
+		// aim halfway between the receiver and the sun, sun is at zenith
+		Vec3d to_receiver = (receiver_origin - origin).normalized();
+		Vec3d normal = (to_receiver + Vec3d(0.0, 0.0, 1.0)).normalized();
+		Vec3d aim_point = origin + normal * 100.0;
+
+		if (use_prototype) {
+			system.add_instance(prototype_index, origin, aim_point, 0.0);
+			continue;
+		}
+
+		// every facet carries the pose of the heliostat composed with its canting
+		ElementInstance instance(0, origin, aim_point, 0.0);
+		Matrix33d rotation = instance.get_rotation_matrix();
+		for (size_t f = 0; f < prototype->get_num_facets(); f++) {
+			const CspElement& facet = prototype->get_facet(f);
+			Vec3d facet_origin = rotation * facet.get_origin() + origin;
+			Vec3d facet_normal = rotation * (facet.get_aim_point() - facet.get_origin());
+
+			auto e = std::make_shared<CspElement>();
+			e->set_origin(facet_origin);
+			e->set_aim_point(facet_origin + facet_normal * 100.0);
+			e->set_zrot(0.0);
+			e->set_surface(prototype->get_surface());
+			e->set_aperture(prototype->get_aperture());
+			system.add_element(e);
+		}
+	}
+
+	// flat receiver facing the field
+	auto receiver = std::make_shared<CspElement>();
+	receiver->set_origin(receiver_origin);
+	receiver->set_aim_point(Vec3d(0.0, 50.0, 0.0));
+	receiver->set_zrot(0.0);
+	receiver->set_aperture(std::make_shared<ApertureRectangle>(20.0, 20.0));
+	receiver->set_surface(std::make_shared<SurfaceFlat>());
+	receiver->set_receiver(true);
+	system.add_element(receiver);
+
+	system.set_sun_vector(Vec3d(0.0, 0.0, 1.0));
+	system.set_sun_angle(0.00465);
+	system.initialize();
+	system.run();
+
+	std::cout << (use_prototype ? "prototype" : "elements") << ", num_heliostats, " << num_heliostats
+		<< ", num_facets, " << num_heliostats * prototype->get_num_facets()
+		<< ", timing_setup, " << system.get_time_setup()
+		<< ", timing_trace, " << system.get_time_trace() << std::endl;
+
+	system.clean_up();
+
+	return 0;
+}
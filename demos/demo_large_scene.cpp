@@ -53,6 +53,8 @@ int main(int argc, char* argv[]) {
 
 	std::cout << "num_rays, " << num_rays << ", timing_setup, " << system.get_time_setup() << ", timing_trace, " << system.get_time_trace() << std::endl;
     system.write_hp_output("output_large_system_flat_heliostats_cylindrical_receiver_stinput-sun_shape_on.csv");
+    // a few hundred thousand hits are enough for the plotting scripts
+    system.write_hp_sample("output_large_system_sample.csv", 200000);
 
     system.clean_up();
 
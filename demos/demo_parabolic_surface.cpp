@@ -80,6 +80,7 @@ int main(int argc, char* argv[]) {
 
 	auto receiver_surface = std::make_shared<SurfaceFlat>();
 	e2->set_surface(receiver_surface);
+	e2->set_receiver(true);
 
 	system.add_element(e2); // Add the receiver to the system
 
@@ -117,6 +118,13 @@ int main(int argc, char* argv[]) {
 	system.write_hp_output(out_dir + filename);
 	system.write_simulation_json(out_dir + "summary.json");
 
+    // receiver flux accumulated in the engine, no need to post-process the hit points
+    const FluxMap& flux_map = system.compute_flux_map(e2->get_id());
+    std::cout << "peak flux " << flux_map.get_peak_flux() << " W/m2, mean flux " << flux_map.get_mean_flux()
+              << " W/m2, total power " << flux_map.get_total_power() << " W" << std::endl;
+    flux_map.write_csv(out_dir + "flux_map.csv");
+    flux_map.write_binary(out_dir + "flux_map.bin");
+
     // Clean up all allocated resources.
     system.clean_up();
 
@@ -0,0 +1,58 @@
+#include "core/ray_order.h"
+#include "core/timer.h"
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <string>
+
+using namespace OptixCSP;
+
+// mean (u, v) extent of warps of 32 consecutive launch indices, smaller means more coherent rays
+static double mean_warp_extent(const std::vector<uint32_t>& order) {
+    const size_t warp = 32;
+    double sum = 0.0;
+    size_t num_warps = order.size() / warp;
+    for (size_t w = 0; w < num_warps; w++) {
+        float u_min = 1.0f, u_max = 0.0f, v_min = 1.0f, v_max = 0.0f;
+        for (size_t i = w * warp; i < (w + 1) * warp; i++) {
+            float u = halton_H(order[i], 2);
+            float v = halton_H(order[i], 3);
+            u_min = fminf(u_min, u); u_max = fmaxf(u_max, u);
+            v_min = fminf(v_min, v); v_max = fmaxf(v_max, v);
+        }
+        sum += std::sqrt((u_max - u_min) * (u_max - u_min) + (v_max - v_min) * (v_max - v_min));
+    }
+    return num_warps ? sum / num_warps : 0.0;
+}
+
+// host cost of the Morton ordering of the sun samples, and the coherence of the warps it produces
+int main(int argc, char* argv[]) {
+
+    int num_rays = (argc > 1) ? std::stoi(argv[1]) : 10000000;
+
+    std::vector<uint32_t> halton_order(num_rays);
+    for (int i = 0; i < num_rays; i++) halton_order[i] = static_cast<uint32_t>(i);
+
+    std::vector<uint32_t> morton_order;
+    Timer order_timer;
+    order_timer.start();
+    compute_morton_ray_order(static_cast<uint32_t>(num_rays), morton_order);
+    order_timer.stop();
+
+    // every ray id shows up exactly once
+    std::vector<bool> seen(num_rays, false);
+    bool valid = morton_order.size() == static_cast<size_t>(num_rays);
+    for (size_t i = 0; valid && i < morton_order.size(); i++) {
+        valid = morton_order[i] < static_cast<uint32_t>(num_rays) && !seen[morton_order[i]];
+        if (valid) seen[morton_order[i]] = true;
+    }
+
+    std::cout << "num_rays, " << num_rays
+        << ", valid_permutation, " << (valid ? "yes" : "no")
+        << ", timing_order, " << order_timer.get_time_sec()
+        << ", timing_order_per_million_rays, " << order_timer.get_time_sec() * 1e6 / num_rays
+        << ", halton_warp_extent, " << mean_warp_extent(halton_order)
+        << ", morton_warp_extent, " << mean_warp_extent(morton_order) << std::endl;
+
+    return valid ? 0 : 1;
+}
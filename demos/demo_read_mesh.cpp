@@ -1,116 +1,18 @@
-// this is for reading a triangular obj mesh file and using each mesh triangle as an aperture for the receiver
+// this is for reading a triangular obj mesh file and using the mesh as a receiver
 
 #include "core/soltrace_system.h"
+#include "core/mesh_loader.h"
 #include <iostream>
 #include <stdexcept>
 #include <cstdlib>
 #include <filesystem>
-#include <fstream>
 #include <string>
-#include <sstream>
+#include <utility>
 
 using namespace std;
 using namespace OptixCSP;
 
 
-class mesh_receiver {
-public: 
-    mesh_receiver(std::string& m_mesh_file) {
-        
-		std::ifstream file(m_mesh_file);
-
-        if (!file.is_open()) {
-            throw std::runtime_error("Failed to open file: " + m_mesh_file);
-        }
-
-        std::vector<Vec3d> vertices;
-        std::vector<int> vertex_id;
-
-        std::string line;
-        while (std::getline(file, line)) {
-            std::istringstream iss(line);
-            std::string prefix;
-            iss >> prefix;
-
-            if (prefix == "v") {
-                // Vertex line
-                double x, y, z;
-                iss >> x >> y >> z;
-                vertices.emplace_back(x, y, z);
-            }
-            else if (prefix == "f") {
-                // Face line
-				int id;
-                char slash; // To handle "v/vt/vn" format
-                for (int i = 0; i < 3; ++i) {
-                    std::string token;
-                    iss >> token; // Read the entire token (e.g., "1//1")
-
-                    // Find the position of the first '/'
-                    size_t slash_pos = token.find('/');
-                    if (slash_pos != std::string::npos) {
-                        // Extract the part before the first '/'
-                        id = std::stoi(token.substr(0, slash_pos));
-                    }
-                    else {
-                        // If no '/' is found, the token is just the vertex index
-                        id = std::stoi(token);
-                    }
-
-                    // OBJ indices are 1-based, convert to 0-based
-                    vertex_id.push_back(id - 1);
-                }
-            }
-        }
-
-        file.close();
-
-		num_triangles = vertex_id.size() / 3;
-
-        // Compute normals for each face
-        for (int i = 0; i < num_triangles; i++) {
-            const Vec3d& v0 = vertices[vertex_id[3 * i]];
-			const Vec3d& v1 = vertices[vertex_id[3 * i + 1]];
-			const Vec3d& v2 = vertices[vertex_id[3 * i + 2]];
-
-            Vec3d edge1 = v1 - v0;
-            Vec3d edge2 = v2 - v0;
-            Vec3d normal = edge1.cross(edge2).normalized();
-
-			vertices_v0.push_back(v0);
-			vertices_v1.push_back(v1);
-            vertices_v2.push_back(v2);
-			normals.push_back(normal * (-1.0));
-
-        }
-        
-	}
-
-	Vec3d get_v0(int i) { return vertices_v0[i]; }
-	Vec3d get_v1(int i) { return vertices_v1[i]; }
-	Vec3d get_v2(int i) { return vertices_v2[i]; }
-	Vec3d get_normal(int i) { return normals[i]; }
-	int get_num_triangles() { return num_triangles; }
-
-    void scale(double scale) {
-        for (auto& v : vertices_v0) v = v * scale;
-        for (auto& v : vertices_v1) v = v * scale;
-		for (auto& v : vertices_v2) v = v * scale;
-
-    }
-
-    private:
-        std::vector<Vec3d> vertices_v0;
-		std::vector<Vec3d> vertices_v1;
-		std::vector<Vec3d> vertices_v2;
-		std::vector<Vec3d> normals;
-		int num_triangles;
-
-
-};
-
-
-
 int main(int argc, char* argv[]) {
     int num_rays = 1000000;
 
@@ -198,30 +100,17 @@ int main(int argc, char* argv[]) {
 
 
 		std::string mesh_file = "../data/structured_mesh.obj";
-		mesh_receiver receiver(mesh_file);
-        receiver.scale(10); // scale the mesh if needed
-		int num_triangles = receiver.get_num_triangles();
-		std::cout << "Number of triangles in the mesh: " << num_triangles << std::endl;
-
-		for (int i = 0; i < num_triangles; i++) {
-            Vec3d p1 = receiver.get_v0(i);
-            Vec3d p2 = receiver.get_v1(i);
-            Vec3d p3 = receiver.get_v2(i);
-            Vec3d normal = receiver.get_normal(i);
-            //normal = normal * (-1.0);
-            Vec3d receiver_aim_point = receiver_origin + normal; // aim point of the receiver
-            auto e4 = std::make_shared<CspElement>();
-            e4->set_origin(receiver_origin);
-            e4->set_aim_point(receiver_aim_point); // Aim direction
-            e4->set_zrot(0.0); // No rotation for the receiver
-            // Create a triangular aperture
-            e4->set_aperture(std::make_shared<ApertureTriangle>(p1, p2, p3));
-            // Create a flat surface
-            auto receiver_surface = std::make_shared<SurfaceFlat>();
-            e4->set_surface(receiver_surface);
-            e4->set_receiver(true); // Mark this element as a receiver
-            system.add_element(e4); // Add the receiver to the system
-		}
+        std::shared_ptr<TriangleMesh> receiver_mesh = load_mesh(mesh_file); // obj or binary stl, duplicate vertices welded
+        for (float3& v : receiver_mesh->vertices) v = make_float3(v.x * 10.0f, v.y * 10.0f, v.z * 10.0f); // scale the mesh if needed
+        // the obj faces point away from the field, swap the winding so the front side faces the heliostats
+        for (uint3& f : receiver_mesh->indices) std::swap(f.y, f.z);
+		std::cout << "Number of triangles in the mesh: " << receiver_mesh->get_num_faces() << std::endl;
+
+        // the whole mesh is a single receiver: one triangle GAS on the device, one hit id per face
+        auto mesh = std::make_shared<MeshElement>(receiver_mesh);
+        mesh->set_origin(receiver_origin);
+        mesh->set_aim_point(receiver_origin + Vec3d(0.0, 0.0, 1.0)); // keep the mesh orientation
+        system.add_mesh(mesh);
 
 
     Vec3d sun_vector(0.0, 0.0, 100.0); // sun vector
@@ -263,6 +152,12 @@ int main(int argc, char* argv[]) {
     system.write_hp_output(out_dir + "sun_error_hit_points_" + to_string(num_rays) + "_rays.csv");
     system.write_simulation_json(out_dir + "sun_error_summary_" + to_string(num_rays) + "_rays.json");
 
+    // flux on every face of the mesh receiver, binned by primitive instead of by hit point
+    const TriangleFlux& face_flux = system.compute_triangle_flux();
+    std::cout << "Power on the mesh receiver: " << face_flux.get_total_power() << " W, peak flux: " << face_flux.get_peak_flux() << " W/m2" << std::endl;
+    face_flux.write_ply(out_dir + "face_flux_" + to_string(num_rays) + "_rays.ply");
+    face_flux.write_csv(out_dir + "face_flux_" + to_string(num_rays) + "_rays.csv");
+
     /////////////////////////////////////////
     // STEP 6  Be a good citizen, clean up //
     /////////////////////////////////////////
@@ -0,0 +1,116 @@
+#include "core/result_pipeline.h"
+#include "core/receiver_stats.h"
+#include "core/timer.h"
+#include <vector_functions.h>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <chrono>
+#include <thread>
+
+using namespace OptixCSP;
+
+// synthetic hits of ray r: the sun point, a heliostat (hit id 1..num_heliostats) and, for some rays, the receiver (hit id 0)
+static void fill_hits(size_t first_ray, size_t num_rays, size_t depth, uint32_t num_heliostats,
+    float4* hit_points, uint32_t* hit_ids) {
+    for (size_t r = 0; r < num_rays; r++) {
+        uint32_t ray = static_cast<uint32_t>(first_ray + r);
+        uint32_t mix = ray * 0x9E3779B9u;
+        mix ^= mix >> 15;
+        for (size_t d = 0; d < depth; d++) {
+            size_t k = r * depth + d;
+            hit_points[k] = make_float4(static_cast<float>(d), static_cast<float>(ray), 0.0f, 0.0f);
+            hit_ids[k] = 0;
+        }
+        hit_ids[r * depth + 1] = 2 + mix % num_heliostats;
+        if (mix % 3 != 0) hit_ids[r * depth + 2] = 1;
+    }
+}
+
+// host side of the batched launches of SolTraceSystem driven by a synthetic producer, no GPU needed:
+// checks that the reducers see every batch once and in order, and that the overlapped
+// produce / reduce pipeline gives the same receiver count as a serial pass over all the hits
+int main(int argc, char* argv[]) {
+
+    size_t num_rays = (argc > 1) ? std::stoul(argv[1]) : 4000000;
+    uint32_t num_batches = (argc > 2) ? static_cast<uint32_t>(std::stoul(argv[2])) : 8;
+    const size_t depth = 5;
+    const uint32_t num_heliostats = 1000;
+    // pretend the device needs this long to trace a batch
+    const auto trace_time = std::chrono::milliseconds(20);
+
+    auto batch_begin = [&](uint32_t b) { return num_rays * b / num_batches; };
+
+    // receiver is hit id 0, stored as 1
+    std::vector<int32_t> hit_to_receiver(num_heliostats + 1, -1);
+    hit_to_receiver[0] = 0;
+
+    // serial reference: trace everything, then reduce
+    Timer serial_timer;
+    serial_timer.start();
+    std::vector<float4> all_points(num_rays * depth);
+    std::vector<uint32_t> all_ids(num_rays * depth);
+    for (uint32_t b = 0; b < num_batches; b++) {
+        std::this_thread::sleep_for(trace_time);
+        fill_hits(batch_begin(b), batch_begin(b + 1) - batch_begin(b), depth, num_heliostats,
+            all_points.data() + batch_begin(b) * depth, all_ids.data() + batch_begin(b) * depth);
+    }
+    BatchLayout one_batch;
+    one_batch.entries_per_ray = depth;
+    one_batch.num_rays = num_rays;
+    std::vector<uint64_t> serial_counts;
+    std::vector<double> serial_power;
+    count_receiver_hits(all_ids, {}, hit_to_receiver, 1, one_batch, PathFilter::ALL, serial_counts, serial_power);
+    serial_timer.stop();
+
+    // pipelined: the producer fills batch N + 1 while the worker reduces batch N
+    Timer pipeline_timer;
+    pipeline_timer.start();
+    size_t max_batch_rays = 0;
+    for (uint32_t b = 0; b < num_batches; b++) max_batch_rays = std::max(max_batch_rays, batch_begin(b + 1) - batch_begin(b));
+
+    ResultPipeline pipeline(2, max_batch_rays * depth, false);
+    uint64_t pipeline_count = 0;
+    uint32_t next_batch = 0;
+    bool in_order = true;
+    pipeline.add_reducer([&](const HitBatch& batch) {
+        in_order = in_order && batch.index == next_batch++;
+        std::vector<uint32_t> ids(batch.hit_ids, batch.hit_ids + batch.get_num_entries());
+        std::vector<uint64_t> counts;
+        std::vector<double> power;
+        BatchLayout layout;
+        layout.entries_per_ray = batch.entries_per_ray;
+        layout.num_rays = batch.num_rays;
+        count_receiver_hits(ids, {}, hit_to_receiver, 1, layout, PathFilter::ALL, counts, power);
+        pipeline_count += counts[0];
+    });
+
+    for (uint32_t b = 0; b < num_batches; b++) {
+        size_t s = pipeline.acquire();
+        const ResultPipeline::Slot& slot = pipeline.get_slot(s);
+        std::this_thread::sleep_for(trace_time);
+        fill_hits(batch_begin(b), batch_begin(b + 1) - batch_begin(b), depth, num_heliostats, slot.hit_points, slot.hit_ids);
+
+        HitBatch batch;
+        batch.index = b;
+        batch.first_ray = batch_begin(b);
+        batch.num_rays = batch_begin(b + 1) - batch_begin(b);
+        batch.entries_per_ray = depth;
+        pipeline.submit(s, batch);
+    }
+    pipeline.finish();
+    pipeline_timer.stop();
+
+    bool valid = in_order && next_batch == num_batches && pipeline_count == serial_counts[0];
+
+    std::cout << "num_rays, " << num_rays
+        << ", num_batches, " << num_batches
+        << ", receiver_hits_serial, " << serial_counts[0]
+        << ", receiver_hits_pipeline, " << pipeline_count
+        << ", batches_in_order, " << (in_order ? "yes" : "no")
+        << ", timing_serial, " << serial_timer.get_time_sec()
+        << ", timing_pipeline, " << pipeline_timer.get_time_sec() << std::endl;
+
+    return valid ? 0 : 1;
+}
@@ -70,6 +70,8 @@ int main(int argc, char* argv[]) {
     double sun_angle = 0.465; // 0.00465; // sun angle
     system.set_sun_angle(sun_angle);
 	system.set_sun_vector(sun_vector);
+    // the sun ray directions are written out below, trace them too
+    system.set_output_fields(OUTPUT_POSITION | OUTPUT_DIRECTION);
 
     ///////////////////////////////////
     // STEP 3  Initialize the system //
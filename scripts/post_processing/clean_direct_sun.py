@@ -3,6 +3,8 @@ import csv
 import pandas as pd
 
 # remove hitpoints on the receiver coming directly from the sun for CPU comparison 
+# note: the engine tags these hits during the trace, SolTraceSystem::set_path_filter(PathFilter::REFLECTED)
+# gives the cleaned flux map and receiver stats without going through the hit point CSV
 def clean_receiver_direct_sun_hits(filename, output_filename):
     df = pd.read_csv(filename)
 
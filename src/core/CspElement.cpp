@@ -8,6 +8,7 @@
 #include "utils/math_util.h"
 #include "shaders/GeometryDataST.h"
 #include "CspElement.h"
+#include "transform_group.h"
 #include <vector>
 
 
@@ -20,6 +21,10 @@ CspElement::CspElement() {
     m_aim_point = Vec3d(0.0, 0.0, 1.0); // Default aim direction
     m_euler_angles = Vec3d(0.0, 0.0, 0.0); // Default orientation
     m_zrot = 0.0;
+    m_global_origin = Vec3d(0.0, 0.0, 0.0);
+    m_group = nullptr;
+    m_id = -1;
+    m_dirty = true;
     m_surface = nullptr;
     m_aperture = nullptr;
     m_receiver = false;
@@ -28,6 +33,8 @@ CspElement::CspElement() {
     m_slope_error = 0.0f;
 	m_specularity_error = 0.0f;
     m_use_refraction = false;
+    m_optic = -1;
+    m_enabled = true;
 }
 
 // set and get origin 
@@ -37,10 +44,12 @@ const Vec3d& CspElement::get_origin() const{
 
 void CspElement::set_origin(const Vec3d& o) {
     m_origin = o;
+    mark_dirty();
 }
 
 void CspElement::set_aim_point(const Vec3d& a) {
     m_aim_point = a;
+    mark_dirty();
 }
 
 const Vec3d& CspElement::get_aim_point() const {
@@ -49,6 +58,17 @@ const Vec3d& CspElement::get_aim_point() const {
 
 void CspElement::set_zrot(double zrot) {
     m_zrot = zrot;
+    mark_dirty();
+}
+
+void CspElement::set_group(TransformGroup* group) {
+    m_group = group;
+    mark_dirty();
+}
+
+void CspElement::mark_dirty() {
+    m_dirty = true;
+    if (m_group) m_group->mark_subtree_dirty();
 }
 
 double CspElement::get_zrot() const {
@@ -87,25 +107,46 @@ void CspElement::update_euler_angles(const Vec3d& aim_point, const double zrot)
     Vec3d normal = aim_point - m_origin;
     normal.normalized();
     m_euler_angles = OptixCSP::normal_to_euler(normal, zrot);
+    update_global_frame();
 }
 
 void CspElement::update_euler_angles() {
     Vec3d normal = m_aim_point - m_origin;
     normal.normalized();
     m_euler_angles = OptixCSP::normal_to_euler(normal, m_zrot);
+    update_global_frame();
 }
 
 void CspElement::update_element(const Vec3d& aim_point, const double zrot) {
     m_aim_point = aim_point;
     m_zrot = zrot;
     update_euler_angles();
+    mark_dirty();
+}
+
+void CspElement::update_global_frame() {
+    // get G2L rotation matrix from euler angles, cache the L2G one
+    Matrix33d rotation_local = OptixCSP::get_rotation_matrix_G2L(m_euler_angles).transpose();
+
+    if (m_group) {
+        const Matrix33d& group_rotation = m_group->get_rotation_matrix();
+        m_rotation_L2G = group_rotation * rotation_local;
+        m_global_origin = group_rotation * m_origin + m_group->get_global_origin();
+    }
+    else {
+        m_rotation_L2G = rotation_local;
+        m_global_origin = m_origin;
+    }
+    m_dirty = true;
 }
+
 // return L2G rotation matrix
-Matrix33d CspElement::get_rotation_matrix() const {
-    // get G2L rotation matrix from euler angles 
-    // TODO: need to think about if we store this or not
-    Matrix33d mat_G2L = OptixCSP::get_rotation_matrix_G2L(m_euler_angles);
-    return mat_G2L.transpose();
+const Matrix33d& CspElement::get_rotation_matrix() const {
+    return m_rotation_L2G;
+}
+
+const Vec3d& CspElement::get_global_origin() const {
+    return m_global_origin;
 }
 
 
@@ -138,14 +179,14 @@ GeometryDataST CspElement::toDeviceGeometryData() const {
         Vec3d v2 = rotation_matrix.get_y_basis();
 
         if (surface_type == SurfaceType::FLAT) {
-            GeometryDataST::Rectangle_Flat heliostat(OptixCSP::toFloat3(m_origin), OptixCSP::toFloat3(v1), OptixCSP::toFloat3(v2), (float)width, (float)height);
+            GeometryDataST::Rectangle_Flat heliostat(OptixCSP::toFloat3(m_global_origin), OptixCSP::toFloat3(v1), OptixCSP::toFloat3(v2), (float)width, (float)height);
             geometry_data.setRectangle_Flat(heliostat);
         }
 
         if (surface_type == SurfaceType::PARABOLIC) {
 			v1 = v1 * (float)(-width);
 			v2 = v2 * (float)height;
-			float3 anchor = OptixCSP::toFloat3(m_origin - v1 * 0.5 - v2 * 0.5);
+			float3 anchor = OptixCSP::toFloat3(m_global_origin - v1 * 0.5 - v2 * 0.5);
             GeometryDataST::Rectangle_Parabolic heliostat(OptixCSP::toFloat3(v1), OptixCSP::toFloat3(v2),  anchor,
                 (float)m_surface->get_curvature_1(),
                 (float)m_surface->get_curvature_2());
@@ -156,7 +197,7 @@ GeometryDataST CspElement::toDeviceGeometryData() const {
             float radius = static_cast<float>(width) / 2.0f;
             float half_height = static_cast<float>(height) / 2.0f;
 
-			float3 center = OptixCSP::toFloat3(m_origin);
+			float3 center = OptixCSP::toFloat3(m_global_origin);
 			Matrix33d rotation_matrix = get_rotation_matrix();  // L2G rotation matrix
 
 			float3 base_x = OptixCSP::toFloat3(rotation_matrix.get_x_basis());
@@ -181,9 +222,9 @@ GeometryDataST CspElement::toDeviceGeometryData() const {
 
 		// given the origin and rotation, compute global coordinates of the triangle vertices
 		Matrix33d rotation_matrix = get_rotation_matrix();  // L2G rotation matrix
-		Vec3d v1_global = rotation_matrix * v1 + m_origin;
-		Vec3d v2_global = rotation_matrix * v2 + m_origin;
-		Vec3d v3_global = rotation_matrix * v3 + m_origin;
+		Vec3d v1_global = rotation_matrix * v1 + m_global_origin;
+		Vec3d v2_global = rotation_matrix * v2 + m_global_origin;
+		Vec3d v3_global = rotation_matrix * v3 + m_global_origin;
 
 		GeometryDataST::Triangle_Flat heliostat(OptixCSP::toFloat3(v1_global), OptixCSP::toFloat3(v2_global), OptixCSP::toFloat3(v3_global));
 		geometry_data.setTriangle_Flat(heliostat);        
@@ -193,6 +234,27 @@ GeometryDataST CspElement::toDeviceGeometryData() const {
 }
 
 
+GeometryDataST::Type CspElement::get_geometry_type() const {
+
+    SurfaceType surface_type = m_surface->get_surface_type();
+    ApertureType aperture_type = m_aperture->get_aperture_type();
+
+    if (aperture_type == ApertureType::RECTANGLE) {
+        if (surface_type == SurfaceType::FLAT)
+            return GeometryDataST::RECTANGLE_FLAT;
+        if (surface_type == SurfaceType::PARABOLIC)
+            return GeometryDataST::RECTANGLE_PARABOLIC;
+        if (surface_type == SurfaceType::CYLINDER)
+            return GeometryDataST::CYLINDER_Y;
+    }
+
+    if (aperture_type == ApertureType::TRIANGLE)
+        return GeometryDataST::TRIANGLE_FLAT;
+
+    return GeometryDataST::UNKNOWN_TYPE;
+}
+
+
 // we also need to implement the bounding box computation
 // for a case like a rectangle aperture,
 // once we have the origin, euler angles, rotatioin matrix
@@ -219,10 +281,10 @@ void CspElement::compute_bounding_box() {
         Vec3d corner4 = Vec3d(-width / 2,  height / 2, 0.0);
 
         // transform the corners to the global frame
-        Vec3d corner1_global = rotation_matrix * corner1 + m_origin;
-        Vec3d corner2_global = rotation_matrix * corner2 + m_origin;
-        Vec3d corner3_global = rotation_matrix * corner3 + m_origin;
-        Vec3d corner4_global = rotation_matrix * corner4 + m_origin;
+        Vec3d corner1_global = rotation_matrix * corner1 + m_global_origin;
+        Vec3d corner2_global = rotation_matrix * corner2 + m_global_origin;
+        Vec3d corner3_global = rotation_matrix * corner3 + m_global_origin;
+        Vec3d corner4_global = rotation_matrix * corner4 + m_global_origin;
 
         // now update the bounding box, need to find the min and max x, y, z
         m_lower_box_bound[0] = fmin(fmin(corner1_global[0], corner2_global[0]), fmin(corner3_global[0], corner4_global[0]));
@@ -254,14 +316,14 @@ void CspElement::compute_bounding_box() {
 		Matrix33d rotation_matrix = get_rotation_matrix();  // L2G rotation matrix
 
 		// transform the corners to the global frame
-		Vec3d corner1_global = rotation_matrix * corner1 + m_origin;
-		Vec3d corner2_global = rotation_matrix * corner2 + m_origin;
-		Vec3d corner3_global = rotation_matrix * corner3 + m_origin;
-		Vec3d corner4_global = rotation_matrix * corner4 + m_origin;
-		Vec3d corner5_global = rotation_matrix * corner5 + m_origin;
-		Vec3d corner6_global = rotation_matrix * corner6 + m_origin;
-		Vec3d corner7_global = rotation_matrix * corner7 + m_origin;
-		Vec3d corner8_global = rotation_matrix * corner8 + m_origin;
+		Vec3d corner1_global = rotation_matrix * corner1 + m_global_origin;
+		Vec3d corner2_global = rotation_matrix * corner2 + m_global_origin;
+		Vec3d corner3_global = rotation_matrix * corner3 + m_global_origin;
+		Vec3d corner4_global = rotation_matrix * corner4 + m_global_origin;
+		Vec3d corner5_global = rotation_matrix * corner5 + m_global_origin;
+		Vec3d corner6_global = rotation_matrix * corner6 + m_global_origin;
+		Vec3d corner7_global = rotation_matrix * corner7 + m_global_origin;
+		Vec3d corner8_global = rotation_matrix * corner8 + m_global_origin;
 
 		// go through the corners and find the min and max x, y, z
 		std::vector<Vec3d> corners = { corner1_global, corner2_global, corner3_global, corner4_global,
@@ -306,9 +368,9 @@ void CspElement::compute_bounding_box() {
         Vec3d v2 = tri.get_v1();
         Vec3d v3 = tri.get_v2();
         // transform the vertices to the global frame
-        Vec3d v1_global = rotation_matrix * v1 + m_origin;
-        Vec3d v2_global = rotation_matrix * v2 + m_origin;
-        Vec3d v3_global = rotation_matrix * v3 + m_origin;
+        Vec3d v1_global = rotation_matrix * v1 + m_global_origin;
+        Vec3d v2_global = rotation_matrix * v2 + m_global_origin;
+        Vec3d v3_global = rotation_matrix * v3 + m_global_origin;
         // now update the bounding box, need to find the min and max x, y, z
         m_lower_box_bound[0] = fmin(fmin(v1_global[0], v2_global[0]), v3_global[0]);
         m_lower_box_bound[1] = fmin(fmin(v1_global[1], v2_global[1]), v3_global[1]);
@@ -335,7 +397,7 @@ bool CspElement::in_plane(const Vec3d& point) const {
         // get the rotation matrix
         Matrix33d rotation_matrix = get_rotation_matrix();  // L2G rotation matrix
         // transform the point to local coordinates
-        Vec3d point_local = rotation_matrix.transpose() * (point - m_origin);
+        Vec3d point_local = rotation_matrix.transpose() * (point - m_global_origin);
         // check if the point is inside the rectangle
         if (point_local[0] >= -width / 2 && point_local[0] <= width / 2 &&
             point_local[1] >= -height / 2 && point_local[1] <= height / 2 &&
@@ -14,6 +14,7 @@
 namespace OptixCSP {
 
     class Aperture;
+    class TransformGroup;
     class CspElementBase {
     public:
         CspElementBase();
@@ -67,16 +68,26 @@ namespace OptixCSP {
         void set_aperture(const std::shared_ptr<Aperture>& aperture);
         void set_surface(const std::shared_ptr<Surface>& surface);
 
+		/// fraction of the power reflected, 1 (no loss) by default. Unweighted rays are absorbed with probability
+		/// 1 - reflectivity, weighted rays are scaled by it.
 		void set_reflectivity(float val) { m_reflectivity = val; }
 		float get_reflectivity() const { return m_reflectivity; }
         void set_transmissivity(float val) { m_transmissivity = val;}
 		float get_transmissivity() const { return m_transmissivity; }
+		/// gaussian surface errors (mrad, per axis) of the slope and of the reflected direction, see SurfaceError.h
 		void set_slope_error(float val) { m_slope_error = val; }
 		float get_slope_error() const { return m_slope_error; }
 		void set_specularity_error(float val) { m_specularity_error = val; }
 		float get_specularity_error() const { return m_specularity_error; }
 		void use_refraction(bool val) { m_use_refraction = val; }
 		bool use_refraction() const { return m_use_refraction; }
+		// index of a shared optic (SolTraceSystem::add_optic) replacing the properties above, -1 if none.
+		// use_refraction still selects the interaction.
+		void set_optic(int index) { m_optic = index; }
+		int get_optic() const { return m_optic; }
+		// disabled elements are skipped by the trace (e.g. heliostat outages), see SolTraceSystem::set_element_enabled
+		void set_enabled(bool val) { m_enabled = val; }
+		bool is_enabled() const { return m_enabled; }
 
 
         // set orientation based on aimpoint and zrot
@@ -86,8 +97,23 @@ namespace OptixCSP {
 
         void update_element(const Vec3d& aim_point, const double zrot);
 
-        // return L2G rotation matrix
-        Matrix33d get_rotation_matrix() const;
+        // return L2G rotation matrix, composed with the parent group if there is one
+        const Matrix33d& get_rotation_matrix() const;
+
+        // origin in the global frame, same as get_origin() if the element is not in a group
+        const Vec3d& get_global_origin() const;
+
+        // group the element belongs to, origin and aim point are relative to the group frame
+        void set_group(TransformGroup* group);
+        TransformGroup* get_group() const { return m_group; }
+
+        // index of the element in the system, assigned by SolTraceSystem::add_element
+        void set_id(int id) { m_id = id; }
+        int get_id() const { return m_id; }
+
+        // true if the pose changed since the geometry was last collected
+        bool is_dirty() const { return m_dirty; }
+        void clear_dirty() { m_dirty = false; }
 
 
         // return upper bounding box
@@ -99,6 +125,9 @@ namespace OptixCSP {
         // convert to device data available to GPU
         GeometryDataST toDeviceGeometryData() const override; 
 
+        // type of the device geometry, same as toDeviceGeometryData().type without building it
+        GeometryDataST::Type get_geometry_type() const;
+
         // we also need to implement the bounding box computation
         // for a case like a rectangle aperture,
         // once we have the origin, euler angles, rotatioin matrix
@@ -111,11 +140,24 @@ namespace OptixCSP {
 
 
     private:
+        // recompute the cached global frame from the euler angles and the parent group
+        void update_global_frame();
+        // flag the pose as changed and let the parent group know
+        void mark_dirty();
+
         Vec3d m_origin;
         Vec3d m_aim_point;
         Vec3d m_euler_angles;  // euler angles, need to be computed from aim point and zrot
         double m_zrot; // zrot from the stinput file, user provided value, in degrees
 
+        // cached global frame, refreshed by update_euler_angles()
+        Vec3d m_global_origin;
+        Matrix33d m_rotation_L2G;
+
+        TransformGroup* m_group;  // not owned, the group holds the element
+        int m_id;
+        bool m_dirty;
+
         Vec3d m_upper_box_bound;
         Vec3d m_lower_box_bound;
 
@@ -128,6 +170,8 @@ namespace OptixCSP {
 		float m_slope_error;
 		float m_specularity_error;
 		bool m_use_refraction; // for now, if true, ray goes through the object, otherwise it reflects
+		int m_optic;
+		bool m_enabled;
 
     };
 }
\ No newline at end of file
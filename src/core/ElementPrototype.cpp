@@ -0,0 +1,87 @@
+#include "ElementPrototype.h"
+#include "Surface.h"
+#include "Aperture.h"
+#include "utils/math_util.h"
+
+#include <stdexcept>
+
+using namespace OptixCSP;
+
+ElementPrototype::ElementPrototype(const std::shared_ptr<Surface>& surface, const std::shared_ptr<Aperture>& aperture) {
+    m_element.set_surface(surface);
+    m_element.set_aperture(aperture);
+    // default pose (origin, aim at +z, no zrot) gives the identity frame
+    m_element.update_euler_angles();
+}
+
+void ElementPrototype::set_facet_grid(int nx, int ny, double gap_x, double gap_y) {
+    if (nx < 1 || ny < 1) {
+        throw std::invalid_argument("ElementPrototype: a facet grid needs at least one facet in each direction");
+    }
+    const double pitch_x = get_aperture()->get_width() + gap_x;
+    const double pitch_y = get_aperture()->get_height() + gap_y;
+
+    std::vector<Vec3d> centers;
+    centers.reserve(static_cast<size_t>(nx) * ny);
+    for (int j = 0; j < ny; j++) {
+        for (int i = 0; i < nx; i++) {
+            centers.emplace_back((i - 0.5 * (nx - 1)) * pitch_x, (j - 0.5 * (ny - 1)) * pitch_y, 0.0);
+        }
+    }
+    set_facet_centers(centers);
+}
+
+void ElementPrototype::set_facet_centers(const std::vector<Vec3d>& centers) {
+    m_facet_centers = centers;
+    update_facets();
+}
+
+void ElementPrototype::set_flat_canting() {
+    m_canting = CantingType::FLAT;
+    update_facets();
+}
+
+void ElementPrototype::set_on_axis_canting(double focal_length) {
+    if (!(focal_length > 0.0)) {
+        throw std::invalid_argument("ElementPrototype: the canting focal length must be positive");
+    }
+    m_canting = CantingType::ON_AXIS;
+    m_canting_sun_dir = Vec3d(0.0, 0.0, 1.0);
+    m_canting_target = Vec3d(0.0, 0.0, focal_length);
+    update_facets();
+}
+
+void ElementPrototype::set_off_axis_canting(const Vec3d& sun_dir, const Vec3d& target) {
+    if (sun_dir.norm() == 0.0) {
+        throw std::invalid_argument("ElementPrototype: the canting sun direction is zero");
+    }
+    m_canting = CantingType::OFF_AXIS;
+    m_canting_sun_dir = sun_dir.normalized();
+    m_canting_target = target;
+    update_facets();
+}
+
+// the normal of a canted facet bisects the sun direction and the direction from its center to the target
+void ElementPrototype::update_facets() {
+    m_facets.clear();
+    m_facets.reserve(m_facet_centers.size());
+    for (const Vec3d& center : m_facet_centers) {
+        Vec3d normal(0.0, 0.0, 1.0);
+        if (m_canting != CantingType::FLAT) {
+            normal = ((m_canting_target - center).normalized() + m_canting_sun_dir).normalized();
+        }
+
+        CspElement facet = m_element;
+        facet.set_origin(center);
+        facet.set_aim_point(center + normal);
+        facet.set_zrot(0.0);
+        facet.update_euler_angles();
+        m_facets.push_back(facet);
+    }
+}
+
+Matrix33d ElementInstance::get_rotation_matrix() const {
+    Vec3d normal = get_aim_point() - get_origin();
+    Vec3d euler = OptixCSP::normal_to_euler(normal, zrot);
+    return OptixCSP::get_rotation_matrix_G2L(euler).transpose();
+}
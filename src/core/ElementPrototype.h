@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "vec3d.h"
+#include "CspElement.h"
+#include "shaders/GeometryDataST.h"
+#include "shaders/MaterialDataST.h"
+
+namespace OptixCSP {
+
+    class Surface;
+    class Aperture;
+
+    /// how the facets of a faceted prototype are tilted with respect to the heliostat plane
+    enum class CantingType {
+        FLAT,       // facets parallel to the heliostat
+        ON_AXIS,    // a ray along the heliostat normal is reflected by every facet center to the focal point
+        OFF_AXIS    // same for a design sun direction and target, both given in the local frame
+    };
+
+    /**
+     * @class ElementPrototype
+     * @brief Shared definition of identical elements (typically heliostats).
+     *
+     * Surface, aperture, curvature and optics are defined once, in the prototype local frame
+     * (origin at zero, facing +z). Each instance only stores its pose and the prototype index
+     * (see ElementInstance), and on the device every instance references the same prototype GAS
+     * through an OptiX instance transform.
+     *
+     * A prototype can also be a faceted heliostat: the surface and aperture then describe one facet,
+     * the facet layout (centers in the local frame) and the canting are set once on the prototype and
+     * the canted facets are computed right away. Every facet is one primitive of the prototype GAS with
+     * its own bounding box, the instance keeps a single bound and a single hit id for the heliostat.
+     */
+    class ElementPrototype {
+    public:
+        ElementPrototype(const std::shared_ptr<Surface>& surface, const std::shared_ptr<Aperture>& aperture);
+        ~ElementPrototype() = default;
+
+        std::shared_ptr<Surface> get_surface() const { return m_element.get_surface(); }
+        std::shared_ptr<Aperture> get_aperture() const { return m_element.get_aperture(); }
+
+        // optical properties, shared by all the instances
+        void set_receiver(bool val) { m_element.set_receiver(val); }
+        bool is_receiver() const { return m_element.is_receiver(); }
+        void set_reflectivity(float val) { m_element.set_reflectivity(val); }
+        float get_reflectivity() const { return m_element.get_reflectivity(); }
+        void set_transmissivity(float val) { m_element.set_transmissivity(val); }
+        float get_transmissivity() const { return m_element.get_transmissivity(); }
+        void set_slope_error(float val) { m_element.set_slope_error(val); }
+        float get_slope_error() const { return m_element.get_slope_error(); }
+        void set_specularity_error(float val) { m_element.set_specularity_error(val); }
+        float get_specularity_error() const { return m_element.get_specularity_error(); }
+        void use_refraction(bool val) { m_element.use_refraction(val); }
+        bool use_refraction() const { return m_element.use_refraction(); }
+        void set_optic(int index) { m_element.set_optic(index); }
+        int get_optic() const { return m_element.get_optic(); }
+
+        /// element describing the prototype in its local frame
+        const CspElement& get_local_element() const { return m_element; }
+
+        /// nx by ny facets of the size of the aperture, separated by gap_x and gap_y, centered on the local origin
+        void set_facet_grid(int nx, int ny, double gap_x, double gap_y);
+        /// facets centered at the given points of the local frame, no facet (a plain prototype) if empty
+        void set_facet_centers(const std::vector<Vec3d>& centers);
+        const std::vector<Vec3d>& get_facet_centers() const { return m_facet_centers; }
+
+        void set_flat_canting();
+        /// cant the facets towards the focal point (0, 0, focal_length) of the local frame
+        void set_on_axis_canting(double focal_length);
+        /// cant the facets for the sun direction sun_dir (towards the sun) and the point target,
+        /// both in the local frame of the heliostat at the design time
+        void set_off_axis_canting(const Vec3d& sun_dir, const Vec3d& target);
+        CantingType get_canting_type() const { return m_canting; }
+
+        /// number of primitives of the prototype, 1 if it is not faceted
+        size_t get_num_facets() const { return m_facets.empty() ? 1 : m_facets.size(); }
+        /// facet f placed and canted in the local frame, the local element if the prototype is not faceted
+        const CspElement& get_facet(size_t f) const { return m_facets.empty() ? m_element : m_facets[f]; }
+
+    private:
+        /// place and cant every facet, called whenever the layout or the canting changes
+        void update_facets();
+
+        CspElement m_element;  // placed at the local origin, aiming at +z (identity frame)
+
+        std::vector<Vec3d>      m_facet_centers;
+        CantingType             m_canting = CantingType::FLAT;
+        Vec3d                   m_canting_sun_dir = Vec3d(0.0, 0.0, 1.0);
+        Vec3d                   m_canting_target = Vec3d(0.0, 0.0, 0.0);
+        std::vector<CspElement> m_facets;  // canted facets, empty if the prototype is not faceted
+    };
+
+    /**
+     * Compact pose of a prototype instance, this is all that is stored per heliostat on the host.
+     * Origin and aim point are global coordinates, same convention as CspElement.
+     */
+    struct ElementInstance {
+        float    origin[3];
+        float    aim_point[3];
+        float    zrot;       // degrees
+        uint32_t prototype;  // index in the prototype list of the system
+
+        ElementInstance() = default;
+        ElementInstance(uint32_t proto, const Vec3d& o, const Vec3d& aim, double z)
+            : origin{ (float)o[0], (float)o[1], (float)o[2] },
+              aim_point{ (float)aim[0], (float)aim[1], (float)aim[2] },
+              zrot((float)z),
+              prototype(proto) {}
+
+        Vec3d get_origin() const { return Vec3d(origin[0], origin[1], origin[2]); }
+        Vec3d get_aim_point() const { return Vec3d(aim_point[0], aim_point[1], aim_point[2]); }
+
+        /// L2G rotation matrix of the instance
+        Matrix33d get_rotation_matrix() const;
+    };
+}
@@ -0,0 +1,29 @@
+#include "MeshElement.h"
+#include "utils/math_util.h"
+#include "utils/parallel_util.h"
+
+#include <stdexcept>
+#include <utility>
+
+using namespace OptixCSP;
+
+MeshElement::MeshElement(std::shared_ptr<const TriangleMesh> mesh) : m_mesh(std::move(mesh)) {
+    if (!m_mesh) {
+        throw std::invalid_argument("MeshElement: no mesh given");
+    }
+}
+
+Matrix33d MeshElement::get_rotation_matrix() const {
+    Vec3d euler = OptixCSP::normal_to_euler(m_aim_point - m_origin, m_zrot);
+    return OptixCSP::get_rotation_matrix_G2L(euler).transpose();
+}
+
+std::vector<float3> MeshElement::get_global_vertices() const {
+    const Matrix33d rotation_matrix = get_rotation_matrix();
+    std::vector<float3> vertices(m_mesh->vertices.size());
+    parallel_for(vertices.size(), [&](size_t i) {
+        const float3& v = m_mesh->vertices[i];
+        vertices[i] = OptixCSP::toFloat3(rotation_matrix * Vec3d(v.x, v.y, v.z) + m_origin);
+    }, 4096);
+    return vertices;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <vector_types.h>
+
+#include "vec3d.h"
+
+namespace OptixCSP {
+
+    /**
+     * Indexed triangle mesh in the local frame of the elements using it.
+     * Faces are three vertex indices, the front side is determined by the right-hand rule (same as ApertureTriangle).
+     */
+    struct TriangleMesh {
+        std::vector<float3> vertices;
+        std::vector<uint3>  indices;
+
+        size_t get_num_vertices() const { return vertices.size(); }
+        size_t get_num_faces() const { return indices.size(); }
+    };
+
+    /**
+     * @class MeshElement
+     * @brief Triangle mesh receiver placed in the scene with a single pose.
+     *
+     * The vertex and index buffers are shared (several elements can place the same mesh) and are never
+     * expanded into one CspElement per face: on the device the mesh is one triangle GAS built from the buffers
+     * and referenced by one instance of the IAS. Every face gets its own hit id (see SolTraceSystem::add_mesh),
+     * so the hits of a face are known without looking at the hit point.
+     * Rays hitting the front side of a face are absorbed, the back side is transparent.
+     */
+    class MeshElement {
+    public:
+        explicit MeshElement(std::shared_ptr<const TriangleMesh> mesh);
+        ~MeshElement() = default;
+
+        /// pose, same convention as CspElement. The default (origin at zero, aiming at +z, no zrot)
+        /// keeps the mesh in its own coordinates.
+        void set_origin(const Vec3d& origin) { m_origin = origin; }
+        Vec3d get_origin() const { return m_origin; }
+        void set_aim_point(const Vec3d& aim_point) { m_aim_point = aim_point; }
+        Vec3d get_aim_point() const { return m_aim_point; }
+        void set_zrot(double zrot) { m_zrot = zrot; }  // degrees
+        double get_zrot() const { return m_zrot; }
+
+        /// L2G rotation matrix of the mesh
+        Matrix33d get_rotation_matrix() const;
+
+        const TriangleMesh& get_mesh() const { return *m_mesh; }
+        const std::shared_ptr<const TriangleMesh>& get_shared_mesh() const { return m_mesh; }
+        size_t get_num_faces() const { return m_mesh->get_num_faces(); }
+
+        /// vertices of the mesh placed with the pose of the element (global coordinates)
+        std::vector<float3> get_global_vertices() const;
+
+    private:
+        std::shared_ptr<const TriangleMesh> m_mesh;
+        Vec3d  m_origin = Vec3d(0.0, 0.0, 0.0);
+        Vec3d  m_aim_point = Vec3d(0.0, 0.0, 1.0);
+        double m_zrot = 0.0;
+    };
+}
@@ -0,0 +1,74 @@
+#include "compact_hits.h"
+#include "hit_path.h"
+#include "utils/parallel_util.h"
+
+#include <fstream>
+#include <iostream>
+
+using namespace OptixCSP;
+
+std::vector<CompactHitRecord> OptixCSP::compact_hits(const std::vector<uint32_t>& hit_ids,
+    const std::vector<uint32_t>& hit_uv,
+    const std::vector<float4>& hit_points,
+    const std::vector<HitFrame>& frames) {
+
+    // count the hits of every chunk, then each chunk writes at its offset
+    const size_t count = hit_ids.size();
+    std::vector<size_t> chunk_counts(get_num_host_threads() + 1, 0);
+    unsigned int num_chunks = parallel_for_chunks(count, [&](size_t begin, size_t end, unsigned int t) {
+        size_t n = 0;
+        for (size_t k = begin; k < end; k++) n += get_stored_hit_id(hit_ids[k]) != 0;
+        chunk_counts[t + 1] = n;
+    });
+    for (unsigned int t = 0; t < num_chunks; t++) chunk_counts[t + 1] += chunk_counts[t];
+
+    std::vector<CompactHitRecord> records(chunk_counts[num_chunks]);
+    parallel_for_chunks(count, [&](size_t begin, size_t end, unsigned int t) {
+        size_t dst = chunk_counts[t];
+        for (size_t k = begin; k < end; k++) {
+            uint32_t stored_id = get_stored_hit_id(hit_ids[k]);
+            if (stored_id == 0) continue;
+
+            CompactHitRecord& r = records[dst++];
+            r.entry = static_cast<uint32_t>(k);
+            r.hit = hit_ids[k];
+            if (!hit_uv.empty()) {
+                r.uv = hit_uv[k];
+            }
+            else {
+                const float4& hp = hit_points[k];
+                r.uv = encode_hit_uv(frames[stored_id - 1], make_float3(hp.y, hp.z, hp.w));
+            }
+        }
+    });
+
+    return records;
+}
+
+void OptixCSP::write_compact_hits_binary(const std::string& filename, uint32_t max_depth,
+    const std::vector<uint32_t>& element_order, uint32_t num_instances, uint32_t num_mesh_faces,
+    const std::vector<HitFrame>& frames, const std::vector<CompactHitRecord>& records) {
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Error: Could not open the file " << filename << " for writing." << std::endl;
+        return;
+    }
+
+    static_assert(sizeof(CompactHitRecord) == 12, "CompactHitRecord is part of the file format");
+    static_assert(sizeof(HitFrame) == 72, "HitFrame is part of the file format");
+
+    const char magic[8] = { 'O', 'C', 'S', 'P', 'C', 'H', 'I', 'T' };
+    uint32_t header[5] = { max_depth, static_cast<uint32_t>(element_order.size()), num_instances, num_mesh_faces,
+        static_cast<uint32_t>(sizeof(CompactHitRecord)) };
+    uint64_t num_records = records.size();
+
+    out.write(magic, sizeof(magic));
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(&num_records), sizeof(num_records));
+    out.write(reinterpret_cast<const char*>(element_order.data()), element_order.size() * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(frames.data()), frames.size() * sizeof(HitFrame));
+    out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(CompactHitRecord));
+
+    std::cout << "Data successfully written to " << filename << std::endl;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "shaders/HitEncoding.h"
+
+namespace OptixCSP {
+
+    /// one hit of the compact output, 12 bytes
+    struct CompactHitRecord {
+        uint32_t entry;   // slot in the hit buffers: ray = entry / max_depth, stage = entry % max_depth
+        uint32_t hit;     // hit id + 1 | HIT_DIRECT_SUN, as in hit_element_buffer
+        uint32_t uv;      // encode_hit_uv in the frame of the hit id
+    };
+
+    /// compact records of the non-empty entries of the hit buffers, in entry order.
+    /// hit_uv holds the quantized points of every entry, or is empty to encode hit_points with frames on the host.
+    std::vector<CompactHitRecord> compact_hits(const std::vector<uint32_t>& hit_ids,
+        const std::vector<uint32_t>& hit_uv,
+        const std::vector<float4>& hit_points,
+        const std::vector<HitFrame>& frames);
+
+    /// little-endian binary: "OCSPCHIT", uint32 max_depth, num_elements, num_instances, num_mesh_faces,
+    /// record size (12), uint64 num_records, uint32 element id of every element hit id (get_element_order),
+    /// the HitFrame (72 bytes) of every hit id, then the records. Hit points are recovered with decode_hit_uv.
+    void write_compact_hits_binary(const std::string& filename, uint32_t max_depth,
+        const std::vector<uint32_t>& element_order, uint32_t num_instances, uint32_t num_mesh_faces,
+        const std::vector<HitFrame>& frames, const std::vector<CompactHitRecord>& records);
+}
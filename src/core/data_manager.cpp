@@ -17,7 +17,23 @@ dataManager::dataManager() : launch_params_D(nullptr) {
 	launch_params_H.height = 1;
 	launch_params_H.max_depth = 5;
 
+	launch_params_H.ray_order = nullptr;
+	launch_params_H.ray_offset = 0;
 	launch_params_H.hit_point_buffer = nullptr;
+	launch_params_H.hit_element_buffer = nullptr;
+	launch_params_H.num_elements = 0;
+	launch_params_H.instance_offset = 0;
+	launch_params_H.heliostat_ledger = nullptr;
+	launch_params_H.hit_weight_buffer = nullptr;
+	launch_params_H.ray_power = 1.0f;
+	launch_params_H.roulette_threshold = 0.0f;
+	launch_params_H.hit_uv_buffer = nullptr;
+	launch_params_H.hit_frames = nullptr;
+	launch_params_H.material_index = nullptr;
+	launch_params_H.angle_tables = nullptr;
+	launch_params_H.error_tables = nullptr;
+	launch_params_H.enabled_mask = nullptr;
+	launch_params_H.hit_dir_buffer = nullptr;
 	launch_params_H.sun_dir_buffer = nullptr;
 	launch_params_H.sun_vector = make_float3(0.0f, 0.0f, 10.0f);
 	launch_params_H.max_sun_angle = 0.0f;
@@ -44,56 +60,135 @@ void dataManager::updateLaunchParams() {
     CUDA_CHECK(cudaMemcpy(launch_params_D, &launch_params_H, sizeof(LaunchParams), cudaMemcpyHostToDevice));
 }
 
-void dataManager::allocateGeometryDataArray(std::vector<GeometryDataST> geometry_data_array_H) {
+// allocate a device array and copy the host vector into it, nullptr if empty
+template <typename T>
+static T* allocate_and_copy(const std::vector<T>& vec_H) {
+	T* vec_D = nullptr;
+	if (vec_H.empty()) {
+		return vec_D;
+	}
+	CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&vec_D), vec_H.size() * sizeof(T)));
+	CUDA_CHECK(cudaMemcpy(vec_D, vec_H.data(), vec_H.size() * sizeof(T), cudaMemcpyHostToDevice));
+	return vec_D;
+}
 
+template <typename T>
+static void copy_to_device(T* vec_D, const std::vector<T>& vec_H) {
+	if (vec_H.empty()) {
+		return;
+	}
+	CUDA_CHECK(cudaMemcpy(vec_D, vec_H.data(), vec_H.size() * sizeof(T), cudaMemcpyHostToDevice));
+}
 
-    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&geometry_data_array_D),
-        geometry_data_array_H.size() * sizeof(GeometryDataST)));
+void dataManager::allocateGeometryArrays(const PackedGeometryArrays& geometry_H) {
 
-	CUDA_CHECK(cudaMemcpy(geometry_data_array_D, geometry_data_array_H.data(),
-		geometry_data_array_H.size() * sizeof(GeometryDataST), cudaMemcpyHostToDevice));
-	// make sure launch_params_H is updated with the new geometry data array
-	launch_params_H.geometry_data_array = geometry_data_array_D;
+	rectangle_flat_array_D = allocate_and_copy(geometry_H.rectangle_flat);
+	rectangle_parabolic_array_D = allocate_and_copy(geometry_H.rectangle_parabolic);
+	cylinder_y_array_D = allocate_and_copy(geometry_H.cylinder_y);
+	triangle_flat_array_D = allocate_and_copy(geometry_H.triangle_flat);
+	geometry_slot_D = allocate_and_copy(geometry_H.slot);
 
+	// make sure launch_params_H is updated with the new geometry arrays
+	launch_params_H.rectangle_flat_array = rectangle_flat_array_D;
+	launch_params_H.rectangle_parabolic_array = rectangle_parabolic_array_D;
+	launch_params_H.cylinder_y_array = cylinder_y_array_D;
+	launch_params_H.triangle_flat_array = triangle_flat_array_D;
+	launch_params_H.geometry_slot = geometry_slot_D;
 }
 
-void dataManager::updateGeometryDataArray(std::vector<GeometryDataST> geometry_data_array_H) {
+void dataManager::updateGeometryArrays(const PackedGeometryArrays& geometry_H) {
 
-	if (geometry_data_array_D == nullptr) {
+	if (geometry_slot_D == nullptr) {
 		throw std::runtime_error("Geometry data array is not allocated.");
 	}
 
-	CUDA_CHECK(cudaMemcpy(geometry_data_array_D, geometry_data_array_H.data(),
-		geometry_data_array_H.size() * sizeof(GeometryDataST), cudaMemcpyHostToDevice));
-
-	//launch_params_H.geometry_data_array = geometry_data_array_D;
-
+	copy_to_device(rectangle_flat_array_D, geometry_H.rectangle_flat);
+	copy_to_device(rectangle_parabolic_array_D, geometry_H.rectangle_parabolic);
+	copy_to_device(cylinder_y_array_D, geometry_H.cylinder_y);
+	copy_to_device(triangle_flat_array_D, geometry_H.triangle_flat);
 }
 
-void dataManager::allocateMaterialDataArray(std::vector<MaterialData> material_data_array_H) {
+void dataManager::allocateMaterialDataArray(const std::vector<MaterialData>& material_data_array_H,
+	const std::vector<uint16_t>& material_index_H, const std::vector<float>& angle_tables_H) {
 
-	CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&material_data_array_D),
-		material_data_array_H.size() * sizeof(MaterialData)));
+	material_data_array_D = allocate_and_copy(material_data_array_H);
+	material_index_D = reinterpret_cast<unsigned short*>(allocate_and_copy(material_index_H));
+	angle_tables_D = allocate_and_copy(angle_tables_H);
+	angle_tables_size = angle_tables_H.size();
 
-	CUDA_CHECK(cudaMemcpy(material_data_array_D, material_data_array_H.data(),
-		material_data_array_H.size() * sizeof(MaterialData), cudaMemcpyHostToDevice));
-	// make sure launch_params_H is updated with the new geometry data array
+	// make sure launch_params_H is updated with the new material arrays
 	launch_params_H.material_data_array = material_data_array_D;
-
+	launch_params_H.material_index = material_index_D;
+	launch_params_H.angle_tables = angle_tables_D;
 }
 
-void dataManager::updateMaterialDataArray(std::vector<MaterialData> material_data_array_H) {
+void dataManager::updateMaterialDataArray(const std::vector<MaterialData>& material_data_array_H,
+	const std::vector<float>& angle_tables_H) {
 	if (material_data_array_D == nullptr) {
-		throw std::runtime_error("Not implemented yet ... does material data change??");
+		throw std::runtime_error("Material data array is not allocated.");
+	}
+
+	copy_to_device(material_data_array_D, material_data_array_H);
+
+	if (angle_tables_H.size() != angle_tables_size) {
+		CUDA_CHECK(cudaFree(angle_tables_D));
+		angle_tables_D = allocate_and_copy(angle_tables_H);
+		angle_tables_size = angle_tables_H.size();
+		launch_params_H.angle_tables = angle_tables_D;
 	}
+	else {
+		copy_to_device(angle_tables_D, angle_tables_H);
+	}
+}
 
+void dataManager::allocateErrorTables(const std::vector<float>& error_tables_H) {
+	CUDA_CHECK(cudaFree(error_tables_D));
+	error_tables_D = allocate_and_copy(error_tables_H);
+	launch_params_H.error_tables = error_tables_D;
 }
 
+void dataManager::updateEnabledMask(const std::vector<uint32_t>& enabled_mask_H) {
+	if (enabled_mask_H.empty()) {
+		launch_params_H.enabled_mask = nullptr;
+		return;
+	}
+	if (enabled_mask_H.size() != enabled_mask_size) {
+		CUDA_CHECK(cudaFree(enabled_mask_D));
+		enabled_mask_D = allocate_and_copy(enabled_mask_H);
+		enabled_mask_size = enabled_mask_H.size();
+	}
+	else {
+		copy_to_device(enabled_mask_D, enabled_mask_H);
+	}
+	launch_params_H.enabled_mask = enabled_mask_D;
+}
 
 void dataManager::cleanup() {
 	CUDA_CHECK(cudaFree(launch_params_D));
 	launch_params_D = nullptr;
 
-	CUDA_CHECK(cudaFree(geometry_data_array_D));
-	geometry_data_array_D = nullptr;
+	CUDA_CHECK(cudaFree(rectangle_flat_array_D));
+	CUDA_CHECK(cudaFree(rectangle_parabolic_array_D));
+	CUDA_CHECK(cudaFree(cylinder_y_array_D));
+	CUDA_CHECK(cudaFree(triangle_flat_array_D));
+	CUDA_CHECK(cudaFree(geometry_slot_D));
+	rectangle_flat_array_D = nullptr;
+	rectangle_parabolic_array_D = nullptr;
+	cylinder_y_array_D = nullptr;
+	triangle_flat_array_D = nullptr;
+	geometry_slot_D = nullptr;
+
+	CUDA_CHECK(cudaFree(material_data_array_D));
+	CUDA_CHECK(cudaFree(material_index_D));
+	CUDA_CHECK(cudaFree(angle_tables_D));
+	material_data_array_D = nullptr;
+	material_index_D = nullptr;
+	angle_tables_D = nullptr;
+	angle_tables_size = 0;
+
+	CUDA_CHECK(cudaFree(error_tables_D));
+	error_tables_D = nullptr;
+	CUDA_CHECK(cudaFree(enabled_mask_D));
+	enabled_mask_D = nullptr;
+	enabled_mask_size = 0;
 }
@@ -2,6 +2,8 @@
 
 #include "shaders/Soltrace.h"
 #include "CspElement.h"
+#include "geometry_manager.h"
+#include <cstdint>
 #include <vector>
 
 namespace OptixCSP {
@@ -15,11 +17,21 @@ namespace OptixCSP {
         // Device pointer to launch parameters.
         OptixCSP::LaunchParams* launch_params_D;
 
-        // device pointer to geometry data
-        GeometryDataST* geometry_data_array_D;
-
-        // device pointer to material data
-		MaterialData* material_data_array_D;
+        // device pointers to the geometry data, one array per primitive type
+        PackedRectangleFlat*      rectangle_flat_array_D = nullptr;
+        PackedRectangleParabolic* rectangle_parabolic_array_D = nullptr;
+        PackedCylinderY*          cylinder_y_array_D = nullptr;
+        PackedTriangleFlat*       triangle_flat_array_D = nullptr;
+        unsigned int*             geometry_slot_D = nullptr;
+
+        // device pointers to the shared material records and to the record index of every geometry index
+		MaterialData*   material_data_array_D = nullptr;
+		unsigned short* material_index_D = nullptr;
+		float*          angle_tables_D = nullptr;
+		size_t          angle_tables_size = 0;
+		float*          error_tables_D = nullptr;
+		unsigned int*   enabled_mask_D = nullptr;
+		size_t          enabled_mask_size = 0;
 
         dataManager();
         ~dataManager();
@@ -32,22 +44,29 @@ namespace OptixCSP {
 
         void updateLaunchParams();
 
-        // create geometry_data_array_D on the device
-        // then launch_params_D.geometry_data_array = geometry_data_array_D gets a copy.
-        void allocateGeometryDataArray(std::vector<GeometryDataST> geometry_data_array);
+        // create the per-type geometry arrays and the slot map on the device
+        // then launch_params_H gets a copy of the device pointers.
+        void allocateGeometryArrays(const PackedGeometryArrays& geometry_H);
+
+        // update the per-type geometry arrays on the device, the slot map does not change
+        void updateGeometryArrays(const PackedGeometryArrays& geometry_H);
 
-        // update geometry_data_array_D on the device
-        // then launch_params_D.geometry_data_array = geometry_data_array_D gets a copy.
-        void updateGeometryDataArray(std::vector<GeometryDataST> geometry_data_array_H);
+        // create material_data_array_D (the shared records), material_index_D and the resampled angle tables
+        // on the device, then launch_params_H gets a copy of the device pointers.
+        void allocateMaterialDataArray(const std::vector<MaterialData>& material_data_array_H,
+            const std::vector<uint16_t>& material_index_H, const std::vector<float>& angle_tables_H);
 
-        // create material_data_array_D on the device
-        // then launch_params_D.material_data_array = material_data_array_D gets a copy.
-        void allocateMaterialDataArray(std::vector<MaterialData> material_data_array);
+        // update the records in material_data_array_D (their number and the indices do not change) and the
+        // angle tables, reallocated if an optic got a new table
+        void updateMaterialDataArray(const std::vector<MaterialData>& material_data_array_H,
+            const std::vector<float>& angle_tables_H);
 
-        // update material_data_array_D on the device
-        // then launch_params_D.material_data_array = material_data_array_D gets a copy.
-        void updateMaterialDataArray(std::vector<MaterialData> material_data_array_H);
+        // create the surface error tables on the device (build_error_tables), they never change
+        void allocateErrorTables(const std::vector<float>& error_tables_H);
 
+        // upload the enable mask (one bit per hit id of the elements and instances), reallocated if its size
+        // changed. An empty mask leaves launch_params_H.enabled_mask at nullptr, every element is enabled.
+        void updateEnabledMask(const std::vector<uint32_t>& enabled_mask_H);
 
     };
 }
\ No newline at end of file
@@ -0,0 +1,221 @@
+#include "flux_map.h"
+#include "CspElement.h"
+#include "Aperture.h"
+#include "soltrace_type.h"
+#include "utils/parallel_util.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace OptixCSP;
+
+namespace {
+    const double kPi = 3.14159265358979323846;
+}
+
+FluxMap::FluxMap(int nx, int ny) {
+    set_resolution(nx, ny);
+}
+
+void FluxMap::set_resolution(int nx, int ny) {
+    if (nx <= 0 || ny <= 0) {
+        throw std::invalid_argument("FluxMap: resolution must be positive");
+    }
+    m_nx = nx;
+    m_ny = ny;
+    m_flux.assign(static_cast<size_t>(nx) * ny, 0.0);
+    m_flux_std_error.assign(static_cast<size_t>(nx) * ny, 0.0);
+}
+
+void FluxMap::set_receiver(const CspElement& receiver) {
+
+    const Matrix33d& rotation_matrix = receiver.get_rotation_matrix();  // L2G rotation matrix
+    m_origin = receiver.get_global_origin();
+    m_basis_x = rotation_matrix.get_x_basis();
+    m_basis_y = rotation_matrix.get_y_basis();
+    m_basis_z = rotation_matrix.get_z_basis();
+
+    double width = receiver.get_aperture()->get_width();
+    double height = receiver.get_aperture()->get_height();
+
+    switch (receiver.get_surface_type()) {
+    case SurfaceType::FLAT:
+        m_shape = ReceiverShape::FLAT;
+        m_extent_u = width;
+        m_extent_v = height;
+        break;
+    case SurfaceType::CYLINDER:
+        // same convention as Cylinder_Y: radius is half the aperture width, axis along the y basis
+        m_shape = ReceiverShape::CYLINDER;
+        m_radius = width / 2.0;
+        m_extent_u = 2.0 * kPi * m_radius;
+        m_extent_v = height;
+        break;
+    default:
+        throw std::runtime_error("FluxMap: only flat and cylindrical receivers are supported");
+    }
+}
+
+bool FluxMap::get_surface_coordinates(const Vec3d& point, double& u, double& v) const {
+    Vec3d d = point - m_origin;
+
+    if (m_shape == ReceiverShape::FLAT) {
+        u = d.dot(m_basis_x) + 0.5 * m_extent_u;
+        v = d.dot(m_basis_y) + 0.5 * m_extent_v;
+        return true;
+    }
+
+    double x = d.dot(m_basis_x);
+    double z = d.dot(m_basis_z);
+    // hits on the caps of the cylinder are not part of the unwrapped surface
+    if (x * x + z * z < 0.998 * m_radius * m_radius) return false;
+    u = (std::atan2(z, x) + kPi) * m_radius;
+    v = d.dot(m_basis_y) + 0.5 * m_extent_v;
+    return true;
+}
+
+void FluxMap::accumulate(const std::vector<float4>& hit_points,
+    const std::vector<uint32_t>& hit_ids,
+    uint32_t receiver_hit_id,
+    double power_per_ray,
+    const std::vector<float>& hit_weights,
+    const BatchLayout& batches,
+    PathFilter filter) {
+
+    const size_t num_bins = static_cast<size_t>(m_nx) * m_ny;
+    const uint32_t stored_id = receiver_hit_id + 1;
+    const bool weighted = !hit_weights.empty();
+    const uint32_t num_batches = batches.num_batches;
+
+    // one private grid of power (W) per batch and one hit counter per host thread, entry bin * num_batches + batch
+    std::vector<std::vector<double>> power(get_num_host_threads());
+    std::vector<int> hits(get_num_host_threads(), 0);
+
+    unsigned int num_chunks = parallel_for_chunks(hit_ids.size(), [&](size_t begin, size_t end, unsigned int t) {
+        std::vector<double>& local = power[t];
+        local.assign(num_bins * num_batches, 0.0);
+
+        for (size_t k = begin; k < end; k++) {
+            if (get_stored_hit_id(hit_ids[k]) != stored_id || !is_path_selected(hit_ids[k], filter)) continue;
+
+            const float4& hp = hit_points[k];
+            double u, v;
+            if (!get_surface_coordinates(Vec3d(hp.y, hp.z, hp.w), u, v)) continue;
+
+            int i = static_cast<int>(std::floor(u * m_nx / m_extent_u));
+            int j = static_cast<int>(std::floor(v * m_ny / m_extent_v));
+            i = std::min(std::max(i, 0), m_nx - 1);
+            j = std::min(std::max(j, 0), m_ny - 1);
+            size_t bin = static_cast<size_t>(j) * m_nx + i;
+            local[bin * num_batches + batches.batch_of(k)] += weighted ? hit_weights[k] : power_per_ray;
+            hits[t]++;
+        }
+    });
+
+    // merge the private grids, each batch gives one estimate of the flux of every bin
+    const double bin_area = (m_extent_u / m_nx) * (m_extent_v / m_ny);
+    m_num_batches = num_batches;
+    m_num_hits = 0;
+    for (unsigned int t = 0; t < num_chunks; t++) m_num_hits += hits[t];
+
+    std::vector<double> bin_batches(num_batches);
+    std::vector<double> total_batches(num_batches, 0.0);
+    for (size_t b = 0; b < num_bins; b++) {
+        std::fill(bin_batches.begin(), bin_batches.end(), 0.0);
+        for (unsigned int t = 0; t < num_chunks; t++) {
+            for (uint32_t s = 0; s < num_batches; s++) bin_batches[s] += power[t][b * num_batches + s];
+        }
+        for (uint32_t s = 0; s < num_batches; s++) total_batches[s] += bin_batches[s];
+
+        WelfordAccumulator acc = accumulate_batches(bin_batches.data(), num_batches);
+        m_flux[b] = acc.mean / bin_area;
+        m_flux_std_error[b] = acc.get_standard_error() / bin_area;
+    }
+    m_total_power_std_error = accumulate_batches(total_batches.data(), num_batches).get_standard_error();
+
+    compute_statistics();
+}
+
+void FluxMap::compute_statistics() {
+
+    const double bin_w = m_extent_u / m_nx;
+    const double bin_h = m_extent_v / m_ny;
+    const double bin_area = bin_w * bin_h;
+
+    m_peak_flux = 0.0;
+    double sum = 0.0, sum_u = 0.0, sum_v = 0.0;
+    for (int j = 0; j < m_ny; j++) {
+        for (int i = 0; i < m_nx; i++) {
+            double f = get_flux(i, j);
+            m_peak_flux = std::max(m_peak_flux, f);
+            sum += f;
+            // bin centers, centered on the receiver
+            sum_u += f * ((i + 0.5) * bin_w - 0.5 * m_extent_u);
+            sum_v += f * ((j + 0.5) * bin_h - 0.5 * m_extent_v);
+        }
+    }
+
+    m_mean_flux = sum / (static_cast<double>(m_nx) * m_ny);
+    m_total_power = sum * bin_area;
+    m_centroid_u = (sum > 0.0) ? sum_u / sum : 0.0;
+    m_centroid_v = (sum > 0.0) ? sum_v / sum : 0.0;
+}
+
+void FluxMap::write_binary(const std::string& filename) const {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Error: Could not open the file " << filename << " for writing." << std::endl;
+        return;
+    }
+
+    const char magic[8] = { 'O', 'C', 'S', 'P', 'F', 'L', 'U', 'X' };
+    int32_t header[3] = { m_nx, m_ny, static_cast<int32_t>(m_shape) };
+    double stats[7] = { m_extent_u, m_extent_v, m_peak_flux, m_mean_flux, m_total_power, m_centroid_u, m_centroid_v };
+
+    out.write(magic, sizeof(magic));
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(stats), sizeof(stats));
+    out.write(reinterpret_cast<const char*>(m_flux.data()), m_flux.size() * sizeof(double));
+
+    std::cout << "Data successfully written to " << filename << std::endl;
+}
+
+void FluxMap::write_csv(const std::string& filename) const {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Error: Could not open the file " << filename << " for writing." << std::endl;
+        return;
+    }
+
+    out << "# shape," << (m_shape == ReceiverShape::FLAT ? "flat" : "cylinder") << "\n";
+    out << "# nx," << m_nx << ",ny," << m_ny << "\n";
+    out << "# extent_u," << m_extent_u << ",extent_v," << m_extent_v << "\n";
+    out << "# num_hits," << m_num_hits << "\n";
+    out << "# peak_flux," << m_peak_flux << "\n";
+    out << "# mean_flux," << m_mean_flux << "\n";
+    out << "# total_power," << m_total_power << "\n";
+    out << "# centroid," << m_centroid_u << "," << m_centroid_v << "\n";
+    out << "# num_batches," << m_num_batches << "\n";
+    out << "# mean_flux_std_error," << get_mean_flux_std_error() << "\n";
+    out << "# total_power_std_error," << m_total_power_std_error << "\n";
+
+    for (int j = 0; j < m_ny; j++) {
+        for (int i = 0; i < m_nx; i++) {
+            out << get_flux(i, j) << (i + 1 < m_nx ? "," : "\n");
+        }
+    }
+
+    if (m_num_batches > 1) {
+        out << "# flux_std_error\n";
+        for (int j = 0; j < m_ny; j++) {
+            for (int i = 0; i < m_nx; i++) {
+                out << get_flux_std_error(i, j) << (i + 1 < m_nx ? "," : "\n");
+            }
+        }
+    }
+
+    std::cout << "Data successfully written to " << filename << std::endl;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vector_types.h>
+
+#include "vec3d.h"
+#include "hit_path.h"
+#include "utils/welford.h"
+
+namespace OptixCSP {
+
+    class CspElement;
+
+    /**
+     * @class FluxMap
+     * @brief Receiver flux accumulated on a regular grid in the receiver surface coordinates.
+     *
+     * Flat rectangles use the local (u, v) of the aperture, u along the x basis and v along the y basis,
+     * both centered on the element origin. Cylinder_Y receivers are unwrapped to (theta, y): theta is the
+     * angle around the cylinder axis measured from the x basis towards the z basis, y runs along the axis.
+     * Every hit carries power_per_ray = DNI * sun plane area / number of rays, the grid stores W/m2.
+     */
+    class FluxMap {
+    public:
+        enum class ReceiverShape { FLAT, CYLINDER };
+
+        FluxMap(int nx = 100, int ny = 100);
+
+        void set_resolution(int nx, int ny);
+        int get_nx() const { return m_nx; }
+        int get_ny() const { return m_ny; }
+
+        /// take the frame and extent of the grid from a flat or cylindrical receiver element
+        void set_receiver(const CspElement& receiver);
+
+        /// reset the grid and bin the hits whose hit id matches receiver_hit_id, each one carrying power_per_ray,
+        /// or its entry of hit_weights (W) when given (weighted rays).
+        /// hit_ids follows the device hit_element_buffer (hit id + 1, 0 for empty slots).
+        /// With more than one batch, every bin also gets the batched-means standard error of its flux.
+        /// Only hits whose path matches filter are binned (e.g. REFLECTED drops sun -> receiver hits).
+        /// Accumulation runs on host threads with private grids, merged at the end.
+        void accumulate(const std::vector<float4>& hit_points,
+            const std::vector<uint32_t>& hit_ids,
+            uint32_t receiver_hit_id,
+            double power_per_ray,
+            const std::vector<float>& hit_weights = {},
+            const BatchLayout& batches = BatchLayout(),
+            PathFilter filter = PathFilter::ALL);
+
+        /// grid coordinates (u, v) of a global point on the receiver surface,
+        /// false for points off the unwrapped surface (caps of a cylinder)
+        bool get_surface_coordinates(const Vec3d& point, double& u, double& v) const;
+
+        double get_extent_u() const { return m_extent_u; }
+        double get_extent_v() const { return m_extent_v; }
+
+        /// flux in W/m2 of bin (i, j), i along u (or theta), j along v (or y)
+        double get_flux(int i, int j) const { return m_flux[static_cast<size_t>(j) * m_nx + i]; }
+        const std::vector<double>& get_flux() const { return m_flux; }
+
+        /// standard error of the flux of bin (i, j), 0 without batches
+        double get_flux_std_error(int i, int j) const { return m_flux_std_error[static_cast<size_t>(j) * m_nx + i]; }
+        const std::vector<double>& get_flux_std_error() const { return m_flux_std_error; }
+
+        double get_peak_flux() const { return m_peak_flux; }
+        double get_mean_flux() const { return m_mean_flux; }       // over the whole receiver area
+        double get_total_power() const { return m_total_power; }   // W
+        double get_mean_flux_std_error() const { return m_total_power_std_error / (m_extent_u * m_extent_v); }
+        double get_total_power_std_error() const { return m_total_power_std_error; }
+        int get_num_hits() const { return m_num_hits; }
+        /// flux weighted centroid in grid coordinates (u, v) or (theta * radius, y)
+        double get_centroid_u() const { return m_centroid_u; }
+        double get_centroid_v() const { return m_centroid_v; }
+
+        /// little-endian binary: "OCSPFLUX", int32 nx, ny, shape, then doubles extent_u, extent_v,
+        /// peak, mean, total power, centroid u, v and nx * ny flux values, row j = 0 first
+        void write_binary(const std::string& filename) const;
+
+        /// statistics as # comment lines, then one row of the grid per line, j = 0 first,
+        /// followed by the standard errors of the bins in the same layout if batches were used
+        void write_csv(const std::string& filename) const;
+
+    private:
+        void compute_statistics();
+
+        int m_nx;
+        int m_ny;
+
+        ReceiverShape m_shape = ReceiverShape::FLAT;
+        Vec3d m_origin;
+        Vec3d m_basis_x;
+        Vec3d m_basis_y;
+        Vec3d m_basis_z;
+        double m_extent_u = 0.0;  // width, or circumference of the cylinder
+        double m_extent_v = 0.0;  // height
+        double m_radius = 0.0;
+
+        std::vector<double> m_flux;
+        std::vector<double> m_flux_std_error;
+        double m_total_power_std_error = 0.0;
+        uint32_t m_num_batches = 1;
+        double m_peak_flux = 0.0;
+        double m_mean_flux = 0.0;
+        double m_total_power = 0.0;
+        double m_centroid_u = 0.0;
+        double m_centroid_v = 0.0;
+        int m_num_hits = 0;
+    };
+}
@@ -1,10 +1,16 @@
 #include "geometry_manager.h"
 #include "shaders/GeometryDataST.h"
+#include "shaders/PackedGeometry.h"
 #include "sun_utils.h"
 #include "soltrace_state.h"
 #include "utils/util_check.hpp"
 #include "data_manager.h"
+#include "utils/parallel_util.h"
+#include "utils/morton_util.h"
 #include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
 #include <optix_stubs.h>
 
 
@@ -13,101 +19,413 @@ using namespace OptixCSP;
 
 // Collect geometry and material information from the scene elements
 void GeometryManager::collect_geometry_info(const std::vector<std::shared_ptr<CspElement>>& element_list,
-                                            LaunchParams& params) {    
+                                            const std::vector<std::shared_ptr<ElementPrototype>>& prototype_list,
+                                            const std::vector<ElementInstance>& instance_list,
+                                            LaunchParams& params,
+                                            const std::vector<std::shared_ptr<MeshElement>>& mesh_list) {    
     m_aabb_list_H.clear(); // Clear the existing AABB list
     m_sbt_index_H.clear(); // Clear the existing SBT index list
-	m_geometry_data_array_H.clear(); // Clear the existing geometry data array
-    m_material_data_array_H.clear();
+	m_packed_geometry_H.clear(); // Clear the existing geometry data arrays
+    m_optics.clear_records();
 
 	m_obj_counts = static_cast<uint32_t>(element_list.size()); // Number of objects in the scene
+    m_num_prototypes = static_cast<uint32_t>(prototype_list.size());
+    m_num_instances = static_cast<uint32_t>(instance_list.size());
+    m_num_meshes = static_cast<uint32_t>(mesh_list.size());
+    m_instance_offset = (use_instancing() && m_obj_counts > 0) ? 1 : 0;
+
+    // faces of the meshes get the hit ids after the instances, meshes sharing a TriangleMesh share its GAS
+    m_mesh_list = mesh_list;
+    m_mesh_first_hit_id.resize(m_num_meshes);
+    m_mesh_gas_index.resize(m_num_meshes);
+    std::vector<const TriangleMesh*> distinct_meshes;
+    uint32_t next_hit_id = m_obj_counts + m_num_instances;
+    for (uint32_t m = 0; m < m_num_meshes; m++) {
+        m_mesh_first_hit_id[m] = next_hit_id;
+        next_hit_id += static_cast<uint32_t>(mesh_list[m]->get_num_faces());
+        const TriangleMesh* mesh = &mesh_list[m]->get_mesh();
+        auto it = std::find(distinct_meshes.begin(), distinct_meshes.end(), mesh);
+        m_mesh_gas_index[m] = static_cast<uint32_t>(it - distinct_meshes.begin());
+        if (it == distinct_meshes.end()) distinct_meshes.push_back(mesh);
+    }
+    m_num_mesh_faces = next_hit_id - m_obj_counts - m_num_instances;
+
+    // every prototype takes one geometry index per facet (a single one if it is not faceted)
+    m_prototype_first_index.resize(m_num_prototypes + 1);
+    m_prototype_first_index[0] = 0;
+    for (uint32_t p = 0; p < m_num_prototypes; p++) {
+        m_prototype_first_index[p + 1] = m_prototype_first_index[p] + static_cast<uint32_t>(prototype_list[p]->get_num_facets());
+    }
+    const uint32_t num_prototype_geometries = m_prototype_first_index[m_num_prototypes];
 
-	// Resize
-	m_aabb_list_H.resize(m_obj_counts);
-	m_geometry_data_array_H.resize(m_obj_counts);
+	// Resize, prototypes are stored after the elements, instances and meshes only need a world aabb for the sun plane
+	m_aabb_list_H.resize(m_obj_counts + m_num_instances + m_num_meshes);
     m_sbt_index_H.resize(m_obj_counts);
-	m_material_data_array_H.resize(m_obj_counts);
+	m_material_index_H.resize(m_obj_counts + num_prototype_geometries);
+    m_hit_frames_H.resize(get_num_hit_ids());
+    m_prototype_frames_H.resize(m_num_prototypes);
+
+    compute_element_order(element_list);
 
+    // reserve the slot of each element and prototype facet in the array of its type (serial, slots are assigned in order)
+    m_packed_geometry_H.slot.resize(m_obj_counts + num_prototype_geometries);
     for (uint32_t i = 0; i < m_obj_counts; i++) {
+        assign_geometry_slot(i, element_list[m_element_order[i]]->get_geometry_type());
+    }
+    for (uint32_t p = 0; p < m_num_prototypes; p++) {
+        for (uint32_t f = 0; f < prototype_list[p]->get_num_facets(); f++) {
+            assign_geometry_slot(m_obj_counts + m_prototype_first_index[p] + f, prototype_list[p]->get_facet(f).get_geometry_type());
+        }
+    }
 
-		std::shared_ptr<CspElement> element = element_list[i];
+    // element i of the GAS is element_list[m_element_order[i]]
+    parallel_for(m_obj_counts, [&](size_t i) {
+        collect_element_info(static_cast<uint32_t>(i), element_list[m_element_order[i]]);
+    }, 1024);
 
-        // Create an OptixAabb from the geometry data
-        OptixAabb aabb;
-        float3 m_min;
-        float3 m_max;
-        uint32_t sbt_offset = 0;
+    // material records, serial so that equal optics get the same record in element order
+    for (uint32_t i = 0; i < m_obj_counts; i++) {
+        const CspElement& element = *element_list[m_element_order[i]];
+        m_material_index_H[i] = m_optics.intern(element.get_optic(), get_material_data(element));
+    }
+    for (uint32_t p = 0; p < m_num_prototypes; p++) {
+        const CspElement& element = prototype_list[p]->get_local_element();
+        const uint16_t record = m_optics.intern(element.get_optic(), get_material_data(element));
+        std::fill(m_material_index_H.begin() + m_obj_counts + m_prototype_first_index[p],
+                  m_material_index_H.begin() + m_obj_counts + m_prototype_first_index[p + 1], record);
+    }
 
-        if (element->get_aperture_type() == ApertureType::CIRCLE) {
-            m_min = make_float3(0.0f, 0.0f, 0.0f); // Initialize min to a large value
-            m_max = make_float3(0.0f, 0.0f, 0.0f); // Initialize max to a small value
-        }
+    m_prototype_aabb_H.resize(m_num_prototypes);
+    m_prototype_facet_aabb_H.resize(num_prototype_geometries);
+    m_prototype_sbt_index_H.resize(num_prototype_geometries);
+    for (uint32_t p = 0; p < m_num_prototypes; p++) {
+        collect_prototype_info(p, *prototype_list[p]);
+    }
+
+    m_instances_H.resize(m_instance_offset + m_num_instances + m_num_meshes);
+    parallel_for(m_num_instances, [&](size_t k) {
+        collect_instance_info(static_cast<uint32_t>(k), instance_list[k]);
+    }, 4096);
+
+    for (uint32_t m = 0; m < m_num_meshes; m++) {
+        collect_mesh_info(m, *mesh_list[m]);
+    }
 
+    // print out computed minimum distance 
+	std::cout << "Minimum distance to sun plane: " << m_sun_plane_distance << std::endl;
+}
+
+
+// order of the elements in the GAS and the device arrays, by type and then along a Z-order curve
+void GeometryManager::compute_element_order(const std::vector<std::shared_ptr<CspElement>>& element_list) {
+
+    m_element_order.resize(m_obj_counts);
+    m_element_rank.resize(m_obj_counts);
+    for (uint32_t i = 0; i < m_obj_counts; i++) {
+        m_element_order[i] = i;
+    }
 
-        if (element->get_aperture_type() == ApertureType::RECTANGLE) {
-            element->compute_bounding_box();
-            m_min.x = (float)(element->get_lower_bounding_box()[0]);
-            m_min.y = (float)(element->get_lower_bounding_box()[1]);
-			m_min.z = (float)(element->get_lower_bounding_box()[2]);
-
-			m_max.x = (float)(element->get_upper_bounding_box()[0]);
-			m_max.y = (float)(element->get_upper_bounding_box()[1]);
-			m_max.z = (float)(element->get_upper_bounding_box()[2]);
-
-            if (element->get_surface_type() == SurfaceType::PARABOLIC) {
-                sbt_offset = static_cast<uint32_t>(OpticalEntityType::RECTANGLE_PARABOLIC_MIRROR);
-                // no receiver only mirrors
-            }
-            else if (element->get_surface_type() == SurfaceType::FLAT) {
-                if (element->is_receiver())
-                    sbt_offset = static_cast<uint32_t>(OpticalEntityType::RECTANGLE_FLAT_RECEIVER);
-                else 
-					sbt_offset = static_cast<uint32_t>(OpticalEntityType::RECTANGLE_FLAT_MIRROR);
-            }
-            else if (element->get_surface_type() == SurfaceType::CYLINDER){
-                sbt_offset = static_cast<uint32_t>(OpticalEntityType::CYLINDRICAL_RECEIVER);
-            }
-			else {
-            }
+    if (m_spatial_ordering && m_obj_counts > 1) {
+
+        // centroids and types, the aabb is recomputed by collect_element_info afterwards
+        std::vector<float3> centroids(m_obj_counts);
+        std::vector<uint32_t> types(m_obj_counts);
+        parallel_for(m_obj_counts, [&](size_t i) {
+            OptixAabb aabb;
+            compute_element_aabb(*element_list[i], aabb, types[i]);
+            centroids[i] = make_float3(0.5f * (aabb.minX + aabb.maxX),
+                                       0.5f * (aabb.minY + aabb.maxY),
+                                       0.5f * (aabb.minZ + aabb.maxZ));
+        }, 1024);
+
+        float3 lo = make_float3(FLT_MAX, FLT_MAX, FLT_MAX);
+        float3 hi = make_float3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (const float3& c : centroids) {
+            lo = make_float3(fminf(lo.x, c.x), fminf(lo.y, c.y), fminf(lo.z, c.z));
+            hi = make_float3(fmaxf(hi.x, c.x), fmaxf(hi.y, c.y), fmaxf(hi.z, c.z));
         }
+        float3 extent = hi - lo;
+        float3 inv_extent = make_float3(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                                        extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                                        extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+        // type in the upper 32 bits, Morton code in the lower ones
+        std::vector<uint64_t> keys(m_obj_counts);
+        parallel_for(m_obj_counts, [&](size_t i) {
+            float3 n = (centroids[i] - lo) * inv_extent;
+            keys[i] = (static_cast<uint64_t>(types[i]) << 32) | morton_code_3d(n.x, n.y, n.z);
+        }, 4096);
+
+        // stable, so elements sharing a code keep their relative order
+        std::stable_sort(m_element_order.begin(), m_element_order.end(),
+            [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+    }
+
+    for (uint32_t i = 0; i < m_obj_counts; i++) {
+        m_element_rank[m_element_order[i]] = i;
+    }
+}
+
+// compute the aabb (in the frame the element is placed in) and the sbt index of an element
+void GeometryManager::compute_element_aabb(CspElement& element, OptixAabb& aabb, uint32_t& sbt_offset) {
+
+    float3 m_min;
+    float3 m_max;
+    sbt_offset = 0;
+
+    if (element.get_aperture_type() == ApertureType::CIRCLE) {
+        m_min = make_float3(0.0f, 0.0f, 0.0f); // Initialize min to a large value
+        m_max = make_float3(0.0f, 0.0f, 0.0f); // Initialize max to a small value
+    }
 
-        if (element->get_aperture_type() == ApertureType::TRIANGLE) {
-            element->compute_bounding_box();
-            m_min.x = (float)(element->get_lower_bounding_box()[0]);
-            m_min.y = (float)(element->get_lower_bounding_box()[1]);
-			m_min.z = (float)(element->get_lower_bounding_box()[2]);
-			m_max.x = (float)(element->get_upper_bounding_box()[0]);
-			m_max.y = (float)(element->get_upper_bounding_box()[1]);
-			m_max.z = (float)(element->get_upper_bounding_box()[2]);
 
-            if (element->is_receiver())
-                sbt_offset = static_cast<uint32_t>(OpticalEntityType::TRIANGLE_FLAT_RECEIVER);
+    if (element.get_aperture_type() == ApertureType::RECTANGLE) {
+        element.compute_bounding_box();
+        m_min.x = (float)(element.get_lower_bounding_box()[0]);
+        m_min.y = (float)(element.get_lower_bounding_box()[1]);
+		m_min.z = (float)(element.get_lower_bounding_box()[2]);
 
+		m_max.x = (float)(element.get_upper_bounding_box()[0]);
+		m_max.y = (float)(element.get_upper_bounding_box()[1]);
+		m_max.z = (float)(element.get_upper_bounding_box()[2]);
+
+        if (element.get_surface_type() == SurfaceType::PARABOLIC) {
+            sbt_offset = static_cast<uint32_t>(OpticalEntityType::RECTANGLE_PARABOLIC_MIRROR);
+            // no receiver only mirrors
+        }
+        else if (element.get_surface_type() == SurfaceType::FLAT) {
+            if (element.is_receiver())
+                sbt_offset = static_cast<uint32_t>(OpticalEntityType::RECTANGLE_FLAT_RECEIVER);
+            else 
+				sbt_offset = static_cast<uint32_t>(OpticalEntityType::RECTANGLE_FLAT_MIRROR);
         }
+        else if (element.get_surface_type() == SurfaceType::CYLINDER){
+            sbt_offset = static_cast<uint32_t>(OpticalEntityType::CYLINDRICAL_RECEIVER);
+        }
+		else {
+        }
+    }
+
+    if (element.get_aperture_type() == ApertureType::TRIANGLE) {
+        element.compute_bounding_box();
+        m_min.x = (float)(element.get_lower_bounding_box()[0]);
+        m_min.y = (float)(element.get_lower_bounding_box()[1]);
+		m_min.z = (float)(element.get_lower_bounding_box()[2]);
+		m_max.x = (float)(element.get_upper_bounding_box()[0]);
+		m_max.y = (float)(element.get_upper_bounding_box()[1]);
+		m_max.z = (float)(element.get_upper_bounding_box()[2]);
+
+        if (element.is_receiver())
+            sbt_offset = static_cast<uint32_t>(OpticalEntityType::TRIANGLE_FLAT_RECEIVER);
+
+    }
+
+
+    aabb.minX = m_min.x;
+    aabb.minY = m_min.y;
+    aabb.minZ = m_min.z;
+
+    aabb.maxX = m_max.x;
+    aabb.maxY = m_max.y;
+    aabb.maxZ = m_max.z;
+}
 
+// own optical properties of an element, used when it has no optic
+MaterialData GeometryManager::get_material_data(const CspElement& element) {
+    return { element.get_reflectivity(), element.get_transmissivity(), element.get_slope_error(), element.get_specularity_error(), element.use_refraction() };
+}
 
-        aabb.minX = m_min.x;
-        aabb.minY = m_min.y;
-        aabb.minZ = m_min.z;
+// compute aabb, sbt index and geometry data of a single element
+void GeometryManager::collect_element_info(uint32_t i, const std::shared_ptr<CspElement>& element) {
 
-        aabb.maxX = m_max.x;
-        aabb.maxY = m_max.y;
-        aabb.maxZ = m_max.z;
+    OptixAabb aabb;
+    uint32_t sbt_offset = 0;
+    compute_element_aabb(*element, aabb, sbt_offset);
 
+	m_aabb_list_H[i] = aabb; // Store the AABB in the list
+    m_sbt_index_H[i] = sbt_offset; // Store the SBT index
+    m_hit_frames_H[i] = store_geometry(i, element->toDeviceGeometryData());
 
-		m_aabb_list_H[i] = aabb; // Store the AABB in the list
-        m_sbt_index_H[i] = sbt_offset; // Store the SBT index
-        m_geometry_data_array_H[i] = element->toDeviceGeometryData();
+    element->clear_dirty();
+}
 
+// compute the facet aabbs, sbt indices and geometry data of a prototype, and its local aabb over all the facets
+void GeometryManager::collect_prototype_info(uint32_t p, const ElementPrototype& prototype) {
+
+    const uint32_t first = m_prototype_first_index[p];
+    const uint32_t num_facets = static_cast<uint32_t>(prototype.get_num_facets());
+
+    OptixAabb& bound = m_prototype_aabb_H[p];
+    bound.minX = bound.minY = bound.minZ = FLT_MAX;
+    bound.maxX = bound.maxY = bound.maxZ = -FLT_MAX;
+    HitFrame frame = {};
+    for (uint32_t f = 0; f < num_facets; f++) {
+        // copy, computing the bounding box updates the element
+        CspElement facet = prototype.get_facet(f);
+
+        OptixAabb& aabb = m_prototype_facet_aabb_H[first + f];
+        compute_element_aabb(facet, aabb, m_prototype_sbt_index_H[first + f]);
+        frame = store_geometry(m_obj_counts + first + f, facet.toDeviceGeometryData());
+
+        bound.minX = fminf(bound.minX, aabb.minX);
+        bound.minY = fminf(bound.minY, aabb.minY);
+        bound.minZ = fminf(bound.minZ, aabb.minZ);
+        bound.maxX = fmaxf(bound.maxX, aabb.maxX);
+        bound.maxY = fmaxf(bound.maxY, aabb.maxY);
+        bound.maxZ = fmaxf(bound.maxZ, aabb.maxZ);
+    }
 
-		// now we set the material data for each element, use placeholder values for now 
-        m_material_data_array_H[i] = {element->get_reflectivity(), element->get_transmissivity(), element->get_slope_error(), element->get_specularity_error(), element->use_refraction()};
+    // hits on a faceted heliostat are located in the plane of the heliostat, over the extent of its facets,
+    // an instance has a single hit id (see HitEncoding.h for the bound along the normal)
+    if (num_facets > 1) {
+        frame = make_bounding_hit_frame(make_float3(bound.minX, bound.minY, bound.minZ), make_float3(bound.maxX, bound.maxY, bound.maxZ));
+    }
+    m_prototype_frames_H[p] = frame;
+}
 
+// append geometry index i to the array of its type, the geometry itself is stored by store_geometry
+void GeometryManager::assign_geometry_slot(uint32_t i, GeometryDataST::Type type) {
+    uint32_t slot = 0;
+    switch (type) {
+    case GeometryDataST::RECTANGLE_FLAT:
+        slot = static_cast<uint32_t>(m_packed_geometry_H.rectangle_flat.size());
+        m_packed_geometry_H.rectangle_flat.emplace_back();
+        break;
+    case GeometryDataST::RECTANGLE_PARABOLIC:
+        slot = static_cast<uint32_t>(m_packed_geometry_H.rectangle_parabolic.size());
+        m_packed_geometry_H.rectangle_parabolic.emplace_back();
+        break;
+    case GeometryDataST::CYLINDER_Y:
+        slot = static_cast<uint32_t>(m_packed_geometry_H.cylinder_y.size());
+        m_packed_geometry_H.cylinder_y.emplace_back();
+        break;
+    case GeometryDataST::TRIANGLE_FLAT:
+        slot = static_cast<uint32_t>(m_packed_geometry_H.triangle_flat.size());
+        m_packed_geometry_H.triangle_flat.emplace_back();
+        break;
+    default:
+        // no intersection program for this geometry, nothing to store
+        break;
     }
+    m_packed_geometry_H.slot[i] = slot;
+}
 
-    // print out computed minimum distance 
-	std::cout << "Minimum distance to sun plane: " << m_sun_plane_distance << std::endl;
+// pack the geometry of index i into its slot, derived quantities are computed here once instead of per ray
+// returns the hit frame derived from the packed data, in the frame the geometry is placed in
+HitFrame GeometryManager::store_geometry(uint32_t i, const GeometryDataST& geometry) {
+    uint32_t slot = m_packed_geometry_H.slot[i];
+    HitFrame frame = {};
+    switch (geometry.type) {
+    case GeometryDataST::RECTANGLE_FLAT:
+        m_packed_geometry_H.rectangle_flat[slot] = pack_geometry(geometry.getRectangle_Flat());
+        frame = make_hit_frame(m_packed_geometry_H.rectangle_flat[slot]);
+        break;
+    case GeometryDataST::RECTANGLE_PARABOLIC:
+        m_packed_geometry_H.rectangle_parabolic[slot] = pack_geometry(geometry.getRectangleParabolic());
+        frame = make_hit_frame(m_packed_geometry_H.rectangle_parabolic[slot]);
+        break;
+    case GeometryDataST::CYLINDER_Y:
+        m_packed_geometry_H.cylinder_y[slot] = pack_geometry(geometry.getCylinder_Y());
+        frame = make_hit_frame(m_packed_geometry_H.cylinder_y[slot]);
+        break;
+    case GeometryDataST::TRIANGLE_FLAT:
+        m_packed_geometry_H.triangle_flat[slot] = pack_geometry(geometry.getTriangle_Flat());
+        frame = make_hit_frame(m_packed_geometry_H.triangle_flat[slot]);
+        break;
+    default:
+        break;
+    }
+
+    return frame;
+}
+
+// compute the OptiX instance transform and the world aabb of a prototype instance
+void GeometryManager::collect_instance_info(uint32_t k, const ElementInstance& instance) {
+
+    Matrix33d rotation_matrix = instance.get_rotation_matrix();  // L2G rotation matrix
+    Vec3d origin = instance.get_origin();
+
+    // row-major 3x4 object to world transform
+    OptixInstance& optix_instance = m_instances_H[m_instance_offset + k];
+    for (int r = 0; r < 3; r++) {
+        optix_instance.transform[r * 4 + 0] = (float)rotation_matrix(r, 0);
+        optix_instance.transform[r * 4 + 1] = (float)rotation_matrix(r, 1);
+        optix_instance.transform[r * 4 + 2] = (float)rotation_matrix(r, 2);
+        optix_instance.transform[r * 4 + 3] = (float)origin[r];
+    }
+    m_hit_frames_H[m_obj_counts + k] = transform_hit_frame(m_prototype_frames_H[instance.prototype], optix_instance.transform);
+
+    // geometry and material data of the prototype (its first facet) start at instanceId
+    optix_instance.instanceId = m_obj_counts + m_prototype_first_index[instance.prototype];
+    optix_instance.sbtOffset = 0;   // per-primitive sbt index is stored in the prototype GAS
+    optix_instance.visibilityMask = 255;
+    optix_instance.flags = OPTIX_INSTANCE_FLAG_NONE;
+    if (instance.prototype < m_prototype_gas_handles.size()) {
+        optix_instance.traversableHandle = m_prototype_gas_handles[instance.prototype];
+    }
+
+    // world aabb from the corners of the local one (all the facets), only used for the sun plane
+    const OptixAabb& local = m_prototype_aabb_H[instance.prototype];
+    OptixAabb& world = m_aabb_list_H[m_obj_counts + k];
+    world.minX = world.minY = world.minZ = FLT_MAX;
+    world.maxX = world.maxY = world.maxZ = -FLT_MAX;
+    for (int c = 0; c < 8; c++) {
+        Vec3d corner((c & 1) ? local.maxX : local.minX,
+                     (c & 2) ? local.maxY : local.minY,
+                     (c & 4) ? local.maxZ : local.minZ);
+        Vec3d p = rotation_matrix * corner + origin;
+        world.minX = fminf(world.minX, (float)p[0]);
+        world.minY = fminf(world.minY, (float)p[1]);
+        world.minZ = fminf(world.minZ, (float)p[2]);
+        world.maxX = fmaxf(world.maxX, (float)p[0]);
+        world.maxY = fmaxf(world.maxY, (float)p[1]);
+        world.maxZ = fmaxf(world.maxZ, (float)p[2]);
+    }
 }
 
+// compute the OptiX instance transform, the world aabb and the hit frames of the faces of a mesh
+void GeometryManager::collect_mesh_info(uint32_t m, const MeshElement& mesh) {
+
+    Matrix33d rotation_matrix = mesh.get_rotation_matrix();  // L2G rotation matrix
+    Vec3d origin = mesh.get_origin();
+
+    OptixInstance& optix_instance = m_instances_H[m_instance_offset + m_num_instances + m];
+    for (int r = 0; r < 3; r++) {
+        optix_instance.transform[r * 4 + 0] = (float)rotation_matrix(r, 0);
+        optix_instance.transform[r * 4 + 1] = (float)rotation_matrix(r, 1);
+        optix_instance.transform[r * 4 + 2] = (float)rotation_matrix(r, 2);
+        optix_instance.transform[r * 4 + 3] = (float)origin[r];
+    }
+
+    // built-in triangles report instanceId + primitive index as the hit id (see getHitId)
+    optix_instance.instanceId = m_mesh_first_hit_id[m];
+    optix_instance.sbtOffset = static_cast<uint32_t>(OpticalEntityType::TRIANGLE_MESH_RECEIVER);
+    optix_instance.visibilityMask = 255;
+    optix_instance.flags = OPTIX_INSTANCE_FLAG_NONE;
+    if (m_mesh_gas_index[m] < m_mesh_gas_handles.size()) {
+        optix_instance.traversableHandle = m_mesh_gas_handles[m_mesh_gas_index[m]];
+    }
+
+    const std::vector<float3> vertices = mesh.get_global_vertices();
+    OptixAabb& world = m_aabb_list_H[m_obj_counts + m_num_instances + m];
+    world.minX = world.minY = world.minZ = FLT_MAX;
+    world.maxX = world.maxY = world.maxZ = -FLT_MAX;
+    for (const float3& v : vertices) {
+        world.minX = fminf(world.minX, v.x);
+        world.minY = fminf(world.minY, v.y);
+        world.minZ = fminf(world.minZ, v.z);
+        world.maxX = fmaxf(world.maxX, v.x);
+        world.maxY = fmaxf(world.maxY, v.y);
+        world.maxZ = fmaxf(world.maxZ, v.z);
+    }
+
+    const std::vector<uint3>& faces = mesh.get_mesh().indices;
+    HitFrame* frames = m_hit_frames_H.data() + m_mesh_first_hit_id[m];
+    parallel_for(faces.size(), [&](size_t f) {
+        GeometryDataST::Triangle_Flat triangle(vertices[faces[f].x], vertices[faces[f].y], vertices[faces[f].z]);
+        frames[f] = make_hit_frame(pack_geometry(triangle));
+    }, 4096);
+}
 
 void GeometryManager::compute_sun_plane_H(LaunchParams& params) {
 
@@ -118,7 +436,10 @@ void GeometryManager::compute_sun_plane_H(LaunchParams& params) {
     CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&sun_plane_dist_D), sizeof(float)));
     CUDA_CHECK(cudaMemset(sun_plane_dist_D, 0, sizeof(float)));
 
-    compute_d_on_gpu(reinterpret_cast<const OptixAabb*>(m_aabb_list_D), m_obj_counts, sun_vector, sun_plane_dist_D);
+    // elements and prototype instances
+    int num_aabbs = static_cast<int>(m_aabb_list_H.size());
+
+    compute_d_on_gpu(reinterpret_cast<const OptixAabb*>(m_aabb_list_D), num_aabbs, sun_vector, sun_plane_dist_D);
 
     CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(&m_sun_plane_distance),
                          reinterpret_cast<void*>(sun_plane_dist_D),
@@ -136,7 +457,7 @@ void GeometryManager::compute_sun_plane_H(LaunchParams& params) {
     CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&sun_uv_bounds_D), 4 * sizeof(float)));
 
     compute_uv_bounds_on_gpu(reinterpret_cast<const OptixAabb*>(m_aabb_list_D),
-        m_obj_counts,
+        num_aabbs,
         m_sun_plane_distance,
         sun_vector,
         sun_u,
@@ -164,15 +485,26 @@ void GeometryManager::compute_sun_plane_H(LaunchParams& params) {
 
 void GeometryManager::create_geometries(LaunchParams& params) {
 
-    // Allocate memory on the device for the AABB array.
-    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_aabb_list_D), m_obj_counts * sizeof(OptixAabb)));
+    // Allocate memory on the device for the AABB array (elements first, the GAS only uses those)
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_aabb_list_D), m_aabb_list_H.size() * sizeof(OptixAabb)));
     CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(m_aabb_list_D),
                m_aabb_list_H.data(), 
-		       m_obj_counts * sizeof(OptixAabb),
+		       m_aabb_list_H.size() * sizeof(OptixAabb),
                cudaMemcpyHostToDevice));
 
 	compute_sun_plane_H(params);
 
+    if (use_instancing()) {
+        create_prototype_geometries();
+        create_mesh_geometries();
+    }
+
+    if (m_obj_counts == 0 && use_instancing()) {
+        // only prototype instances and meshes in the scene
+        create_instance_accel();
+        return;
+    }
+
     // populate aabb_input_flags vector, size of types, no rebuild
     std::vector<uint32_t> aabb_input_flags(NUM_OPTICAL_ENTITY_TYPES);
     for (int i = 0; i < NUM_OPTICAL_ENTITY_TYPES; i++) {
@@ -231,22 +563,287 @@ void GeometryManager::create_geometries(LaunchParams& params) {
 		&m_state.gas_handle,                             // Output handle for the GAS
 		nullptr,                                        // Emitted properties (not used here)
 		0));                                           // Number of emitted properties
-    
+
+    if (use_instancing()) {
+        create_instance_accel();
+    }
+}
+
+// build one GAS per prototype, in the prototype local frame, with one primitive per facet
+void GeometryManager::create_prototype_geometries() {
+
+    std::vector<uint32_t> aabb_input_flags(NUM_OPTICAL_ENTITY_TYPES, OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT);
+
+    m_prototype_gas_handles.resize(m_num_prototypes);
+    m_prototype_gas_buffers.resize(m_num_prototypes);
+
+    for (uint32_t p = 0; p < m_num_prototypes; p++) {
+
+        const uint32_t first = m_prototype_first_index[p];
+        const uint32_t num_facets = m_prototype_first_index[p + 1] - first;
+
+        CUdeviceptr d_aabb;
+        CUdeviceptr d_sbt_index;
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_aabb), num_facets * sizeof(OptixAabb)));
+        CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_aabb), &m_prototype_facet_aabb_H[first], num_facets * sizeof(OptixAabb), cudaMemcpyHostToDevice));
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_sbt_index), num_facets * sizeof(uint32_t)));
+        CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_sbt_index), &m_prototype_sbt_index_H[first], num_facets * sizeof(uint32_t), cudaMemcpyHostToDevice));
+
+        OptixBuildInput aabb_input = {};
+        aabb_input.type = OPTIX_BUILD_INPUT_TYPE_CUSTOM_PRIMITIVES;
+        aabb_input.customPrimitiveArray.aabbBuffers = &d_aabb;
+        aabb_input.customPrimitiveArray.flags = aabb_input_flags.data();
+        aabb_input.customPrimitiveArray.numSbtRecords = NUM_OPTICAL_ENTITY_TYPES;
+        aabb_input.customPrimitiveArray.numPrimitives = num_facets;
+        aabb_input.customPrimitiveArray.sbtIndexOffsetBuffer = d_sbt_index;
+        aabb_input.customPrimitiveArray.sbtIndexOffsetSizeInBytes = sizeof(uint32_t);
+        aabb_input.customPrimitiveArray.primitiveIndexOffset = 0;
+
+        // prototypes never change, no update needed
+        OptixAccelBuildOptions build_options = {
+            OPTIX_BUILD_FLAG_PREFER_FAST_TRACE,
+            OPTIX_BUILD_OPERATION_BUILD
+        };
+
+        OptixAccelBufferSizes buffer_sizes;
+        OPTIX_CHECK(optixAccelComputeMemoryUsage(m_state.context, &build_options, &aabb_input, 1, &buffer_sizes));
+
+        CUdeviceptr d_temp;
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_temp), buffer_sizes.tempSizeInBytes));
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_prototype_gas_buffers[p]), buffer_sizes.outputSizeInBytes));
+
+        OPTIX_CHECK(optixAccelBuild(m_state.context,
+            m_state.stream,
+            &build_options,
+            &aabb_input,
+            1,
+            d_temp,
+            buffer_sizes.tempSizeInBytes,
+            m_prototype_gas_buffers[p],
+            buffer_sizes.outputSizeInBytes,
+            &m_prototype_gas_handles[p],
+            nullptr,
+            0));
+
+        CUDA_CHECK(cudaStreamSynchronize(m_state.stream));
+        CUDA_CHECK(cudaFree(reinterpret_cast<void*>(d_temp)));
+        CUDA_CHECK(cudaFree(reinterpret_cast<void*>(d_aabb)));
+        CUDA_CHECK(cudaFree(reinterpret_cast<void*>(d_sbt_index)));
+    }
+
+    // now that the handles exist, link the instances to their prototype, found from its first geometry index
+    parallel_for(m_num_instances, [&](size_t k) {
+        OptixInstance& optix_instance = m_instances_H[m_instance_offset + k];
+        auto it = std::upper_bound(m_prototype_first_index.begin(), m_prototype_first_index.end(),
+            optix_instance.instanceId - m_obj_counts);
+        optix_instance.traversableHandle = m_prototype_gas_handles[it - m_prototype_first_index.begin() - 1];
+    }, 4096);
+}
+
+// build one triangle GAS per distinct mesh, in the mesh local frame
+void GeometryManager::create_mesh_geometries() {
+
+    uint32_t num_gases = 0;
+    for (uint32_t index : m_mesh_gas_index) num_gases = std::max(num_gases, index + 1);
+    m_mesh_gas_handles.resize(num_gases);
+    m_mesh_gas_buffers.resize(num_gases);
+
+    const uint32_t triangle_input_flags = OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT;
+
+    for (uint32_t m = 0; m < m_num_meshes; m++) {
+
+        // the first mesh using a GAS builds it
+        const uint32_t g = m_mesh_gas_index[m];
+        if (m_mesh_gas_buffers[g]) continue;
+
+        const TriangleMesh& mesh = m_mesh_list[m]->get_mesh();
+        const size_t vertices_size = mesh.vertices.size() * sizeof(float3);
+        const size_t indices_size = mesh.indices.size() * sizeof(uint3);
+
+        CUdeviceptr d_vertices;
+        CUdeviceptr d_indices;
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_vertices), vertices_size));
+        CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_vertices), mesh.vertices.data(), vertices_size, cudaMemcpyHostToDevice));
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_indices), indices_size));
+        CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(d_indices), mesh.indices.data(), indices_size, cudaMemcpyHostToDevice));
+
+        OptixBuildInput triangle_input = {};
+        triangle_input.type = OPTIX_BUILD_INPUT_TYPE_TRIANGLES;
+        triangle_input.triangleArray.vertexBuffers = &d_vertices;
+        triangle_input.triangleArray.numVertices = static_cast<unsigned int>(mesh.vertices.size());
+        triangle_input.triangleArray.vertexFormat = OPTIX_VERTEX_FORMAT_FLOAT3;
+        triangle_input.triangleArray.vertexStrideInBytes = sizeof(float3);
+        triangle_input.triangleArray.indexBuffer = d_indices;
+        triangle_input.triangleArray.numIndexTriplets = static_cast<unsigned int>(mesh.indices.size());
+        triangle_input.triangleArray.indexFormat = OPTIX_INDICES_FORMAT_UNSIGNED_INT3;
+        triangle_input.triangleArray.indexStrideInBytes = sizeof(uint3);
+        triangle_input.triangleArray.flags = &triangle_input_flags;
+        triangle_input.triangleArray.numSbtRecords = 1;  // the instance sbt offset selects the mesh receiver program
+
+        // meshes never change shape, moving them only changes the instance transform
+        OptixAccelBuildOptions build_options = {
+            OPTIX_BUILD_FLAG_PREFER_FAST_TRACE,
+            OPTIX_BUILD_OPERATION_BUILD
+        };
+
+        OptixAccelBufferSizes buffer_sizes;
+        OPTIX_CHECK(optixAccelComputeMemoryUsage(m_state.context, &build_options, &triangle_input, 1, &buffer_sizes));
+
+        CUdeviceptr d_temp;
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&d_temp), buffer_sizes.tempSizeInBytes));
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_mesh_gas_buffers[g]), buffer_sizes.outputSizeInBytes));
+
+        OPTIX_CHECK(optixAccelBuild(m_state.context,
+            m_state.stream,
+            &build_options,
+            &triangle_input,
+            1,
+            d_temp,
+            buffer_sizes.tempSizeInBytes,
+            m_mesh_gas_buffers[g],
+            buffer_sizes.outputSizeInBytes,
+            &m_mesh_gas_handles[g],
+            nullptr,
+            0));
+
+        // the GAS keeps its own copy of the triangles
+        CUDA_CHECK(cudaStreamSynchronize(m_state.stream));
+        CUDA_CHECK(cudaFree(reinterpret_cast<void*>(d_temp)));
+        CUDA_CHECK(cudaFree(reinterpret_cast<void*>(d_vertices)));
+        CUDA_CHECK(cudaFree(reinterpret_cast<void*>(d_indices)));
+    }
+
+    for (uint32_t m = 0; m < m_num_meshes; m++) {
+        m_instances_H[m_instance_offset + m_num_instances + m].traversableHandle = m_mesh_gas_handles[m_mesh_gas_index[m]];
+    }
+}
+
+// build the IAS over the element GAS, the prototype instances and the meshes
+void GeometryManager::create_instance_accel() {
+
+    if (m_instance_offset) {
+        // the element GAS is already in world coordinates
+        OptixInstance& element_instance = m_instances_H[0];
+        const float identity[12] = { 1.0f, 0.0f, 0.0f, 0.0f,
+                                     0.0f, 1.0f, 0.0f, 0.0f,
+                                     0.0f, 0.0f, 1.0f, 0.0f };
+        memcpy(element_instance.transform, identity, sizeof(identity));
+        element_instance.instanceId = 0;
+        element_instance.sbtOffset = 0;
+        element_instance.visibilityMask = 255;
+        element_instance.flags = OPTIX_INSTANCE_FLAG_DISABLE_TRANSFORM;
+        element_instance.traversableHandle = m_state.gas_handle;
+    }
+
+    size_t instances_size = m_instances_H.size() * sizeof(OptixInstance);
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_instances_D), instances_size));
+    CUDA_CHECK(cudaMemcpy(reinterpret_cast<void*>(m_instances_D), m_instances_H.data(), instances_size, cudaMemcpyHostToDevice));
+
+    m_instance_input = {};
+    m_instance_input.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
+    m_instance_input.instanceArray.instances = m_instances_D;
+    m_instance_input.instanceArray.numInstances = static_cast<unsigned int>(m_instances_H.size());
+
+    // heliostats track the sun, allow refitting
+    m_ias_build_options = {
+        OPTIX_BUILD_FLAG_ALLOW_UPDATE,
+        OPTIX_BUILD_OPERATION_BUILD
+    };
+
+    OptixAccelBufferSizes ias_buffer_sizes;
+    OPTIX_CHECK(optixAccelComputeMemoryUsage(m_state.context, &m_ias_build_options, &m_instance_input, 1, &ias_buffer_sizes));
+
+    m_ias_temp_buffer_size = std::max(ias_buffer_sizes.tempSizeInBytes, ias_buffer_sizes.tempUpdateSizeInBytes);
+    m_ias_output_buffer_size = ias_buffer_sizes.outputSizeInBytes;
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_ias_temp_buffer), m_ias_temp_buffer_size));
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_ias_output_buffer), m_ias_output_buffer_size));
+
+    OPTIX_CHECK(optixAccelBuild(m_state.context,
+        m_state.stream,
+        &m_ias_build_options,
+        &m_instance_input,
+        1,
+        m_ias_temp_buffer,
+        m_ias_temp_buffer_size,
+        m_ias_output_buffer,
+        m_ias_output_buffer_size,
+        &m_state.ias_handle,
+        nullptr,
+        0));
+
+    m_instances_dirty = false;
+}
+
+// upload the instance transforms and refit the IAS
+void GeometryManager::update_instance_accel() {
+
+    CUDA_CHECK(cudaMemcpyAsync(reinterpret_cast<void*>(m_instances_D),
+        m_instances_H.data(),
+        m_instances_H.size() * sizeof(OptixInstance),
+        cudaMemcpyHostToDevice, m_state.stream));
+
+    m_ias_build_options.operation = OPTIX_BUILD_OPERATION_UPDATE;
+
+    OPTIX_CHECK(optixAccelBuild(m_state.context,
+        m_state.stream,
+        &m_ias_build_options,
+        &m_instance_input,
+        1,
+        m_ias_temp_buffer,
+        m_ias_temp_buffer_size,
+        m_ias_output_buffer,
+        m_ias_output_buffer_size,
+        &m_state.ias_handle,
+        nullptr,
+        0));
+
+    m_instances_dirty = false;
+}
+
+void GeometryManager::update_instance_info(const std::vector<ElementInstance>& instance_list,
+    const std::vector<int>& changed_ids) {
+
+    if (changed_ids.empty()) return;
+
+    parallel_for(changed_ids.size(), [&](size_t j) {
+        uint32_t k = static_cast<uint32_t>(changed_ids[j]);
+        collect_instance_info(k, instance_list[k]);
+    }, 4096);
+
+    m_instances_dirty = true;
 }
 
 
 void GeometryManager::update_geometry_info(const std::vector<std::shared_ptr<CspElement>>& element_list,
+    const std::vector<int>& changed_ids,
 	LaunchParams& params) {
-	// Recollect geometry info
-	collect_geometry_info(element_list, params);
 
-    // update device aabb list
+    // nothing moved, aabbs and acceleration structures are still valid, only the sun plane needs to follow the sun vector
+    if (changed_ids.empty() && !m_instances_dirty) {
+        compute_sun_plane_H(params);
+        return;
+    }
+
+	// Recollect geometry info of the elements that moved
+    parallel_for(changed_ids.size(), [&](size_t k) {
+        uint32_t id = static_cast<uint32_t>(changed_ids[k]);
+        collect_element_info(m_element_rank[id], element_list[id]);
+    }, 1024);
+
+    // update device aabb list, world aabbs of the instances are needed for the sun plane
 	CUDA_CHECK(cudaMemcpyAsync(
 		reinterpret_cast<void*>(m_aabb_list_D),
 		m_aabb_list_H.data(),
 		m_aabb_list_H.size() * sizeof(OptixAabb),
 		cudaMemcpyHostToDevice, m_state.stream));
 
+    if (changed_ids.empty()) {
+        // only instances moved
+        update_instance_accel();
+        compute_sun_plane_H(params);
+        return;
+    }
+
     std::vector<uint32_t> aabb_input_flags(NUM_OPTICAL_ENTITY_TYPES);
     for (int i = 0; i < NUM_OPTICAL_ENTITY_TYPES; i++) {
         aabb_input_flags[i] = OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT;
@@ -254,13 +851,6 @@ void GeometryManager::update_geometry_info(const std::vector<std::shared_ptr<Csp
 
 	m_aabb_input.customPrimitiveArray.flags = aabb_input_flags.data();
 
-
-    CUDA_CHECK(cudaMemcpyAsync(
-        reinterpret_cast<void*>(m_aabb_input.customPrimitiveArray.aabbBuffers[0]),
-        m_aabb_list_H.data(),
-        m_aabb_list_H.size() * sizeof(OptixAabb),
-        cudaMemcpyHostToDevice, m_state.stream));
-
     m_accel_build_options.operation = OPTIX_BUILD_OPERATION_UPDATE; // set to update 
 
     OPTIX_CHECK(optixAccelBuild(m_state.context,								  // OptiX context
@@ -276,6 +866,10 @@ void GeometryManager::update_geometry_info(const std::vector<std::shared_ptr<Csp
         nullptr,                                        // Emitted properties (not used here)
         0));                                           // Number of emitted properties
 
+    // the IAS has to be refit whenever the GAS it references is refit
+    if (use_instancing()) {
+        update_instance_accel();
+    }
 
 	compute_sun_plane_H(params);
 }
\ No newline at end of file
@@ -1,3 +1,4 @@
+#pragma once
 #include <string>
 #include <vector>
 #include <cuda_runtime.h>
@@ -5,15 +6,55 @@
 
 #include "shaders/Soltrace.h"
 #include "CspElement.h"
+#include "ElementPrototype.h"
+#include "MeshElement.h"
+#include "optics_table.h"
 #include "soltrace_state.h"
 
 namespace OptixCSP {
 
 	class dataManager;
+
+	/// device geometry on the host, one densely packed array per primitive type
+	/// slot[i] is the position of geometry index i (element, then prototype facet) in the array of its type
+	struct PackedGeometryArrays {
+		std::vector<PackedRectangleFlat>      rectangle_flat;
+		std::vector<PackedRectangleParabolic> rectangle_parabolic;
+		std::vector<PackedCylinderY>          cylinder_y;
+		std::vector<PackedTriangleFlat>       triangle_flat;
+		std::vector<uint32_t>                 slot;
+
+		void clear() {
+			rectangle_flat.clear();
+			rectangle_parabolic.clear();
+			cylinder_y.clear();
+			triangle_flat.clear();
+			slot.clear();
+		}
+	};
+
 	/**
 	 * @class geometryManager
 	 * @brief Given the geoemtry of the elements, populate the list of aabb,
 	 * compute the sun plane, and build the GAS (Geometry Acceleration Structure) for ray tracing.
+	 *
+	 * Prototype instances get one small GAS per prototype (built in the prototype local frame)
+	 * and an IAS on top of it, the GAS of the individual elements being instance 0 of the IAS.
+	 * Geometry and material index arrays hold the elements first and then one entry per prototype facet
+	 * (one per prototype if it is not faceted), each OptiX instance stores the index of the first entry
+	 * of its prototype in instanceId. A faceted prototype GAS has one primitive per facet, bounded by
+	 * its own box, while the IAS only bounds the whole heliostat. The material index of an
+	 * entry is a 16-bit index into the shared records of the OpticsTable.
+	 * The geometry itself is packed per primitive type, the geometry index is mapped to the
+	 * slot in the array of its type (see PackedGeometryArrays).
+	 *
+	 * With spatial ordering enabled, elements are placed in the GAS (and in the geometry, material
+	 * and aabb arrays) sorted by OpticalEntityType and then by the Morton code of their aabb centroid,
+	 * so that neighboring elements are also neighbors in memory. get_element_order() maps the
+	 * primitive index back to the element id, ids exposed to the user are never reordered.
+	 *
+	 * Mesh elements are built-in triangle GASes (one per distinct TriangleMesh) placed in the IAS after the
+	 * prototype instances. Hit ids go elements, prototype instances, then the faces of every mesh.
 	 */
 	class GeometryManager {
 	public:
@@ -22,41 +63,147 @@ namespace OptixCSP {
 
 		/// go through the list of elements and collect the geometry info on the host: 
 		/// - AABBs
-		/// - GeometryDataST on the host
+		/// - packed geometry data on the host
 		/// - SBT index
-		/// - MaterialData info on the host
+		/// - material record index into the optics table, the records are rebuilt
+		/// - per-instance transforms (OptixInstance) and world AABBs of the prototype instances and meshes
 		void collect_geometry_info(const std::vector<std::shared_ptr<CspElement>>& element_list,
-			LaunchParams& params);
+			const std::vector<std::shared_ptr<ElementPrototype>>& prototype_list,
+			const std::vector<ElementInstance>& instance_list,
+			LaunchParams& params,
+			const std::vector<std::shared_ptr<MeshElement>>& mesh_list = {});
 
 		/// build the GAS (Geometry Acceleration Structure) using the AABB list, populate optix state
+		/// if there are prototype instances or meshes, also build their GASes and the IAS
 		void create_geometries(LaunchParams& params);
 
+		/// recompute the transforms of the instances listed in changed_ids,
+		/// the IAS is refit on the next update_geometry_info
+		void update_instance_info(const std::vector<ElementInstance>& instance_list,
+			const std::vector<int>& changed_ids);
+
 
 		/// update the GAS (Geometry Acceleration Structure) using the AABB list, populate optix state
+		/// only the elements listed in changed_ids are recollected, the GAS is refit only if something moved
+		/// the IAS is refit if the GAS or any instance moved
 		void update_geometry_info(const std::vector<std::shared_ptr<CspElement>>& element_list,
+			const std::vector<int>& changed_ids,
 			LaunchParams& params);
 
-		/// return the list of geometry data vector
-		std::vector<GeometryDataST>& get_geometry_data_array() { return m_geometry_data_array_H; }
+		/// sort elements by type and Morton code of their centroid on the next collect_geometry_info
+		void set_spatial_ordering(bool val) { m_spatial_ordering = val; }
+		bool use_spatial_ordering() const { return m_spatial_ordering; }
+
+		/// element id of each primitive of the element GAS (identity without spatial ordering)
+		const std::vector<uint32_t>& get_element_order() const { return m_element_order; }
+
+		/// primitive index of each element id, inverse of get_element_order()
+		const std::vector<uint32_t>& get_element_rank() const { return m_element_rank; }
 
-		/// return the list of material data array 
-		std::vector<MaterialData>& get_material_data_array() { return m_material_data_array_H; }
+		/// return the geometry packed per primitive type
+		const PackedGeometryArrays& get_packed_geometry() const { return m_packed_geometry_H; }
+
+		/// frame of every hit id (primitives of the element GAS, prototype instances, then mesh faces) in world space,
+		/// used to quantize the hit points (see HitEncoding.h)
+		const std::vector<HitFrame>& get_hit_frames() const { return m_hit_frames_H; }
+
+		/// shared optics and the deduplicated material records
+		OpticsTable& get_optics() { return m_optics; }
+		const std::vector<MaterialData>& get_material_data_array() const { return m_optics.get_records(); }
+		/// record of every geometry index (elements, then prototype facets)
+		const std::vector<uint16_t>& get_material_index() const { return m_material_index_H; }
 
 
 		// compute sun plane 
 		void compute_sun_plane_H(LaunchParams& params);
 
+		/// number of elements (primitives of the element GAS)
+		uint32_t get_num_elements() const { return m_obj_counts; }
+
+		/// index of the first prototype instance in the IAS (1 if the element GAS is instance 0)
+		uint32_t get_instance_offset() const { return m_instance_offset; }
+
+		/// true if the scene is traced through the IAS (there are prototype instances or meshes)
+		bool use_instancing() const { return m_num_instances + m_num_meshes > 0; }
+
+		/// number of hit ids: elements, prototype instances and mesh faces
+		uint32_t get_num_hit_ids() const { return m_obj_counts + m_num_instances + m_num_mesh_faces; }
+
+		/// hit id of the first face of mesh m, face f has hit id get_mesh_first_hit_id(m) + f
+		uint32_t get_mesh_first_hit_id(uint32_t m) const { return m_mesh_first_hit_id[m]; }
+
 
 	private:
+		/// own optical properties of an element, used when it has no optic
+		static MaterialData get_material_data(const CspElement& element);
+
+		/// compute aabb, sbt index and geometry data of element i
+		void collect_element_info(uint32_t i, const std::shared_ptr<CspElement>& element);
+
+		/// compute the facet aabbs, sbt indices and geometry data of prototype p, and its local aabb
+		void collect_prototype_info(uint32_t p, const ElementPrototype& prototype);
+
+		/// compute transform and world aabb of instance k
+		void collect_instance_info(uint32_t k, const ElementInstance& instance);
+
+		/// compute transform, world aabb and face hit frames of mesh m
+		void collect_mesh_info(uint32_t m, const MeshElement& mesh);
+
+		/// fill m_element_order and m_element_rank, sorted by type and Morton code if spatial ordering is on
+		void compute_element_order(const std::vector<std::shared_ptr<CspElement>>& element_list);
+
+		/// reserve the slot of geometry index i in the array of its type
+		void assign_geometry_slot(uint32_t i, GeometryDataST::Type type);
+
+		/// pack geometry index i into its slot, returns its hit frame
+		HitFrame store_geometry(uint32_t i, const GeometryDataST& geometry);
+
+		/// aabb and sbt index of an element, in the frame the element is placed in
+		static void compute_element_aabb(CspElement& element, OptixAabb& aabb, uint32_t& sbt_offset);
+
+		void create_prototype_geometries();
+		void create_mesh_geometries();
+		void create_instance_accel();
+		void update_instance_accel();
+
 		SoltraceState& m_state;
 		float m_sun_plane_distance = -1.0f; // distance of the sun plane from the origin
 		uint32_t m_obj_counts;
+		uint32_t m_num_prototypes = 0;
+		uint32_t m_num_instances = 0;
+		uint32_t m_instance_offset = 0;  // 1 if the element GAS is the first instance of the IAS
+		uint32_t m_num_meshes = 0;
+		uint32_t m_num_mesh_faces = 0;
+
+		bool m_spatial_ordering = false;
+		std::vector<uint32_t> m_element_order;  // primitive index -> element id
+		std::vector<uint32_t> m_element_rank;   // element id -> primitive index
 
 		// data related to the geometry and material of each element on the host side
-		std::vector<OptixAabb>      m_aabb_list_H;           // aabb list
-		std::vector<GeometryDataST> m_geometry_data_array_H; // geometry data
+		std::vector<OptixAabb>      m_aabb_list_H;           // aabb list, elements then world aabbs of the instances
+		PackedGeometryArrays        m_packed_geometry_H;     // geometry data, packed per type
 		std::vector<uint32_t>       m_sbt_index_H;           // sbt offset index
-		std::vector<MaterialData>   m_material_data_array_H; // material data
+		OpticsTable                 m_optics;                // optics and material records
+		std::vector<uint16_t>       m_material_index_H;      // material record of every element and prototype facet
+		std::vector<HitFrame>       m_hit_frames_H;          // per hit id, elements then instances
+		std::vector<HitFrame>       m_prototype_frames_H;    // local frame of every prototype
+
+		// prototypes and their instances
+		std::vector<uint32_t>               m_prototype_first_index;  // first facet of every prototype after the elements, + total
+		std::vector<OptixAabb>              m_prototype_aabb_H;       // local frame, over all the facets
+		std::vector<OptixAabb>              m_prototype_facet_aabb_H; // local frame, per facet
+		std::vector<uint32_t>               m_prototype_sbt_index_H;  // per facet
+		std::vector<OptixTraversableHandle> m_prototype_gas_handles;
+		std::vector<CUdeviceptr>            m_prototype_gas_buffers;
+		std::vector<OptixInstance>          m_instances_H;            // per-instance transforms
+		bool m_instances_dirty = false;
+
+		// meshes, instances of the IAS after the prototype instances
+		std::vector<std::shared_ptr<MeshElement>> m_mesh_list;
+		std::vector<uint32_t>               m_mesh_first_hit_id;
+		std::vector<uint32_t>               m_mesh_gas_index;         // GAS of every mesh, meshes sharing a TriangleMesh share it
+		std::vector<OptixTraversableHandle> m_mesh_gas_handles;
+		std::vector<CUdeviceptr>            m_mesh_gas_buffers;
 
 		// members related to building GAS
 		OptixBuildInput        m_aabb_input = {};                   // needed after the first build
@@ -68,5 +215,14 @@ namespace OptixCSP {
 		CUdeviceptr m_temp_buffer{};     // temporary buffer for building GAS
 		size_t m_output_buffer_size = 0;   // size of that scratch
 		size_t m_temp_buffer_size = 0;     // size of the output buffer
+
+		// members related to building the IAS
+		OptixBuildInput        m_instance_input = {};
+		OptixAccelBuildOptions m_ias_build_options = {};
+		CUdeviceptr m_instances_D{};
+		CUdeviceptr m_ias_output_buffer{};
+		CUdeviceptr m_ias_temp_buffer{};
+		size_t m_ias_output_buffer_size = 0;
+		size_t m_ias_temp_buffer_size = 0;
 	};
 }
\ No newline at end of file
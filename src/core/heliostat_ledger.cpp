@@ -0,0 +1,25 @@
+#include "heliostat_ledger.h"
+
+#include <fstream>
+#include <iostream>
+
+using namespace OptixCSP;
+
+void OptixCSP::write_heliostat_ledger_csv(const std::string& filename, const std::vector<HeliostatLedgerEntry>& ledger) {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Error: Could not open the file " << filename << " for writing." << std::endl;
+        return;
+    }
+
+    out << "element_id,instance_id,cosine,shaded,incident,reflected,blocked,receiver,spilled,absorbed,"
+        "shading_efficiency,intercept_efficiency\n";
+    for (const HeliostatLedgerEntry& e : ledger) {
+        out << e.element_id << "," << e.instance_id << "," << e.cosine << "," << e.shaded << ","
+            << e.incident << "," << e.reflected << "," << e.blocked << ","
+            << e.receiver << "," << e.spilled << "," << e.absorbed << ","
+            << e.get_shading_efficiency() << "," << e.get_intercept_efficiency() << "\n";
+    }
+
+    std::cout << "Data successfully written to " << filename << std::endl;
+}
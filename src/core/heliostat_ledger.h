@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace OptixCSP {
+
+    /// optical losses of one heliostat for the last run. Every sun ray is attributed to the heliostat it hit first:
+    /// incident = reflected + absorbed, reflected rays then end up on a receiver, blocked by another heliostat,
+    /// spilled (missing every receiver or hitting its back), or past the trace depth.
+    /// shaded counts the sun rays stopped by another heliostat that would have hit this one next: each sun ray
+    /// hitting a heliostat is traced on along the sun direction, and the first heliostat behind it is shaded.
+    struct HeliostatLedgerEntry {
+        int      element_id = -1;   // element id, -1 for a prototype instance
+        int      instance_id = -1;  // instance id, -1 for an element
+        double   cosine = 0.0;      // cos of the angle between the heliostat normal and the sun vector
+        uint64_t shaded = 0;
+        uint64_t incident = 0;
+        uint64_t reflected = 0;
+        uint64_t blocked = 0;
+        uint64_t receiver = 0;
+        uint64_t spilled = 0;
+        uint64_t absorbed = 0;
+
+        /// fraction of the incident rays reaching a receiver
+        double get_intercept_efficiency() const { return incident ? static_cast<double>(receiver) / incident : 0.0; }
+
+        /// fraction of the sun rays reaching the heliostat that are not shaded
+        double get_shading_efficiency() const {
+            return incident + shaded ? static_cast<double>(incident) / (incident + shaded) : 0.0;
+        }
+    };
+
+    /// one row per heliostat, counters as columns
+    void write_heliostat_ledger_csv(const std::string& filename, const std::vector<HeliostatLedgerEntry>& ledger);
+}
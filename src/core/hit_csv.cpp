@@ -0,0 +1,136 @@
+#include "hit_csv.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+using namespace OptixCSP;
+
+namespace {
+
+    // field parsers leave p on the comma after the field (or at the end of the row). Numbers may be padded with
+    // spaces, and quoted as SolTrace writes the element.
+    void skip_padding(const char*& p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '"')) p++;
+    }
+
+    template <typename T>
+    bool parse_number(const char*& p, const char* end, T& value) {
+        skip_padding(p, end);
+        if (p < end && *p == '+') p++;
+        std::from_chars_result result = std::from_chars(p, end, value);
+        if (result.ec != std::errc()) return false;
+        p = result.ptr;
+        skip_padding(p, end);
+        return p == end || *p == ',';
+    }
+
+    void skip_field(const char*& p, const char* end) {
+        while (p < end && *p != ',') p++;
+    }
+
+    HitField field_of_column(const std::string& name) {
+        static const std::pair<const char*, HitField> names[] = {
+            { "number", HitField::RAY }, { "raynum", HitField::RAY }, { "stage", HitField::STAGE },
+            { "loc_x", HitField::X }, { "loc_y", HitField::Y }, { "loc_z", HitField::Z },
+            { "element", HitField::ELEMENT }, { "instance", HitField::INSTANCE },
+            { "mesh", HitField::MESH }, { "face", HitField::FACE },
+            { "weight", HitField::WEIGHT }, { "direct_sun", HitField::DIRECT_SUN } };
+        for (const auto& n : names) {
+            if (name == n.first) return n.second;
+        }
+        return HitField::IGNORED;
+    }
+}
+
+bool HitColumns::has(HitField field) const {
+    return std::find(fields.begin(), fields.end(), field) != fields.end();
+}
+
+HitColumns OptixCSP::detect_hit_file_format(const char* data, size_t size) {
+    const char* end = data + size;
+    const char* p = data;
+    // UTF-8 byte order mark
+    if (size >= 3 && std::memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;
+
+    HitColumns columns;
+    std::vector<std::string> names;
+    while (true) {
+        const char* name_end = p;
+        while (name_end < end && *name_end != ',' && *name_end != '\n' && *name_end != '\r') name_end++;
+        const char* name_begin = p;
+        skip_padding(name_begin, name_end);
+        const char* trimmed_end = name_end;
+        while (trimmed_end > name_begin && (trimmed_end[-1] == ' ' || trimmed_end[-1] == '"')) trimmed_end--;
+        names.emplace_back(name_begin, trimmed_end);
+        columns.fields.push_back(field_of_column(names.back()));
+        if (name_end == end || *name_end != ',') break;
+        p = name_end + 1;
+    }
+
+    if (std::find(names.begin(), names.end(), "number") != names.end()) {
+        columns.format = HitFileFormat::OPTIX;
+    }
+    else if (std::find(names.begin(), names.end(), "raynum") != names.end()) {
+        columns.format = HitFileFormat::SOLTRACE;
+    }
+    else {
+        throw std::runtime_error("detect_hit_file_format: no number or raynum column in the header starting with '"
+            + names[0] + "'");
+    }
+
+    std::vector<std::pair<HitField, const char*>> required = { { HitField::STAGE, "stage" } };
+    if (columns.format == HitFileFormat::SOLTRACE) {
+        required.insert(required.end(), { { HitField::X, "loc_x" }, { HitField::Y, "loc_y" }, { HitField::Z, "loc_z" },
+            { HitField::ELEMENT, "element" } });
+    }
+    for (const auto& r : required) {
+        if (!columns.has(r.first)) {
+            throw std::runtime_error(std::string("detect_hit_file_format: no ") + r.second + " column in the header");
+        }
+    }
+    return columns;
+}
+
+bool OptixCSP::parse_hit_record(const char* begin, const char* end, const HitColumns& columns, HitRecord& record) {
+    record = HitRecord();
+    const char* p = begin;
+
+    for (size_t c = 0; c < columns.fields.size(); c++) {
+        if (c > 0) {
+            if (p == end) return false;     // too few columns
+            p++;                            // comma
+        }
+
+        bool ok = true;
+        switch (columns.fields[c]) {
+        case HitField::RAY:        ok = parse_number(p, end, record.ray); break;
+        case HitField::STAGE:      ok = parse_number(p, end, record.stage); break;
+        case HitField::X:          ok = parse_number(p, end, record.x); break;
+        case HitField::Y:          ok = parse_number(p, end, record.y); break;
+        case HitField::Z:          ok = parse_number(p, end, record.z); break;
+        case HitField::ELEMENT:    ok = parse_number(p, end, record.element); break;
+        case HitField::INSTANCE:   ok = parse_number(p, end, record.instance); break;
+        case HitField::MESH:       ok = parse_number(p, end, record.mesh); break;
+        case HitField::FACE:       ok = parse_number(p, end, record.face); break;
+        case HitField::WEIGHT:     ok = parse_number(p, end, record.weight); break;
+        case HitField::DIRECT_SUN: ok = parse_number(p, end, record.direct_sun); break;
+        case HitField::IGNORED:    skip_field(p, end); break;
+        }
+        if (!ok) return false;
+    }
+
+    // too many columns
+    return p == end;
+}
+
+HitCsvReader::HitCsvReader(const std::string& filename) : m_file(filename) {
+    if (m_file.size() == 0) throw std::runtime_error("HitCsvReader: empty file " + filename);
+
+    m_columns = detect_hit_file_format(m_file.data(), m_file.size());
+
+    const char* data = m_file.data();
+    const char* header_end = static_cast<const char*>(std::memchr(data, '\n', m_file.size()));
+    m_body_begin = header_end ? static_cast<size_t>(header_end - data) + 1 : m_file.size();
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "utils/mapped_file.h"
+#include "utils/parallel_util.h"
+
+namespace OptixCSP {
+
+    /// layouts of the ray files written by the two tracers
+    enum class HitFileFormat {
+        OPTIX,      // SolTraceSystem::write_hp_output: number,stage[,loc_x,loc_y,loc_z][,cosx,cosy,cosz]
+                    // [,element,instance[,mesh,face]][,weight][,direct_sun], columns depending on the output fields
+        SOLTRACE    // SolTrace CPU ray data: loc_x,loc_y,loc_z,cos_x,cos_y,cos_z,element,stage,raynum
+    };
+
+    /// meaning of a column of a ray file, from its header name
+    enum class HitField {
+        IGNORED,    // e.g. the direction
+        RAY,        // number (OptiX), raynum (SolTrace)
+        STAGE,
+        X, Y, Z,    // loc_x, loc_y, loc_z
+        ELEMENT,
+        INSTANCE,
+        MESH,
+        FACE,
+        WEIGHT,
+        DIRECT_SUN
+    };
+
+    /// format and columns of a ray file, read from its header line
+    struct HitColumns {
+        HitFileFormat         format = HitFileFormat::OPTIX;
+        std::vector<HitField> fields;   // one per column, in file order
+
+        bool has(HitField field) const;
+    };
+
+    /// one row of a ray file, fields without a column keep their defaults. Stage is the trace depth in OptiX files
+    /// (2 for the receiver of a single-bounce field). Element, instance, mesh and face are -1 where they do not
+    /// apply; SolTrace files use element -1 for the receiver.
+    struct HitRecord {
+        double   x = 0.0;
+        double   y = 0.0;
+        double   z = 0.0;
+        int32_t  stage = 0;
+        int32_t  element = -1;
+        int32_t  instance = -1;
+        int32_t  mesh = -1;
+        int32_t  face = -1;
+        double   weight = 0.0;
+        int32_t  direct_sun = -1;   // 0 or 1, -1 without the column
+        uint64_t ray = 0;
+    };
+
+    /// format and columns from the names of the header line: a "number" column makes an OptiX file, "raynum"
+    /// a SolTrace file. Throws if neither is found or a column the format always has is missing.
+    HitColumns detect_hit_file_format(const char* data, size_t size);
+
+    /// parse one row [begin, end) without the line break, false for malformed rows or a wrong number of columns
+    bool parse_hit_record(const char* begin, const char* end, const HitColumns& columns, HitRecord& record);
+
+    /**
+     * @class HitCsvReader
+     * @brief Memory mapped ray file, parsed in parallel chunks.
+     *
+     * The file is split into byte ranges of roughly equal size, one per host thread. A row belongs to the
+     * range holding its first byte, so every range is parsed independently straight from the page cache.
+     */
+    class HitCsvReader {
+    public:
+        explicit HitCsvReader(const std::string& filename);
+
+        HitFileFormat get_format() const { return m_columns.format; }
+        const HitColumns& get_columns() const { return m_columns; }
+        size_t get_size_bytes() const { return m_file.size(); }
+
+        /// call visit(record, thread_id) for every row, rows of one thread come in file order,
+        /// thread_id is in [0, get_num_host_threads()) for thread-private accumulators.
+        /// Returns the number of malformed rows, which are skipped.
+        template <typename Visitor>
+        uint64_t for_each_record(Visitor&& visit) const;
+
+    private:
+        MappedFile    m_file;
+        HitColumns    m_columns;
+        size_t        m_body_begin = 0;   // first byte after the header line
+    };
+
+    template <typename Visitor>
+    uint64_t HitCsvReader::for_each_record(Visitor&& visit) const {
+        const char* data = m_file.data();
+        const size_t size = m_file.size();
+        const size_t body_size = size - m_body_begin;
+        std::vector<uint64_t> malformed(get_num_host_threads(), 0);
+
+        parallel_for_chunks(body_size, [&](size_t begin, size_t end, unsigned int t) {
+            const char* p = data + m_body_begin + begin;
+            const char* chunk_end = data + m_body_begin + end;
+            const char* file_end = data + size;
+
+            // skip the row started by the previous range
+            if (begin > 0 && p[-1] != '\n') {
+                while (p < file_end && *p != '\n') p++;
+                if (p < file_end) p++;
+            }
+
+            HitRecord record;
+            while (p < chunk_end) {
+                const char* line_end = p;
+                while (line_end < file_end && *line_end != '\n') line_end++;
+                const char* row_end = (line_end > p && line_end[-1] == '\r') ? line_end - 1 : line_end;
+
+                if (row_end > p) {
+                    if (parse_hit_record(p, row_end, m_columns, record)) visit(record, t);
+                    else malformed[t]++;
+                }
+                p = (line_end < file_end) ? line_end + 1 : file_end;
+            }
+        }, size_t(1) << 20);
+
+        uint64_t total = 0;
+        for (uint64_t m : malformed) total += m;
+        return total;
+    }
+}
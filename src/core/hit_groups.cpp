@@ -0,0 +1,95 @@
+#include "hit_groups.h"
+#include "hit_path.h"
+#include "utils/parallel_util.h"
+#include "utils/radix_sort.h"
+
+#include <fstream>
+#include <iostream>
+
+using namespace OptixCSP;
+
+void OptixCSP::sort_hits_by_group(const std::vector<float4>& hit_points,
+    const std::vector<uint32_t>& hit_ids,
+    const std::vector<float>& hit_weights,
+    size_t max_depth,
+    const std::vector<uint32_t>& hit_to_group,
+    size_t num_groups,
+    SortedHits& sorted) {
+
+    // stage in the low byte, group above it
+    int stage_bits = 1;
+    while ((size_t(1) << stage_bits) < max_depth) stage_bits++;
+    int group_bits = 1;
+    while ((size_t(1) << group_bits) < num_groups) group_bits++;
+
+    // compaction: count the hits of every chunk, then each chunk writes at its offset
+    const size_t count = hit_ids.size();
+    std::vector<size_t> chunk_counts(get_num_host_threads() + 1, 0);
+    unsigned int num_chunks = parallel_for_chunks(count, [&](size_t begin, size_t end, unsigned int t) {
+        size_t n = 0;
+        for (size_t k = begin; k < end; k++) n += get_stored_hit_id(hit_ids[k]) != 0;
+        chunk_counts[t + 1] = n;
+    });
+    for (unsigned int t = 0; t < num_chunks; t++) chunk_counts[t + 1] += chunk_counts[t];
+
+    const size_t num_hits = chunk_counts[num_chunks];
+    std::vector<uint64_t> keys(num_hits);
+    std::vector<uint64_t> entries(num_hits);
+    parallel_for_chunks(count, [&](size_t begin, size_t end, unsigned int t) {
+        size_t dst = chunk_counts[t];
+        for (size_t k = begin; k < end; k++) {
+            uint32_t stored_id = get_stored_hit_id(hit_ids[k]);
+            if (stored_id == 0) continue;
+            uint64_t group = hit_to_group[stored_id - 1];
+            keys[dst] = (group << stage_bits) | (k % max_depth);
+            entries[dst] = k;
+            dst++;
+        }
+    });
+
+    radix_sort_pairs(keys, entries, group_bits + stage_bits);
+
+    const bool weighted = !hit_weights.empty();
+    sorted.records.resize(num_hits);
+    parallel_for(num_hits, [&](size_t i) {
+        size_t k = entries[i];
+        const float4& hp = hit_points[k];
+        SortedHitRecord& r = sorted.records[i];
+        r.ray = static_cast<uint32_t>(k / max_depth);
+        r.stage = static_cast<uint16_t>(k % max_depth);
+        r.flags = is_direct_sun_hit(hit_ids[k]) ? 1 : 0;
+        r.x = hp.y;
+        r.y = hp.z;
+        r.z = hp.w;
+        r.weight = weighted ? hit_weights[k] : 0.0f;
+    });
+
+    // group offsets from the sorted keys
+    sorted.group_offsets.assign(num_groups + 1, 0);
+    for (size_t i = 0; i < num_hits; i++) sorted.group_offsets[(keys[i] >> stage_bits) + 1]++;
+    for (size_t g = 0; g < num_groups; g++) sorted.group_offsets[g + 1] += sorted.group_offsets[g];
+}
+
+void OptixCSP::write_sorted_hits_binary(const std::string& filename, const SortedHits& sorted,
+    uint32_t num_elements, uint32_t num_instances, uint32_t num_meshes) {
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Error: Could not open the file " << filename << " for writing." << std::endl;
+        return;
+    }
+
+    static_assert(sizeof(SortedHitRecord) == 24, "SortedHitRecord is part of the file format");
+
+    const char magic[8] = { 'O', 'C', 'S', 'P', 'H', 'I', 'T', 'S' };
+    uint32_t header[4] = { num_elements, num_instances, num_meshes, 0 };
+    uint64_t num_records = sorted.records.size();
+
+    out.write(magic, sizeof(magic));
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(&num_records), sizeof(num_records));
+    out.write(reinterpret_cast<const char*>(sorted.group_offsets.data()), sorted.group_offsets.size() * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(sorted.records.data()), sorted.records.size() * sizeof(SortedHitRecord));
+
+    std::cout << "Data successfully written to " << filename << std::endl;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vector_types.h>
+
+namespace OptixCSP {
+
+    /// one hit of a run, 24 bytes, the layout written by write_sorted_hits
+    struct SortedHitRecord {
+        uint32_t ray;      // launch index of the ray
+        uint16_t stage;    // trace depth of the hit
+        uint16_t flags;    // 1: straight from the sun (sun -> object)
+        float    x;
+        float    y;
+        float    z;
+        float    weight;   // power of the ray at the hit (W) with weighted rays, 0 otherwise
+    };
+
+    /**
+     * Hits of a run sorted by (group, stage, ray), a group being an element or a prototype instance.
+     * The hits of group g are records[group_offsets[g], group_offsets[g + 1]).
+     */
+    struct SortedHits {
+        std::vector<SortedHitRecord> records;
+        std::vector<uint64_t> group_offsets;   // num_groups + 1 entries
+
+        size_t get_num_groups() const { return group_offsets.empty() ? 0 : group_offsets.size() - 1; }
+    };
+
+    /**
+     * Compact the non-empty entries of the hit buffers and sort them by (group, stage, ray) with a parallel LSD
+     * radix sort. The key holds only the group and the stage: the buffers are already in ray order (entry k
+     * belongs to ray k / max_depth) and the sort is stable, so every (group, stage) run comes out in ray order.
+     *
+     * hit_ids follows the device hit_element_buffer (hit id + 1 with path tags, 0 for empty slots),
+     * hit_to_group maps a hit id to its group in [0, num_groups), hit_weights may be empty.
+     */
+    void sort_hits_by_group(const std::vector<float4>& hit_points,
+        const std::vector<uint32_t>& hit_ids,
+        const std::vector<float>& hit_weights,
+        size_t max_depth,
+        const std::vector<uint32_t>& hit_to_group,
+        size_t num_groups,
+        SortedHits& sorted);
+
+    /// little-endian binary: "OCSPHITS", uint32 num_elements, num_instances, num_meshes, 0, uint64 num_records,
+    /// uint64 group_offsets[num_elements + num_instances + num_meshes + 1] (elements in element id order,
+    /// then instances, then one group per mesh), then the records. Every part starts 8-byte aligned,
+    /// so one group can be memory mapped directly.
+    void write_sorted_hits_binary(const std::string& filename, const SortedHits& sorted,
+        uint32_t num_elements, uint32_t num_instances, uint32_t num_meshes = 0);
+}
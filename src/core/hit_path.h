@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+#include "shaders/Soltrace.h"
+
+namespace OptixCSP {
+
+    /// interaction path of the receiver hits kept by the host statistics (flux maps, receiver and group stats).
+    /// Only receiver hits carry the path tag, element hit stats count every hit.
+    enum class PathFilter {
+        ALL,         // every hit
+        REFLECTED,   // sun -> mirror -> receiver, drops receivers hit straight from the sun
+        DIRECT_SUN   // sun -> receiver only
+    };
+
+    /// hit id + 1 of a hit_element_buffer entry, 0 if empty
+    inline uint32_t get_stored_hit_id(uint32_t entry) { return entry & HIT_ID_MASK; }
+
+    /// true if the ray came straight from the sun to this receiver hit
+    inline bool is_direct_sun_hit(uint32_t entry) { return (entry & HIT_DIRECT_SUN) != 0; }
+
+    inline bool is_path_selected(uint32_t entry, PathFilter filter) {
+        switch (filter) {
+        case PathFilter::REFLECTED:  return !is_direct_sun_hit(entry);
+        case PathFilter::DIRECT_SUN: return is_direct_sun_hit(entry);
+        default:                     return true;
+        }
+    }
+
+    inline const char* to_string(PathFilter filter) {
+        switch (filter) {
+        case PathFilter::REFLECTED:  return "reflected";
+        case PathFilter::DIRECT_SUN: return "direct_sun";
+        default:                     return "all";
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#include "hit_sample.h"
+#include "hit_path.h"
+#include "utils/parallel_util.h"
+
+#include <algorithm>
+#include <queue>
+#include <utility>
+
+using namespace OptixCSP;
+
+namespace {
+
+    // splitmix64 finalizer, good enough to decorrelate neighboring entry indices
+    uint64_t hash_priority(uint64_t seed, uint64_t k) {
+        uint64_t z = seed + (k + 1) * 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // (priority, entry), the top of the heap is the entry to evict first
+    using Reservoir = std::priority_queue<std::pair<uint64_t, size_t>>;
+
+    void offer(Reservoir& reservoir, size_t capacity, uint64_t priority, size_t k) {
+        if (reservoir.size() < capacity) {
+            reservoir.emplace(priority, k);
+        }
+        else if (priority < reservoir.top().first) {
+            reservoir.pop();
+            reservoir.emplace(priority, k);
+        }
+    }
+}
+
+std::vector<size_t> OptixCSP::sample_hits(const std::vector<uint32_t>& hit_ids,
+    size_t sample_size,
+    uint64_t seed,
+    const std::vector<int32_t>& hit_to_stratum,
+    size_t num_strata) {
+
+    const bool stratified = !hit_to_stratum.empty();
+    if (!stratified) num_strata = 1;
+    if (sample_size == 0 || num_strata == 0) return {};
+
+    std::vector<std::vector<Reservoir>> reservoirs(get_num_host_threads());
+
+    unsigned int num_chunks = parallel_for_chunks(hit_ids.size(), [&](size_t begin, size_t end, unsigned int t) {
+        std::vector<Reservoir>& local = reservoirs[t];
+        local.resize(num_strata);
+
+        for (size_t k = begin; k < end; k++) {
+            uint32_t stored_id = get_stored_hit_id(hit_ids[k]);
+            if (stored_id == 0) continue;
+
+            size_t stratum = 0;
+            if (stratified) {
+                if (stored_id - 1 >= hit_to_stratum.size() || hit_to_stratum[stored_id - 1] < 0) continue;
+                stratum = static_cast<size_t>(hit_to_stratum[stored_id - 1]);
+            }
+            offer(local[stratum], sample_size, hash_priority(seed, k), k);
+        }
+    });
+
+    // merge the reservoirs of the threads stratum by stratum
+    std::vector<size_t> sample;
+    for (size_t s = 0; s < num_strata; s++) {
+        Reservoir merged;
+        for (unsigned int t = 0; t < num_chunks; t++) {
+            if (reservoirs[t].empty()) continue;
+            Reservoir& local = reservoirs[t][s];
+            while (!local.empty()) {
+                offer(merged, sample_size, local.top().first, local.top().second);
+                local.pop();
+            }
+        }
+        while (!merged.empty()) {
+            sample.push_back(merged.top().second);
+            merged.pop();
+        }
+    }
+
+    std::sort(sample.begin(), sample.end());
+    return sample;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace OptixCSP {
+
+    /// how write_hp_sample draws its hits
+    enum class HitSampleMode {
+        UNIFORM,     // sample_size hits drawn uniformly from all the hits of the run
+        STRATIFIED   // up to sample_size hits drawn uniformly from the hits of every element (and instance)
+    };
+
+    /**
+     * Uniform sample without replacement of the non-empty entries of a hit buffer, in a single streaming pass.
+     * Every entry gets a pseudo random priority hashed from (seed, entry index) and the sample_size entries with the
+     * lowest priorities are kept (priority reservoir). Host threads keep private reservoirs over contiguous chunks
+     * that are merged at the end, so the sample only depends on the seed, not on the number of threads.
+     *
+     * hit_ids follows the device hit_element_buffer (hit id + 1 with path tags, 0 for empty slots).
+     * With hit_to_stratum (indexed by hit id, -1 to drop) a reservoir of sample_size is kept for every one of
+     * num_strata strata, otherwise all the hits share one reservoir.
+     *
+     * @return indices of the sampled entries, in increasing order
+     */
+    std::vector<size_t> sample_hits(const std::vector<uint32_t>& hit_ids,
+        size_t sample_size,
+        uint64_t seed = 0,
+        const std::vector<int32_t>& hit_to_stratum = {},
+        size_t num_strata = 1);
+}
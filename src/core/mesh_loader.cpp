@@ -0,0 +1,311 @@
+#include "mesh_loader.h"
+#include "utils/mapped_file.h"
+#include "utils/parallel_util.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector_functions.h>
+
+using namespace OptixCSP;
+
+namespace {
+
+    // binary STL record, read in place from the mapping (records are 50 bytes, so not 4 byte aligned)
+#pragma pack(push, 1)
+    struct StlTriangle {
+        float    normal[3];
+        float    vertices[3][3];
+        uint16_t attribute;
+    };
+#pragma pack(pop)
+    static_assert(sizeof(StlTriangle) == 50, "binary STL records are 50 bytes");
+
+    constexpr size_t STL_HEADER_SIZE = 84;  // 80 byte header + uint32 face count
+
+    // vertices and faces of one byte range of an OBJ file
+    struct ObjChunk {
+        std::vector<float3>  vertices;
+        std::vector<int64_t> indices;           // 0-based, 3 per triangle
+        std::vector<size_t>  relative;          // positions in indices that are relative to the chunk start
+        size_t               malformed = 0;
+    };
+
+    inline bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+    inline void skip_blank(const char*& p, const char* end) {
+        while (p < end && is_blank(*p)) p++;
+    }
+
+    template <typename T>
+    bool parse_value(const char*& p, const char* end, T& value) {
+        skip_blank(p, end);
+        if (p < end && *p == '+') p++;
+        std::from_chars_result result = std::from_chars(p, end, value);
+        if (result.ec != std::errc()) return false;
+        p = result.ptr;
+        return true;
+    }
+
+    // "v x y z [w]"
+    bool parse_obj_vertex(const char* p, const char* end, ObjChunk& chunk) {
+        float x, y, z;
+        if (!parse_value(p, end, x) || !parse_value(p, end, y) || !parse_value(p, end, z)) return false;
+        chunk.vertices.push_back(make_float3(x, y, z));
+        return true;
+    }
+
+    // "f a b c ...", every corner is "v", "v/vt", "v//vn" or "v/vt/vn", polygons are fanned around a
+    bool parse_obj_face(const char* p, const char* end, ObjChunk& chunk) {
+        int64_t corners[3];
+        bool relative[3];
+        int num_corners = 0;
+
+        while (true) {
+            skip_blank(p, end);
+            if (p >= end) break;
+
+            int64_t index;
+            std::from_chars_result result = std::from_chars(p, end, index);
+            if (result.ec != std::errc() || index == 0) return false;
+            p = result.ptr;
+            while (p < end && !is_blank(*p)) p++;  // texture and normal indices
+
+            // OBJ indices are 1-based, negative ones count back from the last vertex read
+            const bool is_relative = index < 0;
+            const int64_t value = is_relative ? static_cast<int64_t>(chunk.vertices.size()) + index : index - 1;
+
+            if (num_corners < 3) {
+                corners[num_corners] = value;
+                relative[num_corners] = is_relative;
+                num_corners++;
+                if (num_corners < 3) continue;
+            }
+            else {
+                // next triangle of the fan: first corner, previous corner, this one
+                corners[1] = corners[2];
+                relative[1] = relative[2];
+                corners[2] = value;
+                relative[2] = is_relative;
+            }
+
+            for (int k = 0; k < 3; k++) {
+                if (relative[k]) chunk.relative.push_back(chunk.indices.size());
+                chunk.indices.push_back(corners[k]);
+            }
+        }
+        return num_corners == 3;
+    }
+
+    void parse_obj_line(const char* p, const char* end, ObjChunk& chunk) {
+        skip_blank(p, end);
+        if (end - p < 2 || !is_blank(p[1])) return;  // comments, vt, vn, groups, ...
+        if (p[0] == 'v') {
+            if (!parse_obj_vertex(p + 2, end, chunk)) chunk.malformed++;
+        }
+        else if (p[0] == 'f') {
+            if (!parse_obj_face(p + 2, end, chunk)) chunk.malformed++;
+        }
+    }
+
+    inline uint32_t float_bits(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits == 0x80000000u ? 0u : bits;  // -0 welds with +0
+    }
+
+    inline uint64_t hash_vertex(const float3& v) {
+        // splitmix64 finalizer over the three coordinates
+        uint64_t h = (static_cast<uint64_t>(float_bits(v.x)) << 32) ^ float_bits(v.y);
+        h ^= static_cast<uint64_t>(float_bits(v.z)) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 27; h *= 0x94D049BB133111EBull;
+        h ^= h >> 31;
+        return h;
+    }
+}
+
+MeshFileFormat OptixCSP::detect_mesh_file_format(const char* data, size_t size) {
+    // binary STL headers may start with "solid" too, so the size is checked first
+    if (size >= STL_HEADER_SIZE) {
+        uint32_t num_faces;
+        std::memcpy(&num_faces, data + 80, sizeof(num_faces));
+        if (STL_HEADER_SIZE + static_cast<uint64_t>(num_faces) * sizeof(StlTriangle) == size) return MeshFileFormat::STL_BINARY;
+    }
+    if (size >= 5 && std::memcmp(data, "solid", 5) == 0) {
+        throw std::runtime_error("detect_mesh_file_format: ASCII STL is not supported, convert it to binary STL");
+    }
+    return MeshFileFormat::OBJ;
+}
+
+TriangleMesh OptixCSP::parse_obj(const char* data, size_t size) {
+    std::vector<ObjChunk> chunks(get_num_host_threads());
+
+    parallel_for_chunks(size, [&](size_t begin, size_t end, unsigned int t) {
+        ObjChunk& chunk = chunks[t];
+        const char* p = data + begin;
+        const char* chunk_end = data + end;
+        const char* file_end = data + size;
+
+        // skip the line started by the previous range
+        if (begin > 0 && p[-1] != '\n') {
+            while (p < file_end && *p != '\n') p++;
+            if (p < file_end) p++;
+        }
+
+        while (p < chunk_end) {
+            const char* line_end = static_cast<const char*>(std::memchr(p, '\n', file_end - p));
+            if (!line_end) line_end = file_end;
+            const char* row_end = (line_end > p && line_end[-1] == '\r') ? line_end - 1 : line_end;
+
+            parse_obj_line(p, row_end, chunk);
+            p = (line_end < file_end) ? line_end + 1 : file_end;
+        }
+    }, size_t(1) << 20);
+
+    // chunks are in file order, the vertices of chunk t start after those of the chunks before it
+    std::vector<size_t> vertex_offset(chunks.size() + 1, 0);
+    std::vector<size_t> index_offset(chunks.size() + 1, 0);
+    size_t malformed = 0;
+    for (size_t t = 0; t < chunks.size(); t++) {
+        vertex_offset[t + 1] = vertex_offset[t] + chunks[t].vertices.size();
+        index_offset[t + 1] = index_offset[t] + chunks[t].indices.size();
+        malformed += chunks[t].malformed;
+    }
+    if (malformed > 0) {
+        throw std::runtime_error("parse_obj: " + std::to_string(malformed) + " malformed vertex or face lines");
+    }
+
+    const size_t num_vertices = vertex_offset.back();
+    TriangleMesh mesh;
+    mesh.vertices.resize(num_vertices);
+    mesh.indices.resize(index_offset.back() / 3);
+    std::vector<size_t> out_of_range(chunks.size(), 0);
+
+    parallel_for_chunks(chunks.size(), [&](size_t begin, size_t end, unsigned int) {
+        for (size_t t = begin; t < end; t++) {
+            ObjChunk& chunk = chunks[t];
+            for (size_t pos : chunk.relative) chunk.indices[pos] += static_cast<int64_t>(vertex_offset[t]);
+
+            std::copy(chunk.vertices.begin(), chunk.vertices.end(), mesh.vertices.begin() + vertex_offset[t]);
+            uint3* faces = mesh.indices.data() + index_offset[t] / 3;
+            for (size_t i = 0; i + 2 < chunk.indices.size(); i += 3) {
+                const int64_t a = chunk.indices[i], b = chunk.indices[i + 1], c = chunk.indices[i + 2];
+                if (a < 0 || b < 0 || c < 0 || a >= static_cast<int64_t>(num_vertices)
+                    || b >= static_cast<int64_t>(num_vertices) || c >= static_cast<int64_t>(num_vertices)) {
+                    out_of_range[t]++;
+                    continue;
+                }
+                faces[i / 3] = make_uint3(static_cast<unsigned int>(a), static_cast<unsigned int>(b), static_cast<unsigned int>(c));
+            }
+            chunk = ObjChunk();
+        }
+    }, 1);
+
+    size_t bad_faces = 0;
+    for (size_t n : out_of_range) bad_faces += n;
+    if (bad_faces > 0) {
+        throw std::runtime_error("parse_obj: " + std::to_string(bad_faces) + " faces reference missing vertices");
+    }
+    return mesh;
+}
+
+TriangleMesh OptixCSP::parse_stl_binary(const char* data, size_t size) {
+    if (size < STL_HEADER_SIZE) throw std::runtime_error("parse_stl_binary: file too short");
+    uint32_t num_faces;
+    std::memcpy(&num_faces, data + 80, sizeof(num_faces));
+    if (STL_HEADER_SIZE + static_cast<uint64_t>(num_faces) * sizeof(StlTriangle) > size) {
+        throw std::runtime_error("parse_stl_binary: file truncated");
+    }
+
+    const StlTriangle* records = reinterpret_cast<const StlTriangle*>(data + STL_HEADER_SIZE);
+    TriangleMesh mesh;
+    mesh.vertices.resize(3 * static_cast<size_t>(num_faces));
+    mesh.indices.resize(num_faces);
+
+    parallel_for(num_faces, [&](size_t f) {
+        const StlTriangle& record = records[f];
+        for (int k = 0; k < 3; k++) {
+            mesh.vertices[3 * f + k] = make_float3(record.vertices[k][0], record.vertices[k][1], record.vertices[k][2]);
+        }
+        const unsigned int first = static_cast<unsigned int>(3 * f);
+        mesh.indices[f] = make_uint3(first, first + 1, first + 2);
+    }, 1 << 16);
+
+    return mesh;
+}
+
+size_t OptixCSP::weld_vertices(TriangleMesh& mesh) {
+    const size_t num_vertices = mesh.vertices.size();
+    if (num_vertices < 2) return 0;
+
+    std::vector<uint64_t> hashes(num_vertices);
+    parallel_for(num_vertices, [&](size_t i) { hashes[i] = hash_vertex(mesh.vertices[i]); }, 1 << 16);
+
+    auto same_vertex = [&](uint32_t a, uint32_t b) {
+        const float3& va = mesh.vertices[a];
+        const float3& vb = mesh.vertices[b];
+        return float_bits(va.x) == float_bits(vb.x) && float_bits(va.y) == float_bits(vb.y) && float_bits(va.z) == float_bits(vb.z);
+    };
+    auto vertex_hash = [&](uint32_t i) { return static_cast<size_t>(hashes[i]); };
+
+    // first occurrence of every vertex, one hash partition (upper hash bits) per thread
+    std::vector<uint32_t> first(num_vertices);
+    const size_t num_partitions = get_num_host_threads();
+    parallel_for(num_partitions, [&](size_t part) {
+        std::unordered_set<uint32_t, decltype(vertex_hash), decltype(same_vertex)> seen(
+            2 * num_vertices / num_partitions + 16, vertex_hash, same_vertex);
+        for (size_t i = 0; i < num_vertices; i++) {
+            if ((hashes[i] >> 32) % num_partitions != part) continue;
+            first[i] = *seen.insert(static_cast<uint32_t>(i)).first;
+        }
+    }, 1);
+
+    // first occurrences come before their duplicates, so one forward pass assigns the new ids
+    std::vector<uint32_t> remap(num_vertices);
+    uint32_t num_welded = 0;
+    for (size_t i = 0; i < num_vertices; i++) {
+        if (first[i] == i) {
+            mesh.vertices[num_welded] = mesh.vertices[i];
+            remap[i] = num_welded++;
+        }
+        else {
+            remap[i] = remap[first[i]];
+        }
+    }
+    mesh.vertices.resize(num_welded);
+    mesh.vertices.shrink_to_fit();
+
+    parallel_for(mesh.indices.size(), [&](size_t f) {
+        uint3& face = mesh.indices[f];
+        face = make_uint3(remap[face.x], remap[face.y], remap[face.z]);
+    }, 1 << 16);
+
+    return num_vertices - num_welded;
+}
+
+std::shared_ptr<TriangleMesh> OptixCSP::load_mesh(const std::string& filename, bool weld) {
+    MappedFile file(filename);
+    if (file.size() == 0) throw std::runtime_error("load_mesh: empty file " + filename);
+
+    std::shared_ptr<TriangleMesh> mesh;
+    try {
+        if (detect_mesh_file_format(file.data(), file.size()) == MeshFileFormat::STL_BINARY) {
+            mesh = std::make_shared<TriangleMesh>(parse_stl_binary(file.data(), file.size()));
+        }
+        else {
+            mesh = std::make_shared<TriangleMesh>(parse_obj(file.data(), file.size()));
+        }
+    }
+    catch (const std::runtime_error& e) {
+        throw std::runtime_error(std::string(e.what()) + " (" + filename + ")");
+    }
+    if (mesh->get_num_faces() == 0) throw std::runtime_error("load_mesh: no faces in " + filename);
+
+    if (weld) weld_vertices(*mesh);
+    return mesh;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "MeshElement.h"
+
+namespace OptixCSP {
+
+    /// mesh file layouts understood by load_mesh
+    enum class MeshFileFormat {
+        OBJ,        // Wavefront OBJ text: "v x y z" and "f a b c ..." lines (polygons are fanned into triangles)
+        STL_BINARY  // 80 byte header, uint32 face count, then 50 byte records (normal, 3 vertices, attribute)
+    };
+
+    /// binary STL when the size matches the face count of the header, OBJ otherwise.
+    /// Throws for ASCII STL, which is not supported.
+    MeshFileFormat detect_mesh_file_format(const char* data, size_t size);
+
+    /**
+     * Parse an OBJ file held in memory. The bytes are split into one range per host thread and every range
+     * is parsed independently with from_chars (a line belongs to the range holding its first byte), the
+     * per-range vertices and faces are then concatenated in file order. Negative (relative) indices are
+     * supported, texture and normal indices ("v/vt/vn") are ignored. Throws on malformed "v" or "f" lines.
+     */
+    TriangleMesh parse_obj(const char* data, size_t size);
+
+    /// parse a binary STL file held in memory, the records are read in place, 3 vertices per face
+    TriangleMesh parse_stl_binary(const char* data, size_t size);
+
+    /**
+     * Merge vertices with bitwise identical coordinates (+0 and -0 are the same) and remap the faces.
+     * Vertex hashes are computed in parallel, each host thread then owns one hash partition, so the
+     * hash tables are built without locks. Welded vertices keep the order of their first occurrence.
+     *
+     * @return number of vertices removed
+     */
+    size_t weld_vertices(TriangleMesh& mesh);
+
+    /// memory map filename, parse it according to its content (see detect_mesh_file_format) and
+    /// optionally weld duplicate vertices. Throws std::runtime_error if the file can't be read or parsed.
+    std::shared_ptr<TriangleMesh> load_mesh(const std::string& filename, bool weld = true);
+}
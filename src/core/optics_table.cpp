@@ -0,0 +1,237 @@
+#include "optics_table.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+using namespace OptixCSP;
+
+namespace {
+    uint32_t float_bits(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    // copy of a table sorted by angle
+    void sort_angle_table(const std::vector<double>& angles, const std::vector<double>& values,
+        std::vector<double>& sorted_angles, std::vector<double>& sorted_values) {
+        const size_t n = std::min(angles.size(), values.size());
+        std::vector<size_t> order(n);
+        std::iota(order.begin(), order.end(), size_t(0));
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return angles[a] < angles[b]; });
+        sorted_angles.resize(n);
+        sorted_values.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            sorted_angles[i] = angles[order[i]];
+            sorted_values[i] = values[order[i]];
+        }
+    }
+
+    constexpr double GRAZING_ANGLE = 1000.0 * 1.57079632679489661923;  // mrad
+
+    // throws if a table of the optic has a different number of angles and values, tables without angles are unused
+    void check_angle_tables(const Optic& optic) {
+        const OpticalSurface& front = optic.front;
+        if (!front.reflectivity_angles.empty() && front.reflectivity_angles.size() != front.reflectivity_values.size()) {
+            throw std::invalid_argument("OpticsTable: reflectivity table of optic " + optic.name
+                + " has a different number of angles and values");
+        }
+        if (!front.transmissivity_angles.empty() && front.transmissivity_angles.size() != front.transmissivity_values.size()) {
+            throw std::invalid_argument("OpticsTable: transmissivity table of optic " + optic.name
+                + " has a different number of angles and values");
+        }
+    }
+}
+
+double OptixCSP::interpolate_angle_table(const std::vector<double>& angles, const std::vector<double>& values, double angle) {
+    const size_t n = std::min(angles.size(), values.size());
+    if (n == 0) return 0.0;
+    if (angle <= angles[0]) return values[0];
+    for (size_t i = 1; i < n; i++) {
+        if (angle <= angles[i]) {
+            const double span = angles[i] - angles[i - 1];
+            const double t = span > 0.0 ? (angle - angles[i - 1]) / span : 1.0;
+            return values[i - 1] + t * (values[i] - values[i - 1]);
+        }
+    }
+    return values[n - 1];
+}
+
+std::vector<float> OptixCSP::resample_angle_table(const std::vector<double>& angles, const std::vector<double>& values) {
+    std::vector<double> sorted_angles, sorted_values;
+    sort_angle_table(angles, values, sorted_angles, sorted_values);
+
+    std::vector<float> table(ANGLE_TABLE_SIZE);
+    for (unsigned int i = 0; i < ANGLE_TABLE_SIZE; i++) {
+        const double cos_theta = static_cast<double>(i) / (ANGLE_TABLE_SIZE - 1);
+        const double angle = 1000.0 * std::acos(cos_theta);
+        table[i] = static_cast<float>(interpolate_angle_table(sorted_angles, sorted_values, angle));
+    }
+    return table;
+}
+
+double OptixCSP::angle_table_error(const std::vector<double>& angles, const std::vector<double>& values, const float* table) {
+    double max_error = 0.0;
+    const size_t n = std::min(angles.size(), values.size());
+    for (size_t i = 0; i < n; i++) {
+        if (angles[i] < 0.0 || angles[i] > GRAZING_ANGLE) continue;
+        const float lookup = lookup_angle_table(table, static_cast<float>(std::cos(angles[i] / 1000.0)));
+        max_error = std::max(max_error, std::fabs(lookup - values[i]));
+    }
+    return max_error;
+}
+
+std::vector<float> OptixCSP::build_error_tables() {
+    std::vector<float> tables(NUM_ERROR_DISTRIBUTIONS * ERROR_TABLE_SIZE);
+    float* gaussian = tables.data() + ERROR_GAUSSIAN * ERROR_TABLE_SIZE;
+    float* pillbox = tables.data() + ERROR_PILLBOX * ERROR_TABLE_SIZE;
+    for (unsigned int i = 0; i < ERROR_TABLE_SIZE; i++) {
+        const double u = static_cast<double>(i) / (ERROR_TABLE_SIZE - 1);
+        gaussian[i] = static_cast<float>(std::sqrt(-2.0 * std::log1p(-std::min(u, 1.0 - 1e-12))));
+        pillbox[i] = static_cast<float>(std::sqrt(u));
+    }
+
+    // the rayleigh inverse CDF is infinite at u = 1: the last cell ends where a linear cell starting at a
+    // has the mean of the tail, E[r | r > a] = a + sqrt(pi / 2) exp(a^2 / 2) erfc(a / sqrt(2))
+    const double a = gaussian[ERROR_TABLE_SIZE - 2];
+    const double tail_mean = a + 1.25331413731550025 * std::exp(0.5 * a * a) * std::erfc(a / std::sqrt(2.0));
+    gaussian[ERROR_TABLE_SIZE - 1] = static_cast<float>(2.0 * tail_mean - a);
+    return tables;
+}
+
+ErrorDistribution OptixCSP::error_distribution(char letter) {
+    return letter == 'p' || letter == 'P' ? ERROR_PILLBOX : ERROR_GAUSSIAN;
+}
+
+uint16_t OpticsTable::add_optic(const Optic& optic) {
+    auto it = m_optic_index.find(optic.name);
+    if (it != m_optic_index.end()) {
+        set_optic(it->second, optic);
+        return it->second;
+    }
+    if (m_optics.size() >= MAX_RECORDS) {
+        throw std::runtime_error("OpticsTable: too many optics");
+    }
+    check_angle_tables(optic);
+    const uint16_t index = static_cast<uint16_t>(m_optics.size());
+    m_optics.push_back(optic);
+    m_optic_tables.push_back({ -1, -1 });
+    m_optic_index[optic.name] = index;
+    try {
+        build_angle_tables(index);
+    }
+    catch (...) {
+        m_optics.pop_back();
+        m_optic_tables.pop_back();
+        m_optic_index.erase(optic.name);
+        throw;
+    }
+    return index;
+}
+
+int OpticsTable::find_optic(const std::string& name) const {
+    auto it = m_optic_index.find(name);
+    return it == m_optic_index.end() ? -1 : static_cast<int>(it->second);
+}
+
+void OpticsTable::set_optic(uint16_t index, const Optic& optic) {
+    // everything is checked before the table changes
+    Optic& old = m_optics.at(index);
+    const bool renamed = old.name != optic.name;
+    if (renamed && find_optic(optic.name) >= 0) {
+        throw std::invalid_argument("OpticsTable: an optic called " + optic.name + " already exists");
+    }
+    check_angle_tables(optic);
+
+    if (renamed) {
+        m_optic_index.erase(old.name);
+        m_optic_index[optic.name] = index;
+    }
+    old = optic;
+    build_angle_tables(index);
+
+    // the interaction belongs to the element, it is kept
+    for (size_t r = 0; r < m_records.size(); r++) {
+        if (m_record_optic[r] == static_cast<int>(index)) {
+            m_records[r] = make_record(index, m_records[r].use_refraction);
+            m_dirty = true;
+        }
+    }
+}
+
+void OpticsTable::clear_records() {
+    m_records.clear();
+    m_record_optic.clear();
+    m_record_index.clear();
+    m_dirty = true;
+}
+
+uint16_t OpticsTable::intern(int optic, const MaterialData& material) {
+    // optics records only differ by the interaction, element properties by all their values
+    RecordKey key = { static_cast<uint32_t>(optic), material.use_refraction ? 1u : 0u, 0u, 0u, 0u, 0u };
+    if (optic < 0) {
+        key[1] |= material.error_distribution << 1;
+        key[2] = float_bits(material.reflectivity);
+        key[3] = float_bits(material.transmissivity);
+        key[4] = float_bits(material.slope_error);
+        key[5] = float_bits(material.specularity_error);
+    }
+
+    auto it = m_record_index.find(key);
+    if (it != m_record_index.end()) return it->second;
+
+    if (m_records.size() >= MAX_RECORDS) {
+        throw std::runtime_error("OpticsTable: more than 65536 distinct material records");
+    }
+    if (optic >= static_cast<int>(m_optics.size())) {
+        throw std::out_of_range("OpticsTable: no optic " + std::to_string(optic));
+    }
+    const uint16_t index = static_cast<uint16_t>(m_records.size());
+    m_records.push_back(optic < 0 ? material : make_record(static_cast<uint16_t>(optic), material.use_refraction));
+    m_record_optic.push_back(optic);
+    m_record_index.emplace(key, index);
+    m_dirty = true;
+    return index;
+}
+
+MaterialData OpticsTable::make_record(uint16_t optic, bool use_refraction) const {
+    const OpticalSurface& front = m_optics[optic].front;
+    const bool use_reflectivity_table = !front.reflectivity_angles.empty();
+    const bool use_transmissivity_table = !front.transmissivity_angles.empty();
+    return { static_cast<float>(front.reflectivity), static_cast<float>(front.transmissivity),
+        static_cast<float>(front.slope_error), static_cast<float>(front.specularity_error), use_refraction,
+        use_reflectivity_table ? m_optic_tables[optic][0] : -1,
+        use_transmissivity_table ? m_optic_tables[optic][1] : -1,
+        static_cast<unsigned int>(error_distribution(front.error_distribution)) };
+}
+
+void OpticsTable::build_angle_tables(uint16_t index) {
+    const Optic& optic = m_optics[index];
+    const std::vector<double>* angles[2] = { &optic.front.reflectivity_angles, &optic.front.transmissivity_angles };
+    const std::vector<double>* values[2] = { &optic.front.reflectivity_values, &optic.front.transmissivity_values };
+    const char* names[2] = { "reflectivity", "transmissivity" };
+
+    for (int k = 0; k < 2; k++) {
+        if (angles[k]->empty()) continue;
+
+        int& offset = m_optic_tables[index][k];
+        if (offset < 0) {
+            offset = static_cast<int>(m_angle_tables.size());
+            m_angle_tables.resize(m_angle_tables.size() + ANGLE_TABLE_SIZE);
+        }
+        std::vector<float> table = resample_angle_table(*angles[k], *values[k]);
+        std::copy(table.begin(), table.end(), m_angle_tables.begin() + offset);
+        m_dirty = true;
+
+        const double error = angle_table_error(*angles[k], *values[k], table.data());
+        if (error > 1e-3) {
+            std::cout << "Optic " << optic.name << ": " << names[k] << " table resampled with a max error of "
+                << error << " at the tabulated angles" << std::endl;
+        }
+    }
+}
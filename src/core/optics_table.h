@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shaders/MaterialDataST.h"
+#include "shaders/AngleTable.h"
+#include "shaders/SurfaceError.h"
+
+namespace OptixCSP {
+
+    /// one side of a SolTrace optical pair, as read from the OPTICS LIST of a stinput file
+    struct OpticalSurface {
+        char   error_distribution = 'g';    // 'g' gaussian, 'p' pillbox
+        int    aperture_stop_or_grating = 0;
+        int    optical_surface_number = 0;
+        int    diffraction_order = 0;
+        double reflectivity = 1.0;          // 1 by default: no reflection loss
+        double transmissivity = 1.0;
+        double slope_error = 0.0;           // RMS, mrad
+        double specularity_error = 0.0;     // RMS, mrad
+        double refraction_index_real = 1.0;
+        double refraction_index_imag = 0.0;
+        double grating_coeffs[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+        // reflectivity and transmissivity against the incidence angle (mrad), empty if unused
+        std::vector<double> reflectivity_angles;
+        std::vector<double> reflectivity_values;
+        std::vector<double> transmissivity_angles;
+        std::vector<double> transmissivity_values;
+    };
+
+    /// SolTrace lookup of a table against the incidence angle (mrad, ascending): linear interpolation between
+    /// the tabulated points, clamped to the first and last values. Reference for resample_angle_table.
+    double interpolate_angle_table(const std::vector<double>& angles, const std::vector<double>& values, double angle);
+
+    /// table (angles in mrad, any order) sampled on the uniform cos(theta) grid of AngleTable.h
+    std::vector<float> resample_angle_table(const std::vector<double>& angles, const std::vector<double>& values);
+
+    /// largest difference between lookup_angle_table on the resampled table and the tabulated values,
+    /// over the tabulated points between normal and grazing incidence
+    double angle_table_error(const std::vector<double>& angles, const std::vector<double>& values, const float* table);
+
+    /// inverse CDF tables of the radial error distributions of SurfaceError.h, ERROR_TABLE_SIZE floats
+    /// per ErrorDistribution, uploaded once as LaunchParams::error_tables
+    std::vector<float> build_error_tables();
+
+    /// ErrorDistribution of a SolTrace distribution letter, 'p' pillbox, gaussian otherwise
+    ErrorDistribution error_distribution(char letter);
+
+    /// named optical pair, the front side is used for the device record
+    struct Optic {
+        std::string    name;
+        OpticalSurface front;
+        OpticalSurface back;
+    };
+
+    /**
+     * @class OpticsTable
+     * @brief Optics shared by the elements and the deduplicated material records uploaded to the device.
+     *
+     * Optics are kept by name. Every element (or prototype) gets a 16-bit index into the records:
+     * elements using the same optic with the same interaction share one record, and elements without
+     * an optic share the record of their own properties with every element having the same ones.
+     * Changing an optic rewrites the records built from it, the elements are not touched.
+     *
+     * Reflectivity and transmissivity tables of the optics are resampled once, when the optic is added or
+     * changed, into the angle tables referenced by the records (ANGLE_TABLE_SIZE floats per table).
+     */
+    class OpticsTable {
+    public:
+        static constexpr size_t MAX_RECORDS = 65536;
+
+        /// add an optic, or replace the one with the same name, returns its index
+        uint16_t add_optic(const Optic& optic);
+        /// index of the optic called name, -1 if there is none
+        int find_optic(const std::string& name) const;
+        const Optic& get_optic(uint16_t index) const { return m_optics.at(index); }
+        size_t get_num_optics() const { return m_optics.size(); }
+        /// replace optic index, the records built from it are rewritten and marked for upload
+        void set_optic(uint16_t index, const Optic& optic);
+
+        /// drop the records, the optics are kept
+        void clear_records();
+        /// record of an element using optic with the interaction material.use_refraction, or of its own
+        /// properties material if optic < 0. Added if no equal record exists, throws if the table is full.
+        uint16_t intern(int optic, const MaterialData& material);
+
+        const std::vector<MaterialData>& get_records() const { return m_records; }
+        /// resampled tables, see MaterialData::reflectivity_table
+        const std::vector<float>& get_angle_tables() const { return m_angle_tables; }
+        size_t get_num_records() const { return m_records.size(); }
+
+        /// records or angle tables changed since the last clear_dirty()
+        bool is_dirty() const { return m_dirty; }
+        void clear_dirty() { m_dirty = false; }
+
+    private:
+        // optic (or -1) and the bits of the record it is built from
+        using RecordKey = std::array<uint32_t, 6>;
+
+        MaterialData make_record(uint16_t optic, bool use_refraction) const;
+        /// resample the tables of optic index, a table slot is kept once allocated
+        void build_angle_tables(uint16_t index);
+
+        std::vector<Optic>                        m_optics;
+        std::vector<std::array<int, 2>>           m_optic_tables;  // reflectivity, transmissivity offsets, -1 if none
+        std::vector<float>                        m_angle_tables;
+        std::unordered_map<std::string, uint16_t> m_optic_index;
+
+        std::vector<MaterialData>     m_records;
+        std::vector<int>              m_record_optic;  // optic of every record, -1 for element properties
+        std::map<RecordKey, uint16_t> m_record_index;
+        bool                          m_dirty = false;
+    };
+}
@@ -110,10 +110,15 @@ void pipelineManager::loadModules() {
 
 void pipelineManager::createPipeline()
 {
+    // prototype instances are traced through a single level IAS
+    const unsigned int traversable_graph_flags = m_use_instancing ? OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_LEVEL_INSTANCING
+                                                                  : OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_GAS;
+    const unsigned int max_traversable_depth = m_use_instancing ? 2 : 1;
+
     m_state.pipeline_compile_options = {
         false,                                                  // usesMotionBlur: Disable motion blur.
-        OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_SINGLE_GAS,          // traversableGraphFlags: Allow only a single GAS.
-        2,    /* RadiancePRD uses 5 payloads */                 // numPayloadValues
+        traversable_graph_flags,                                // traversableGraphFlags: single GAS or IAS -> GAS.
+        NUM_PAYLOAD_VALUES,  /* ray path index, depth, first heliostat hit, weight */  // numPayloadValues
         5,    /* Parallelogram intersection uses 5 attrs */     // numAttributeValues 
         OPTIX_EXCEPTION_FLAG_NONE,                              // exceptionFlags
         "params"                                                // pipelineLaunchParamsVariableName
@@ -169,7 +174,7 @@ void pipelineManager::createPipeline()
         direct_callable_stack_size_from_traversal,    // Stack size for direct callable traversal.
         direct_callable_stack_size_from_state,        // Stack size for direct callable state.
         continuation_stack_size,                      // Stack size for continuation stack.
-        1                                            // maxTraversableDepth: Maximum depth of traversable hierarchy.
+        max_traversable_depth                        // maxTraversableDepth: Maximum depth of traversable hierarchy.
     ));
 }
 
@@ -277,6 +282,13 @@ void pipelineManager::createReceiverProgram()
 
     m_program_groups.push_back(group);
 
+    // mesh receiver, built-in triangles need no intersection program
+    createHitGroupProgram(group,
+        nullptr, nullptr,
+        m_state.shading_module, "__closesthit__receiver__mesh");
+
+    m_program_groups.push_back(group);
+
 }
 
 // Create program group for handling rays that miss all geometry.
@@ -341,7 +353,7 @@ OptixProgramGroup pipelineManager::getReceiverProgram(SurfaceType surfaceType, A
     // Second receiver (cylinder) is at index num_raygen_programs + num_heliostat_programs + 1
     if (surfaceType == SurfaceType::FLAT) {
         if (apertureType == ApertureType::TRIANGLE) {
-            // flat triangle receiver is the last program group 
+            // flat triangle receiver follows the cylinder
             return m_program_groups[num_raygen_programs + num_heliostat_programs + 2];
 		}
 
@@ -351,6 +363,10 @@ OptixProgramGroup pipelineManager::getReceiverProgram(SurfaceType surfaceType, A
         }
 
     }
+    else if (surfaceType == SurfaceType::MESH) {
+        // mesh receiver is the last receiver program group
+        return m_program_groups[num_raygen_programs + num_heliostat_programs + 3];
+    }
     else if (surfaceType == SurfaceType::CYLINDER) {
         //printf("returning receiver program group %d, flat\n", num_raygen_programs + num_heliostat_programs + 1);
         return m_program_groups[num_raygen_programs + num_heliostat_programs + 1];
@@ -48,6 +48,12 @@ namespace OptixCSP {
          */
         void createPipeline();
 
+        /**
+         * @brief Trace through an IAS (prototype instances) instead of a single GAS.
+         * Must be set before createPipeline().
+         */
+        void set_use_instancing(bool val) { m_use_instancing = val; }
+
         /**
          * @brief Retrieves the OptiX pipeline object.
          * @return The OptiX pipeline.
@@ -125,11 +131,12 @@ namespace OptixCSP {
     private:
         SoltraceState& m_state;  ///< Reference to the simulation's OptiX state.
         std::vector<OptixProgramGroup> m_program_groups; ///< Stores all created OptiX program groups.
+        bool m_use_instancing = false; ///< IAS over GASes instead of a single GAS.
 
         // Number of program groups categorized by type.
         int num_raygen_programs = 1; ///< Number of ray generation programs.
         int num_heliostat_programs = 2; ///< Number of heliostat-related programs.
-        int num_receiver_programs = 2; ///< Number of receiver-related programs.
+        int num_receiver_programs = 4; ///< Number of receiver-related programs.
         int num_miss_programs = 1; ///< Number of miss programs.
     };
 }
\ No newline at end of file
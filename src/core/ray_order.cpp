@@ -0,0 +1,50 @@
+#include "ray_order.h"
+#include "utils/morton_util.h"
+#include "utils/radix_sort.h"
+#include "utils/parallel_util.h"
+
+using namespace OptixCSP;
+
+float OptixCSP::halton_H(uint32_t index, uint32_t base) {
+    float f = 1.0f, result = 0.0f;
+    while (index > 0) {
+        f = f / base;
+        result = result + f * (index % base);
+        index = index / base;
+    }
+    return result;
+}
+
+void OptixCSP::compute_morton_ray_order(uint32_t num_rays, std::vector<uint32_t>& order, uint32_t num_segments) {
+
+    if (num_segments <= 1) {
+        // sample (u, v) of every ray on the sun parallelogram, both in [0, 1)
+        std::vector<uint32_t> codes(num_rays);
+        order.resize(num_rays);
+        parallel_for(num_rays, [&](size_t i) {
+            uint32_t ray_id = static_cast<uint32_t>(i);
+            codes[i] = morton_code_2d(halton_H(ray_id, 2), halton_H(ray_id, 3));
+            order[i] = ray_id;
+        });
+
+        radix_sort_pairs(codes, order);
+        return;
+    }
+
+    // segment in the high bits of the key, the stable sort keeps the segments in place
+    std::vector<uint64_t> codes(num_rays);
+    order.resize(num_rays);
+    for (uint32_t s = 0; s < num_segments; s++) {
+        uint32_t begin = get_segment_begin(num_rays, num_segments, s);
+        uint32_t end = get_segment_begin(num_rays, num_segments, s + 1);
+        parallel_for(end - begin, [&](size_t i) {
+            uint32_t ray_id = begin + static_cast<uint32_t>(i);
+            codes[ray_id] = (static_cast<uint64_t>(s) << 32) | morton_code_2d(halton_H(ray_id, 2), halton_H(ray_id, 3));
+            order[ray_id] = ray_id;
+        });
+    }
+
+    int segment_bits = 0;
+    while ((1ull << segment_bits) < num_segments) segment_bits++;
+    radix_sort_pairs(codes, order, 32 + segment_bits);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace OptixCSP {
+
+    /// order in which the sun plane samples are traced
+    enum class SunSampleOrder {
+        HALTON,  // launch index is the Halton index, consecutive rays land far apart on the sun plane
+        MORTON   // launch indices walk the Halton samples along a Morton curve over (u, v)
+    };
+
+    /// Halton sequence value, same as halton() in sun.cu
+    float halton_H(uint32_t index, uint32_t base);
+
+    /// fill order (launch index -> ray id) so that consecutive launch indices trace neighboring
+    /// samples of the sun plane. Ray ids are Halton indices, they still select the sample,
+    /// the sun direction seed and the output slot of a ray, so results do not depend on the order.
+    /// With num_segments > 1, the rays are split into contiguous segments of ray ids (see the launch
+    /// batches of SolTraceSystem) and every segment is ordered on its own, in place.
+    void compute_morton_ray_order(uint32_t num_rays, std::vector<uint32_t>& order, uint32_t num_segments = 1);
+
+    /// first ray id of segment s when num_rays are split into num_segments contiguous segments
+    inline uint32_t get_segment_begin(uint32_t num_rays, uint32_t num_segments, uint32_t s) {
+        return static_cast<uint32_t>(static_cast<uint64_t>(num_rays) * s / num_segments);
+    }
+}
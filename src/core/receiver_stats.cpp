@@ -0,0 +1,58 @@
+#include "receiver_stats.h"
+#include "utils/parallel_util.h"
+
+using namespace OptixCSP;
+
+void OptixCSP::count_receiver_hits(const std::vector<uint32_t>& hit_ids,
+    const std::vector<float>& hit_weights,
+    const std::vector<int32_t>& hit_to_receiver,
+    size_t num_receivers,
+    const BatchLayout& batches,
+    PathFilter filter,
+    std::vector<uint64_t>& counts,
+    std::vector<double>& power,
+    std::vector<uint64_t>* direct_sun_counts) {
+
+    const size_t num_ids = hit_to_receiver.size();
+    const size_t num_entries = num_receivers * batches.num_batches;
+    const bool weighted = !hit_weights.empty();
+
+    // one private counter and power array per host thread
+    std::vector<std::vector<uint64_t>> local_counts(get_num_host_threads());
+    std::vector<std::vector<double>> local_power(get_num_host_threads());
+    std::vector<std::vector<uint64_t>> local_direct(get_num_host_threads());
+
+    unsigned int num_chunks = parallel_for_chunks(hit_ids.size(), [&](size_t begin, size_t end, unsigned int t) {
+        std::vector<uint64_t>& local = local_counts[t];
+        std::vector<double>& local_p = local_power[t];
+        std::vector<uint64_t>& local_d = local_direct[t];
+        local.assign(num_entries, 0);
+        local_p.assign(num_entries, 0.0);
+        local_d.assign(num_receivers, 0);
+        for (size_t k = begin; k < end; k++) {
+            uint32_t id = get_stored_hit_id(hit_ids[k]);
+            if (id == 0 || id > num_ids) continue;
+            int32_t r = hit_to_receiver[id - 1];
+            if (r < 0) continue;
+            if (is_direct_sun_hit(hit_ids[k])) local_d[r]++;
+            if (!is_path_selected(hit_ids[k], filter)) continue;
+
+            size_t e = static_cast<size_t>(r) * batches.num_batches + batches.batch_of(k);
+            local[e]++;
+            local_p[e] += weighted ? hit_weights[k] : 1.0;
+        }
+    });
+
+    counts.assign(num_entries, 0);
+    power.assign(num_entries, 0.0);
+    if (direct_sun_counts) direct_sun_counts->assign(num_receivers, 0);
+    for (unsigned int t = 0; t < num_chunks; t++) {
+        for (size_t e = 0; e < num_entries; e++) {
+            counts[e] += local_counts[t][e];
+            power[e] += local_power[t][e];
+        }
+        if (direct_sun_counts) {
+            for (size_t r = 0; r < num_receivers; r++) (*direct_sun_counts)[r] += local_direct[t][r];
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "hit_path.h"
+#include "utils/welford.h"
+
+namespace OptixCSP {
+
+    /// hits and power collected by one receiver element, or by all the faces of one mesh, in the last run,
+    /// std errors are batched-means estimates (see SolTraceSystem::set_num_batches)
+    struct ReceiverStats {
+        int      element_id = -1;   // -1 for a mesh
+        int      mesh_id = -1;      // -1 for an element
+        uint64_t num_hits = 0;
+        double   power = 0.0;  // W
+        double   num_hits_std_error = 0.0;
+        double   power_std_error = 0.0;
+        uint64_t num_direct_sun_hits = 0;  // sun -> receiver hits, whatever the path filter
+    };
+
+    /// user-defined set of receiver elements (e.g. the panels of one receiver), reported together
+    struct ReceiverGroup {
+        std::string      name;
+        std::vector<int> element_ids;
+        uint64_t         num_hits = 0;
+        double           power = 0.0;  // W
+        double           num_hits_std_error = 0.0;
+        double           power_std_error = 0.0;
+    };
+
+    /// hits on one element or prototype instance in the last run
+    struct ElementHitStats {
+        int      element_id = -1;   // -1 for a prototype instance
+        int      instance_id = -1;  // -1 for an element
+        uint64_t num_hits = 0;
+        double   num_hits_std_error = 0.0;
+    };
+
+    /// count the hits of every receiver, per batch of rays, in one parallel pass over the hit ids of a run.
+    /// hit_ids follows the device hit_element_buffer (hit id + 1, 0 for empty slots, path tag in the top bit),
+    /// hit_to_receiver[hit id] is the index of the receiver, or -1 for other objects.
+    /// Only hits whose path matches filter are counted in counts and power, resized to
+    /// num_receivers * batches.num_batches, entry r * num_batches + b.
+    /// power sums hit_weights (weighted rays), or counts hits with weight 1 if hit_weights is empty.
+    /// direct_sun_counts (optional) gets the number of sun -> receiver hits of every receiver.
+    void count_receiver_hits(const std::vector<uint32_t>& hit_ids,
+        const std::vector<float>& hit_weights,
+        const std::vector<int32_t>& hit_to_receiver,
+        size_t num_receivers,
+        const BatchLayout& batches,
+        PathFilter filter,
+        std::vector<uint64_t>& counts,
+        std::vector<double>& power,
+        std::vector<uint64_t>* direct_sun_counts = nullptr);
+}
@@ -0,0 +1,121 @@
+#include "result_pipeline.h"
+
+#include <cstdlib>
+#include <new>
+
+using namespace OptixCSP;
+
+ResultPipeline::ResultPipeline(size_t num_slots, size_t slot_entries, bool weighted,
+    Allocator allocator, Deallocator deallocator)
+    : m_slots(num_slots), m_slot_entries(slot_entries), m_deallocator(deallocator) {
+
+    if (!allocator || !m_deallocator) {
+        allocator = [](size_t bytes) { return std::malloc(bytes); };
+        m_deallocator = [](void* ptr) { std::free(ptr); };
+    }
+
+    auto allocate = [&](size_t bytes) {
+        void* ptr = allocator(bytes);
+        if (!ptr) throw std::bad_alloc();
+        return ptr;
+    };
+
+    for (size_t s = 0; s < num_slots; s++) {
+        m_slots[s].hit_points = static_cast<float4*>(allocate(slot_entries * sizeof(float4)));
+        m_slots[s].hit_ids = static_cast<uint32_t*>(allocate(slot_entries * sizeof(uint32_t)));
+        if (weighted) {
+            m_slots[s].hit_weights = static_cast<float*>(allocate(slot_entries * sizeof(float)));
+        }
+        m_free_slots.push_back(s);
+    }
+
+    m_worker = std::thread(&ResultPipeline::worker_loop, this);
+}
+
+ResultPipeline::~ResultPipeline() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    m_worker.join();
+
+    for (Slot& slot : m_slots) {
+        m_deallocator(slot.hit_points);
+        m_deallocator(slot.hit_ids);
+        if (slot.hit_weights) m_deallocator(slot.hit_weights);
+    }
+}
+
+void ResultPipeline::add_reducer(HitReducer reducer) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_reducers.push_back(reducer);
+}
+
+size_t ResultPipeline::acquire() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this] { return !m_free_slots.empty(); });
+    size_t s = m_free_slots.back();
+    m_free_slots.pop_back();
+    return s;
+}
+
+void ResultPipeline::submit(size_t s, const HitBatch& batch, std::function<void()> wait_ready) {
+    Job job;
+    job.slot = s;
+    job.batch = batch;
+    job.batch.hit_points = m_slots[s].hit_points;
+    job.batch.hit_ids = m_slots[s].hit_ids;
+    job.batch.hit_weights = m_slots[s].hit_weights;
+    job.wait_ready = wait_ready;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(job);
+        m_pending++;
+    }
+    m_cv.notify_all();
+}
+
+void ResultPipeline::finish() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this] { return m_pending == 0; });
+    if (m_error) {
+        std::exception_ptr error = m_error;
+        m_error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void ResultPipeline::worker_loop() {
+    while (true) {
+        Job job;
+        bool failed;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+            if (m_jobs.empty()) return;
+            job = m_jobs.front();
+            m_jobs.pop_front();
+            failed = static_cast<bool>(m_error);
+        }
+
+        // after a failure the remaining batches are only drained
+        try {
+            if (job.wait_ready) job.wait_ready();
+            if (!failed) {
+                for (HitReducer& reducer : m_reducers) reducer(job.batch);
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_error) m_error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_free_slots.push_back(job.slot);
+            m_pending--;
+        }
+        m_cv.notify_all();
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <vector_types.h>
+
+namespace OptixCSP {
+
+    /// hits of one launch batch, rays [first_ray, first_ray + num_rays) of the run,
+    /// entries_per_ray entries per ray in the layout of the device hit buffers
+    struct HitBatch {
+        uint32_t        index = 0;          // launch batch
+        size_t          first_ray = 0;
+        size_t          num_rays = 0;
+        size_t          entries_per_ray = 1;
+        const float4*   hit_points = nullptr;
+        const uint32_t* hit_ids = nullptr;
+        const float*    hit_weights = nullptr;  // nullptr without weighted rays
+
+        size_t get_num_entries() const { return num_rays * entries_per_ray; }
+    };
+
+    /// host stage of the pipeline, called once per batch on the pipeline worker thread, batches in order
+    using HitReducer = std::function<void(const HitBatch&)>;
+
+    /**
+     * @class ResultPipeline
+     * @brief Reusable staging slots between the producer of the hits (the device) and the host reducers.
+     *
+     * The producer acquires a free slot, starts filling it (e.g. an asynchronous device to host copy)
+     * and submits it together with a function that blocks until the data has landed. A worker thread waits
+     * for the submitted slots in order, runs every reducer on them and hands the slot back to the producer,
+     * so the next batch can be traced while the previous ones are downloaded and reduced.
+     * Slot memory comes from the given allocator (pinned memory for the device), malloc by default,
+     * the pipeline itself has no device dependency.
+     */
+    class ResultPipeline {
+    public:
+        struct Slot {
+            float4*   hit_points = nullptr;
+            uint32_t* hit_ids = nullptr;
+            float*    hit_weights = nullptr;  // nullptr without weighted rays
+        };
+
+        using Allocator = std::function<void*(size_t)>;
+        using Deallocator = std::function<void(void*)>;
+
+        /// num_slots batches in flight, each holding up to slot_entries hit entries
+        ResultPipeline(size_t num_slots, size_t slot_entries, bool weighted,
+            Allocator allocator = Allocator(), Deallocator deallocator = Deallocator());
+        ~ResultPipeline();
+
+        ResultPipeline(const ResultPipeline&) = delete;
+        ResultPipeline& operator=(const ResultPipeline&) = delete;
+
+        /// add a host stage, before the first submit
+        void add_reducer(HitReducer reducer);
+
+        size_t get_num_slots() const { return m_slots.size(); }
+        size_t get_slot_entries() const { return m_slot_entries; }
+        const Slot& get_slot(size_t s) const { return m_slots[s]; }
+
+        /// wait until a slot is free and return its index
+        size_t acquire();
+
+        /// queue slot s for the reducers, wait_ready (optional) blocks until the slot holds the batch
+        void submit(size_t s, const HitBatch& batch, std::function<void()> wait_ready = std::function<void()>());
+
+        /// wait until every submitted batch has been reduced, rethrows the first exception of a reducer
+        void finish();
+
+    private:
+        struct Job {
+            size_t                slot;
+            HitBatch              batch;
+            std::function<void()> wait_ready;
+        };
+
+        void worker_loop();
+
+        std::vector<Slot> m_slots;
+        size_t m_slot_entries;
+        Deallocator m_deallocator;
+        std::vector<HitReducer> m_reducers;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::vector<size_t> m_free_slots;
+        std::deque<Job> m_jobs;
+        size_t m_pending = 0;   // submitted and not reduced yet
+        bool m_stop = false;
+        std::exception_ptr m_error;
+        std::thread m_worker;
+    };
+}
@@ -13,6 +13,7 @@ namespace OptixCSP
     {
         OptixDeviceContext          context = 0;
         OptixTraversableHandle      gas_handle = {};
+        OptixTraversableHandle      ias_handle = {};      // only built when there are prototype instances
         CUdeviceptr                 d_gas_output_buffer = {};
 
         OptixModule                 geometry_module = 0;
@@ -4,15 +4,21 @@
 #include "pipeline_manager.h"
 #include "soltrace_type.h"
 #include "CspElement.h"
+#include "transform_group.h"
 #include "timer.h"
 
 #include "utils/util_record.hpp"
 #include "utils/util_check.hpp"
 #include "utils/math_util.h"
+#include "utils/parallel_util.h"
 #include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <cstdio>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
 
 #include <optix_function_table_definition.h>
 #include <optix_stubs.h>
@@ -41,6 +47,7 @@ void SolTraceSystem::print_launch_params() {
     std::cout << "max_depth          : " << params.max_depth << std::endl;
     std::cout << "hit_point_buffer   : " << params.hit_point_buffer << std::endl;
 	std::cout << "sun_dir_buffer     : " << params.sun_dir_buffer << std::endl;
+    std::cout << "hit_dir_buffer     : " << params.hit_dir_buffer << std::endl;
     std::cout << "sun_vector         : " << params.sun_vector.x << " " <<params.sun_vector.y << " " <<params.sun_vector.z << std::endl;
     std::cout << "max_sun_angle      : " << params.max_sun_angle << std::endl;
     std::cout << "sun_v0             : " << params.sun_v0.x << " " <<params.sun_v0.y << " " <<params.sun_v0.z << std::endl;
@@ -80,6 +87,10 @@ SolTraceSystem::~SolTraceSystem() {
 }
 
 void SolTraceSystem::initialize() {
+    if (m_compact_hits && m_launch_batches > 1) {
+        throw std::runtime_error("SolTraceSystem: compact hits can not be combined with launch batches");
+    }
+
 	cudaMemGetInfo(&m_mem_free_before, nullptr);
     m_timer_setup.start();
 
@@ -92,7 +103,9 @@ void SolTraceSystem::initialize() {
 
     Timer AABB_timer;
     AABB_timer.start();
-	geometry_manager->collect_geometry_info(m_element_list, data_manager->launch_params_H);
+    update_transforms(true);
+	geometry_manager->collect_geometry_info(m_element_list, m_prototype_list, m_instance_list, data_manager->launch_params_H, m_mesh_list);
+    m_changed_instances.clear();
 	AABB_timer.stop();
 	std::cout << "Time to compute AABB: " << AABB_timer.get_time_sec() << " seconds" << std::endl;
 
@@ -105,6 +118,7 @@ void SolTraceSystem::initialize() {
     // Pipeline setup.
 	Timer pipeline_timer;
 	pipeline_timer.start();
+    pipeline_manager->set_use_instancing(geometry_manager->use_instancing());
     pipeline_manager->createPipeline();
     pipeline_timer.stop();
 	std::cout << "Time to create pipeline: " << pipeline_timer.get_time_sec() << " seconds" << std::endl;
@@ -125,29 +139,85 @@ void SolTraceSystem::initialize() {
 	// seed for sun ray randomization
     data_manager->launch_params_H.sun_dir_seed = 123456ULL;
 
+    // spatially coherent order of the sun samples, ray ids (and outputs) are not affected
+    if (m_sun_sample_order == SunSampleOrder::MORTON) {
+        Timer order_timer;
+        order_timer.start();
+        std::vector<uint32_t> ray_order;
+        // each launch batch is ordered on its own, so that it still covers its own ray ids
+        compute_morton_ray_order(static_cast<uint32_t>(m_num_sunpoints), ray_order, m_launch_batches);
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&data_manager->launch_params_H.ray_order), ray_order.size() * sizeof(uint32_t)));
+        CUDA_CHECK(cudaMemcpy(data_manager->launch_params_H.ray_order, ray_order.data(), ray_order.size() * sizeof(uint32_t), cudaMemcpyHostToDevice));
+        order_timer.stop();
+        std::cout << "Time to order sun samples: " << order_timer.get_time_sec() << " seconds" << std::endl;
+    }
+
     // Allocate memory for the hit point buffer, size is number of rays launched * depth
     const size_t hit_point_buffer_size = data_manager->launch_params_H.width * data_manager->launch_params_H.height * sizeof(float4) * data_manager->launch_params_H.max_depth;
 
-    CUDA_CHECK(cudaMalloc(
-        reinterpret_cast<void**>(&data_manager->launch_params_H.hit_point_buffer),
-        hit_point_buffer_size
-    ));
-    CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_point_buffer, 0, hit_point_buffer_size));
+    if (m_compact_hits) {
+        // 16-bit (u, v) in the frame of the object hit instead of the hit point, decoded on download
+        const size_t hit_uv_buffer_size = hit_point_buffer_size / sizeof(float4) * sizeof(unsigned int);
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&data_manager->launch_params_H.hit_uv_buffer), hit_uv_buffer_size));
+        CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_uv_buffer, 0, hit_uv_buffer_size));
+        upload_hit_frames();
+    }
+    else {
+        CUDA_CHECK(cudaMalloc(
+            reinterpret_cast<void**>(&data_manager->launch_params_H.hit_point_buffer),
+            hit_point_buffer_size
+        ));
+        CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_point_buffer, 0, hit_point_buffer_size));
+    }
+
+    // id of the object hit, for every entry of the hit point buffer
+    const size_t hit_element_buffer_size = hit_point_buffer_size / sizeof(float4) * sizeof(unsigned int);
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&data_manager->launch_params_H.hit_element_buffer), hit_element_buffer_size));
+    CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_element_buffer, 0, hit_element_buffer_size));
+    data_manager->launch_params_H.num_elements = geometry_manager->get_num_elements();
+    data_manager->launch_params_H.instance_offset = geometry_manager->get_instance_offset();
+
+    // power of every hit, for weighted rays
+    data_manager->launch_params_H.ray_power = static_cast<float>(get_power_per_ray());
+    data_manager->launch_params_H.roulette_threshold = static_cast<float>(m_roulette_threshold);
+    if (m_weighted_rays) {
+        const size_t hit_weight_buffer_size = hit_point_buffer_size / sizeof(float4) * sizeof(float);
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&data_manager->launch_params_H.hit_weight_buffer), hit_weight_buffer_size));
+        CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_weight_buffer, 0, hit_weight_buffer_size));
+    }
 
+    // per-heliostat loss counters, one row per hit id, cleared before every launch
+    if (m_use_heliostat_ledger) {
+        m_heliostat_ledger_size = (geometry_manager->get_num_elements() + m_instance_list.size()) * NUM_LEDGER_COUNTERS;
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&data_manager->launch_params_H.heliostat_ledger), m_heliostat_ledger_size * sizeof(unsigned int)));
+    }
 
-	// Luning TODO: Allocate memory for the direction cosine buffer, size is number of rays launched * depth
-    const size_t sun_dir_size = data_manager->launch_params_H.width * data_manager->launch_params_H.height * sizeof(float3);
 
-    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&data_manager->launch_params_H.sun_dir_buffer), sun_dir_size));
-    CUDA_CHECK(cudaMemset(data_manager->launch_params_H.sun_dir_buffer, 0, sun_dir_size));
+    // directions of the sun rays and of the rays leaving every hit, only when they are written out
+    if (m_output_fields & OUTPUT_DIRECTION) {
+        const size_t sun_dir_size = data_manager->launch_params_H.width * data_manager->launch_params_H.height * sizeof(float3);
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&data_manager->launch_params_H.sun_dir_buffer), sun_dir_size));
+        CUDA_CHECK(cudaMemset(data_manager->launch_params_H.sun_dir_buffer, 0, sun_dir_size));
+
+        const size_t hit_dir_size = hit_point_buffer_size / sizeof(float4) * sizeof(float3);
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&data_manager->launch_params_H.hit_dir_buffer), hit_dir_size));
+        CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_dir_buffer, 0, hit_dir_size));
+    }
 
     // Create a CUDA stream for asynchronous operations.
     CUDA_CHECK(cudaStreamCreate(&m_state.stream));
 
-    // Link the GAS handle.
-    data_manager->launch_params_H.handle = m_state.gas_handle;
-    data_manager->allocateGeometryDataArray(geometry_manager->get_geometry_data_array());
-    data_manager->allocateMaterialDataArray(geometry_manager->get_material_data_array());
+    // Link the GAS handle, or the IAS if there are prototype instances.
+    data_manager->launch_params_H.handle = geometry_manager->use_instancing() ? m_state.ias_handle : m_state.gas_handle;
+    data_manager->allocateGeometryArrays(geometry_manager->get_packed_geometry());
+    data_manager->allocateMaterialDataArray(geometry_manager->get_material_data_array(), geometry_manager->get_material_index(),
+        geometry_manager->get_optics().get_angle_tables());
+    geometry_manager->get_optics().clear_dirty();
+    data_manager->allocateErrorTables(build_error_tables());
+    m_enabled_mask_H.clear();
+    upload_enabled_mask();
+    std::cout << "Material records: " << geometry_manager->get_material_data_array().size() << " shared by "
+        << geometry_manager->get_material_index().size() << " elements and prototype facets" << std::endl;
     print_launch_params();
 
 
@@ -155,6 +225,10 @@ void SolTraceSystem::initialize() {
     data_manager->allocateLaunchParams();
     data_manager->updateLaunchParams();
 
+    if (m_launch_batches > 1) {
+        create_result_pipeline();
+    }
+
     m_timer_setup.stop();
 
 }
@@ -169,6 +243,15 @@ void SolTraceSystem::run() {
     std::cout << "Memory used by launch: " << (m_mem_free_before - m_mem_free_after) / (1024.0 * 1024.0) << " MB\n";
 
     m_timer_trace.start();
+    if (data_manager->launch_params_H.heliostat_ledger) {
+        CUDA_CHECK(cudaMemsetAsync(data_manager->launch_params_H.heliostat_ledger, 0, m_heliostat_ledger_size * sizeof(unsigned int), m_state.stream));
+    }
+
+    if (m_result_pipeline) {
+        run_pipelined();
+        m_timer_trace.stop();
+        return;
+    }
     // Launch the simulation.
     OPTIX_CHECK(optixLaunch(
         m_state.pipeline,
@@ -182,8 +265,134 @@ void SolTraceSystem::run() {
     CUDA_SYNC_CHECK();
 
 	m_timer_trace.stop();
+    m_hits_downloaded = false;
+
+
+}
+
+void SolTraceSystem::set_launch_batches(uint32_t num_batches, uint32_t num_slots) {
+    if (num_batches == 0 || num_slots == 0) {
+        throw std::invalid_argument("set_launch_batches: at least one batch and one slot are needed");
+    }
+    m_launch_batches = num_batches;
+    m_pipeline_slots = num_slots;
+}
+
+void SolTraceSystem::add_hit_reducer(HitReducer reducer) {
+    m_hit_reducers.push_back(reducer);
+    if (m_result_pipeline) {
+        m_result_pipeline->add_reducer(reducer);
+    }
+}
+
+void SolTraceSystem::create_result_pipeline() {
+
+    const LaunchParams& params = data_manager->launch_params_H;
+    const uint32_t num_rays = params.width * params.height;
+    const size_t entries_per_ray = params.max_depth;
+    const bool weighted = params.hit_weight_buffer != nullptr;
+
+    // largest batch
+    size_t max_batch_rays = 0;
+    for (uint32_t b = 0; b < m_launch_batches; b++) {
+        max_batch_rays = std::max<size_t>(max_batch_rays, get_segment_begin(num_rays, m_launch_batches, b + 1) - get_segment_begin(num_rays, m_launch_batches, b));
+    }
+
+    // pinned staging buffers, so that the downloads run asynchronously
+    m_result_pipeline.reset(new ResultPipeline(m_pipeline_slots, max_batch_rays * entries_per_ray, weighted,
+        [](size_t bytes) {
+            void* ptr = nullptr;
+            return cudaMallocHost(&ptr, bytes) == cudaSuccess ? ptr : nullptr;
+        },
+        [](void* ptr) { cudaFreeHost(ptr); }));
+
+    // first stage: the batch lands in the host copy of the hit buffers, so the other outputs work as after a single launch
+    m_result_pipeline->add_reducer([this](const HitBatch& batch) {
+        const size_t first = batch.first_ray * batch.entries_per_ray;
+        const size_t count = batch.get_num_entries();
+        std::memcpy(m_hit_points_H.data() + first, batch.hit_points, count * sizeof(float4));
+        std::memcpy(m_hit_ids_H.data() + first, batch.hit_ids, count * sizeof(uint32_t));
+        if (batch.hit_weights) {
+            std::memcpy(m_hit_weights_H.data() + first, batch.hit_weights, count * sizeof(float));
+        }
+    });
+    for (const HitReducer& reducer : m_hit_reducers) {
+        m_result_pipeline->add_reducer(reducer);
+    }
 
+    CUDA_CHECK(cudaStreamCreateWithFlags(&m_copy_stream, cudaStreamNonBlocking));
+    m_traced_events.resize(m_pipeline_slots);
+    m_copied_events.resize(m_pipeline_slots);
+    for (uint32_t s = 0; s < m_pipeline_slots; s++) {
+        CUDA_CHECK(cudaEventCreateWithFlags(&m_traced_events[s], cudaEventDisableTiming));
+        CUDA_CHECK(cudaEventCreateWithFlags(&m_copied_events[s], cudaEventDisableTiming));
+    }
+
+    CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(&m_batch_launch_params_D), m_launch_batches * sizeof(LaunchParams)));
+}
+
+void SolTraceSystem::run_pipelined() {
+
+    const LaunchParams& params = data_manager->launch_params_H;
+    const uint32_t num_rays = params.width * params.height;
+    const size_t entries_per_ray = params.max_depth;
+    const size_t output_size = num_rays * entries_per_ray;
+
+    // launch params of every batch, they only differ by the offset of the first ray
+    std::vector<LaunchParams> batch_params(m_launch_batches, params);
+    for (uint32_t b = 0; b < m_launch_batches; b++) {
+        batch_params[b].ray_offset = get_segment_begin(num_rays, m_launch_batches, b);
+    }
+    CUDA_CHECK(cudaMemcpy(m_batch_launch_params_D, batch_params.data(), m_launch_batches * sizeof(LaunchParams), cudaMemcpyHostToDevice));
+
+    m_hit_points_H.resize(output_size);
+    m_hit_ids_H.resize(output_size);
+    if (params.hit_weight_buffer) {
+        m_hit_weights_H.resize(output_size);
+    }
 
+    for (uint32_t b = 0; b < m_launch_batches; b++) {
+        const uint32_t begin = get_segment_begin(num_rays, m_launch_batches, b);
+        const uint32_t end = get_segment_begin(num_rays, m_launch_batches, b + 1);
+
+        // blocks while all the slots are still being downloaded or reduced
+        const size_t s = m_result_pipeline->acquire();
+        const ResultPipeline::Slot& slot = m_result_pipeline->get_slot(s);
+
+        OPTIX_CHECK(optixLaunch(
+            m_state.pipeline,
+            m_state.stream,
+            reinterpret_cast<CUdeviceptr>(m_batch_launch_params_D + b),
+            sizeof(OptixCSP::LaunchParams),
+            &m_state.sbt,
+            end - begin,
+            1,
+            1));
+        CUDA_CHECK(cudaEventRecord(m_traced_events[s], m_state.stream));
+
+        // download on its own stream, the next batch is traced meanwhile
+        const size_t first = static_cast<size_t>(begin) * entries_per_ray;
+        const size_t count = static_cast<size_t>(end - begin) * entries_per_ray;
+        CUDA_CHECK(cudaStreamWaitEvent(m_copy_stream, m_traced_events[s], 0));
+        CUDA_CHECK(cudaMemcpyAsync(slot.hit_points, params.hit_point_buffer + first, count * sizeof(float4), cudaMemcpyDeviceToHost, m_copy_stream));
+        CUDA_CHECK(cudaMemcpyAsync(slot.hit_ids, params.hit_element_buffer + first, count * sizeof(uint32_t), cudaMemcpyDeviceToHost, m_copy_stream));
+        if (slot.hit_weights) {
+            CUDA_CHECK(cudaMemcpyAsync(slot.hit_weights, params.hit_weight_buffer + first, count * sizeof(float), cudaMemcpyDeviceToHost, m_copy_stream));
+        }
+        CUDA_CHECK(cudaEventRecord(m_copied_events[s], m_copy_stream));
+
+        HitBatch batch;
+        batch.index = b;
+        batch.first_ray = begin;
+        batch.num_rays = end - begin;
+        batch.entries_per_ray = entries_per_ray;
+        cudaEvent_t copied = m_copied_events[s];
+        m_result_pipeline->submit(s, batch, [copied]() { CUDA_CHECK(cudaEventSynchronize(copied)); });
+    }
+
+    m_result_pipeline->finish();
+    CUDA_SYNC_CHECK();
+    m_hits_downloaded = true;
 }
 
 void SolTraceSystem::update() {
@@ -191,12 +400,40 @@ void SolTraceSystem::update() {
 
     const size_t hit_point_buffer_size = data_manager->launch_params_H.width * data_manager->launch_params_H.height * sizeof(float4) * data_manager->launch_params_H.max_depth;
 
+    // refresh the frames of the groups and elements that moved, untouched subtrees are skipped
+    std::vector<int> changed_ids = update_transforms(false);
+
+    // transforms of the instances that moved
+    geometry_manager->update_instance_info(m_instance_list, m_changed_instances);
+    m_changed_instances.clear();
+
     // update aabb and sun plane accordingly
-	geometry_manager->update_geometry_info(m_element_list, data_manager->launch_params_H);
+	geometry_manager->update_geometry_info(m_element_list, changed_ids, data_manager->launch_params_H);
 
     // update data on the device    
-	data_manager->updateGeometryDataArray(geometry_manager->get_geometry_data_array());
-    CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_point_buffer, 0, hit_point_buffer_size));
+    if (!changed_ids.empty()) {
+	    data_manager->updateGeometryArrays(geometry_manager->get_packed_geometry());
+    }
+    // optics changed with set_optic
+    if (geometry_manager->get_optics().is_dirty()) {
+        data_manager->updateMaterialDataArray(geometry_manager->get_material_data_array(), geometry_manager->get_optics().get_angle_tables());
+        geometry_manager->get_optics().clear_dirty();
+    }
+    if (m_compact_hits) {
+        CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_uv_buffer, 0, hit_point_buffer_size / sizeof(float4) * sizeof(unsigned int)));
+        upload_hit_frames();
+    }
+    else {
+        CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_point_buffer, 0, hit_point_buffer_size));
+    }
+    CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_element_buffer, 0, hit_point_buffer_size / sizeof(float4) * sizeof(unsigned int)));
+    if (data_manager->launch_params_H.hit_weight_buffer) {
+        CUDA_CHECK(cudaMemset(data_manager->launch_params_H.hit_weight_buffer, 0, hit_point_buffer_size / sizeof(float4) * sizeof(float)));
+    }
+    upload_enabled_mask();
+    // the sun plane follows the geometry
+    data_manager->launch_params_H.ray_power = static_cast<float>(get_power_per_ray());
+    m_hits_downloaded = false;
 	data_manager->updateLaunchParams();
 }
 
@@ -220,9 +457,9 @@ bool SolTraceSystem::read_st_input(const char* filename) {
 
 int SolTraceSystem::get_num_hits_receiver(CspElement receiver) {
 
-    int output_size = m_num_sunpoints * data_manager->launch_params_H.max_depth;
-    std::vector<float4> hp_output_buffer(output_size);
-    CUDA_CHECK(cudaMemcpy(hp_output_buffer.data(), data_manager->launch_params_H.hit_point_buffer, output_size * sizeof(float4), cudaMemcpyDeviceToHost));
+    download_hits();
+    const std::vector<float4>& hp_output_buffer = m_hit_points_H;
+    int output_size = static_cast<int>(hp_output_buffer.size());
 
 
 	m_num_hits_receiver = 0;
@@ -248,10 +485,324 @@ int SolTraceSystem::get_num_hits_receiver(CspElement receiver) {
     return m_num_hits_receiver;
 }
 
+double SolTraceSystem::get_power_per_ray() const {
+    const LaunchParams& params = data_manager->launch_params_H;
+    double sun_plane_area = length(params.sun_v1 - params.sun_v0) * length(params.sun_v3 - params.sun_v0);
+    return m_dni * sun_plane_area / m_num_sunpoints;
+}
+
+void SolTraceSystem::download_hits() {
+    if (m_hits_downloaded) return;
+
+    size_t output_size = static_cast<size_t>(data_manager->launch_params_H.width) * data_manager->launch_params_H.height * data_manager->launch_params_H.max_depth;
+    m_hit_points_H.resize(output_size);
+    m_hit_ids_H.resize(output_size);
+    CUDA_CHECK(cudaMemcpy(m_hit_ids_H.data(), data_manager->launch_params_H.hit_element_buffer, output_size * sizeof(uint32_t), cudaMemcpyDeviceToHost));
+    if (m_compact_hits) {
+        m_hit_uv_H.resize(output_size);
+        CUDA_CHECK(cudaMemcpy(m_hit_uv_H.data(), data_manager->launch_params_H.hit_uv_buffer, output_size * sizeof(uint32_t), cudaMemcpyDeviceToHost));
+        decode_hits();
+    }
+    else {
+        CUDA_CHECK(cudaMemcpy(m_hit_points_H.data(), data_manager->launch_params_H.hit_point_buffer, output_size * sizeof(float4), cudaMemcpyDeviceToHost));
+    }
+    if (data_manager->launch_params_H.hit_weight_buffer) {
+        m_hit_weights_H.resize(output_size);
+        CUDA_CHECK(cudaMemcpy(m_hit_weights_H.data(), data_manager->launch_params_H.hit_weight_buffer, output_size * sizeof(float), cudaMemcpyDeviceToHost));
+    }
+    m_hits_downloaded = true;
+}
+
+void SolTraceSystem::upload_hit_frames() {
+    const std::vector<HitFrame>& frames = geometry_manager->get_hit_frames();
+    LaunchParams& params = data_manager->launch_params_H;
+    if (!params.hit_frames) {
+        CUDA_CHECK(cudaMalloc(reinterpret_cast<void**>(const_cast<HitFrame**>(&params.hit_frames)), frames.size() * sizeof(HitFrame)));
+    }
+    CUDA_CHECK(cudaMemcpy(const_cast<HitFrame*>(params.hit_frames), frames.data(), frames.size() * sizeof(HitFrame), cudaMemcpyHostToDevice));
+}
+
+void SolTraceSystem::decode_hits() {
+    const LaunchParams& params = data_manager->launch_params_H;
+    const size_t max_depth = params.max_depth;
+    const std::vector<HitFrame>& frames = geometry_manager->get_hit_frames();
+    const float3 sun_edge1 = params.sun_v1 - params.sun_v0;
+    const float3 sun_edge2 = params.sun_v3 - params.sun_v0;
+
+    parallel_for(m_hit_uv_H.size(), [&](size_t k) {
+        const uint32_t stored_id = get_stored_hit_id(m_hit_ids_H[k]);
+        const float stage = static_cast<float>(k % max_depth);
+        if (stored_id != 0) {
+            float3 p = decode_hit_uv(frames[stored_id - 1], m_hit_uv_H[k]);
+            m_hit_points_H[k] = make_float4(stage, p.x, p.y, p.z);
+        }
+        else if (k % max_depth == 0) {
+            // sun point, same sample as haltonSampleInParallelogram in sun.cu
+            const uint32_t ray = static_cast<uint32_t>(k / max_depth);
+            float3 p = params.sun_v0 + halton_H(ray, 2) * sun_edge1 + halton_H(ray, 3) * sun_edge2;
+            m_hit_points_H[k] = make_float4(0.0f, p.x, p.y, p.z);
+        }
+        else {
+            m_hit_points_H[k] = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+        }
+    });
+}
+
+const FluxMap& SolTraceSystem::compute_flux_map(int receiver_id) {
+
+    if (receiver_id < 0 || receiver_id >= static_cast<int>(m_element_list.size()) || !m_element_list[receiver_id]->is_receiver()) {
+        throw std::invalid_argument("compute_flux_map: element " + std::to_string(receiver_id) + " is not a receiver");
+    }
+
+    download_hits();
+
+    m_flux_map.set_receiver(*m_element_list[receiver_id]);
+    // hit ids of elements are their position in the element GAS
+    m_flux_map.accumulate(m_hit_points_H, m_hit_ids_H, geometry_manager->get_element_rank()[receiver_id], get_power_per_ray(), m_hit_weights_H, get_batch_layout(), m_path_filter);
+
+    return m_flux_map;
+}
+
+const TriangleFlux& SolTraceSystem::compute_triangle_flux() {
+
+    download_hits();
+
+    // faces are taken from the packed geometry, the vertices there are already global
+    const PackedGeometryArrays& packed = geometry_manager->get_packed_geometry();
+    const std::vector<uint32_t>& element_rank = geometry_manager->get_element_rank();
+    m_triangle_flux.clear();
+    for (int id : get_receiver_indices()) {
+        if (m_element_list[id]->get_aperture_type() != ApertureType::TRIANGLE) continue;
+        uint32_t hit_id = element_rank[id];
+        const PackedTriangleFlat& tri = packed.triangle_flat[packed.slot[hit_id]];
+        m_triangle_flux.add_face(id, -1, hit_id, tri.v0, tri.v0 + tri.e1, tri.v0 + tri.e2);
+    }
+
+    // every face of a mesh has its own hit id
+    for (uint32_t m = 0; m < m_mesh_list.size(); m++) {
+        const std::vector<float3> vertices = m_mesh_list[m]->get_global_vertices();
+        const std::vector<uint3>& faces = m_mesh_list[m]->get_mesh().indices;
+        const uint32_t first_hit_id = geometry_manager->get_mesh_first_hit_id(m);
+        for (size_t f = 0; f < faces.size(); f++) {
+            m_triangle_flux.add_face(-1, static_cast<int>(m), first_hit_id + static_cast<uint32_t>(f),
+                vertices[faces[f].x], vertices[faces[f].y], vertices[faces[f].z]);
+        }
+    }
+
+    m_triangle_flux.accumulate(m_hit_ids_H, geometry_manager->get_num_hit_ids(),
+        get_power_per_ray(), m_hit_weights_H, m_path_filter);
+
+    return m_triangle_flux;
+}
+
+void SolTraceSystem::add_receiver_group(const std::string& name, const std::vector<int>& element_ids) {
+    for (int id : element_ids) {
+        if (id < 0 || id >= static_cast<int>(m_element_list.size()) || !m_element_list[id]->is_receiver()) {
+            throw std::invalid_argument("add_receiver_group: element " + std::to_string(id) + " is not a receiver");
+        }
+    }
+    ReceiverGroup group;
+    group.name = name;
+    group.element_ids = element_ids;
+    m_receiver_groups.push_back(group);
+}
+
+const std::vector<ReceiverStats>& SolTraceSystem::compute_receiver_stats() {
+
+    std::vector<int> receiver_indices = get_receiver_indices();
+    download_hits();
+
+    // receiver slot of every hit id: the receiver elements, then one slot per mesh covering all its faces
+    const std::vector<uint32_t>& element_rank = geometry_manager->get_element_rank();
+    std::vector<int32_t> hit_to_receiver(geometry_manager->get_num_hit_ids(), -1);
+    for (size_t r = 0; r < receiver_indices.size(); r++) {
+        hit_to_receiver[element_rank[receiver_indices[r]]] = static_cast<int32_t>(r);
+    }
+    const size_t num_receivers = receiver_indices.size() + m_mesh_list.size();
+    for (uint32_t m = 0; m < m_mesh_list.size(); m++) {
+        std::fill_n(hit_to_receiver.begin() + geometry_manager->get_mesh_first_hit_id(m), m_mesh_list[m]->get_num_faces(),
+            static_cast<int32_t>(receiver_indices.size() + m));
+    }
+
+    // per receiver and per batch of rays
+    const BatchLayout batches = get_batch_layout();
+    const uint32_t num_batches = batches.num_batches;
+    std::vector<uint64_t> counts;
+    std::vector<double> power;
+    std::vector<uint64_t> direct_sun_counts;
+    count_receiver_hits(m_hit_ids_H, m_hit_weights_H, hit_to_receiver, num_receivers, batches, m_path_filter,
+        counts, power, &direct_sun_counts);
+
+    // unweighted rays all carry the same power
+    if (m_hit_weights_H.empty()) {
+        const double power_per_ray = get_power_per_ray();
+        for (double& p : power) p *= power_per_ray;
+    }
+
+    m_receiver_stats.assign(num_receivers, ReceiverStats());
+    std::vector<int32_t> element_to_receiver(m_element_list.size(), -1);
+    for (size_t r = 0; r < num_receivers; r++) {
+        WelfordAccumulator hits = accumulate_batches(&counts[r * num_batches], num_batches);
+        WelfordAccumulator watts = accumulate_batches(&power[r * num_batches], num_batches);
+        if (r < receiver_indices.size()) {
+            m_receiver_stats[r].element_id = receiver_indices[r];
+            element_to_receiver[receiver_indices[r]] = static_cast<int32_t>(r);
+        }
+        else {
+            m_receiver_stats[r].mesh_id = static_cast<int>(r - receiver_indices.size());
+        }
+        m_receiver_stats[r].num_hits = static_cast<uint64_t>(std::llround(hits.mean));
+        m_receiver_stats[r].num_hits_std_error = hits.get_standard_error();
+        m_receiver_stats[r].power = watts.mean;
+        m_receiver_stats[r].power_std_error = watts.get_standard_error();
+        m_receiver_stats[r].num_direct_sun_hits = direct_sun_counts[r];
+    }
+
+    // group totals are summed per batch, so that the correlation between panels is accounted for
+    std::vector<uint64_t> group_counts(num_batches);
+    std::vector<double> group_power(num_batches);
+    for (ReceiverGroup& group : m_receiver_groups) {
+        std::fill(group_counts.begin(), group_counts.end(), 0);
+        std::fill(group_power.begin(), group_power.end(), 0.0);
+        for (int id : group.element_ids) {
+            size_t r = element_to_receiver[id];
+            for (uint32_t b = 0; b < num_batches; b++) {
+                group_counts[b] += counts[r * num_batches + b];
+                group_power[b] += power[r * num_batches + b];
+            }
+        }
+        WelfordAccumulator hits = accumulate_batches(group_counts.data(), num_batches);
+        WelfordAccumulator watts = accumulate_batches(group_power.data(), num_batches);
+        group.num_hits = static_cast<uint64_t>(std::llround(hits.mean));
+        group.num_hits_std_error = hits.get_standard_error();
+        group.power = watts.mean;
+        group.power_std_error = watts.get_standard_error();
+    }
+
+    return m_receiver_stats;
+}
+
+std::vector<ElementHitStats> SolTraceSystem::compute_element_hit_stats() {
+
+    download_hits();
+
+    // every hit id is its own slot
+    const size_t num_elements = geometry_manager->get_num_elements();
+    const size_t num_ids = num_elements + m_instance_list.size();
+    std::vector<int32_t> hit_to_slot(num_ids);
+    for (size_t id = 0; id < num_ids; id++) hit_to_slot[id] = static_cast<int32_t>(id);
+
+    const BatchLayout batches = get_batch_layout();
+    std::vector<uint64_t> counts;
+    std::vector<double> power;
+    // the path filter is for receivers, a filtered run keeps the heliostat counts
+    count_receiver_hits(m_hit_ids_H, {}, hit_to_slot, num_ids, batches, PathFilter::ALL, counts, power);
+
+    std::vector<ElementHitStats> stats;
+    stats.reserve(num_ids);
+    const std::vector<uint32_t>& element_rank = geometry_manager->get_element_rank();
+    for (size_t id = 0; id < m_element_list.size(); id++) {
+        WelfordAccumulator hits = accumulate_batches(&counts[element_rank[id] * batches.num_batches], batches.num_batches);
+        ElementHitStats entry;
+        entry.element_id = static_cast<int>(id);
+        entry.num_hits = static_cast<uint64_t>(std::llround(hits.mean));
+        entry.num_hits_std_error = hits.get_standard_error();
+        stats.push_back(entry);
+    }
+    for (size_t k = 0; k < m_instance_list.size(); k++) {
+        WelfordAccumulator hits = accumulate_batches(&counts[(num_elements + k) * batches.num_batches], batches.num_batches);
+        ElementHitStats entry;
+        entry.instance_id = static_cast<int>(k);
+        entry.num_hits = static_cast<uint64_t>(std::llround(hits.mean));
+        entry.num_hits_std_error = hits.get_standard_error();
+        stats.push_back(entry);
+    }
+
+    return stats;
+}
+
+BatchLayout SolTraceSystem::get_batch_layout() const {
+    BatchLayout batches;
+    batches.num_batches = m_num_batches;
+    batches.entries_per_ray = data_manager->launch_params_H.max_depth;
+    batches.num_rays = static_cast<size_t>(data_manager->launch_params_H.width) * data_manager->launch_params_H.height;
+    return batches;
+}
+
+void SolTraceSystem::set_num_batches(uint32_t num_batches) {
+    if (num_batches == 0) {
+        throw std::invalid_argument("set_num_batches: at least one batch is needed");
+    }
+    m_num_batches = num_batches;
+}
+
+std::vector<HeliostatLedgerEntry> SolTraceSystem::compute_heliostat_ledger() {
+
+    if (!data_manager->launch_params_H.heliostat_ledger) {
+        throw std::runtime_error("compute_heliostat_ledger: enable the ledger with set_heliostat_ledger before initialize");
+    }
+
+    std::vector<unsigned int> counters(m_heliostat_ledger_size);
+    CUDA_CHECK(cudaMemcpy(counters.data(), data_manager->launch_params_H.heliostat_ledger, m_heliostat_ledger_size * sizeof(unsigned int), cudaMemcpyDeviceToHost));
+
+    const Vec3d sun_vec = m_sun_vector.normalized();
+    auto fill_counters = [&](HeliostatLedgerEntry& entry, size_t hit_id) {
+        const unsigned int* c = &counters[hit_id * NUM_LEDGER_COUNTERS];
+        entry.incident = c[LEDGER_INCIDENT];
+        entry.reflected = c[LEDGER_REFLECTED];
+        entry.blocked = c[LEDGER_BLOCKED];
+        entry.receiver = c[LEDGER_RECEIVER];
+        entry.spilled = c[LEDGER_SPILLED];
+        entry.absorbed = c[LEDGER_ABSORBED];
+        entry.shaded = c[LEDGER_SHADED];
+    };
+
+    std::vector<HeliostatLedgerEntry> ledger;
+    const std::vector<uint32_t>& element_rank = geometry_manager->get_element_rank();
+    for (size_t id = 0; id < m_element_list.size(); id++) {
+        const CspElement& element = *m_element_list[id];
+        if (element.is_receiver()) continue;
+        HeliostatLedgerEntry entry;
+        entry.element_id = static_cast<int>(id);
+        entry.cosine = element.get_rotation_matrix().get_z_basis().dot(sun_vec);
+        fill_counters(entry, element_rank[id]);
+        ledger.push_back(entry);
+    }
+
+    // instances follow the elements in hit id order
+    const size_t num_elements = geometry_manager->get_num_elements();
+    for (size_t k = 0; k < m_instance_list.size(); k++) {
+        HeliostatLedgerEntry entry;
+        entry.instance_id = static_cast<int>(k);
+        entry.cosine = m_instance_list[k].get_rotation_matrix().get_z_basis().dot(sun_vec);
+        fill_counters(entry, num_elements + k);
+        ledger.push_back(entry);
+    }
+
+    return ledger;
+}
+
+void SolTraceSystem::write_heliostat_ledger(const std::string& filename) {
+    write_heliostat_ledger_csv(filename, compute_heliostat_ledger());
+}
+
 void SolTraceSystem::write_hp_output(const std::string& filename) {
-    int output_size = data_manager->launch_params_H.width * data_manager->launch_params_H.height * data_manager->launch_params_H.max_depth;
-    std::vector<float4> hp_output_buffer(output_size);
-    CUDA_CHECK(cudaMemcpy(hp_output_buffer.data(), data_manager->launch_params_H.hit_point_buffer, output_size * sizeof(float4), cudaMemcpyDeviceToHost));
+
+    download_hits();
+
+    const LaunchParams& params = data_manager->launch_params_H;
+    const size_t max_depth = params.max_depth;
+    const bool with_direction = (m_output_fields & OUTPUT_DIRECTION) != 0;
+    if (with_direction && !params.hit_dir_buffer) {
+        std::cerr << "Error: directions were not traced, call set_output_fields with OUTPUT_DIRECTION before initialize()." << std::endl;
+        return;
+    }
+
+    std::vector<float3> hit_dirs;
+    if (with_direction) {
+        hit_dirs.resize(m_hit_points_H.size());
+        CUDA_CHECK(cudaMemcpy(hit_dirs.data(), params.hit_dir_buffer, hit_dirs.size() * sizeof(float3), cudaMemcpyDeviceToHost));
+    }
 
     std::ofstream outFile(filename);
 
@@ -261,48 +812,163 @@ void SolTraceSystem::write_hp_output(const std::string& filename) {
     }
 
     // Write header
-	// TODO, if statements to check if one needs to write dir_cos_buffer or not
-    outFile << "number,stage,loc_x,loc_y,loc_z,cosx,cosy,cosz\n";
+    outFile << "number,stage";
+    if (m_output_fields & OUTPUT_POSITION) outFile << ",loc_x,loc_y,loc_z";
+    if (with_direction) outFile << ",cosx,cosy,cosz";
+    const bool with_mesh = !m_mesh_list.empty();
+    if (m_output_fields & OUTPUT_ELEMENT) outFile << (with_mesh ? ",element,instance,mesh,face" : ",element,instance");
+    if (m_output_fields & OUTPUT_WEIGHT) outFile << ",weight";
+    if (m_output_fields & OUTPUT_PATH) outFile << ",direct_sun";
+    outFile << "\n";
+
+    const double power_per_ray = get_power_per_ray();
+
+    for (size_t k = 0; k < m_hit_points_H.size(); k++) {
+        const float4& hp = m_hit_points_H[k];
+
+        // unused slots of the rays that ended early are all zero
+        if ((hp.y == 0) && (hp.z == 0) && (hp.w == 0)) continue;
+
+        outFile << k / max_depth + 1 << "," << hp.x;
+        if (m_output_fields & OUTPUT_POSITION) {
+            outFile << "," << hp.y << "," << hp.z << "," << hp.w;
+        }
+        if (with_direction) {
+            const float3& d = hit_dirs[k];
+            outFile << "," << d.x << "," << d.y << "," << d.z;
+        }
+        if (m_output_fields & OUTPUT_ELEMENT) {
+            // the sun point (stage 0) is not a hit, element and instance are -1 there
+            uint32_t stored_id = get_stored_hit_id(m_hit_ids_H[k]);
+            int element = -1, instance = -1, mesh = -1, face = -1;
+            if (stored_id != 0) resolve_hit_id(stored_id - 1, element, instance, mesh, face);
+            outFile << "," << element << "," << instance;
+            if (with_mesh) outFile << "," << mesh << "," << face;
+        }
+        if (m_output_fields & OUTPUT_WEIGHT) {
+            outFile << "," << (m_hit_weights_H.empty() ? power_per_ray : m_hit_weights_H[k]);
+        }
+        if (m_output_fields & OUTPUT_PATH) {
+            outFile << "," << (is_direct_sun_hit(m_hit_ids_H[k]) ? 1 : 0);
+        }
+        outFile << "\n";
+    }
 
-    int currentRay = 1;
-    int stage = 0;
+    outFile.close();
+    std::cout << "Data successfully written to " << filename << std::endl;
+}
 
-    for (const auto& element : hp_output_buffer) {
+void SolTraceSystem::write_hp_sample(const std::string& filename, size_t sample_size, HitSampleMode mode, uint64_t seed) {
 
-        // Inline check: if y, z, and w are all zero, treat as marker for new ray.
-        if ((element.y == 0) && (element.z == 0) && (element.w == 0)) {
-            if (stage > 0) {
-                currentRay++;
-                stage = 0;
-            }
-            continue;  // Skip printing this marker element.
-        }
+    download_hits();
 
-        // If we haven't reached max_trace stages for the current ray, print the element.
-        if (stage < data_manager->launch_params_H.max_depth) {
-            outFile << currentRay << ","
-                << element.x << "," << element.y << ","
-                << element.z << "," << element.w << "\n";
-            stage++;
-        }
-        else {
-            // If max_trace stages reached, move to next ray and reset stage counter.
-            currentRay++;
-            stage = 0;
-            outFile << currentRay << ","
-                << element.x << "," << element.y << ","
-                << element.z << "," << element.w << "\n";
-            stage++;
+    // one stratum per element and instance, and one per mesh
+    const size_t num_objects = geometry_manager->get_num_elements() + m_instance_list.size();
+
+    std::vector<int32_t> hit_to_stratum;
+    size_t num_strata = 1;
+    if (mode == HitSampleMode::STRATIFIED) {
+        num_strata = num_objects + m_mesh_list.size();
+        hit_to_stratum.resize(geometry_manager->get_num_hit_ids());
+        for (size_t id = 0; id < num_objects; id++) hit_to_stratum[id] = static_cast<int32_t>(id);
+        for (uint32_t m = 0; m < m_mesh_list.size(); m++) {
+            std::fill_n(hit_to_stratum.begin() + geometry_manager->get_mesh_first_hit_id(m), m_mesh_list[m]->get_num_faces(),
+                static_cast<int32_t>(num_objects + m));
         }
+    }
 
+    std::vector<size_t> sample = sample_hits(m_hit_ids_H, sample_size, seed, hit_to_stratum, num_strata);
 
+    std::ofstream outFile(filename);
+    if (!outFile.is_open()) {
+        std::cerr << "Error: Could not open the file " << filename << " for writing." << std::endl;
+        return;
+    }
+
+    const size_t max_depth = data_manager->launch_params_H.max_depth;
+    const bool with_mesh = !m_mesh_list.empty();
+    outFile << (with_mesh ? "number,stage,loc_x,loc_y,loc_z,element,instance,mesh,face\n" : "number,stage,loc_x,loc_y,loc_z,element,instance\n");
+    for (size_t k : sample) {
+        const float4& hp = m_hit_points_H[k];
+        int element = -1, instance = -1, mesh = -1, face = -1;
+        resolve_hit_id(get_stored_hit_id(m_hit_ids_H[k]) - 1, element, instance, mesh, face);
+
+        outFile << k / max_depth + 1 << "," << hp.x << "," << hp.y << "," << hp.z << "," << hp.w << ","
+            << element << "," << instance;
+        if (with_mesh) outFile << "," << mesh << "," << face;
+        outFile << "\n";
     }
 
     outFile.close();
     std::cout << "Data successfully written to " << filename << std::endl;
 }
 
+SortedHits SolTraceSystem::sort_hits_by_element() {
+
+    download_hits();
+
+    // elements keep their id, instances follow them, then one group per mesh
+    const size_t num_elements = geometry_manager->get_num_elements();
+    const std::vector<uint32_t>& element_order = geometry_manager->get_element_order();
+    const size_t num_objects = num_elements + m_instance_list.size();
+    const size_t num_groups = num_objects + m_mesh_list.size();
+    std::vector<uint32_t> hit_to_group(geometry_manager->get_num_hit_ids());
+    for (size_t id = 0; id < num_objects; id++) {
+        hit_to_group[id] = (id < num_elements) ? element_order[id] : static_cast<uint32_t>(id);
+    }
+    for (uint32_t m = 0; m < m_mesh_list.size(); m++) {
+        std::fill_n(hit_to_group.begin() + geometry_manager->get_mesh_first_hit_id(m), m_mesh_list[m]->get_num_faces(),
+            static_cast<uint32_t>(num_objects + m));
+    }
+
+    SortedHits sorted;
+    sort_hits_by_group(m_hit_points_H, m_hit_ids_H, m_hit_weights_H, data_manager->launch_params_H.max_depth,
+        hit_to_group, num_groups, sorted);
+    return sorted;
+}
 
+void SolTraceSystem::write_compact_hits(const std::string& filename) {
+
+    download_hits();
+
+    // without compact hits the points are encoded on the host
+    static const std::vector<uint32_t> no_uv;
+    const size_t num_objects = geometry_manager->get_num_elements() + m_instance_list.size();
+    const std::vector<HitFrame>& frames = geometry_manager->get_hit_frames();
+    std::vector<CompactHitRecord> records = compact_hits(m_hit_ids_H, m_compact_hits ? m_hit_uv_H : no_uv, m_hit_points_H, frames);
+    write_compact_hits_binary(filename, data_manager->launch_params_H.max_depth, geometry_manager->get_element_order(),
+        static_cast<uint32_t>(m_instance_list.size()), geometry_manager->get_num_hit_ids() - static_cast<uint32_t>(num_objects), frames, records);
+}
+
+void SolTraceSystem::write_sorted_hits(const std::string& filename) {
+    SortedHits sorted = sort_hits_by_element();
+    write_sorted_hits_binary(filename, sorted, geometry_manager->get_num_elements(),
+        static_cast<uint32_t>(m_instance_list.size()), static_cast<uint32_t>(m_mesh_list.size()));
+}
+
+// string as a JSON string literal, quotes included
+static std::string json_string(const std::string& value) {
+    std::string quoted = "\"";
+    for (char c : value) {
+        switch (c) {
+        case '"':  quoted += "\\\""; break;
+        case '\\': quoted += "\\\\"; break;
+        case '\n': quoted += "\\n"; break;
+        case '\r': quoted += "\\r"; break;
+        case '\t': quoted += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned int>(static_cast<unsigned char>(c)));
+                quoted += buf;
+            }
+            else {
+                quoted += c;
+            }
+        }
+    }
+    return quoted + "\"";
+}
 
 // write json output file for post processing
 // need sun vector, number of rays, sun box, sun angle
@@ -325,20 +991,55 @@ void SolTraceSystem::write_simulation_json(const std::string& filename) {
     out << "    \"sun_vector\": ["
         << m_sun_vector[0] << ", " << m_sun_vector[1] << ", " << m_sun_vector[2] << "],\n";
     out << "    \"sun_box_edge_a\": " << sun_box_edge_a << ",\n";
-    out << "    \"sun_box_edge_b\": " << sun_box_edge_b << "\n";
-    out << "  },\n";
-
+    out << "    \"sun_box_edge_b\": " << sun_box_edge_b << ",\n";
+    out << "    \"dni\": " << m_dni << ",\n";
+    out << "    \"power_per_ray\": " << get_power_per_ray() << ",\n";
+    out << "    \"num_batches\": " << m_num_batches << ",\n";
+    out << "    \"path_filter\": \"" << to_string(m_path_filter) << "\"\n";
+    out << "  }";
+
+    // hits and power of all the receivers, in one pass over the hit buffers
+    const std::vector<ReceiverStats>& receiver_stats = compute_receiver_stats();
+
+    if (receiver_stats.empty()) {
+        std::cerr << "Warning: No receiver found in the system, the simulation JSON lists no receiver." << std::endl;
+    }
 
-	std::vector<int> receiver_indices = get_receiver_indices();
+    out << ",\n  \"receivers\": [";
+    for (size_t r = 0; r < receiver_stats.size(); r++) {
+        out << (r > 0 ? ",\n" : "\n") << "    {\"element_id\": " << receiver_stats[r].element_id
+            << ", \"mesh_id\": " << receiver_stats[r].mesh_id
+            << ", \"num_hits\": " << receiver_stats[r].num_hits
+            << ", \"num_hits_std_error\": " << receiver_stats[r].num_hits_std_error
+            << ", \"power\": " << receiver_stats[r].power
+            << ", \"power_std_error\": " << receiver_stats[r].power_std_error
+            << ", \"num_direct_sun_hits\": " << receiver_stats[r].num_direct_sun_hits << "}";
+    }
+    out << (receiver_stats.empty() ? "]" : "\n  ]");
+
+    out << ",\n  \"receiver_groups\": [";
+    for (size_t g = 0; g < m_receiver_groups.size(); g++) {
+        const ReceiverGroup& group = m_receiver_groups[g];
+        out << (g > 0 ? ",\n" : "\n") << "    {\"name\": " << json_string(group.name) << ", \"element_ids\": [";
+        for (size_t k = 0; k < group.element_ids.size(); k++) {
+            out << group.element_ids[k] << (k + 1 < group.element_ids.size() ? ", " : "");
+        }
+        out << "], \"num_hits\": " << group.num_hits
+            << ", \"num_hits_std_error\": " << group.num_hits_std_error
+            << ", \"power\": " << group.power
+            << ", \"power_std_error\": " << group.power_std_error << "}";
+    }
+    out << (m_receiver_groups.empty() ? "]" : "\n  ]");
 
-    if (receiver_indices.size() == 0) {
-        std::cerr << "Error: No receiver found in the system. Cannot write simulation JSON." << std::endl;
+    // the receiver elements come before the meshes, without any there is no first receiver to describe
+    if (receiver_stats.empty() || receiver_stats[0].element_id < 0) {
+        out << "\n}\n";
+        return;
     }
-    if (receiver_indices.size() > 1) {
-		std::cerr << "Error: More than one receiver found in the system. Luning needs to implement this!" << std::endl;
-	}
+    out << ",\n";
 
-    std::shared_ptr<CspElement> receiver = m_element_list[receiver_indices[0]];
+    // first receiver, kept in the layout the post-processing scripts expect
+    std::shared_ptr<CspElement> receiver = m_element_list[receiver_stats[0].element_id];
 
     out << "  \"receiver\": {\n";
 
@@ -370,7 +1071,7 @@ void SolTraceSystem::write_simulation_json(const std::string& filename) {
 			break;
     }
 
-	Vec3d receiver_location = receiver->get_origin();
+	Vec3d receiver_location = receiver->get_global_origin();
 	Matrix33d rotation_matrix = receiver->get_rotation_matrix(); // get the rotation matrix
 	Vec3d receiver_x_basis = rotation_matrix.get_x_basis();
 	Vec3d receiver_y_basis = rotation_matrix.get_y_basis();
@@ -380,7 +1081,7 @@ void SolTraceSystem::write_simulation_json(const std::string& filename) {
         << receiver_location[0] << ", " << receiver_location[1] << ", " << receiver_location[2] << "],\n";
 
     out << "    \"num_hits\": "
-        << get_num_hits_receiver(*receiver) << ",\n";
+        << receiver_stats[0].num_hits << ",\n";
 
 
     // print out rotation matrix basis
@@ -404,6 +1105,11 @@ void SolTraceSystem::write_simulation_json(const std::string& filename) {
 
 
 void SolTraceSystem::write_sun_output(const std::string& filename) {
+    if (!data_manager->launch_params_H.sun_dir_buffer) {
+        std::cerr << "Error: sun directions were not traced, call set_output_fields with OUTPUT_DIRECTION before initialize()." << std::endl;
+        return;
+    }
+
     int output_size = data_manager->launch_params_H.width * data_manager->launch_params_H.height;
 
     std::vector<float3> sun_dir_buffer(output_size);
@@ -418,7 +1124,6 @@ void SolTraceSystem::write_sun_output(const std::string& filename) {
     }
 
     // Write header
-    // TODO, if statements to check if one needs to write dir_cos_buffer or not
     outFile << "number,cosx,cosy,cosz\n";
 
     int currentRay = 1;
@@ -462,6 +1167,35 @@ void SolTraceSystem::clean_up() {
     // Free device-side launch parameter memory
     CUDA_CHECK(cudaFree(reinterpret_cast<void*>(data_manager->launch_params_H.hit_point_buffer)));
     CUDA_CHECK(cudaFree(reinterpret_cast<void*>(data_manager->launch_params_H.sun_dir_buffer)));
+    data_manager->launch_params_H.sun_dir_buffer = nullptr;
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(data_manager->launch_params_H.hit_dir_buffer)));
+    data_manager->launch_params_H.hit_dir_buffer = nullptr;
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(data_manager->launch_params_H.hit_uv_buffer)));
+    data_manager->launch_params_H.hit_uv_buffer = nullptr;
+    CUDA_CHECK(cudaFree(const_cast<HitFrame*>(data_manager->launch_params_H.hit_frames)));
+    data_manager->launch_params_H.hit_frames = nullptr;
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(data_manager->launch_params_H.hit_element_buffer)));
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(data_manager->launch_params_H.ray_order)));
+    data_manager->launch_params_H.ray_order = nullptr;
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(data_manager->launch_params_H.heliostat_ledger)));
+    data_manager->launch_params_H.heliostat_ledger = nullptr;
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(data_manager->launch_params_H.hit_weight_buffer)));
+    data_manager->launch_params_H.hit_weight_buffer = nullptr;
+
+    // batched launches
+    m_result_pipeline.reset();
+    for (size_t s = 0; s < m_traced_events.size(); s++) {
+        CUDA_CHECK(cudaEventDestroy(m_traced_events[s]));
+        CUDA_CHECK(cudaEventDestroy(m_copied_events[s]));
+    }
+    m_traced_events.clear();
+    m_copied_events.clear();
+    if (m_copy_stream) {
+        CUDA_CHECK(cudaStreamDestroy(m_copy_stream));
+        m_copy_stream = 0;
+    }
+    CUDA_CHECK(cudaFree(reinterpret_cast<void*>(m_batch_launch_params_D)));
+    m_batch_launch_params_D = nullptr;
 
     data_manager->cleanup();
 
@@ -569,6 +1303,11 @@ void SolTraceSystem::create_shader_binding_table(){
                 hitgroup_records_list[i].data.material_data = { 0.95, 0, 0, 0 };
                 printf("TRIANGLE_FLAT_RECEIVER, program group address: %p \n", program_group_handle);
 				break;
+            case OptixCSP::OpticalEntityType::TRIANGLE_MESH_RECEIVER:
+                program_group_handle = pipeline_manager->getReceiverProgram(SurfaceType::MESH, ApertureType::TRIANGLE);
+                hitgroup_records_list[i].data.material_data = { 0.95, 0, 0, 0 };
+                printf("TRIANGLE_MESH_RECEIVER, program group address: %p \n", program_group_handle);
+                break;
             default:
 				std::cerr << "Unknown OpticalEntityType: " << my_type << std::endl;
 			}
@@ -605,9 +1344,185 @@ void SolTraceSystem::add_element(std::shared_ptr<CspElement> e)
 
     // update the euler angles for the element
     e->update_euler_angles();
+    e->set_id(static_cast<int>(m_element_list.size()));
     m_element_list.push_back(e);
 }
 
+void SolTraceSystem::add_group(std::shared_ptr<TransformGroup> group)
+{
+    m_group_list.push_back(group);
+}
+
+uint32_t SolTraceSystem::add_prototype(std::shared_ptr<ElementPrototype> prototype)
+{
+    m_prototype_list.push_back(prototype);
+    return static_cast<uint32_t>(m_prototype_list.size() - 1);
+}
+
+uint32_t SolTraceSystem::add_instance(uint32_t prototype, const Vec3d& origin, const Vec3d& aim_point, double zrot)
+{
+    if (prototype >= m_prototype_list.size()) {
+        throw std::runtime_error("add_instance: unknown prototype index");
+    }
+    m_instance_list.emplace_back(prototype, origin, aim_point, zrot);
+    m_instance_enabled.push_back(true);
+    return static_cast<uint32_t>(m_instance_list.size() - 1);
+}
+
+uint16_t SolTraceSystem::add_optic(const Optic& optic)
+{
+    return geometry_manager->get_optics().add_optic(optic);
+}
+
+int SolTraceSystem::find_optic(const std::string& name) const
+{
+    return geometry_manager->get_optics().find_optic(name);
+}
+
+void SolTraceSystem::set_optic(uint16_t index, const Optic& optic)
+{
+    geometry_manager->get_optics().set_optic(index, optic);
+}
+
+const OpticsTable& SolTraceSystem::get_optics_table() const
+{
+    return geometry_manager->get_optics();
+}
+
+uint32_t SolTraceSystem::add_mesh(std::shared_ptr<MeshElement> mesh)
+{
+    const TriangleMesh& triangles = mesh->get_mesh();
+    const size_t num_vertices = triangles.get_num_vertices();
+    for (const uint3& face : triangles.indices) {
+        if (face.x >= num_vertices || face.y >= num_vertices || face.z >= num_vertices) {
+            throw std::invalid_argument("add_mesh: a face references a missing vertex");
+        }
+    }
+    m_mesh_list.push_back(mesh);
+    return static_cast<uint32_t>(m_mesh_list.size() - 1);
+}
+
+uint32_t SolTraceSystem::get_mesh_first_hit_id(uint32_t m) const
+{
+    return geometry_manager->get_mesh_first_hit_id(m);
+}
+
+void SolTraceSystem::resolve_hit_id(uint32_t hit_id, int& element, int& instance, int& mesh, int& face) const
+{
+    element = instance = mesh = face = -1;
+    const size_t num_elements = geometry_manager->get_num_elements();
+    const size_t num_objects = num_elements + m_instance_list.size();
+    if (hit_id < num_elements) {
+        element = static_cast<int>(geometry_manager->get_element_order()[hit_id]);
+    }
+    else if (hit_id < num_objects) {
+        instance = static_cast<int>(hit_id - num_elements);
+    }
+    else {
+        // meshes are stored in order, find the last one starting at or before hit_id
+        uint32_t m = static_cast<uint32_t>(m_mesh_list.size());
+        while (m > 0 && geometry_manager->get_mesh_first_hit_id(m - 1) > hit_id) m--;
+        if (m == 0) return;
+        mesh = static_cast<int>(m - 1);
+        face = static_cast<int>(hit_id - geometry_manager->get_mesh_first_hit_id(m - 1));
+    }
+}
+
+void SolTraceSystem::set_spatial_ordering(bool val)
+{
+    geometry_manager->set_spatial_ordering(val);
+}
+
+const std::vector<uint32_t>& SolTraceSystem::get_element_order() const
+{
+    return geometry_manager->get_element_order();
+}
+
+void SolTraceSystem::set_instance_pose(uint32_t instance, const Vec3d& origin, const Vec3d& aim_point, double zrot)
+{
+    ElementInstance& inst = m_instance_list.at(instance);
+    inst = ElementInstance(inst.prototype, origin, aim_point, zrot);
+    m_changed_instances.push_back(static_cast<int>(instance));
+}
+
+void SolTraceSystem::set_element_enabled(int id, bool enabled)
+{
+    m_element_list.at(id)->set_enabled(enabled);
+}
+
+bool SolTraceSystem::is_element_enabled(int id) const
+{
+    return m_element_list.at(id)->is_enabled();
+}
+
+void SolTraceSystem::set_instance_enabled(uint32_t instance, bool enabled)
+{
+    m_instance_enabled.at(instance) = enabled;
+}
+
+bool SolTraceSystem::is_instance_enabled(uint32_t instance) const
+{
+    return m_instance_enabled.at(instance);
+}
+
+void SolTraceSystem::set_enabled_mask(const std::vector<bool>& enabled)
+{
+    if (enabled.size() != m_element_list.size() + m_instance_list.size()) {
+        throw std::invalid_argument("set_enabled_mask: expected one entry per element and instance");
+    }
+    for (size_t i = 0; i < m_element_list.size(); i++) {
+        m_element_list[i]->set_enabled(enabled[i]);
+    }
+    for (size_t k = 0; k < m_instance_list.size(); k++) {
+        m_instance_enabled[k] = enabled[m_element_list.size() + k];
+    }
+}
+
+// elements are masked by primitive index, the hit id they get on the device
+void SolTraceSystem::upload_enabled_mask()
+{
+    const uint32_t num_elements = geometry_manager->get_num_elements();
+    const std::vector<uint32_t>& rank = geometry_manager->get_element_rank();
+    const size_t num_ids = num_elements + m_instance_list.size();
+
+    std::vector<uint32_t> mask((num_ids + 31) / 32, 0u);
+    bool all_enabled = true;
+    for (uint32_t id = 0; id < num_elements; id++) {
+        if (m_element_list[id]->is_enabled()) mask[rank[id] >> 5] |= 1u << (rank[id] & 31u);
+        else all_enabled = false;
+    }
+    for (size_t k = 0; k < m_instance_list.size(); k++) {
+        const size_t hit_id = num_elements + k;
+        if (m_instance_enabled[k]) mask[hit_id >> 5] |= 1u << (hit_id & 31u);
+        else all_enabled = false;
+    }
+    if (all_enabled) mask.clear();
+
+    if (mask == m_enabled_mask_H) return;
+    m_enabled_mask_H.swap(mask);
+    data_manager->updateEnabledMask(m_enabled_mask_H);
+}
+
+std::vector<int> SolTraceSystem::update_transforms(bool force) {
+
+    std::vector<int> changed_ids;
+
+    // groups first, so that elements see the composed frame of their parents
+    for (const auto& group : m_group_list) {
+        group->update_transforms(changed_ids, force);
+    }
+
+    // elements that do not belong to any group
+    for (const auto& element : m_element_list) {
+        if (element->get_group() == nullptr && (force || element->is_dirty())) {
+            element->update_euler_angles();
+            changed_ids.push_back(element->get_id());
+        }
+    }
+
+    return changed_ids;
+}
+
 double SolTraceSystem::get_time_trace() {
     return m_timer_trace.get_time_sec();
 } 
@@ -747,7 +1662,7 @@ bool SolTraceSystem::read_sun(FILE* fp) {
 	return true;
 }
 
-bool SolTraceSystem::read_optic_surface(FILE* fp) {
+bool SolTraceSystem::read_optic_surface(FILE* fp, OpticalSurface& surface) {
 	
     if (!fp) return false;
 	char buf[1024];
@@ -760,36 +1675,27 @@ bool SolTraceSystem::read_optic_surface(FILE* fp) {
 		return false;
 	}
 
-	char ErrorDistribution = 'g';
+	surface.error_distribution = 'g';
 	if (parts[1].length() > 0)
-		ErrorDistribution = parts[1][0];
-
-    /*
-	int ApertureStopOrGratingType = atoi( parts[2].c_str() );
-	int OpticalSurfaceNumber = atoi( parts[3].c_str() );
-	int DiffractionOrder = atoi( parts[4].c_str() );
-	double Reflectivity = atof( parts[5].c_str() );
-	double Transmissivity = atof( parts[6].c_str() );
-	double RMSSlope = atof( parts[7].c_str() );
-	double RMSSpecularity = atof( parts[8].c_str() );
-	double RefractionIndexReal = atof( parts[9].c_str() );
-	double RefractionIndexImag = atof( parts[10].c_str() );
-	double GratingCoeffs[4];
-	GratingCoeffs[0] = atof( parts[11].c_str() );
-	GratingCoeffs[1] = atof( parts[12].c_str() );
-	GratingCoeffs[2] = atof( parts[13].c_str() );
-	GratingCoeffs[3] = atof( parts[14].c_str() );
-    */
+		surface.error_distribution = parts[1][0];
+
+	surface.aperture_stop_or_grating = atoi( parts[2].c_str() );
+	surface.optical_surface_number = atoi( parts[3].c_str() );
+	surface.diffraction_order = atoi( parts[4].c_str() );
+	surface.reflectivity = atof( parts[5].c_str() );
+	surface.transmissivity = atof( parts[6].c_str() );
+	surface.slope_error = atof( parts[7].c_str() );
+	surface.specularity_error = atof( parts[8].c_str() );
+	surface.refraction_index_real = atof( parts[9].c_str() );
+	surface.refraction_index_imag = atof( parts[10].c_str() );
+	for (int i = 0; i < 4; i++)
+		surface.grating_coeffs[i] = atof( parts[11 + i].c_str() );
 
 	bool UseReflectivityTable = false;
 	int refl_npoints = 0;
-	double *refl_angles = 0;
-	double *refls = 0;
 
 	bool UseTransmissivityTable = false;
 	int trans_npoints = 0;
-	double* trans_angles = 0;
-	double* transs = 0;
 
 	if (parts.size() >= 17)
 	{
@@ -802,45 +1708,33 @@ bool SolTraceSystem::read_optic_surface(FILE* fp) {
 		}
 	}
 
+	surface.reflectivity_angles.clear();
+	surface.reflectivity_values.clear();
 	if (UseReflectivityTable)
 	{
-		refl_angles = new double[refl_npoints];
-		refls = new double[refl_npoints];
-
 		for (int i=0;i<refl_npoints;i++)
 		{
+			double angle = 0.0, value = 0.0;
 			read_line(buf,1023,fp);
-			sscanf(buf, "%lg %lg", &refl_angles[i], &refls[i]);
+			sscanf(buf, "%lg %lg", &angle, &value);
+			surface.reflectivity_angles.push_back(angle);
+			surface.reflectivity_values.push_back(value);
 		}
 	}
+	surface.transmissivity_angles.clear();
+	surface.transmissivity_values.clear();
 	if (UseTransmissivityTable)
 	{
-		trans_angles = new double[trans_npoints];
-		transs = new double[trans_npoints];
-
 		for (int i = 0; i < trans_npoints; i++)
 		{
+			double angle = 0.0, value = 0.0;
 			read_line(buf, 1023, fp);
-			sscanf(buf, "%lg %lg", &trans_angles[i], &transs[i]);
+			sscanf(buf, "%lg %lg", &angle, &value);
+			surface.transmissivity_angles.push_back(angle);
+			surface.transmissivity_values.push_back(value);
 		}
 	}
 
-	// TODO: Update once optical surface params are implemented
-	// st_optic( cxt, iopt, fb, ErrorDistribution,
-	// 	OpticalSurfaceNumber, ApertureStopOrGratingType, DiffractionOrder,
-	// 	RefractionIndexReal, RefractionIndexImag,
-	// 	Reflectivity, Transmissivity,
-	// 	GratingCoeffs, RMSSlope, RMSSpecularity,
-	// 	UseReflectivityTable ? 1 : 0, refl_npoints,
-	// 	refl_angles, refls,
-	// 	UseTransmissivityTable? 1 : 0, trans_npoints,
-	// 	trans_angles, transs
-	// 	);
-
-	if (refl_angles != 0) delete [] refl_angles;
-	if (refls != 0) delete [] refls;
-	if (trans_angles != 0) delete[] trans_angles;
-	if (transs != 0) delete[] transs;
 	return true;
 }
 
@@ -851,14 +1745,23 @@ bool SolTraceSystem::read_optic(FILE* fp) {
 
 	if (strncmp( buf, "OPTICAL PAIR", 12) == 0)
 	{
-		read_optic_surface( fp );
-		read_optic_surface( fp );
+		// OPTICAL PAIR\t<name>, then the front and back surfaces
+		Optic optic;
+		std::vector<std::string> parts = split( std::string(buf), "\t", true, false );
+		if (parts.size() > 1) optic.name = parts[1];
+
+		if (!read_optic_surface( fp, optic.front )) return false;
+		if (!read_optic_surface( fp, optic.back )) return false;
+
+		if (find_optic(optic.name) >= 0)
+			printf("optic '%s' defined twice, the last definition is used\n", optic.name.c_str());
+		add_optic(optic);
 		return true;
 	}
 	else return false;
 }
 
-bool SolTraceSystem::read_element(FILE* fp) {
+bool SolTraceSystem::read_element(FILE* fp, const std::shared_ptr<TransformGroup>& stage) {
 	
     //int ielm = ::st_add_element( cxt, istage );
 
@@ -879,8 +1782,8 @@ bool SolTraceSystem::read_element(FILE* fp) {
         return true;
     }
 
-    // st_element_enabled( cxt, istage, ielm,  atoi( tok[0].c_str() ) ? 1 : 0 );
     auto elem = std::make_shared<CspElement>();
+    elem->set_enabled(atoi(tok[0].c_str()) != 0);
     Vec3d origin(atof(tok[1].c_str()),
                     atof(tok[2].c_str()),
                     atof(tok[3].c_str())); // origin of the element
@@ -955,9 +1858,16 @@ bool SolTraceSystem::read_element(FILE* fp) {
         return false;
     }
 
-    // st_element_optic( cxt, istage, ielm,  tok[27].c_str() );
-    // st_element_interaction( cxt, istage, ielm,  atoi( tok[28].c_str()) );
+    // optic by name, shared with every element using it; interaction 1 is refraction, 2 reflection
+    int optic = find_optic(tok[27]);
+    if (optic < 0)
+    {
+        printf("Optic not found: %s, using the default optical properties\n", tok[27].c_str());
+    }
+    elem->set_optic(optic);
+    elem->use_refraction(atoi(tok[28].c_str()) == 1);
 
+    stage->add_element(elem);
     add_element(elem); // Add the element to the system
 
     return true;
@@ -987,9 +1897,13 @@ bool SolTraceSystem::read_stage(FILE* fp) {
 
 	//printf("stage '%s': [%d] %lg %lg %lg   %lg %lg %lg   %lg   %d %d %d\n",
 	//	buf, count, X, Y, Z, AX, AY, AZ, ZRot, virt, multi, tr );
-	
+
+	// element coordinates are given in the stage frame
+	auto stage = std::make_shared<TransformGroup>(Vec3d(X, Y, Z), Vec3d(AX, AY, AZ), ZRot);
+	add_group(stage);
+
 	for (int i=0;i<count;i++)
-		if (!read_element( fp )) 
+		if (!read_element( fp, stage ))
 		{ printf("error in element %d\n", i ); return false; }
 
 	return true;
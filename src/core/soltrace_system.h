@@ -13,6 +13,19 @@
 #include "core/timer.h"
 #include "core/CspElement.h" // CspElement
 #include "core/Surface.h"    // Surface and derived classes
+#include "core/transform_group.h" // TransformGroup
+#include "core/ElementPrototype.h" // ElementPrototype, ElementInstance
+#include "core/MeshElement.h"      // MeshElement, TriangleMesh
+#include "core/ray_order.h"       // SunSampleOrder
+#include "core/flux_map.h"        // FluxMap
+#include "core/receiver_stats.h"  // ReceiverStats, ReceiverGroup
+#include "core/heliostat_ledger.h" // HeliostatLedgerEntry
+#include "core/result_pipeline.h"  // ResultPipeline, HitReducer
+#include "core/hit_sample.h"       // HitSampleMode
+#include "core/hit_groups.h"       // SortedHits
+#include "core/compact_hits.h"     // CompactHitRecord
+#include "core/triangle_flux.h"    // TriangleFlux
+#include "core/optics_table.h"     // Optic, OpticsTable
 
 namespace OptixCSP {
 
@@ -22,6 +35,8 @@ namespace OptixCSP {
     class CspElement;
     class Vec3d;
     class Surface;
+    class TransformGroup;
+    struct LaunchParams;
 
     class SolTraceSystem {
     public:
@@ -34,7 +49,7 @@ namespace OptixCSP {
         /// Execute the ray tracing simulation
         void run();
 
-        /// Update launch params
+        /// Update launch params, geometry of the elements (or groups) that moved since the last update is refreshed
         void update();
 
         // Read a stinput file for the simulation setup.
@@ -42,15 +57,122 @@ namespace OptixCSP {
 
         // Write sun point to a file
         void write_sun_output(const std::string& filename);
-        // write all the hit points to a file
+        // write all the hit points to a file, with the columns selected by set_output_fields,
+        // OUTPUT_ELEMENT also writes the mesh and face of every hit if the system has meshes
         void write_hp_output(const std::string& filename);
+
+        /// <summary>
+        /// columns written by write_hp_output, a mask of OutputField (default OUTPUT_POSITION). Must be set before
+        /// initialize(): the outgoing directions (and the sun ray directions of write_sun_output) are only traced
+        /// into device buffers with OUTPUT_DIRECTION. Hit points and element ids are always kept for the statistics.
+        /// </summary>
+        void set_output_fields(unsigned int fields) { m_output_fields = fields; }
+        unsigned int get_output_fields() const { return m_output_fields; }
+        /// write sample_size hits of the last run drawn uniformly (or up to sample_size per element and instance
+        /// with STRATIFIED) in one pass over the hit buffers, for plotting large runs. Columns: ray number, stage
+        /// and hit point as in write_hp_output, then element id and instance id (-1 if none), mesh and face
+        /// if the system has meshes (one stratum per mesh). Sun points are not
+        /// hits, see write_sun_output. The sample only depends on seed.
+        void write_hp_sample(const std::string& filename, size_t sample_size,
+            HitSampleMode mode = HitSampleMode::UNIFORM, uint64_t seed = 0);
+        /// <summary>
+        /// store the hit points on the device as 16-bit (u, v) in the frame of the object hit (see HitEncoding.h for
+        /// the error bounds), 4 bytes per hit instead of 16. Hit points are decoded when they are downloaded, so the
+        /// outputs and statistics are unchanged up to the quantization. Must be set before initialize(), not
+        /// available with launch batches.
+        /// </summary>
+        void set_compact_hits(bool val) { m_compact_hits = val; }
+        bool use_compact_hits() const { return m_compact_hits; }
+
+        /// quantized hits of the last run with the frames needed to decode them, see write_compact_hits_binary.
+        /// Encoded on the host from the hit points without compact hits.
+        void write_compact_hits(const std::string& filename);
+
+        /// hits of the last run sorted by element (element id order, then prototype instances, then meshes), stage and ray,
+        /// with the offsets of every element in the sorted records
+        SortedHits sort_hits_by_element();
+        /// sort_hits_by_element() written with write_sorted_hits_binary, one element can be mapped without a scan
+        void write_sorted_hits(const std::string& filename);
         // write simulation summary to a file, including receiver stats, etc
 		void write_simulation_json(const std::string& filename);
 		// get number of rays hitting the receiver
         int get_num_hits_receiver(CspElement e);
 
+        /// direct normal irradiance in W/m2, used to scale the flux maps (default 1000)
+        void set_dni(double dni) { m_dni = dni; }
+        double get_dni() const { return m_dni; }
+
+        /// power carried by each ray in W: DNI * sun plane area / number of rays
+        double get_power_per_ray() const;
+
+        /// <summary>
+        /// weighted rays carry their power instead of being absorbed at random: reflectivity (or transmissivity)
+        /// scales the power at every hit and the power is stored with the hit. Rays whose power drops below
+        /// roulette_threshold * get_power_per_ray() play Russian roulette (0 disables it).
+        /// Must be set before initialize().
+        /// </summary>
+        void set_weighted_rays(bool val, double roulette_threshold = 0.1) {
+            m_weighted_rays = val;
+            m_roulette_threshold = roulette_threshold;
+        }
+        bool use_weighted_rays() const { return m_weighted_rays; }
+
+        /// grid used by compute_flux_map, default 100 x 100
+        void set_flux_map_resolution(int nx, int ny) { m_flux_map.set_resolution(nx, ny); }
+
+        /// accumulate the flux on the receiver element receiver_id (flat or cylindrical) from the hits of the last run,
+        /// without going through the hit point output file. Use write_binary / write_csv on the result, which is
+        /// overwritten by the next call. Throws std::invalid_argument if the element is not a receiver.
+        const FluxMap& compute_flux_map(int receiver_id);
+
+        /// power and area-normalized flux on every flat receiver with a TRIANGLE aperture (in element id order)
+        /// and on every face of the meshes (mesh by mesh) from the hit ids of the last run, no hit point is needed.
+        /// Use write_ply / write_csv on the result.
+        const TriangleFlux& compute_triangle_flux();
+
+        /// report the given receiver elements together (e.g. the panels of a multi-panel receiver)
+        /// in the simulation JSON. Throws if an id is not a receiver element.
+        void add_receiver_group(const std::string& name, const std::vector<int>& element_ids);
+
+        /// hits and power of every receiver element, then of every mesh (all its faces), and of every receiver
+        /// group for the last run, computed from a single download of the hit buffers and a single parallel pass
+        const std::vector<ReceiverStats>& compute_receiver_stats();
+        const std::vector<ReceiverGroup>& get_receiver_groups() const { return m_receiver_groups; }
+
+        /// <summary>
+        /// number of contiguous batches the rays of a run are split into for the batched-means standard errors
+        /// reported with the receiver stats, element hit counts and flux maps (default 16, 1 disables them)
+        /// </summary>
+        void set_num_batches(uint32_t num_batches);
+        uint32_t get_num_batches() const { return m_num_batches; }
+
+        /// hits on every element (in element id order) and prototype instance for the last run, with standard errors
+        std::vector<ElementHitStats> compute_element_hit_stats();
+
+        /// <summary>
+        /// interaction path of the receiver hits kept by the flux maps and the receiver and group stats.
+        /// Receiver hits are tagged during the trace, REFLECTED drops the ones straight from the sun
+        /// (sun -> receiver) in the same pass that accumulates the statistics. Mirrors are never tagged
+        /// and element hit stats count every hit whatever the filter. Default ALL.
+        /// </summary>
+        void set_path_filter(PathFilter filter) { m_path_filter = filter; }
+        PathFilter get_path_filter() const { return m_path_filter; }
+
 		std::vector<int> get_receiver_indices();
 
+        /// <summary>
+        /// count, on the device, the fate of the rays of every heliostat (shaded, incident, reflected, blocked,
+        /// receiver, spilled, absorbed), must be set before initialize(). Shading traces one more ray per
+        /// sun ray hitting a heliostat.
+        /// </summary>
+        void set_heliostat_ledger(bool val) { m_use_heliostat_ledger = val; }
+
+        /// one entry per mirror element (in element id order) and per prototype instance for the last run,
+        /// with the cosine factor of its frame. Requires set_heliostat_ledger(true).
+        std::vector<HeliostatLedgerEntry> compute_heliostat_ledger();
+
+        void write_heliostat_ledger(const std::string& filename);
+
 
         /// Explicit cleanup
         void clean_up();
@@ -70,6 +192,25 @@ namespace OptixCSP {
 
         void set_sun_angle(double angle) { m_sun_angle = angle; } // Set the sun angle
 
+        /// <summary>
+        /// order in which the sun plane samples are traced, must be set before initialize().
+        /// MORTON traces neighboring samples in neighboring threads, outputs are the same as with HALTON.
+        /// </summary>
+        void set_sun_sample_order(SunSampleOrder order) { m_sun_sample_order = order; }
+
+        /// <summary>
+        /// trace the rays of a run in num_batches launches of contiguous ray ids, must be set before initialize().
+        /// Batch N+1 is traced while batch N is copied to num_slots reusable pinned staging buffers and reduced
+        /// on a host worker thread, hit buffers on the host are then filled by the end of run().
+        /// 1 (default) traces all the rays in a single launch.
+        /// </summary>
+        void set_launch_batches(uint32_t num_batches, uint32_t num_slots = 2);
+
+        /// <summary>
+        /// host stage run on every launch batch (in order, on the pipeline worker thread) when rays are traced in batches
+        /// </summary>
+        void add_hit_reducer(HitReducer reducer);
+
 
         /// <summary>
         /// compute number of heliostat CspElements added to the system 
@@ -77,7 +218,7 @@ namespace OptixCSP {
         /// <returns></returns>
         size_t get_num_heliostats() const
         {
-            return m_element_list.size() - 1; // Return the number of heliostats (elements) added
+            return m_element_list.size() - 1 + m_instance_list.size(); // Return the number of heliostats (elements and instances) added
         }
 
         /// <summary>
@@ -93,6 +234,91 @@ namespace OptixCSP {
         /// /// </summary>
         void add_element(std::shared_ptr<CspElement> element);
 
+        /// <summary>
+        /// add a root transform group (stage), its elements still need to be added with add_element
+        /// </summary>
+        void add_group(std::shared_ptr<TransformGroup> group);
+
+        const std::vector<std::shared_ptr<TransformGroup>>& get_groups() const { return m_group_list; }
+
+        /// <summary>
+        /// add a prototype shared by identical elements, returns its index for add_instance
+        /// </summary>
+        uint32_t add_prototype(std::shared_ptr<ElementPrototype> prototype);
+
+        /// <summary>
+        /// add an instance of a prototype placed at origin, facing aim_point, zrot in degrees.
+        /// returns the index of the instance
+        /// </summary>
+        uint32_t add_instance(uint32_t prototype, const Vec3d& origin, const Vec3d& aim_point, double zrot = 0.0);
+
+        /// <summary>
+        /// add a triangle mesh receiver, traced as one triangle GAS placed with the pose of the mesh instead of
+        /// one element per face. Face f of mesh m gets its own hit id, see get_mesh_first_hit_id.
+        /// Returns the index of the mesh. Throws if a face references a missing vertex.
+        /// </summary>
+        uint32_t add_mesh(std::shared_ptr<MeshElement> mesh);
+
+        const std::vector<std::shared_ptr<MeshElement>>& get_meshes() const { return m_mesh_list; }
+
+        /// hit id of the first face of mesh m, valid after initialize()
+        uint32_t get_mesh_first_hit_id(uint32_t m) const;
+
+        /// <summary>
+        /// add an optic shared by the elements (read_st_input adds the OPTICS LIST), or replace the one with the
+        /// same name. Returns its index for CspElement::set_optic / ElementPrototype::set_optic.
+        /// </summary>
+        uint16_t add_optic(const Optic& optic);
+
+        /// index of the optic called name, -1 if there is none
+        int find_optic(const std::string& name) const;
+
+        /// <summary>
+        /// change an optic, every element using it sees the change after the next update(). Only the shared
+        /// material records are uploaded again, the elements are not touched.
+        /// </summary>
+        void set_optic(uint16_t index, const Optic& optic);
+
+        /// optics and the deduplicated material records (filled by initialize())
+        const OpticsTable& get_optics_table() const;
+
+        /// <summary>
+        /// move an instance (e.g. heliostat tracking), applied on the next update()
+        /// </summary>
+        void set_instance_pose(uint32_t instance, const Vec3d& origin, const Vec3d& aim_point, double zrot);
+
+        /// <summary>
+        /// enable or disable an element (e.g. a heliostat outage), disabled elements are not hit by any ray.
+        /// Applied on the next update() by uploading a bit mask checked by the intersection programs,
+        /// the geometry is not rebuilt. read_st_input takes the enable flag of the elements from the file.
+        /// </summary>
+        void set_element_enabled(int id, bool enabled);
+        bool is_element_enabled(int id) const;
+
+        /// same for a prototype instance
+        void set_instance_enabled(uint32_t instance, bool enabled);
+        bool is_instance_enabled(uint32_t instance) const;
+
+        /// <summary>
+        /// enable state of everything at once: enabled[i] for element id i, then enabled[number of elements + k]
+        /// for instance k. Throws if the size is not the number of elements plus the number of instances.
+        /// </summary>
+        void set_enabled_mask(const std::vector<bool>& enabled);
+
+        /// <summary>
+        /// store elements on the device sorted by type and position (Morton order) for better memory coherence,
+        /// must be set before initialize(). Element ids and outputs keep the order elements were added in.
+        /// </summary>
+        void set_spatial_ordering(bool val);
+
+        /// <summary>
+        /// element id of each primitive of the element GAS, maps device side geometry indices back to element ids
+        /// </summary>
+        const std::vector<uint32_t>& get_element_order() const;
+
+        const std::vector<std::shared_ptr<ElementPrototype>>& get_prototypes() const { return m_prototype_list; }
+        const std::vector<ElementInstance>& get_instances() const { return m_instance_list; }
+
         double get_time_trace();
         double get_time_setup();
 
@@ -111,17 +337,76 @@ namespace OptixCSP {
 
         OptixCSP::Vec3d m_sun_vector;
         double m_sun_angle;
+        double m_dni = 1000.0;
+        SunSampleOrder m_sun_sample_order = SunSampleOrder::HALTON;
         OptixCSP::SoltraceState m_state;
 
         std::vector<std::shared_ptr<CspElement>> m_element_list;
+        std::vector<std::shared_ptr<TransformGroup>> m_group_list;  // root groups (stages)
+        std::vector<std::shared_ptr<ElementPrototype>> m_prototype_list;
+        std::vector<ElementInstance> m_instance_list;  // compact, one per heliostat
+        std::vector<std::shared_ptr<MeshElement>> m_mesh_list;
+        std::vector<int> m_changed_instances;          // moved since the last update
+        std::vector<bool> m_instance_enabled;          // enable state of every instance
+        std::vector<uint32_t> m_enabled_mask_H;        // last uploaded enable mask, empty if everything is enabled
+
+        // pack the enable state of the elements and instances into one bit per hit id, uploaded if it changed
+        void upload_enabled_mask();
         void create_shader_binding_table();
 
+        // copy hit points and hit ids of the last run to the host, once per run
+        void download_hits();
+
+        // element id, instance, mesh and face of a hit id (not + 1), -1 where it does not apply
+        void resolve_hit_id(uint32_t hit_id, int& element, int& instance, int& mesh, int& face) const;
+
+        FluxMap m_flux_map;
+        TriangleFlux m_triangle_flux;
+        std::vector<ReceiverStats> m_receiver_stats;
+        std::vector<ReceiverGroup> m_receiver_groups;
+        std::vector<float4>   m_hit_points_H;
+        std::vector<uint32_t> m_hit_ids_H;
+        std::vector<float>    m_hit_weights_H;  // weighted rays only
+        bool m_weighted_rays = false;
+        unsigned int m_output_fields = OUTPUT_POSITION;
+        bool m_compact_hits = false;
+        std::vector<uint32_t> m_hit_uv_H;  // compact hits only
+
+        // copy the hit frames of the geometry manager to the device (compact hits)
+        void upload_hit_frames();
+        // fill m_hit_points_H from m_hit_uv_H, sun points are recomputed from the ray ids
+        void decode_hits();
+        uint32_t m_num_batches = 16;
+        PathFilter m_path_filter = PathFilter::ALL;
+
+        // batches of the rays of the current launch
+        BatchLayout get_batch_layout() const;
+
+        // batched launches overlapped with the download and host reduction of the hits
+        uint32_t m_launch_batches = 1;
+        uint32_t m_pipeline_slots = 2;
+        std::vector<HitReducer> m_hit_reducers;
+        std::unique_ptr<ResultPipeline> m_result_pipeline;
+        LaunchParams* m_batch_launch_params_D = nullptr;  // one copy per launch batch, only ray_offset differs
+        cudaStream_t m_copy_stream = 0;
+        std::vector<cudaEvent_t> m_traced_events;  // per pipeline slot
+        std::vector<cudaEvent_t> m_copied_events;  // per pipeline slot
+        void create_result_pipeline();
+        void run_pipelined();
+        double m_roulette_threshold = 0.1;
+        bool m_hits_downloaded = false;
+        bool m_use_heliostat_ledger = false;
+        size_t m_heliostat_ledger_size = 0;  // number of counters
+
+        // refresh cached global frames, returns the ids of the elements that moved
+        std::vector<int> update_transforms(bool force);
+
         // Helper functions to read a stinput file
         bool read_system(FILE* fp);
         bool read_stage(FILE* fp);
-        bool read_element(FILE* fp);
+        bool read_element(FILE* fp, const std::shared_ptr<TransformGroup>& stage);
         bool read_optic(FILE* fp);
-        bool read_optic_surface(FILE* fp);
+        bool read_optic_surface(FILE* fp, OpticalSurface& surface);
         bool read_sun(FILE* fp);
         void read_line(char* buf, int len, FILE* fp);
         std::vector<std::string> split(const std::string& str, const std::string& delim, bool ret_empty, bool ret_delim);
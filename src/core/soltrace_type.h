@@ -17,6 +17,15 @@ namespace OptixCSP {
 		CYLINDER
 	};
 
+	// columns of the hit output, combined into a mask with |
+	enum OutputField : unsigned int {
+		OUTPUT_POSITION  = 1u << 0,  // hit point
+		OUTPUT_DIRECTION = 1u << 1,  // direction the ray leaves the hit with, stored on the device only if requested
+		OUTPUT_ELEMENT   = 1u << 2,  // element id and prototype instance id
+		OUTPUT_WEIGHT    = 1u << 3,  // power carried by the ray at the hit (W)
+		OUTPUT_PATH      = 1u << 4   // 1 if the ray came straight from the sun (sun -> object)
+	};
+
 	// mapping of the surface type combined with the aperture type
 	// for lookup in the sbt mapping
 	struct SurfaceApertureMap {
@@ -0,0 +1,116 @@
+#include "transform_group.h"
+#include "CspElement.h"
+#include "utils/math_util.h"
+#include "utils/parallel_util.h"
+
+using namespace OptixCSP;
+
+TransformGroup::TransformGroup()
+    : m_origin(0.0, 0.0, 0.0),
+      m_aim_point(0.0, 0.0, 1.0),   // identity orientation
+      m_zrot(0.0),
+      m_global_origin(0.0, 0.0, 0.0),
+      m_pose_dirty(true),
+      m_subtree_dirty(false),
+      m_parent(nullptr) {}
+
+TransformGroup::TransformGroup(const Vec3d& origin, const Vec3d& aim_point, double zrot)
+    : TransformGroup() {
+    m_origin = origin;
+    m_aim_point = aim_point;
+    m_zrot = zrot;
+}
+
+void TransformGroup::set_origin(const Vec3d& origin) {
+    m_origin = origin;
+    m_pose_dirty = true;
+    if (m_parent) m_parent->mark_subtree_dirty();
+}
+
+void TransformGroup::set_aim_point(const Vec3d& aim_point) {
+    m_aim_point = aim_point;
+    m_pose_dirty = true;
+    if (m_parent) m_parent->mark_subtree_dirty();
+}
+
+void TransformGroup::set_zrot(double zrot) {
+    m_zrot = zrot;
+    m_pose_dirty = true;
+    if (m_parent) m_parent->mark_subtree_dirty();
+}
+
+void TransformGroup::update_pose(const Vec3d& origin, const Vec3d& aim_point, double zrot) {
+    m_origin = origin;
+    m_aim_point = aim_point;
+    m_zrot = zrot;
+    m_pose_dirty = true;
+    if (m_parent) m_parent->mark_subtree_dirty();
+}
+
+void TransformGroup::add_group(const std::shared_ptr<TransformGroup>& group) {
+    group->m_parent = this;
+    group->m_pose_dirty = true;
+    m_groups.push_back(group);
+    mark_subtree_dirty();
+}
+
+void TransformGroup::add_element(const std::shared_ptr<CspElement>& element) {
+    element->set_group(this);
+    m_elements.push_back(element);
+    mark_subtree_dirty();
+}
+
+void TransformGroup::mark_subtree_dirty() {
+    // stop as soon as we reach a node that is already flagged, its parents are flagged too
+    TransformGroup* node = this;
+    while (node && !node->m_subtree_dirty) {
+        node->m_subtree_dirty = true;
+        node = node->m_parent;
+    }
+}
+
+void TransformGroup::compose_transform() {
+    Vec3d normal = (m_aim_point - m_origin).normalized();
+    Matrix33d rotation_local = get_rotation_matrix_G2L(normal_to_euler(normal, m_zrot)).transpose();
+
+    if (m_parent) {
+        m_rotation_L2G = m_parent->m_rotation_L2G * rotation_local;
+        m_global_origin = m_parent->m_rotation_L2G * m_origin + m_parent->m_global_origin;
+    }
+    else {
+        m_rotation_L2G = rotation_local;
+        m_global_origin = m_origin;
+    }
+}
+
+void TransformGroup::update_transforms(std::vector<int>& changed_ids, bool force) {
+    // nothing moved in this subtree, skip it entirely
+    if (!force && !m_pose_dirty && !m_subtree_dirty) return;
+
+    bool moved = force || m_pose_dirty;
+    if (moved) {
+        compose_transform();
+    }
+
+    // refresh the cached global frames of the members, every member if the group moved,
+    // otherwise only the ones that were edited directly
+    parallel_for(m_elements.size(), [&](size_t i) {
+        CspElement* element = m_elements[i].get();
+        if (moved || element->is_dirty()) {
+            element->update_euler_angles();
+        }
+    }, 256);
+
+    for (const auto& element : m_elements) {
+        if (element->is_dirty() && element->get_id() >= 0) {
+            changed_ids.push_back(element->get_id());
+        }
+    }
+
+    for (const auto& group : m_groups) {
+        group->update_transforms(changed_ids, moved);
+    }
+
+    m_pose_dirty = false;
+    m_subtree_dirty = false;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "vec3d.h"
+
+namespace OptixCSP {
+
+    class CspElement;
+
+    /**
+     * @class TransformGroup
+     * @brief Node of the stage -> group -> element transform hierarchy.
+     *
+     * A group has a pose (origin, aim point, zrot) expressed in the frame of its parent group,
+     * or in the global frame if it is a root (stage). The composed local-to-global transform is cached,
+     * so moving a whole tracking row or a rotating stage is a single update_pose() call followed by
+     * SolTraceSystem::update(). Only the subtrees that were touched since the last update are recomputed.
+     *
+     * Elements added to a group have their origin and aim point interpreted in the group frame,
+     * the same way SolTrace interprets element coordinates in stage coordinates.
+     */
+    class TransformGroup {
+    public:
+        TransformGroup();
+        TransformGroup(const Vec3d& origin, const Vec3d& aim_point, double zrot);
+        ~TransformGroup() = default;
+
+        // pose relative to the parent frame
+        void set_origin(const Vec3d& origin);
+        const Vec3d& get_origin() const { return m_origin; }
+        void set_aim_point(const Vec3d& aim_point);
+        const Vec3d& get_aim_point() const { return m_aim_point; }
+        // zrot in degrees
+        void set_zrot(double zrot);
+        double get_zrot() const { return m_zrot; }
+
+        void update_pose(const Vec3d& origin, const Vec3d& aim_point, double zrot);
+
+        /// attach a child group, its pose becomes relative to this group
+        void add_group(const std::shared_ptr<TransformGroup>& group);
+
+        /// attach an element, its origin and aim point become relative to this group
+        void add_element(const std::shared_ptr<CspElement>& element);
+
+        const std::vector<std::shared_ptr<TransformGroup>>& get_groups() const { return m_groups; }
+        const std::vector<std::shared_ptr<CspElement>>& get_elements() const { return m_elements; }
+        TransformGroup* get_parent() const { return m_parent; }
+
+        /// composed L2G rotation matrix of the group (valid after update_transforms)
+        const Matrix33d& get_rotation_matrix() const { return m_rotation_L2G; }
+        /// composed origin of the group in the global frame (valid after update_transforms)
+        const Vec3d& get_global_origin() const { return m_global_origin; }
+
+        /// true if the pose of this group or anything below it changed since the last update
+        bool is_dirty() const { return m_pose_dirty || m_subtree_dirty; }
+
+        /// flag this subtree as changed, propagates up to the root so the walk can find it
+        void mark_subtree_dirty();
+
+        /// Recompose the cached transforms of the changed subtrees and refresh the global frames
+        /// of the elements below them (in parallel). Untouched subtrees are skipped.
+        /// Ids of the elements whose frame changed are appended to changed_ids.
+        /// @param force recompute everything regardless of the dirty flags (used at initialization)
+        void update_transforms(std::vector<int>& changed_ids, bool force = false);
+
+    private:
+        void compose_transform();
+
+        Vec3d m_origin;
+        Vec3d m_aim_point;
+        double m_zrot;  // degrees
+
+        Matrix33d m_rotation_L2G;  // composed with all parents
+        Vec3d m_global_origin;     // composed with all parents
+
+        bool m_pose_dirty;     // pose of this group changed
+        bool m_subtree_dirty;  // a child group or an element changed
+
+        TransformGroup* m_parent;
+        std::vector<std::shared_ptr<TransformGroup>> m_groups;
+        std::vector<std::shared_ptr<CspElement>> m_elements;
+    };
+}
@@ -0,0 +1,155 @@
+#include "triangle_flux.h"
+#include "receiver_stats.h"
+#include "vec3d.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace OptixCSP;
+
+namespace {
+    Vec3d to_vec3d(const float3& v) { return Vec3d(v.x, v.y, v.z); }
+}
+
+void TriangleFlux::clear() {
+    m_element_ids.clear();
+    m_mesh_ids.clear();
+    m_hit_ids.clear();
+    m_vertices.clear();
+    m_area.clear();
+    m_num_hits.clear();
+    m_power.clear();
+    m_flux.clear();
+    m_peak_flux = 0.0;
+    m_total_area = 0.0;
+    m_total_power = 0.0;
+}
+
+void TriangleFlux::add_face(int element_id, int mesh_id, uint32_t hit_id, const float3& v0, const float3& v1, const float3& v2) {
+    m_element_ids.push_back(element_id);
+    m_mesh_ids.push_back(mesh_id);
+    m_hit_ids.push_back(hit_id);
+    m_vertices.push_back(v0);
+    m_vertices.push_back(v1);
+    m_vertices.push_back(v2);
+
+    Vec3d e1 = to_vec3d(v1) - to_vec3d(v0);
+    Vec3d e2 = to_vec3d(v2) - to_vec3d(v0);
+    m_area.push_back(0.5 * e1.cross(e2).norm());
+}
+
+void TriangleFlux::accumulate(const std::vector<uint32_t>& hit_ids,
+    size_t num_hit_ids,
+    double power_per_ray,
+    const std::vector<float>& hit_weights,
+    PathFilter filter) {
+
+    const size_t num_faces = m_element_ids.size();
+
+    // face of every hit id, keyed by primitive index
+    std::vector<int32_t> hit_to_face(num_hit_ids, -1);
+    for (size_t f = 0; f < num_faces; f++) {
+        hit_to_face[m_hit_ids[f]] = static_cast<int32_t>(f);
+    }
+
+    // a single batch: one private counter and power entry per face and host thread
+    std::vector<double> power;
+    count_receiver_hits(hit_ids, hit_weights, hit_to_face, num_faces, BatchLayout(), filter, m_num_hits, power);
+
+    // unweighted rays all carry the same power
+    const double scale = hit_weights.empty() ? power_per_ray : 1.0;
+    m_power.resize(num_faces);
+    m_flux.resize(num_faces);
+    m_peak_flux = 0.0;
+    m_total_area = 0.0;
+    m_total_power = 0.0;
+    for (size_t f = 0; f < num_faces; f++) {
+        m_power[f] = power[f] * scale;
+        m_flux[f] = (m_area[f] > 0.0) ? m_power[f] / m_area[f] : 0.0;
+        m_peak_flux = std::max(m_peak_flux, m_flux[f]);
+        m_total_area += m_area[f];
+        m_total_power += m_power[f];
+    }
+}
+
+void TriangleFlux::write_ply(const std::string& filename) const {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Error: Could not open the file " << filename << " for writing." << std::endl;
+        return;
+    }
+
+    const size_t num_faces = m_element_ids.size();
+    out << "ply\n"
+        << "format binary_little_endian 1.0\n"
+        << "comment OptixCSP per-face receiver flux, power in W, flux in W/m2\n"
+        << "element vertex " << m_vertices.size() << "\n"
+        << "property float x\n"
+        << "property float y\n"
+        << "property float z\n"
+        << "element face " << num_faces << "\n"
+        << "property list uchar int vertex_indices\n"
+        << "property int element\n"
+        << "property int mesh\n"
+        << "property uint hits\n"
+        << "property float power\n"
+        << "property float flux\n"
+        << "end_header\n";
+
+    for (const float3& v : m_vertices) {
+        float xyz[3] = { v.x, v.y, v.z };
+        out.write(reinterpret_cast<const char*>(xyz), sizeof(xyz));
+    }
+
+    // packed face record: vertex count, 3 indices, element, mesh, hits, power, flux
+    char record[1 + 3 * sizeof(int32_t) + 2 * sizeof(int32_t) + sizeof(uint32_t) + 2 * sizeof(float)];
+    for (size_t f = 0; f < num_faces; f++) {
+        const unsigned char count = 3;
+        int32_t indices[3] = { static_cast<int32_t>(3 * f), static_cast<int32_t>(3 * f + 1), static_cast<int32_t>(3 * f + 2) };
+        int32_t element = m_element_ids[f];
+        int32_t mesh = m_mesh_ids[f];
+        uint32_t hits = f < m_num_hits.size() ? static_cast<uint32_t>(m_num_hits[f]) : 0u;
+        float power = f < m_power.size() ? static_cast<float>(m_power[f]) : 0.0f;
+        float flux = f < m_flux.size() ? static_cast<float>(m_flux[f]) : 0.0f;
+
+        char* p = record;
+        std::memcpy(p, &count, 1);                  p += 1;
+        std::memcpy(p, indices, sizeof(indices));   p += sizeof(indices);
+        std::memcpy(p, &element, sizeof(element));  p += sizeof(element);
+        std::memcpy(p, &mesh, sizeof(mesh));        p += sizeof(mesh);
+        std::memcpy(p, &hits, sizeof(hits));        p += sizeof(hits);
+        std::memcpy(p, &power, sizeof(power));      p += sizeof(power);
+        std::memcpy(p, &flux, sizeof(flux));
+        out.write(record, sizeof(record));
+    }
+
+    std::cout << "Data successfully written to " << filename << std::endl;
+}
+
+void TriangleFlux::write_csv(const std::string& filename) const {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Error: Could not open the file " << filename << " for writing." << std::endl;
+        return;
+    }
+
+    out << "# num_faces," << m_element_ids.size() << "\n";
+    out << "# total_area," << m_total_area << "\n";
+    out << "# total_power," << m_total_power << "\n";
+    out << "# peak_flux," << m_peak_flux << "\n";
+    out << "# mean_flux," << (m_total_area > 0.0 ? m_total_power / m_total_area : 0.0) << "\n";
+    out << "face,element,mesh,area,hits,power,flux\n";
+
+    for (size_t f = 0; f < m_element_ids.size(); f++) {
+        out << f << "," << m_element_ids[f] << "," << m_mesh_ids[f] << "," << m_area[f] << ","
+            << (f < m_num_hits.size() ? m_num_hits[f] : 0) << ","
+            << (f < m_power.size() ? m_power[f] : 0.0) << ","
+            << (f < m_flux.size() ? m_flux[f] : 0.0) << "\n";
+    }
+
+    out.close();
+    std::cout << "Data successfully written to " << filename << std::endl;
+}
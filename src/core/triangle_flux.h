@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vector_types.h>
+
+#include "hit_path.h"
+
+namespace OptixCSP {
+
+    /**
+     * @class TriangleFlux
+     * @brief Receiver flux accumulated per face of a triangle mesh receiver.
+     *
+     * Every face is one flat triangle receiver, hits are binned by the hit id (primitive index) of the face
+     * instead of by position, so no hit point is needed. The flux of a face is its power divided by its area.
+     * Every hit carries power_per_ray = DNI * sun plane area / number of rays, or its weight (weighted rays).
+     */
+    class TriangleFlux {
+    public:
+        TriangleFlux() = default;
+
+        /// reset the faces, one per element id (or face of a mesh, element_id -1) with its global vertices
+        /// (front side by the right-hand rule) and the hit id of its primitive
+        void clear();
+        void add_face(int element_id, int mesh_id, uint32_t hit_id, const float3& v0, const float3& v1, const float3& v2);
+
+        /// reset the face totals and accumulate the hits of a run in one parallel pass, with private
+        /// per-thread accumulators merged at the end. hit_ids follows the device hit_element_buffer
+        /// (hit id + 1, 0 for empty slots), num_hit_ids is the number of hit ids of the scene.
+        /// Only hits whose path matches filter are accumulated.
+        void accumulate(const std::vector<uint32_t>& hit_ids,
+            size_t num_hit_ids,
+            double power_per_ray,
+            const std::vector<float>& hit_weights = {},
+            PathFilter filter = PathFilter::ALL);
+
+        size_t get_num_faces() const { return m_element_ids.size(); }
+        int get_element_id(size_t face) const { return m_element_ids[face]; }
+        int get_mesh_id(size_t face) const { return m_mesh_ids[face]; }
+        const std::vector<float3>& get_vertices() const { return m_vertices; }  // 3 per face
+
+        const std::vector<double>& get_area() const { return m_area; }         // m2
+        const std::vector<uint64_t>& get_num_hits() const { return m_num_hits; }
+        const std::vector<double>& get_power() const { return m_power; }       // W
+        const std::vector<double>& get_flux() const { return m_flux; }         // W/m2
+
+        double get_peak_flux() const { return m_peak_flux; }
+        double get_total_area() const { return m_total_area; }
+        double get_total_power() const { return m_total_power; }
+
+        /// binary little-endian PLY: 3 vertices per face (float x, y, z), then the faces with the
+        /// properties element (int), mesh (int), hits (uint), power (float, W) and flux (float, W/m2)
+        void write_ply(const std::string& filename) const;
+
+        /// totals as # comment lines, then one row per face:
+        /// face,element,mesh,area,hits,power,flux
+        void write_csv(const std::string& filename) const;
+
+    private:
+        std::vector<int>      m_element_ids;
+        std::vector<int>      m_mesh_ids;
+        std::vector<uint32_t> m_hit_ids;
+        std::vector<float3>   m_vertices;
+        std::vector<double>   m_area;
+
+        std::vector<uint64_t> m_num_hits;
+        std::vector<double>   m_power;
+        std::vector<double>   m_flux;
+        double m_peak_flux = 0.0;
+        double m_total_area = 0.0;
+        double m_total_power = 0.0;
+    };
+}
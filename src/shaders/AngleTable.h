@@ -0,0 +1,19 @@
+#pragma once
+#include "device_util.h"
+
+namespace OptixCSP {
+
+    // Reflectivity and transmissivity against the incidence angle are resampled when the optic is loaded
+    // (see OpticsTable) on a uniform grid of cos(theta): sample i is the value at cos(theta) = i / (ANGLE_TABLE_SIZE - 1).
+    // A lookup is one multiply and one linear interpolation, instead of a search through the tabulated angles.
+    // The grid is finest at grazing incidence; near normal incidence the first cell spans acos(1 - 1/1023) = 44 mrad.
+    static constexpr unsigned int ANGLE_TABLE_SIZE = 1024;
+
+    INLINE HOSTDEVICE float lookup_angle_table(const float* table, float cos_theta)
+    {
+        const float x = fminf(fmaxf(cos_theta, 0.0f), 1.0f) * static_cast<float>(ANGLE_TABLE_SIZE - 1);
+        const unsigned int i = x < static_cast<float>(ANGLE_TABLE_SIZE - 2) ? static_cast<unsigned int>(x) : ANGLE_TABLE_SIZE - 2;
+        const float t = x - static_cast<float>(i);
+        return table[i] + t * (table[i + 1] - table[i]);
+    }
+}
@@ -0,0 +1,178 @@
+#pragma once
+#include "device_util.h"
+#include "PackedGeometry.h"
+
+namespace OptixCSP {
+
+    // Quantized hit points: a hit is stored as 16-bit (u, v) coordinates in the frame of the object it hit
+    // instead of a global float4, 4 bytes instead of 16. The object (hit id) and the stage are already known
+    // from hit_element_buffer and from the slot of the hit in the buffer.
+    //
+    // Error bounds, with Q = 65535 quantization steps over each extent:
+    //   - planes and paraboloids: |du| <= width / (2 Q), |dv| <= height / (2 Q), e.g. 0.08 mm on a 10 m heliostat.
+    //     The decoded point lies on the surface; on a paraboloid its height error is the slope times the above.
+    //   - cylinders: arc length error <= pi * radius / Q, axial error <= height / (2 Q), radial error 0.
+    //     Hits on the caps are decoded onto the rim of the side surface.
+    //   - triangles use the bounding rectangle of the triangle in its plane.
+    //   - faceted prototypes (more than one facet) share one hit id per instance, so their hits use one flat frame
+    //     over the x, y extent of all the facets, in the mid plane of their bounding box (z = 0 for facets centered
+    //     in the plane of the prototype). u and v are bounded as for planes over that extent, but the decoded point
+    //     is on that plane, not on the facet: its error along the prototype normal is up to half the z depth of the
+    //     facet bounding box, i.e. half the facet diagonal times the sine of the largest canting angle plus the sag
+    //     of curved facets. E.g. 1.2 m facets canted on axis for 500 m on a 10 m heliostat: tilts up to 6.2 mrad,
+    //     about 5 mm. Keep the float4 hit points (no compact hits) where that matters.
+    // The distance to the true point is bounded by the root sum of squares of the per-axis bounds, plus the float
+    // rounding of the frame (~1e-7 relative to the distance from the world origin). Points outside the extent are
+    // clamped to its border.
+
+    enum HitFrameShape : unsigned int {
+        HIT_FRAME_PLANE = 0,    // u, v along basis_x, basis_y, height curv_x / 2 u^2 + curv_y / 2 v^2 along basis_z
+        HIT_FRAME_CYLINDER = 1  // u is the angle around basis_y from basis_x towards basis_z, v along basis_y
+    };
+
+    struct HitFrame
+    {
+        float3 origin;      // center of the extent
+        float3 basis_x;
+        float3 basis_y;
+        float3 basis_z;
+        float  extent_u;    // width, unused on cylinders (full turn)
+        float  extent_v;    // height
+        float  radius;      // cylinders
+        float  curv_x;      // paraboloids, 0 on flat surfaces
+        float  curv_y;
+        unsigned int shape;
+    };
+
+    static constexpr float HIT_UV_STEPS = 65535.0f;
+
+    INLINE HOSTDEVICE unsigned int quantize_hit_coordinate(float t)
+    {
+        t = fminf(fmaxf(t, 0.0f), 1.0f);
+        return static_cast<unsigned int>(t * HIT_UV_STEPS + 0.5f);
+    }
+
+    /// u in the high 16 bits, v in the low 16 bits
+    INLINE HOSTDEVICE unsigned int encode_hit_uv(const HitFrame& f, const float3& p)
+    {
+        const float3 d = p - f.origin;
+        float u;
+        if (f.shape == HIT_FRAME_CYLINDER) {
+            u = (atan2f(dot(d, f.basis_z), dot(d, f.basis_x)) + M_PIf) / (2.0f * M_PIf);
+        }
+        else {
+            u = dot(d, f.basis_x) / f.extent_u + 0.5f;
+        }
+        const float v = dot(d, f.basis_y) / f.extent_v + 0.5f;
+        return (quantize_hit_coordinate(u) << 16) | quantize_hit_coordinate(v);
+    }
+
+    INLINE HOSTDEVICE float3 decode_hit_uv(const HitFrame& f, unsigned int uv)
+    {
+        const float u = static_cast<float>(uv >> 16) / HIT_UV_STEPS;
+        const float y = (static_cast<float>(uv & 0xFFFFu) / HIT_UV_STEPS - 0.5f) * f.extent_v;
+        if (f.shape == HIT_FRAME_CYLINDER) {
+            const float theta = u * 2.0f * M_PIf - M_PIf;
+            return f.origin + (f.radius * cosf(theta)) * f.basis_x + y * f.basis_y + (f.radius * sinf(theta)) * f.basis_z;
+        }
+        const float x = (u - 0.5f) * f.extent_u;
+        const float z = 0.5f * (f.curv_x * x * x + f.curv_y * y * y);
+        return f.origin + x * f.basis_x + y * f.basis_y + z * f.basis_z;
+    }
+
+    INLINE HOSTDEVICE HitFrame make_hit_frame(const PackedRectangleFlat& r)
+    {
+        HitFrame f = {};
+        f.origin = r.center;
+        f.basis_x = r.x;
+        f.basis_y = r.y;
+        f.basis_z = r.normal;
+        f.extent_u = 2.0f * r.half_width;
+        f.extent_v = 2.0f * r.half_height;
+        f.shape = HIT_FRAME_PLANE;
+        return f;
+    }
+
+    INLINE HOSTDEVICE HitFrame make_hit_frame(const PackedRectangleParabolic& r)
+    {
+        HitFrame f = {};
+        f.origin = r.center;
+        f.basis_x = r.e1;
+        f.basis_y = r.e2;
+        f.basis_z = r.normal;
+        f.extent_u = 2.0f * r.half_l1;
+        f.extent_v = 2.0f * r.half_l2;
+        f.curv_x = r.curv_x;
+        f.curv_y = r.curv_y;
+        f.shape = HIT_FRAME_PLANE;
+        return f;
+    }
+
+    INLINE HOSTDEVICE HitFrame make_hit_frame(const PackedCylinderY& c)
+    {
+        HitFrame f = {};
+        f.origin = c.center;
+        f.basis_x = c.base_x;
+        f.basis_y = c.base_y;
+        f.basis_z = c.base_z;
+        f.extent_u = 2.0f * M_PIf * c.radius;
+        f.extent_v = 2.0f * c.half_height;
+        f.radius = c.radius;
+        f.shape = HIT_FRAME_CYLINDER;
+        return f;
+    }
+
+    // bounding rectangle of the triangle, u along the first edge
+    INLINE HOSTDEVICE HitFrame make_hit_frame(const PackedTriangleFlat& t)
+    {
+        HitFrame f = {};
+        f.basis_x = normalize(t.e1);
+        f.basis_z = t.normal;
+        f.basis_y = cross(f.basis_z, f.basis_x);
+
+        const float x1 = dot(t.e1, f.basis_x), y1 = dot(t.e1, f.basis_y);
+        const float x2 = dot(t.e2, f.basis_x), y2 = dot(t.e2, f.basis_y);
+        const float min_x = fminf(0.0f, fminf(x1, x2)), max_x = fmaxf(0.0f, fmaxf(x1, x2));
+        const float min_y = fminf(0.0f, fminf(y1, y2)), max_y = fmaxf(0.0f, fmaxf(y1, y2));
+
+        f.origin = t.v0 + (0.5f * (min_x + max_x)) * f.basis_x + (0.5f * (min_y + max_y)) * f.basis_y;
+        f.extent_u = fmaxf(max_x - min_x, 1e-6f);
+        f.extent_v = fmaxf(max_y - min_y, 1e-6f);
+        f.shape = HIT_FRAME_PLANE;
+        return f;
+    }
+
+    // flat frame over the x, y extent of a box, in its mid plane: the frame of a faceted prototype over the
+    // bounding box of its facets (local frame of the prototype)
+    INLINE HOSTDEVICE HitFrame make_bounding_hit_frame(const float3& box_min, const float3& box_max)
+    {
+        HitFrame f = {};
+        f.origin = 0.5f * (box_min + box_max);
+        f.basis_x = make_float3(1.0f, 0.0f, 0.0f);
+        f.basis_y = make_float3(0.0f, 1.0f, 0.0f);
+        f.basis_z = make_float3(0.0f, 0.0f, 1.0f);
+        f.extent_u = box_max.x - box_min.x;
+        f.extent_v = box_max.y - box_min.y;
+        f.shape = HIT_FRAME_PLANE;
+        return f;
+    }
+
+    // rotation part of a row-major 3x4 transform applied to v
+    INLINE HOSTDEVICE float3 rotate_by_transform(const float* m, const float3& v)
+    {
+        return make_float3(m[0] * v.x + m[1] * v.y + m[2] * v.z,
+                           m[4] * v.x + m[5] * v.y + m[6] * v.z,
+                           m[8] * v.x + m[9] * v.y + m[10] * v.z);
+    }
+
+    // frame of a prototype placed by a row-major 3x4 object to world transform (rotation and translation)
+    INLINE HOSTDEVICE HitFrame transform_hit_frame(const HitFrame& local, const float* m)
+    {
+        HitFrame f = local;
+        f.origin = rotate_by_transform(m, local.origin) + make_float3(m[3], m[7], m[11]);
+        f.basis_x = rotate_by_transform(m, local.basis_x);
+        f.basis_y = rotate_by_transform(m, local.basis_y);
+        f.basis_z = rotate_by_transform(m, local.basis_z);
+        return f;
+    }
+}
@@ -0,0 +1,253 @@
+#pragma once
+#include "device_util.h"
+#include "PackedGeometry.h"
+
+namespace OptixCSP {
+
+    // Ray intersection of the packed primitives, shared by the intersection programs (intersection.cu)
+    // and the host tests. Ray and geometry are given in the same frame (object space of the GAS).
+    // Each function returns true on a hit within the ray interval and sets t and the (unit) normal.
+
+    INLINE HOSTDEVICE bool intersect_rectangle_flat(const PackedRectangleFlat& rectangle, const float3& ray_orig, const float3& ray_dir,
+        float ray_tmin, float ray_tmax, float& t, float3& normal)
+    {
+        // Get plane normal and distance
+        const float3 n = rectangle.normal;
+        const float dt = dot(ray_dir, n);
+
+        // Compute distance t (point of intersection) along ray direction from ray origin
+        t = (rectangle.d - dot(n, ray_orig)) / dt;
+
+        // Verify intersection distance
+        if (!(t > ray_tmin && t < ray_tmax)) return false;
+
+        // Project the vector from the center to the intersection point onto x and y to get local coordinates
+        const float3 v = ray_orig + ray_dir * t - rectangle.center;
+        const float x = dot(rectangle.x, v);
+        const float y = dot(rectangle.y, v);
+
+        // Check if point is within rectangle bounds
+        if (x >= -rectangle.half_width && x <= rectangle.half_width &&
+            y >= -rectangle.half_height && y <= rectangle.half_height)
+        {
+            normal = n;
+            return true;
+        }
+        return false;
+    }
+
+    // ray in the local frame of the cylinder (axis along y)
+    INLINE HOSTDEVICE void cylinder_local_ray(const PackedCylinderY& cyl, const float3& ray_orig, const float3& ray_dir,
+        float3& local_ray_orig, float3& local_ray_dir)
+    {
+        const float3 d = ray_orig - cyl.center;
+        local_ray_orig = make_float3(dot(d, cyl.base_x), dot(d, cyl.base_y), dot(d, cyl.base_z));
+        local_ray_dir = make_float3(dot(ray_dir, cyl.base_x), dot(ray_dir, cyl.base_y), dot(ray_dir, cyl.base_z));
+    }
+
+    // open cylinder, the direction is normalized first so t is a distance
+    INLINE HOSTDEVICE bool intersect_cylinder_y(const PackedCylinderY& cyl, const float3& ray_orig, const float3& ray_dir_in,
+        float ray_tmin, float ray_tmax, float& t, float3& normal)
+    {
+        const float3 ray_dir = normalize(ray_dir_in);
+        float3 local_ray_orig, local_ray_dir;
+        cylinder_local_ray(cyl, ray_orig, ray_dir, local_ray_orig, local_ray_dir);
+
+        // solve quadratic equation for intersection
+        const float A = local_ray_dir.x * local_ray_dir.x + local_ray_dir.z * local_ray_dir.z;
+        const float B = 2.0f * (local_ray_orig.x * local_ray_dir.x + local_ray_orig.z * local_ray_dir.z);
+        const float C = local_ray_orig.x * local_ray_orig.x + local_ray_orig.z * local_ray_orig.z - cyl.radius * cyl.radius;
+
+        const float determinant = B * B - 4.0f * A * C;
+        if (determinant < 0.0f) return false;
+
+        // Compute intersection distances
+        const float t1 = (-B - sqrtf(determinant)) / (2.0f * A);
+        const float t2 = (-B + sqrtf(determinant)) / (2.0f * A);
+
+        t = t1 > 0.0f ? t1 : t2; // Use the closer valid intersection
+        if (t < ray_tmin || t > ray_tmax) return false;
+
+        // Check if the hit point is within the cylinder's height bounds, otherwise try t2
+        float3 local_hit_point = local_ray_orig + t * local_ray_dir;
+        if (fabsf(local_hit_point.y) > cyl.half_height)
+        {
+            t = t2;
+            local_hit_point = local_ray_orig + t * local_ray_dir;
+            if (t < ray_tmin || t > ray_tmax || fabsf(local_hit_point.y) > cyl.half_height) return false;
+        }
+
+        // Normal in local coordinates, transformed back to object coordinates
+        const float3 local_normal = normalize(make_float3(local_hit_point.x, 0.0f, local_hit_point.z));
+        normal = local_normal.x * cyl.base_x + local_normal.y * cyl.base_y + local_normal.z * cyl.base_z;
+        return true;
+    }
+
+    // cylinder closed by its top and bottom disks, the direction is normalized first so t is a distance
+    INLINE HOSTDEVICE bool intersect_cylinder_y_capped(const PackedCylinderY& cyl, const float3& ray_orig, const float3& ray_dir_in,
+        float ray_tmin, float ray_tmax, float& t, float3& normal)
+    {
+        const float3 ray_dir = normalize(ray_dir_in);
+        float3 local_ray_orig, local_ray_dir;
+        cylinder_local_ray(cyl, ray_orig, ray_dir, local_ray_orig, local_ray_dir);
+
+        // Solve quadratic equation for intersection with curved surface
+        const float A = local_ray_dir.x * local_ray_dir.x + local_ray_dir.z * local_ray_dir.z;
+        const float B = 2.0f * (local_ray_orig.x * local_ray_dir.x + local_ray_orig.z * local_ray_dir.z);
+        const float C = local_ray_orig.x * local_ray_orig.x + local_ray_orig.z * local_ray_orig.z - cyl.radius * cyl.radius;
+
+        const float determinant = B * B - 4.0f * A * C;
+
+        float t_curved = ray_tmax + 1.0f; // Initialize to invalid
+        if (determinant >= 0.0f)
+        {
+            const float t1 = (-B - sqrtf(determinant)) / (2.0f * A);
+            const float t2 = (-B + sqrtf(determinant)) / (2.0f * A);
+
+            // Select the closest valid intersection within bounds
+            if (t1 > ray_tmin && t1 < ray_tmax && fabsf(local_ray_orig.y + t1 * local_ray_dir.y) <= cyl.half_height)
+            {
+                t_curved = t1;
+            }
+            else if (t2 > ray_tmin && t2 < ray_tmax && fabsf(local_ray_orig.y + t2 * local_ray_dir.y) <= cyl.half_height)
+            {
+                t_curved = t2;
+            }
+        }
+
+        // Check intersection with the bottom (y = -half_height) and top (y = +half_height) caps
+        float t_caps = ray_tmax + 1.0f;
+        if (fabsf(local_ray_dir.y) > 1e-6f) // Avoid division by zero
+        {
+            const float t_bottom = (-cyl.half_height - local_ray_orig.y) / local_ray_dir.y;
+            const float2 bottom = make_float2(local_ray_orig.x + t_bottom * local_ray_dir.x, local_ray_orig.z + t_bottom * local_ray_dir.z);
+            if (t_bottom > ray_tmin && t_bottom < ray_tmax && dot(bottom, bottom) <= cyl.radius * cyl.radius)
+            {
+                t_caps = t_bottom;
+            }
+
+            const float t_top = (cyl.half_height - local_ray_orig.y) / local_ray_dir.y;
+            const float2 top = make_float2(local_ray_orig.x + t_top * local_ray_dir.x, local_ray_orig.z + t_top * local_ray_dir.z);
+            if (t_top > ray_tmin && t_top < ray_tmax && dot(top, top) <= cyl.radius * cyl.radius)
+            {
+                t_caps = fminf(t_caps, t_top);
+            }
+        }
+
+        // Use the closest valid intersection
+        t = fminf(t_curved, t_caps);
+        if (t >= ray_tmax || t <= ray_tmin) return false;
+
+        const float3 local_hit_point = local_ray_orig + t * local_ray_dir;
+        float3 local_normal;
+        if (t == t_curved)
+        {
+            // Hit on the curved surface
+            local_normal = normalize(make_float3(local_hit_point.x, 0.0f, local_hit_point.z));
+        }
+        else
+        {
+            // Hit on one of the caps
+            local_normal = make_float3(0.0f, copysignf(1.0f, local_hit_point.y), 0.0f);
+        }
+        normal = local_normal.x * cyl.base_x + local_normal.y * cyl.base_y + local_normal.z * cyl.base_z;
+        return true;
+    }
+
+    // Parabolic surface over a rectangle aperture. In the local frame of the rectangle (origin at its center,
+    // x and y along the unit edges e1 and e2, z along the flat normal) the surface is
+    //    z = (curv_x/2)*x^2 + (curv_y/2)*y^2
+    // and the ray (ox,oy,oz) + t*(dx,dy,dz) gives the quadratic A*t^2 + B*t + C = 0. The smallest positive
+    // root must lie within the ray interval and its (x, y) within the half extents. The normal follows from
+    // the derivatives f_x = curv_x * x and f_y = curv_y * y: (-f_x, -f_y, 1) in the local frame.
+    INLINE HOSTDEVICE bool intersect_rectangle_parabolic(const PackedRectangleParabolic& rect, const float3& ray_orig, const float3& ray_dir,
+        float ray_tmin, float ray_tmax, float& t, float3& normal)
+    {
+        const float3 d = ray_orig - rect.center;
+        const float ox = dot(d, rect.e1);
+        const float oy = dot(d, rect.e2);
+        const float oz = dot(d, rect.normal);
+
+        const float dx = dot(ray_dir, rect.e1);
+        const float dy = dot(ray_dir, rect.e2);
+        const float dz = dot(ray_dir, rect.normal);
+
+        const float curv_x = rect.curv_x;
+        const float curv_y = rect.curv_y;
+
+        const float A = (curv_x * 0.5f) * (dx * dx) + (curv_y * 0.5f) * (dy * dy);
+        const float B = curv_x * (ox * dx) + curv_y * (oy * dy) - dz;
+        const float C = (curv_x * 0.5f) * (ox * ox) + (curv_y * 0.5f) * (oy * oy) - oz;
+
+        t = 0.0f;
+        const float eps = 1e-12f;
+        bool valid = false;
+
+        if (fabsf(A) < eps) {
+            // Degenerate (linear) case.
+            t = -C / B;
+            valid = (t > 0.0f);
+        }
+        else {
+            const float discr = B * B - 4.0f * A * C;
+            if (discr >= 0.0f) {
+                const float sqrt_discr = sqrtf(discr);
+                const float t1 = (-B - sqrt_discr) / (2.0f * A);
+                const float t2 = (-B + sqrt_discr) / (2.0f * A);
+                // Choose the smallest positive t.
+                if (t1 > 0.0f && t1 < t2) {
+                    t = t1;
+                    valid = true;
+                }
+                else if (t2 > 0.0f) {
+                    t = t2;
+                    valid = true;
+                }
+            }
+        }
+
+        // Discard if no valid t or if t is not within the ray's bounds.
+        if (!valid || t < ray_tmin || t > ray_tmax) return false;
+
+        // Check if the hit is within the rectangle's flat bounds.
+        const float x_hit = ox + t * dx;
+        const float y_hit = oy + t * dy;
+        const float a1 = x_hit / rect.half_l1;
+        const float a2 = y_hit / rect.half_l2;
+        if (a1 < -1.0f || a1 > 1.0f || a2 < -1.0f || a2 > 1.0f) return false;
+
+        // Normal of the paraboloid, transformed back to object coordinates.
+        const float3 n_local = normalize(make_float3(-curv_x * x_hit, -curv_y * y_hit, 1.0f));
+        normal = normalize(n_local.x * rect.e1 + n_local.y * rect.e2 + n_local.z * rect.normal);
+        return true;
+    }
+
+    // flat triangle, "Fast, Minimum Storage Ray/Triangle Intersection" by Moller and Trumbore (1997),
+    // only the front face is hit
+    INLINE HOSTDEVICE bool intersect_triangle_flat(const PackedTriangleFlat& tri, const float3& ro, const float3& rd,
+        float ray_tmin, float ray_tmax, float& t, float3& normal)
+    {
+        const float3 pvec = cross(rd, tri.e2);
+        const float  det = dot(tri.e1, pvec);
+
+        // Backface culling + parallel rejection (det must be strictly positive and not tiny)
+        const float eps = 1e-8f;
+        if (det <= eps) return false;
+
+        const float inv_det = 1.0f / det;
+
+        const float3 tvec = ro - tri.v0;
+        const float  u = dot(tvec, pvec) * inv_det;
+        if (u < 0.0f || u > 1.0f) return false;
+
+        const float3 qvec = cross(tvec, tri.e1);
+        const float  v = dot(rd, qvec) * inv_det;
+        if (v < 0.0f || (u + v) > 1.0f) return false;
+
+        t = dot(tri.e2, qvec) * inv_det;
+        if (t < ray_tmin || t > ray_tmax) return false;
+
+        normal = tri.normal;
+        return true;
+    }
+}
@@ -8,8 +8,15 @@ namespace OptixCSP
     {
         float reflectivity;
         float transmissivity;
-        float slope_error;
-        float specularity_error;
+        float slope_error;          // mrad, see SurfaceError.h
+        float specularity_error;    // mrad
 		bool  use_refraction;  // todo: for now, the ray goes through the object if true, otherwise it reflects
+        // offsets in LaunchParams::angle_tables of the values against the incidence angle (see AngleTable.h)
+        // replacing reflectivity and transmissivity, -1 if constant. Either way unweighted rays are absorbed at
+        // random with probability 1 - value and weighted rays are scaled by the value.
+        int   reflectivity_table = -1;
+        int   transmissivity_table = -1;
+        // ErrorDistribution of slope_error and specularity_error
+        unsigned int error_distribution = 0;
     };
 }   
\ No newline at end of file
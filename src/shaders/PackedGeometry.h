@@ -0,0 +1,105 @@
+#pragma once
+#include "device_util.h"
+#include "GeometryDataST.h"
+
+namespace OptixCSP {
+
+    // Geometry sent to the device, one densely packed array per primitive type instead of one
+    // GeometryDataST union per element. Quantities the intersection programs would otherwise
+    // recompute on every call (unit edges, normals, half extents) are precomputed on the host.
+    // LaunchParams::geometry_slot maps the geometry index of a hit to the slot in the array of its type.
+
+    struct PackedRectangleFlat
+    {
+        float3 center;
+        float3 x;           // unit edge directions
+        float3 y;
+        float3 normal;      // normalize(cross(x, y))
+        float  d;           // plane distance, dot(normal, center)
+        float  half_width;
+        float  half_height;
+    };
+
+    struct PackedRectangleParabolic
+    {
+        float3 center;      // center of the flat (projected) rectangle
+        float3 e1;          // unit edge directions
+        float3 e2;
+        float3 normal;      // normalize(cross(e2, e1))
+        float  half_l1;     // half edge lengths
+        float  half_l2;
+        float  curv_x;
+        float  curv_y;
+    };
+
+    struct PackedCylinderY
+    {
+        float3 center;
+        float3 base_x;      // local frame, base_y = cross(base_z, base_x)
+        float3 base_y;
+        float3 base_z;
+        float  radius;
+        float  half_height;
+    };
+
+    struct PackedTriangleFlat
+    {
+        float3 v0;          // base vertex
+        float3 e1;          // edges
+        float3 e2;
+        float3 normal;
+    };
+
+    INLINE HOSTDEVICE PackedRectangleFlat pack_geometry(const GeometryDataST::Rectangle_Flat& r)
+    {
+        PackedRectangleFlat p;
+        p.center = r.center;
+        p.x = r.x;
+        p.y = r.y;
+        p.normal = make_float3(r.plane);
+        p.d = r.plane.w;
+        p.half_width = r.width / 2;
+        p.half_height = r.height / 2;
+        return p;
+    }
+
+    // Rectangle_Parabolic stores v1 and v2 scaled by the inverse of their squared length
+    INLINE HOSTDEVICE PackedRectangleParabolic pack_geometry(const GeometryDataST::Rectangle_Parabolic& r)
+    {
+        float l1 = 1.0f / length(r.v1);
+        float l2 = 1.0f / length(r.v2);
+
+        PackedRectangleParabolic p;
+        p.e1 = r.v1 * l1;
+        p.e2 = r.v2 * l2;
+        p.normal = normalize(cross(p.e2, p.e1));
+        p.center = r.anchor + (l1 / 2.0f) * p.e1 + (l2 / 2.0f) * p.e2;
+        p.half_l1 = l1 / 2.0f;
+        p.half_l2 = l2 / 2.0f;
+        p.curv_x = r.curv_x;
+        p.curv_y = r.curv_y;
+        return p;
+    }
+
+    INLINE HOSTDEVICE PackedCylinderY pack_geometry(const GeometryDataST::Cylinder_Y& c)
+    {
+        PackedCylinderY p;
+        p.center = c.center;
+        p.base_x = c.base_x;
+        p.base_y = cross(c.base_z, c.base_x);
+        p.base_z = c.base_z;
+        p.radius = c.radius;
+        p.half_height = c.half_height;
+        return p;
+    }
+
+    INLINE HOSTDEVICE PackedTriangleFlat pack_geometry(const GeometryDataST::Triangle_Flat& t)
+    {
+        PackedTriangleFlat p;
+        p.v0 = t.v0;
+        p.e1 = t.e1;
+        p.e2 = t.e2;
+        p.normal = t.normal;
+        return p;
+    }
+}
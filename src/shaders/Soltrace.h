@@ -1,7 +1,9 @@
 #pragma once
 
-#include "GeometryDataST.h"
+#include "PackedGeometry.h"
 #include "MaterialDataST.h"
+#include "HitEncoding.h"
+#include "AngleTable.h"
 
 #include <vector_types.h>
 #include <optix.h>
@@ -9,8 +11,14 @@
 namespace OptixCSP{
 
     const unsigned int NUM_ATTRIBUTE_VALUES = 4u;
-    const unsigned int NUM_PAYLOAD_VALUES   = 2u;
+    const unsigned int NUM_PAYLOAD_VALUES   = 4u;
     const unsigned int MAX_TRACE_DEPTH      = 5u;
+
+    // path tag stored in the top bit of hit_element_buffer: the ray came straight from the sun to a receiver
+    // (sun -> receiver) instead of after a reflection or refraction (sun -> mirror -> receiver).
+    // Only receiver hits are tagged. The lower bits hold the hit id + 1
+    const unsigned int HIT_DIRECT_SUN       = 0x80000000u;
+    const unsigned int HIT_ID_MASK          = 0x7FFFFFFFu;
     
     struct HitGroupData
     {
@@ -29,17 +37,47 @@ namespace OptixCSP{
         RECTANGLE_FLAT_RECEIVER       = 2,
         CYLINDRICAL_RECEIVER          = 3,
 		TRIANGLE_FLAT_RECEIVER        = 4,
+        TRIANGLE_MESH_RECEIVER        = 5,  // built-in triangles of a mesh GAS, sbt offset of the mesh instances
 	    NUM_OPTICAL_ENTITY_TYPES
     };
 
+    // per-heliostat counters of the optical loss ledger, indexed by the hit id of the heliostat first hit by the ray
+    enum LedgerCounter : unsigned int {
+        LEDGER_INCIDENT  = 0,   // sun rays hitting the heliostat
+        LEDGER_REFLECTED = 1,   // sun rays leaving the heliostat
+        LEDGER_BLOCKED   = 2,   // reflected rays stopped by another heliostat
+        LEDGER_RECEIVER  = 3,   // reflected rays hitting the front of a receiver
+        LEDGER_SPILLED   = 4,   // reflected rays missing every receiver
+        LEDGER_ABSORBED  = 5,   // sun rays absorbed by the heliostat
+        LEDGER_SHADED    = 6,   // sun rays that would have hit the heliostat but hit another heliostat first
+        NUM_LEDGER_COUNTERS
+    };
+
+    // depth payload of the shading probes of the ledger: a sun ray hitting a heliostat goes on along the sun
+    // direction, the first heliostat behind it is shaded. Probes only report the mirror they hit (first_hit).
+    const unsigned int SHADING_PROBE_DEPTH = 0xFFFFFFFFu;
+
     struct LaunchParams
     {
         unsigned int                width;   // essentially number of rays launched and sun points 
         unsigned int                height;
         int                         max_depth;
 
+        unsigned int*               ray_order;  // launch index -> ray id, nullptr traces rays in Halton order
+        unsigned int                ray_offset; // first launch index of this launch, when the rays are traced in batches
         float4*                     hit_point_buffer;
-        float3*                     sun_dir_buffer;
+        unsigned int*               hit_element_buffer;  // hit id + 1 of every hit_point_buffer entry, 0 if empty, | HIT_DIRECT_SUN
+        unsigned int                num_elements;        // hit ids below are elements, above are prototype instances
+        unsigned int                instance_offset;     // index of the first prototype instance in the IAS
+        unsigned int*               heliostat_ledger;    // NUM_LEDGER_COUNTERS per hit id, nullptr disables the ledger
+        float*                      hit_weight_buffer;   // power (W) of the ray at every hit, nullptr traces unweighted rays
+        float                       ray_power;           // initial power of a ray: DNI * sun plane area / number of rays
+        float                       roulette_threshold;  // weighted rays below ray_power * threshold play Russian roulette
+        unsigned int*               hit_uv_buffer;       // quantized hit points (encode_hit_uv), replaces hit_point_buffer (nullptr) when set
+        const HitFrame*             hit_frames;          // frame of every hit id, for hit_uv_buffer
+        const unsigned int*         enabled_mask;        // one bit per element and prototype instance hit id, nullptr if all are enabled
+        float3*                     hit_dir_buffer;      // outgoing direction of the ray at every hit_point_buffer entry, nullptr if not stored
+        float3*                     sun_dir_buffer;      // direction of every sun ray, nullptr if not stored
         OptixTraversableHandle      handle;
 
         float3                      sun_vector;
@@ -51,14 +89,24 @@ namespace OptixCSP{
         float3                      sun_v2;
         float3                      sun_v3;
 
-	    GeometryDataST*             geometry_data_array;
-		MaterialData*               material_data_array;
+	    // geometry packed per primitive type, geometry_slot maps a geometry index to its slot in the array of its type
+	    PackedRectangleFlat*        rectangle_flat_array;
+	    PackedRectangleParabolic*   rectangle_parabolic_array;
+	    PackedCylinderY*            cylinder_y_array;
+	    PackedTriangleFlat*         triangle_flat_array;
+	    unsigned int*               geometry_slot;
+		MaterialData*               material_data_array;   // shared records, see OpticsTable
+		unsigned short*             material_index;        // record of every geometry index
+		float*                      angle_tables;          // resampled angle tables of the records
+		float*                      error_tables;          // inverse CDF of the surface error distributions, see SurfaceError.h
     };
 
     struct PerRayData
     {
         unsigned int ray_path_index;  // Index of the ray in the ray path buffer
         unsigned int depth;           // Trace depth
+        unsigned int first_hit;       // hit id + 1 of the heliostat the sun ray hit first, 0 if none yet
+        float        weight;          // power carried by the ray (W), only updated for weighted rays
     };
 
 } // end namespace OptixCSP
\ No newline at end of file
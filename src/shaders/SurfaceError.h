@@ -0,0 +1,46 @@
+#pragma once
+#include "device_util.h"
+
+namespace OptixCSP {
+
+    // Slope and specularity errors, SolTrace 'g' and 'p' distributions. A direction is tilted by theta = error * r
+    // towards a uniformly drawn azimuth, r being drawn from the radial distribution of unit size:
+    //   - gaussian: 2D normal with standard deviation error per axis, r is Rayleigh, F^-1(u) = sqrt(-2 ln(1 - u))
+    //   - pillbox: uniform on the disk of radius error (the half width), F^-1(u) = sqrt(u)
+    // F^-1 is tabulated once on the host (build_error_tables) on a uniform grid of u, a draw is one multiply
+    // and one linear interpolation. The last gaussian cell ends at the radius that keeps the mean of the tail.
+    enum ErrorDistribution : unsigned int {
+        ERROR_GAUSSIAN = 0,
+        ERROR_PILLBOX = 1,
+        NUM_ERROR_DISTRIBUTIONS = 2
+    };
+
+    static constexpr unsigned int ERROR_TABLE_SIZE = 1024;
+
+    /// radius of unit size for u in [0, 1), tables holds ERROR_TABLE_SIZE values per distribution
+    INLINE HOSTDEVICE float sample_error_radius(const float* tables, unsigned int distribution, float u)
+    {
+        const float* table = tables + distribution * ERROR_TABLE_SIZE;
+        const float x = fminf(fmaxf(u, 0.0f), 1.0f) * static_cast<float>(ERROR_TABLE_SIZE - 1);
+        const unsigned int i = x < static_cast<float>(ERROR_TABLE_SIZE - 2) ? static_cast<unsigned int>(x) : ERROR_TABLE_SIZE - 2;
+        const float t = x - static_cast<float>(i);
+        return table[i] + t * (table[i + 1] - table[i]);
+    }
+
+    /// unit vector dir tilted by theta towards azimuth phi (radians)
+    INLINE HOSTDEVICE float3 tilt_direction(const float3& dir, float theta, float phi)
+    {
+        const float3 a = fabsf(dir.x) > 0.9f ? make_float3(0.0f, 1.0f, 0.0f) : make_float3(1.0f, 0.0f, 0.0f);
+        const float3 u = normalize(cross(a, dir));
+        const float3 v = cross(dir, u);
+        return normalize(cosf(theta) * dir + sinf(theta) * (cosf(phi) * u + sinf(phi) * v));
+    }
+
+    /// dir with an error of the given size (radians) drawn from two uniform numbers in [0, 1), unchanged if error is 0
+    INLINE HOSTDEVICE float3 apply_surface_error(const float* tables, unsigned int distribution, float error,
+        const float3& dir, float u_radius, float u_phi)
+    {
+        if (error <= 0.0f) return dir;
+        return tilt_direction(dir, error * sample_error_radius(tables, distribution, u_radius), 2.0f * M_PIf * u_phi);
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <optix.h>
+
+namespace OptixCSP {
+
+    // Index of the current hit into params.geometry_slot and params.material_data_array.
+    // Elements live in a single GAS (instance id 0, or no IAS at all in which case the instance id is 0 too),
+    // prototype instances store the index of their prototype data in the instance id.
+    static __forceinline__ __device__ unsigned int getGeometryIndex()
+    {
+        return optixGetInstanceId() + optixGetPrimitiveIndex();
+    }
+
+    // Hit id of the custom primitive being intersected or hit: primitive index in the element GAS for elements
+    // (see GeometryManager::get_element_order), num_elements + instance index for prototype instances.
+    // Valid in the intersection programs too.
+    static __forceinline__ __device__ unsigned int getCustomHitId(unsigned int num_elements, unsigned int instance_offset)
+    {
+        const unsigned int geometry_index = getGeometryIndex();
+        if (geometry_index < num_elements) return geometry_index;
+        return num_elements + optixGetInstanceIndex() - instance_offset;
+    }
+
+    // Id of the hit object reported in the outputs, see getCustomHitId.
+    // Mesh elements are the only built-in triangles, the instance id of a mesh is the hit id of its first face.
+    static __forceinline__ __device__ unsigned int getHitId(unsigned int num_elements, unsigned int instance_offset)
+    {
+        if (optixIsTriangleHit()) return optixGetInstanceId() + optixGetPrimitiveIndex();
+        return getCustomHitId(num_elements, instance_offset);
+    }
+
+    // False if the element or prototype instance being intersected is disabled in mask (one bit per hit id),
+    // checked first by the intersection programs, custom primitives only.
+    static __forceinline__ __device__ bool isEnabled(const unsigned int* mask, unsigned int num_elements, unsigned int instance_offset)
+    {
+        if (!mask) return true;
+        const unsigned int id = getCustomHitId(num_elements, instance_offset);
+        return (mask[id >> 5] >> (id & 31u)) & 1u;
+    }
+
+}
@@ -3,6 +3,8 @@
 #include "Soltrace.h"
 #include <stdio.h>
 #include "MaterialDataST.h"
+#include "hit_util.h"
+#include "SurfaceError.h"
 
 
 namespace OptixCSP {
@@ -11,6 +13,8 @@ namespace OptixCSP {
         OptixCSP::PerRayData prd;
         prd.ray_path_index = optixGetPayload_0();
         prd.depth = optixGetPayload_1();
+        prd.first_hit = optixGetPayload_2();
+        prd.weight = __uint_as_float(optixGetPayload_3());
         return prd;
     }
 
@@ -18,6 +22,8 @@ namespace OptixCSP {
     {
         optixSetPayload_0(prd.ray_path_index);
         optixSetPayload_1(prd.depth);
+        optixSetPayload_2(prd.first_hit);
+        optixSetPayload_3(__float_as_uint(prd.weight));
     }
 
     // 32-bit avalanche mix (fast, good diffusion)
@@ -41,11 +47,185 @@ extern "C" {
     __constant__ OptixCSP::LaunchParams params;
 }
 
+namespace OptixCSP {
+    // path tag of a receiver hit: HIT_DIRECT_SUN if nothing was hit before (sun -> receiver).
+    // Mirrors are never tagged, the path filter of the stats selects receiver hits only.
+    static __device__ __inline__ unsigned int receiverPath(const OptixCSP::PerRayData& prd)
+    {
+        return (prd.depth == 0) ? OptixCSP::HIT_DIRECT_SUN : 0u;
+    }
+
+    // record a hit of the ray at the given depth, the hit id is stored + 1 so that 0 marks an empty slot
+    // and or-ed with path (see receiverPath)
+    // weight is the power of the ray arriving at the hit point, kept for weighted rays only,
+    // direction the one the ray leaves the hit with (the incoming one if it ends there), kept if requested
+    static __device__ __inline__ void storeHit(const OptixCSP::PerRayData& prd, int depth, const float3& hit_point, float weight,
+        const float3& direction, unsigned int path)
+    {
+        const unsigned int index = params.max_depth * prd.ray_path_index + depth;
+        const unsigned int hit_id = getHitId(params.num_elements, params.instance_offset);
+        if (params.hit_uv_buffer) {
+            params.hit_uv_buffer[index] = OptixCSP::encode_hit_uv(params.hit_frames[hit_id], hit_point);
+        }
+        else {
+            params.hit_point_buffer[index] = make_float4(depth, hit_point);
+        }
+        params.hit_element_buffer[index] = (hit_id + 1) | path;
+        if (params.hit_weight_buffer) {
+            params.hit_weight_buffer[index] = weight;
+        }
+        if (params.hit_dir_buffer) {
+            params.hit_dir_buffer[index] = direction;
+        }
+    }
+
+    // weighted rays: scale the power of the ray by the reflectivity (or transmissivity) of the surface,
+    // rays dropping below the roulette threshold survive with probability weight / threshold at the threshold power.
+    // returns true if the ray is terminated
+    static __device__ __inline__ bool applyRayWeight(OptixCSP::PerRayData& prd, float factor)
+    {
+        prd.weight *= factor;
+        const float threshold = params.roulette_threshold * params.ray_power;
+        if (prd.weight >= threshold) return false;
+        if (prd.weight <= 0.0f) return true;
+
+        uint32_t seed = params.sun_dir_seed ^ (prd.ray_path_index * 0x9E3779B9u) ^ (prd.depth * 0xC2B2AE35u);
+        const float survival = prd.weight / threshold;
+        if (OptixCSP::rng_uniform(seed) >= survival) return true;
+        prd.weight = threshold;
+        return false;
+    }
+
+    // bump a counter of the heliostat ledger, hit_id is the hit id of the heliostat (not + 1)
+    static __device__ __inline__ void countLedger(unsigned int hit_id, OptixCSP::LedgerCounter counter)
+    {
+        if (params.heliostat_ledger) {
+            atomicAdd(&params.heliostat_ledger[hit_id * OptixCSP::NUM_LEDGER_COUNTERS + counter], 1u);
+        }
+    }
+
+    // shared optics record of the object hit
+    static __device__ __inline__ const OptixCSP::MaterialData& getMaterial()
+    {
+        return params.material_data_array[params.material_index[getGeometryIndex()]];
+    }
+
+    // counter based uniform number in [0, 1): draw number draw of the ray at its current depth,
+    // independent of the order the rays are traced in. Draw 0 decides the absorption of unweighted rays.
+    static __device__ __inline__ float rngRay(const OptixCSP::PerRayData& prd, unsigned int draw)
+    {
+        return OptixCSP::rng_uniform(params.sun_dir_seed ^ (prd.ray_path_index * 0x9E3779B9u)   // golden ratio mix
+            ^ (prd.depth * 0x85EBCA6Bu) ^ (draw * 0x27D4EB2Fu));
+    }
+
+    // surface errors of the record (mrad): the slope error tilts the facing normal before the ray is reflected
+    // or refracted, the specularity error tilts the new direction. Both are no-ops for errors of 0.
+    static __device__ __inline__ float3 applySlopeError(const OptixCSP::MaterialData& material, const float3& normal,
+        const OptixCSP::PerRayData& prd)
+    {
+        return OptixCSP::apply_surface_error(params.error_tables, material.error_distribution, 1e-3f * material.slope_error,
+            normal, rngRay(prd, 1), rngRay(prd, 2));
+    }
+
+    static __device__ __inline__ float3 applySpecularityError(const OptixCSP::MaterialData& material, const float3& dir,
+        const OptixCSP::PerRayData& prd)
+    {
+        return OptixCSP::apply_surface_error(params.error_tables, material.error_distribution, 1e-3f * material.specularity_error,
+            dir, rngRay(prd, 3), rngRay(prd, 4));
+    }
+
+    // reflectivity and transmissivity at the incidence angle, cos_theta = dot(-ray_dir, facing normal)
+    static __device__ __inline__ float evalReflectivity(const OptixCSP::MaterialData& material, float cos_theta)
+    {
+        if (material.reflectivity_table < 0) return material.reflectivity;
+        return lookup_angle_table(params.angle_tables + material.reflectivity_table, cos_theta);
+    }
+
+    static __device__ __inline__ float evalTransmissivity(const OptixCSP::MaterialData& material, float cos_theta)
+    {
+        if (material.transmissivity_table < 0) return material.transmissivity;
+        return lookup_angle_table(params.angle_tables + material.transmissivity_table, cos_theta);
+    }
+
+    // absorption of an unweighted ray reflected by the record: the ray is absorbed at random with probability
+    // 1 - reflectivity (constant or from the table), like the transmissivity of a refracting record, so that
+    // unweighted and weighted rays (scaled by the same reflectivity) agree in expectation.
+    // A reflectivity of 1 never absorbs, draws are in [0, 1).
+    static __device__ __inline__ bool absorbReflection(const OptixCSP::MaterialData& material, float cos_theta,
+        const OptixCSP::PerRayData& prd)
+    {
+        return rngRay(prd, 0) > evalReflectivity(material, cos_theta);
+    }
+
+    // true in the closest-hit programs of a shading probe (see SHADING_PROBE_DEPTH)
+    static __device__ __inline__ bool isShadingProbe()
+    {
+        return optixGetPayload_1() == OptixCSP::SHADING_PROBE_DEPTH;
+    }
+
+    // shading of the ledger: the sun ray that hit heliostat hit_id at hit_point goes on along its direction,
+    // the first other heliostat it reaches is shaded by this one. Receivers and misses report nothing.
+    static __device__ __inline__ void countShading(unsigned int hit_id, const float3& hit_point, const float3& sun_dir)
+    {
+        unsigned int ray_path_index = 0;
+        unsigned int depth = OptixCSP::SHADING_PROBE_DEPTH;
+        unsigned int behind = 0;
+        unsigned int weight = 0;
+        optixTrace(
+            params.handle,
+            hit_point,
+            sun_dir,
+            0.01f,                  // same offset as the reflected rays
+            1e16f,
+            0.0f,
+            OptixVisibilityMask(1),
+            OPTIX_RAY_FLAG_CULL_BACK_FACING_TRIANGLES,
+            OptixCSP::RAY_TYPE_RADIANCE,
+            OptixCSP::RAY_TYPE_COUNT,
+            OptixCSP::RAY_TYPE_RADIANCE,
+            ray_path_index, depth, behind, weight);
+        // the facets of a prototype instance share its hit id
+        if (behind != 0 && behind - 1 != hit_id) {
+            countLedger(behind - 1, OptixCSP::LEDGER_SHADED);
+        }
+    }
+
+    // ledger entries of a ray hitting a mirror: the sun ray is attributed to this heliostat and shades the one
+    // behind it, a ray already reflected by its first heliostat is blocked by this one
+    static __device__ __inline__ void countMirrorHit(OptixCSP::PerRayData& prd, bool absorbed, const float3& hit_point,
+        const float3& ray_dir)
+    {
+        if (!params.heliostat_ledger) return;
+        if (prd.depth == 0) {
+            const unsigned int hit_id = getHitId(params.num_elements, params.instance_offset);
+            prd.first_hit = hit_id + 1;
+            countLedger(hit_id, OptixCSP::LEDGER_INCIDENT);
+            countLedger(hit_id, absorbed ? OptixCSP::LEDGER_ABSORBED : OptixCSP::LEDGER_REFLECTED);
+            countShading(hit_id, hit_point, ray_dir);
+        }
+        else if (prd.depth == 1 && prd.first_hit != 0) {
+            countLedger(prd.first_hit - 1, OptixCSP::LEDGER_BLOCKED);
+        }
+    }
+
+    // ledger entry of a ray reflected by its first heliostat reaching a receiver
+    static __device__ __inline__ void countReceiverHit(const OptixCSP::PerRayData& prd, bool front_face)
+    {
+        if (prd.depth == 1 && prd.first_hit != 0) {
+            countLedger(prd.first_hit - 1, front_face ? OptixCSP::LEDGER_RECEIVER : OptixCSP::LEDGER_SPILLED);
+        }
+    }
+}
+
 extern "C" __global__ void __closesthit__mirror()
 {
-	OptixCSP::MaterialData material = params.material_data_array[optixGetPrimitiveIndex()];
+    if (OptixCSP::isShadingProbe()) {
+        optixSetPayload_2(OptixCSP::getHitId(params.num_elements, params.instance_offset) + 1);
+        return;
+    }
+
+	OptixCSP::MaterialData material = OptixCSP::getMaterial();
 
-    float transmissivity = material.transmissivity;
     bool use_transmmisivity = material.use_refraction;
     // Fetch the normal vector from the hit attributes passed by OptiX
     float3 object_normal = make_float3( __uint_as_float( optixGetAttribute_0() ), __uint_as_float( optixGetAttribute_1() ),
@@ -63,6 +243,10 @@ extern "C" __global__ void __closesthit__mirror()
     // Compute the hit point of the ray using its origin and direction, scaled by the intersection distance (ray_t)
     const float3 hit_point = ray_orig + ray_t * ray_dir;
 
+    // angle dependent optics
+    const float cos_theta = -dot(ray_dir, ffnormal);
+    const float transmissivity = OptixCSP::evalTransmissivity(material, cos_theta);
+
     OptixCSP::PerRayData prd = OptixCSP::getPayload();
     const int new_depth = prd.depth + 1;    // Increment the ray depth for recursive tracing
 
@@ -72,29 +256,39 @@ extern "C" __global__ void __closesthit__mirror()
     float3 new_dir;
 	bool absorbed = false;  // determine whether the ray is absorbed or not, this is montecarlo based, should be applied to reflection and refraction
 
+    const float incoming_weight = prd.weight;
+
+    const float3 surface_normal = OptixCSP::applySlopeError(material, ffnormal, prd);
     if (use_transmmisivity) {
-		new_dir = refract(ray_dir, ffnormal);
+		new_dir = refract(ray_dir, surface_normal);
+    }
+    else {
+		new_dir = reflect(ray_dir, surface_normal);
+    }
+    new_dir = OptixCSP::applySpecularityError(material, new_dir, prd);
+
+    if (params.hit_weight_buffer) {
+        // weighted rays lose power instead of being terminated at random
+        absorbed = OptixCSP::applyRayWeight(prd, use_transmmisivity ? transmissivity : OptixCSP::evalReflectivity(material, cos_theta));
+    }
+    else if (use_transmmisivity) {
 
 		// now we figure out the random number to determine if the ray is absorbed or refracted
-        uint32_t seed = seed = params.sun_dir_seed ^ (prd.ray_path_index * 0x9E3779B9u)   // golden ratio mix
-            ^ (prd.depth * 0x85EBCA6Bu);
-		float xi = OptixCSP::rng_uniform(seed); // random number in [0,1)
+		float xi = OptixCSP::rngRay(prd, 0); // random number in [0,1)
         if (xi > transmissivity) { absorbed = true; 
         //printf("ray is absorbed! ray index is %d, depth %d\n", prd.ray_path_index, prd.depth); 
         }   // ray is absorbed
     }
     else {
-		new_dir = reflect(ray_dir, ffnormal);
+        absorbed = OptixCSP::absorbReflection(material, cos_theta, prd);
     }
 
+    OptixCSP::countMirrorHit(prd, absorbed, hit_point, ray_dir);
+
     // Check if the maximum recursion depth has not been reached
     if (new_depth < params.max_depth) {
         // Store the hit point in the hit point buffer (used for visualization or further calculations)
-        params.hit_point_buffer[params.max_depth * prd.ray_path_index + new_depth] = make_float4(new_depth, hit_point);
-        // Store the reflected direction in its buffer (used for visualization or further calculations)
-        /*
-        params.reflected_dir_buffer[params.max_depth * prd.ray_path_index + new_depth] = make_float4(1.0f, reflected_dir);
-        */
+        OptixCSP::storeHit(prd, new_depth, hit_point, incoming_weight, absorbed ? ray_dir : new_dir, 0u);
 
         // Trace the reflected ray
         prd.depth = new_depth;
@@ -108,12 +302,14 @@ extern "C" __global__ void __closesthit__mirror()
                 1e16f,                  // Maximum distance the ray can travel
                 0.0f,                   // Ray time (used for time-dependent effects)
                 OptixVisibilityMask(1), // Visibility mask (defines what the ray can interact with)
-                OPTIX_RAY_FLAG_NONE,    // Ray flags (no special flags for now)
+                OPTIX_RAY_FLAG_CULL_BACK_FACING_TRIANGLES, // Ray flags (the back of mesh faces is transparent)
                 OptixCSP::RAY_TYPE_RADIANCE,  // Use the radiance ray type
                 OptixCSP::RAY_TYPE_COUNT,     // Total number of ray types
                 OptixCSP::RAY_TYPE_RADIANCE,  // The ray type's offset into the SBT
                 reinterpret_cast<unsigned int&>(prd.ray_path_index), // Pass the ray path index
-                reinterpret_cast<unsigned int&>(prd.depth)           // Pass the updated depth
+                reinterpret_cast<unsigned int&>(prd.depth),          // Pass the updated depth
+                reinterpret_cast<unsigned int&>(prd.first_hit),      // Pass the first heliostat hit
+                reinterpret_cast<unsigned int&>(prd.weight)          // Pass the power of the ray
             );
 
         }
@@ -128,6 +324,8 @@ extern "C" __global__ void __closesthit__mirror()
 
 extern "C" __global__ void __closesthit__receiver()
 {
+    if (OptixCSP::isShadingProbe()) return;
+
     float3 object_normal = make_float3( __uint_as_float( optixGetAttribute_0() ),
                                         __uint_as_float( optixGetAttribute_1() ),
                                         __uint_as_float( optixGetAttribute_2() ) );
@@ -141,16 +339,19 @@ extern "C" __global__ void __closesthit__receiver()
     //printf("ray id hitting the receiver: %d, depth %d\n", prd.ray_path_index, prd.depth);
 
     // Compute the normal of the receiver and dot with ray direction to determine which side was hit
-    const float dot_product = dot(ray_dir, object_normal);
+    const float3 world_normal = optixTransformNormalFromObjectToWorldSpace(object_normal);
+    const float dot_product = dot(ray_dir, world_normal);
 
     float3 hit_point = ray_orig + ray_t * ray_dir;
 
     const int new_depth = prd.depth + 1;
 
+    OptixCSP::countReceiverHit(prd, dot_product < 0.0f);
+
     // Check if the ray hits the receiver surface (dot product negative means ray is hitting the front face)
     if (dot_product < 0.0f) {
         if (new_depth < params.max_depth) {
-            params.hit_point_buffer[params.max_depth * prd.ray_path_index + new_depth] = make_float4(new_depth, hit_point);
+            OptixCSP::storeHit(prd, new_depth, hit_point, prd.weight, ray_dir, OptixCSP::receiverPath(prd));
             prd.depth = new_depth;
         }
     }
@@ -158,15 +359,39 @@ extern "C" __global__ void __closesthit__receiver()
     setPayload(prd);
 }
 
+// Closest-hit for the faces of a mesh element, built-in triangles of the mesh GAS.
+// Back faces are culled by the ray flags, every hit is on the front side of a face.
+extern "C" __global__ void __closesthit__receiver__mesh()
+{
+    if (OptixCSP::isShadingProbe()) return;
+
+    const float3 ray_orig = optixGetWorldRayOrigin();
+    const float3 ray_dir  = optixGetWorldRayDirection();
+    const float  ray_t    = optixGetRayTmax();
+    const float3 hit_point = ray_orig + ray_t * ray_dir;
+
+    OptixCSP::PerRayData prd = OptixCSP::getPayload();
+    const int new_depth = prd.depth + 1;
+
+    OptixCSP::countReceiverHit(prd, true);
+
+    if (new_depth < params.max_depth) {
+        OptixCSP::storeHit(prd, new_depth, hit_point, prd.weight, ray_dir, OptixCSP::receiverPath(prd));
+        prd.depth = new_depth;
+    }
+
+    setPayload(prd);
+}
+
 extern "C" __global__ void __closesthit__receiver__cylinder__y()
 {
+    if (OptixCSP::isShadingProbe()) return;
+
     //// Retrieve the hit group data and access the parallelogram geometry
     //const OptixCSP::HitGroupData* sbt_data = reinterpret_cast<OptixCSP::HitGroupData*>(optixGetSbtDataPointer());
 
     
 
-    const OptixCSP::GeometryDataST::Cylinder_Y& cyl = params.geometry_data_array[optixGetPrimitiveIndex()].getCylinder_Y();
-
     /*
     float3 object_normal = make_float3( __uint_as_float( optixGetAttribute_0() ), __uint_as_float( optixGetAttribute_1() ),
                                         __uint_as_float( optixGetAttribute_2() ) );
@@ -189,10 +414,12 @@ extern "C" __global__ void __closesthit__receiver__cylinder__y()
     OptixCSP::PerRayData prd = OptixCSP::getPayload();
     const int new_depth = prd.depth + 1;
 
+    OptixCSP::countReceiverHit(prd, true);
+
     // Check if the ray hits the receiver surface (dot product negative means ray is hitting the front face)
     //if (dot_product < 0.0f) {
         if (new_depth < params.max_depth) {
-            params.hit_point_buffer[params.max_depth * prd.ray_path_index + new_depth] = make_float4(new_depth, hit_point);
+            OptixCSP::storeHit(prd, new_depth, hit_point, prd.weight, ray_dir, OptixCSP::receiverPath(prd));
             prd.depth = new_depth;
         }
     //}
@@ -207,6 +434,11 @@ extern "C" __global__ void __closesthit__receiver__cylinder__y()
 // __intersection__rectangle_parabolic) reports a normal that already accounts for the curvature.
 extern "C" __global__ void __closesthit__mirror__parabolic()
 {
+    if (OptixCSP::isShadingProbe()) {
+        optixSetPayload_2(OptixCSP::getHitId(params.num_elements, params.instance_offset) + 1);
+        return;
+    }
+
     // Optionally, you can access material data if needed:
     // const OptixCSP::HitGroupData* sbt_data = reinterpret_cast<OptixCSP::HitGroupData*>( optixGetSbtDataPointer() );
     // const MaterialData::Mirror& mirror = sbt_data->material_data.mirror;
@@ -236,32 +468,50 @@ extern "C" __global__ void __closesthit__mirror__parabolic()
     OptixCSP::PerRayData prd = OptixCSP::getPayload();
     const int new_depth = prd.depth + 1; // Increase recursion depth.
 
-    // Compute the reflected ray direction.
-    float3 reflected_dir = reflect(ray_dir, ffnormal);
+    // Compute the reflected ray direction, with the surface errors of the mirror.
+    const OptixCSP::MaterialData& material = OptixCSP::getMaterial();
+    float3 reflected_dir = reflect(ray_dir, OptixCSP::applySlopeError(material, ffnormal, prd));
+    reflected_dir = OptixCSP::applySpecularityError(material, reflected_dir, prd);
 
-    // (Optional: Add noise to reflected_dir if desired.)
+    const float incoming_weight = prd.weight;
+    bool absorbed = false;
+    if (params.hit_weight_buffer) {
+        absorbed = OptixCSP::applyRayWeight(prd, OptixCSP::evalReflectivity(material, -dot(ray_dir, ffnormal)));
+    }
+    else {
+        absorbed = OptixCSP::absorbReflection(material, -dot(ray_dir, ffnormal), prd);
+    }
+
+    OptixCSP::countMirrorHit(prd, absorbed, hit_point, ray_dir);
 
     // If the new depth is below the maximum, trace the reflected ray.
     if (new_depth < params.max_depth) {
         // Save the hit point (for visualization or further processing).
-        params.hit_point_buffer[params.max_depth * prd.ray_path_index + new_depth] = make_float4(new_depth, hit_point);
+        OptixCSP::storeHit(prd, new_depth, hit_point, incoming_weight, absorbed ? ray_dir : reflected_dir, 0u);
 
         prd.depth = new_depth;
-        optixTrace(
-            params.handle,          // Acceleration structure handle.
-            hit_point,              // Ray origin.
-            reflected_dir,          // Ray direction.
-            0.01f,                  // Minimum t to avoid self-intersection.
-            1e16f,                  // Maximum t.
-            0.0f,                   // Ray time.
-            OptixVisibilityMask(1), // Visibility mask.
-            OPTIX_RAY_FLAG_NONE,    // Ray flags.
-            OptixCSP::RAY_TYPE_RADIANCE,  // Ray type.
-            OptixCSP::RAY_TYPE_COUNT,     // Number of ray types.
-            OptixCSP::RAY_TYPE_RADIANCE,  // SBT offset for this ray type.
-            reinterpret_cast<unsigned int&>(prd.ray_path_index), // Ray path index.
-            reinterpret_cast<unsigned int&>(prd.depth)           // Current recursion depth.
-        );
+        if (!absorbed) {
+            optixTrace(
+                params.handle,          // Acceleration structure handle.
+                hit_point,              // Ray origin.
+                reflected_dir,          // Ray direction.
+                0.01f,                  // Minimum t to avoid self-intersection.
+                1e16f,                  // Maximum t.
+                0.0f,                   // Ray time.
+                OptixVisibilityMask(1), // Visibility mask.
+                OPTIX_RAY_FLAG_CULL_BACK_FACING_TRIANGLES, // Ray flags (the back of mesh faces is transparent).
+                OptixCSP::RAY_TYPE_RADIANCE,  // Ray type.
+                OptixCSP::RAY_TYPE_COUNT,     // Number of ray types.
+                OptixCSP::RAY_TYPE_RADIANCE,  // SBT offset for this ray type.
+                reinterpret_cast<unsigned int&>(prd.ray_path_index), // Ray path index.
+                reinterpret_cast<unsigned int&>(prd.depth),          // Current recursion depth.
+                reinterpret_cast<unsigned int&>(prd.first_hit),      // First heliostat hit.
+                reinterpret_cast<unsigned int&>(prd.weight)          // Power of the ray.
+            );
+        }
+        else {
+            prd.depth = params.max_depth; // terminate the ray
+        }
     }
 
     // Store the updated payload.
@@ -285,6 +535,13 @@ extern "C" __global__ void __miss__ms()
     }
     */
 
+    // a ray reflected by its first heliostat that misses everything is spilled
+    const unsigned int depth = optixGetPayload_1();
+    const unsigned int first_hit = optixGetPayload_2();
+    if (depth == 1 && first_hit != 0) {
+        OptixCSP::countLedger(first_hit - 1, OptixCSP::LEDGER_SPILLED);
+    }
+
     // Set the payload values to 0, indicating that the ray missed all geometry.
     optixSetPayload_0(0);  // Default value
     optixSetPayload_1(0);
@@ -94,7 +94,9 @@ extern "C" __global__ void __raygen__sun_source()
     // Lookup location in launch grid
     const uint3 launch_idx = optixGetLaunchIndex();         // Index of the current launch thread
     const uint3 launch_dims = optixGetLaunchDimensions();   // Dimensions of the launch grid
-    const unsigned int ray_number = launch_idx.y * launch_dims.x + launch_idx.x;  // Unique ray ID
+    const unsigned int launch_index = params.ray_offset + launch_idx.y * launch_dims.x + launch_idx.x;
+    // Unique ray ID, selects the sun sample and the output slot whatever the order rays are traced in
+    const unsigned int ray_number = params.ray_order ? params.ray_order[launch_index] : launch_index;
 
     float3 sun_sample_pos = OptixCSP::haltonSampleInParallelogram(ray_number);
 
@@ -109,10 +111,20 @@ extern "C" __global__ void __raygen__sun_source()
     OptixCSP::PerRayData prd;
     prd.ray_path_index = ray_number;
     prd.depth = 0;
+    prd.first_hit = 0;
+    prd.weight = params.ray_power;
 
     // TODO make this a launch parameter
-    params.hit_point_buffer[params.max_depth * prd.ray_path_index] = make_float4(0.0f, ray_gen_pos);
-    params.sun_dir_buffer[prd.ray_path_index] = ray_dir;
+    // quantized hits do not keep the sun point, it is recomputed on the host from the ray id
+    if (params.hit_point_buffer) {
+        params.hit_point_buffer[params.max_depth * prd.ray_path_index] = make_float4(0.0f, ray_gen_pos);
+    }
+    if (params.sun_dir_buffer) {
+        params.sun_dir_buffer[prd.ray_path_index] = ray_dir;
+    }
+    if (params.hit_dir_buffer) {
+        params.hit_dir_buffer[params.max_depth * prd.ray_path_index] = ray_dir;
+    }
     
 
     // Cast and trace the ray through the scene
@@ -124,11 +136,13 @@ extern "C" __global__ void __raygen__sun_source()
         1e16f,                       // Maximum ray distance (far hit distance)
         0.0f,                        // Time parameter (static for now)
         OptixVisibilityMask(1),      // Visibility mask (e.g., to restrict ray interactions)
-        OPTIX_RAY_FLAG_NONE,         // Ray flags (no special flags)
+        OPTIX_RAY_FLAG_CULL_BACK_FACING_TRIANGLES, // Ray flags (the back of mesh faces is transparent, as for custom triangles)
         OptixCSP::RAY_TYPE_RADIANCE, // Ray type (radiance for sunlight)
         OptixCSP::RAY_TYPE_COUNT,    // Number of ray types
         OptixCSP::RAY_TYPE_RADIANCE, // SBT offset (ray type to launch)
         reinterpret_cast<unsigned int&>(prd.ray_path_index),
-        reinterpret_cast<unsigned int&>(prd.depth)  
+        reinterpret_cast<unsigned int&>(prd.depth),
+        reinterpret_cast<unsigned int&>(prd.first_hit),
+        reinterpret_cast<unsigned int&>(prd.weight)
     );
 }
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace OptixCSP {
+
+/// result of a two-sample Kolmogorov-Smirnov test
+struct KsResult {
+    double statistic = 0.0;  // sup |F1 - F2|
+    double p_value = 1.0;    // asymptotic, accurate for large samples
+};
+
+/**
+ * Two-sample Kolmogorov-Smirnov test of whether a and b come from the same distribution.
+ * Both samples are sorted in place; the p-value uses the Kolmogorov distribution with
+ * the Stephens small-sample correction of the effective sample size.
+ */
+inline KsResult ks_two_sample(std::vector<double>& a, std::vector<double>& b) {
+    KsResult result;
+    if (a.empty() || b.empty()) return result;
+
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+
+    const double na = static_cast<double>(a.size());
+    const double nb = static_cast<double>(b.size());
+    size_t i = 0, j = 0;
+    double d = 0.0;
+    while (i < a.size() && j < b.size()) {
+        // step over every copy of the smaller value so ties move both functions together
+        double x = std::min(a[i], b[j]);
+        while (i < a.size() && a[i] <= x) i++;
+        while (j < b.size() && b[j] <= x) j++;
+        d = std::max(d, std::fabs(i / na - j / nb));
+    }
+    result.statistic = d;
+
+    double n = std::sqrt(na * nb / (na + nb));
+    double lambda = (n + 0.12 + 0.11 / n) * d;
+    if (lambda < 0.2) return result;   // series does not converge fast there, p is 1 to double precision anyway
+
+    double sum = 0.0;
+    for (int k = 1; k <= 100; k++) {
+        double term = std::exp(-2.0 * k * k * lambda * lambda);
+        sum += (k % 2 == 1) ? term : -term;
+        if (term < 1e-12 * sum) break;
+    }
+    result.p_value = std::min(1.0, std::max(0.0, 2.0 * sum));
+    return result;
+}
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace OptixCSP {
+
+/**
+ * Read-only memory mapping of a whole file, unmapped on destruction.
+ * Lets the parsers work on the page cache directly instead of copying the file through streams.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename) {
+#ifdef _WIN32
+        m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE) throw std::runtime_error("MappedFile: could not open " + filename);
+        LARGE_INTEGER size;
+        GetFileSizeEx(m_file, &size);
+        m_size = static_cast<size_t>(size.QuadPart);
+        if (m_size > 0) {
+            m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!m_mapping) { close(); throw std::runtime_error("MappedFile: could not map " + filename); }
+            m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+            if (!m_data) { close(); throw std::runtime_error("MappedFile: could not map " + filename); }
+        }
+#else
+        m_fd = ::open(filename.c_str(), O_RDONLY);
+        if (m_fd < 0) throw std::runtime_error("MappedFile: could not open " + filename);
+        struct stat st;
+        if (fstat(m_fd, &st) != 0) { close(); throw std::runtime_error("MappedFile: could not stat " + filename); }
+        m_size = static_cast<size_t>(st.st_size);
+        if (m_size > 0) {
+            void* ptr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+            if (ptr == MAP_FAILED) { close(); throw std::runtime_error("MappedFile: could not map " + filename); }
+            m_data = static_cast<const char*>(ptr);
+            madvise(ptr, m_size, MADV_SEQUENTIAL);
+        }
+#endif
+    }
+
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    void close() {
+#ifdef _WIN32
+        if (m_data) UnmapViewOfFile(m_data);
+        if (m_mapping) CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+        m_mapping = nullptr;
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        if (m_data) munmap(const_cast<char*>(m_data), m_size);
+        if (m_fd >= 0) ::close(m_fd);
+        m_fd = -1;
+#endif
+        m_data = nullptr;
+    }
+
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+};
+
+}
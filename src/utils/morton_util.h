@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cuda_runtime.h>
+
+namespace OptixCSP {
+
+/**
+ * Spread the lower 10 bits of v so that there are two zero bits between each of them.
+ */
+inline __host__ __device__ uint32_t expand_bits_10(uint32_t v) {
+    v &= 0x3ffu;
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+/**
+ * 30-bit Morton code of a point given in normalized coordinates, each in [0, 1].
+ * Points that are close in space get close codes, sorting by it gives a Z-order curve.
+ */
+inline __host__ __device__ uint32_t morton_code_3d(float x, float y, float z) {
+    x = fminf(fmaxf(x * 1024.0f, 0.0f), 1023.0f);
+    y = fminf(fmaxf(y * 1024.0f, 0.0f), 1023.0f);
+    z = fminf(fmaxf(z * 1024.0f, 0.0f), 1023.0f);
+    uint32_t xx = expand_bits_10(static_cast<uint32_t>(x));
+    uint32_t yy = expand_bits_10(static_cast<uint32_t>(y));
+    uint32_t zz = expand_bits_10(static_cast<uint32_t>(z));
+    return (xx << 2) | (yy << 1) | zz;
+}
+
+/**
+ * Spread the lower 16 bits of v so that there is one zero bit between each of them.
+ */
+inline __host__ __device__ uint32_t expand_bits_16(uint32_t v) {
+    v &= 0xffffu;
+    v = (v | (v << 8)) & 0x00FF00FFu;
+    v = (v | (v << 4)) & 0x0F0F0F0Fu;
+    v = (v | (v << 2)) & 0x33333333u;
+    v = (v | (v << 1)) & 0x55555555u;
+    return v;
+}
+
+/**
+ * 32-bit Morton code of a point given in normalized coordinates, each in [0, 1].
+ */
+inline __host__ __device__ uint32_t morton_code_2d(float x, float y) {
+    x = fminf(fmaxf(x * 65536.0f, 0.0f), 65535.0f);
+    y = fminf(fmaxf(y * 65536.0f, 0.0f), 65535.0f);
+    return (expand_bits_16(static_cast<uint32_t>(x)) << 1) | expand_bits_16(static_cast<uint32_t>(y));
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace OptixCSP {
+
+/**
+ * Number of host worker threads used by the parallel helpers below.
+ * Falls back to a single thread if the hardware concurrency is unknown.
+ */
+inline unsigned int get_num_host_threads() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return (n == 0) ? 1u : n;
+}
+
+/**
+ * Split [0, count) into contiguous chunks and process them on host threads.
+ * func(begin, end, thread_id) is called once per chunk, thread_id is in [0, num_threads),
+ * so callers can keep thread-private accumulators indexed by thread_id and merge them afterwards.
+ * Small ranges (below min_chunk items per thread) run on the calling thread.
+ *
+ * @return number of chunks (threads) actually used
+ */
+template <typename Func>
+unsigned int parallel_for_chunks(size_t count, Func&& func, size_t min_chunk = 4096) {
+    if (count == 0) return 0;
+
+    unsigned int num_threads = get_num_host_threads();
+    size_t max_threads = (count + min_chunk - 1) / min_chunk;
+    num_threads = static_cast<unsigned int>(std::min<size_t>(num_threads, max_threads));
+
+    if (num_threads <= 1) {
+        func(size_t(0), count, 0u);
+        return 1;
+    }
+
+    size_t chunk = (count + num_threads - 1) / num_threads;
+    std::vector<std::thread> workers;
+    workers.reserve(num_threads - 1);
+
+    for (unsigned int t = 1; t < num_threads; t++) {
+        size_t begin = t * chunk;
+        size_t end = std::min(count, begin + chunk);
+        workers.emplace_back([&func, begin, end, t]() { if (begin < end) func(begin, end, t); });
+    }
+    // calling thread takes the first chunk
+    func(size_t(0), std::min(count, chunk), 0u);
+
+    for (auto& w : workers) w.join();
+    return num_threads;
+}
+
+/**
+ * Parallel loop over [0, count), func(i) is called once for every index.
+ */
+template <typename Func>
+void parallel_for(size_t count, Func&& func, size_t min_chunk = 4096) {
+    parallel_for_chunks(count, [&func](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) func(i);
+    }, min_chunk);
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "parallel_util.h"
+
+namespace OptixCSP {
+
+/**
+ * Stable LSD radix sort of (key, value) pairs by the lower key_bits bits of the key, 8 bits per pass.
+ * The input is cut into tiles of tile_size items: every pass builds one digit histogram per tile
+ * in parallel, prefix-sums them digit-major/tile-minor, and then scatters the tiles in parallel.
+ * Passes where all the keys share the same digit are skipped.
+ */
+template <typename Key, typename Value>
+void radix_sort_pairs(std::vector<Key>& keys, std::vector<Value>& values,
+                      int key_bits = static_cast<int>(8 * sizeof(Key)), size_t tile_size = 1 << 16) {
+
+    const size_t count = keys.size();
+    if (count < 2) return;
+
+    const size_t num_tiles = (count + tile_size - 1) / tile_size;
+    std::vector<std::array<size_t, 256>> offsets(num_tiles);
+
+    std::vector<Key> keys_tmp(count);
+    std::vector<Value> values_tmp(count);
+
+    for (int shift = 0; shift < key_bits; shift += 8) {
+
+        // digit histogram of each tile
+        parallel_for(num_tiles, [&](size_t t) {
+            std::array<size_t, 256>& hist = offsets[t];
+            hist.fill(0);
+            size_t end = std::min(count, (t + 1) * tile_size);
+            for (size_t i = t * tile_size; i < end; i++) {
+                hist[(keys[i] >> shift) & 0xff]++;
+            }
+        }, 1);
+
+        // exclusive scan, digit-major then tile so that the sort stays stable
+        size_t sum = 0;
+        bool single_digit = false;
+        for (int d = 0; d < 256; d++) {
+            size_t digit_count = 0;
+            for (size_t t = 0; t < num_tiles; t++) {
+                size_t c = offsets[t][d];
+                offsets[t][d] = sum;
+                sum += c;
+                digit_count += c;
+            }
+            if (digit_count == count) single_digit = true;
+        }
+        if (single_digit) continue;
+
+        parallel_for(num_tiles, [&](size_t t) {
+            std::array<size_t, 256>& offset = offsets[t];
+            size_t end = std::min(count, (t + 1) * tile_size);
+            for (size_t i = t * tile_size; i < end; i++) {
+                size_t dst = offset[(keys[i] >> shift) & 0xff]++;
+                keys_tmp[dst] = keys[i];
+                values_tmp[dst] = values[i];
+            }
+        }, 1);
+
+        keys.swap(keys_tmp);
+        values.swap(values_tmp);
+    }
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace OptixCSP {
+
+/**
+ * Streaming mean and variance (Welford). Accumulators filled on different threads, runs or
+ * processes are combined with merge(), which gives the same result as adding all the samples to one.
+ */
+struct WelfordAccumulator {
+    uint64_t count = 0;
+    double   mean = 0.0;
+    double   m2 = 0.0;    // sum of squared deviations from the mean
+
+    void add(double x) {
+        count++;
+        double delta = x - mean;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+    }
+
+    void merge(const WelfordAccumulator& other) {
+        if (other.count == 0) return;
+        if (count == 0) { *this = other; return; }
+        uint64_t n = count + other.count;
+        double delta = other.mean - mean;
+        mean += delta * other.count / n;
+        m2 += other.m2 + delta * delta * (static_cast<double>(count) * other.count / n);
+        count = n;
+    }
+
+    /// unbiased sample variance
+    double get_variance() const { return count > 1 ? m2 / (count - 1) : 0.0; }
+
+    /// standard error of the mean
+    double get_standard_error() const { return count > 1 ? std::sqrt(get_variance() / count) : 0.0; }
+};
+
+/**
+ * Split of the rays of a run into contiguous batches of ray ids, used for batched-means error estimates.
+ * Hit buffers hold entries_per_ray entries per ray (the trace depth), entry k belongs to ray k / entries_per_ray.
+ * Each batch is a contiguous run of the sun sample sequence, so it is a well distributed sample by itself.
+ */
+struct BatchLayout {
+    uint32_t num_batches = 1;
+    size_t   entries_per_ray = 1;
+    size_t   num_rays = 1;
+
+    uint32_t batch_of(size_t k) const {
+        if (num_batches <= 1) return 0;
+        return static_cast<uint32_t>((k / entries_per_ray) * num_batches / num_rays);
+    }
+};
+
+/// accumulate the estimates of a run total given by each batch (batch value * num_batches),
+/// the mean is the total of the run and the standard error its uncertainty
+template <typename T>
+WelfordAccumulator accumulate_batches(const T* batch_values, uint32_t num_batches) {
+    WelfordAccumulator acc;
+    for (uint32_t b = 0; b < num_batches; b++) {
+        acc.add(static_cast<double>(batch_values[b]) * num_batches);
+    }
+    return acc;
+}
+
+}
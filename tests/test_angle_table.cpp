@@ -0,0 +1,135 @@
+// Reflectivity / transmissivity tables resampled on the cos(theta) grid of AngleTable.h against the
+// SolTrace interpolation of the tabulated angles.
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "core/optics_table.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    const double HALF_PI_MRAD = 1000.0 * 1.57079632679489661923;
+
+    // smooth reflectivity, falling off towards grazing incidence
+    double smooth_reflectivity(double angle) {
+        const double x = angle / HALF_PI_MRAD;
+        return 0.95 - 0.4 * x * x * x * x;
+    }
+
+    void tabulate(double step, std::vector<double>& angles, std::vector<double>& values) {
+        angles.clear();
+        values.clear();
+        for (double angle = 0.0; angle < HALF_PI_MRAD; angle += step) {
+            angles.push_back(angle);
+            values.push_back(smooth_reflectivity(angle));
+        }
+        angles.push_back(HALF_PI_MRAD);
+        values.push_back(smooth_reflectivity(HALF_PI_MRAD));
+    }
+
+    // a smooth table is reproduced at the tabulated angles and in between
+    void test_smooth_table() {
+        std::vector<double> angles, values;
+        tabulate(10.0, angles, values);
+        const std::vector<float> table = resample_angle_table(angles, values);
+        CHECK(table.size() == ANGLE_TABLE_SIZE);
+
+        const double error = angle_table_error(angles, values, table.data());
+        CHECK(error < 1e-3);
+
+        double max_error = 0.0;
+        for (double angle = 0.0; angle <= HALF_PI_MRAD; angle += 0.5) {
+            const float lookup = lookup_angle_table(table.data(), static_cast<float>(std::cos(angle / 1000.0)));
+            max_error = std::max(max_error, std::fabs(lookup - interpolate_angle_table(angles, values, angle)));
+        }
+        CHECK(max_error < 1e-3);
+        std::printf("smooth table: %.3g at the tabulated angles, %.3g in between\n", error, max_error);
+
+        // a coarse table is interpolated linearly by both, only the grid spacing differs
+        tabulate(200.0, angles, values);
+        const std::vector<float> coarse = resample_angle_table(angles, values);
+        CHECK(angle_table_error(angles, values, coarse.data()) < 1e-3);
+    }
+
+    // the order of the tabulated points does not matter
+    void test_unsorted_input() {
+        std::vector<double> angles, values;
+        tabulate(25.0, angles, values);
+        const std::vector<float> sorted = resample_angle_table(angles, values);
+
+        std::vector<size_t> order(angles.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        std::shuffle(order.begin(), order.end(), std::mt19937(7u));
+        std::vector<double> shuffled_angles, shuffled_values;
+        for (size_t i : order) {
+            shuffled_angles.push_back(angles[i]);
+            shuffled_values.push_back(values[i]);
+        }
+        CHECK(shuffled_angles != angles);
+
+        const std::vector<float> shuffled = resample_angle_table(shuffled_angles, shuffled_values);
+        CHECK(shuffled == sorted);
+        CHECK(angle_table_error(shuffled_angles, shuffled_values, shuffled.data()) < 1e-3);
+
+        // descending
+        std::reverse(angles.begin(), angles.end());
+        std::reverse(values.begin(), values.end());
+        CHECK(resample_angle_table(angles, values) == sorted);
+    }
+
+    // one point is a constant
+    void test_single_point() {
+        const std::vector<float> table = resample_angle_table({ 300.0 }, { 0.8 });
+        for (float value : table) CHECK(value == 0.8f);
+        for (float cos_theta = 0.0f; cos_theta <= 1.0f; cos_theta += 0.01f) {
+            CHECK(lookup_angle_table(table.data(), cos_theta) == 0.8f);
+        }
+        CHECK(angle_table_error({ 300.0 }, { 0.8 }, table.data()) < 1e-7);
+    }
+
+    // the ends of the grid hold the values at normal (cos = 1) and grazing (cos = 0) incidence,
+    // angles outside of the table are clamped to its first and last values
+    void test_normal_and_grazing() {
+        std::vector<double> angles = { 0.0, 500.0, 1000.0, HALF_PI_MRAD };
+        std::vector<double> values = { 0.9, 0.85, 0.7, 0.1 };
+        std::vector<float> table = resample_angle_table(angles, values);
+        CHECK(table[ANGLE_TABLE_SIZE - 1] == 0.9f);
+        CHECK_NEAR(table[0], 0.1, 1e-6);
+        CHECK(lookup_angle_table(table.data(), 1.0f) == 0.9f);
+        CHECK_NEAR(lookup_angle_table(table.data(), 0.0f), 0.1, 1e-6);
+        // the kinks at 500 and 1000 mrad are rounded over one grid cell
+        CHECK(angle_table_error(angles, values, table.data()) < 1e-3);
+
+        // cos(theta) out of [0, 1] is clamped
+        CHECK(lookup_angle_table(table.data(), 1.5f) == 0.9f);
+        CHECK_NEAR(lookup_angle_table(table.data(), -0.5f), 0.1, 1e-6);
+
+        // a table from 100 to 1200 mrad is flat below and above
+        angles = { 100.0, 1200.0 };
+        values = { 0.6, 0.3 };
+        table = resample_angle_table(angles, values);
+        CHECK(lookup_angle_table(table.data(), 1.0f) == 0.6f);
+        CHECK(lookup_angle_table(table.data(), static_cast<float>(std::cos(0.05))) == 0.6f);
+        CHECK(lookup_angle_table(table.data(), 0.0f) == 0.3f);
+        CHECK(lookup_angle_table(table.data(), static_cast<float>(std::cos(1.4))) == 0.3f);
+        // and so are the kinks at both ends
+        CHECK(angle_table_error(angles, values, table.data()) < 1e-3);
+
+        // tabulated points beyond grazing incidence do not count towards the error
+        angles = { 0.0, HALF_PI_MRAD, 2000.0 };
+        values = { 0.9, 0.5, 0.0 };
+        table = resample_angle_table(angles, values);
+        CHECK(angle_table_error(angles, values, table.data()) < 1e-6);
+    }
+}
+
+int main() {
+    test_smooth_table();
+    test_unsorted_input();
+    test_single_point();
+    test_normal_and_grazing();
+    return OptixCSP::test::test_result();
+}
@@ -0,0 +1,65 @@
+// Heliostat ledger rows: efficiencies from the counters and the CSV written by write_heliostat_ledger_csv.
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "core/heliostat_ledger.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    HeliostatLedgerEntry make_entry(int element_id, int instance_id) {
+        HeliostatLedgerEntry e;
+        e.element_id = element_id;
+        e.instance_id = instance_id;
+        e.cosine = 0.5;
+        e.shaded = 20;
+        e.incident = 80;
+        e.reflected = 76;
+        e.absorbed = 4;
+        e.blocked = 6;
+        e.receiver = 60;
+        e.spilled = 10;
+        return e;
+    }
+
+    void test_efficiencies() {
+        const HeliostatLedgerEntry e = make_entry(0, -1);
+        CHECK_NEAR(e.get_shading_efficiency(), 0.8, 1e-12);
+        CHECK_NEAR(e.get_intercept_efficiency(), 0.75, 1e-12);
+
+        // fully shaded, and never reached by the sun
+        HeliostatLedgerEntry shaded;
+        shaded.shaded = 5;
+        CHECK(shaded.get_shading_efficiency() == 0.0);
+        CHECK(shaded.get_intercept_efficiency() == 0.0);
+        CHECK(HeliostatLedgerEntry().get_shading_efficiency() == 0.0);
+    }
+
+    void test_csv() {
+        const std::string filename = "test_heliostat_ledger.csv";
+        write_heliostat_ledger_csv(filename, { make_entry(3, -1), make_entry(-1, 7) });
+
+        std::ifstream in(filename);
+        std::vector<std::string> lines;
+        for (std::string line; std::getline(in, line);) lines.push_back(line);
+        in.close();
+        std::remove(filename.c_str());
+
+        CHECK(lines.size() == 3);
+        if (lines.size() != 3) return;
+        CHECK(lines[0] == "element_id,instance_id,cosine,shaded,incident,reflected,blocked,receiver,spilled,absorbed,"
+            "shading_efficiency,intercept_efficiency");
+        CHECK(lines[1] == "3,-1,0.5,20,80,76,6,60,10,4,0.8,0.75");
+        CHECK(lines[2] == "-1,7,0.5,20,80,76,6,60,10,4,0.8,0.75");
+    }
+}
+
+int main() {
+    test_efficiencies();
+    test_csv();
+    return OptixCSP::test::test_result();
+}
@@ -0,0 +1,135 @@
+// Ray files of write_hp_output and SolTrace: columns are found by their header names, whichever output
+// fields the file was written with, and rows are parsed in parallel chunks by HitCsvReader.
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "core/hit_csv.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    HitColumns columns_of(const std::string& header) {
+        return detect_hit_file_format(header.data(), header.size());
+    }
+
+    bool parse(const std::string& row, const HitColumns& columns, HitRecord& record) {
+        return parse_hit_record(row.data(), row.data() + row.size(), columns, record);
+    }
+
+    void test_optix_columns() {
+        HitRecord r;
+
+        // default output fields
+        HitColumns c = columns_of("number,stage,loc_x,loc_y,loc_z\n1,0,0,0,10\n");
+        CHECK(c.format == HitFileFormat::OPTIX);
+        CHECK(c.fields.size() == 5);
+        CHECK(!c.has(HitField::ELEMENT));
+        CHECK(parse("7,2,1.5,-2.25,3e2", c, r));
+        CHECK(r.ray == 7 && r.stage == 2);
+        CHECK(r.x == 1.5 && r.y == -2.25 && r.z == 300.0);
+        CHECK(r.element == -1 && r.instance == -1 && r.mesh == -1 && r.face == -1);
+        CHECK(r.direct_sun == -1);
+
+        // every field, with a direction in the middle that is skipped
+        c = columns_of("number,stage,loc_x,loc_y,loc_z,cosx,cosy,cosz,element,instance,mesh,face,weight,direct_sun\r\n");
+        CHECK(c.fields.size() == 14);
+        CHECK(c.fields[5] == HitField::IGNORED);
+        CHECK(parse("12,1,1,2,3,0.1,0.2,0.97,4,-1,-1,-1,812.5,1", c, r));
+        CHECK(r.ray == 12 && r.stage == 1 && r.z == 3.0);
+        CHECK(r.element == 4 && r.instance == -1 && r.mesh == -1 && r.face == -1);
+        CHECK(r.weight == 812.5 && r.direct_sun == 1);
+        CHECK(parse("13,2,1,2,3,0,0,1,-1,-1,0,17,0.5,0", c, r));
+        CHECK(r.mesh == 0 && r.face == 17 && r.element == -1 && r.direct_sun == 0);
+
+        // no position, instances only
+        c = columns_of("number,stage,element,instance,weight");
+        CHECK(!c.has(HitField::X));
+        CHECK(parse("3,1,-1,250,1.0", c, r));
+        CHECK(r.ray == 3 && r.instance == 250 && r.element == -1 && r.x == 0.0);
+
+        // the columns are found by name, not by position
+        c = columns_of("stage,element,number");
+        CHECK(parse("2,9,44", c, r));
+        CHECK(r.stage == 2 && r.element == 9 && r.ray == 44);
+
+        // a row must have one field per column
+        c = columns_of("number,stage,loc_x,loc_y,loc_z");
+        CHECK(!parse("1,2,3,4", c, r));
+        CHECK(!parse("1,2,3,4,5,6", c, r));
+        CHECK(!parse("1,2,x,4,5", c, r));
+        CHECK(!parse("", c, r));
+    }
+
+    void test_soltrace_columns() {
+        HitRecord r;
+        // with a byte order mark, SolTrace quotes the element
+        HitColumns c = columns_of("\xEF\xBB\xBF" "loc_x,loc_y,loc_z,cos_x,cos_y,cos_z,element,stage,raynum\n");
+        CHECK(c.format == HitFileFormat::SOLTRACE);
+        CHECK(parse("1.25,2,3,0,0,1,\"-1\",2,1001", c, r));
+        CHECK(r.x == 1.25 && r.element == -1 && r.stage == 2 && r.ray == 1001);
+        CHECK(parse(" 1, 2, 3, 0, 0, 1, 5, 1, +17", c, r));
+        CHECK(r.element == 5 && r.ray == 17);
+        CHECK(r.instance == -1 && r.weight == 0.0);
+
+        // headers naming neither format, or without a column the format always has
+        CHECK_THROWS(columns_of("x,y,z\n"));
+        CHECK_THROWS(columns_of("number,loc_x\n"));
+        CHECK_THROWS(columns_of("loc_x,loc_y,loc_z,stage,raynum\n"));
+    }
+
+    // rows spread over several chunks of the parallel reader
+    void test_reader() {
+        const std::string filename = "test_hit_csv.csv";
+        const int num_rows = 200000;
+        {
+            std::ofstream out(filename, std::ios::binary);
+            out << "number,stage,loc_x,loc_y,loc_z,element,instance\r\n";
+            for (int i = 0; i < num_rows; i++) {
+                out << i / 3 + 1 << "," << i % 3 << "," << i * 0.5 << ",0,1," << (i % 3 == 1 ? i % 7 : -1) << ",-1\r\n";
+                if (i == 1000) out << "broken row\r\n";
+            }
+        }
+
+        std::vector<std::vector<int>> element_counts(get_num_host_threads(), std::vector<int>(8, 0));
+        std::vector<uint64_t> ray_sums(get_num_host_threads(), 0);
+        uint64_t malformed = 0;
+        {
+            HitCsvReader reader(filename);
+            CHECK(reader.get_format() == HitFileFormat::OPTIX);
+            CHECK(reader.get_columns().has(HitField::ELEMENT));
+            malformed = reader.for_each_record([&](const HitRecord& r, unsigned int t) {
+                element_counts[t][r.element + 1]++;
+                ray_sums[t] += r.ray;
+            });
+        }
+        std::remove(filename.c_str());
+
+        CHECK(malformed == 1);
+        std::vector<int> counts(8, 0);
+        uint64_t ray_sum = 0;
+        for (size_t t = 0; t < element_counts.size(); t++) {
+            for (int e = 0; e < 8; e++) counts[e] += element_counts[t][e];
+            ray_sum += ray_sums[t];
+        }
+        std::vector<int> expected(8, 0);
+        uint64_t expected_sum = 0;
+        for (int i = 0; i < num_rows; i++) {
+            expected[(i % 3 == 1 ? i % 7 : -1) + 1]++;
+            expected_sum += i / 3 + 1;
+        }
+        CHECK(counts == expected);
+        CHECK(ray_sum == expected_sum);
+    }
+}
+
+int main() {
+    test_optix_columns();
+    test_soltrace_columns();
+    test_reader();
+    return OptixCSP::test::test_result();
+}
@@ -0,0 +1,279 @@
+// Quantized hit points of HitEncoding.h: encode_hit_uv then decode_hit_uv over every HitFrame kind, the error
+// stays within the bounds stated in HitEncoding.h (half a quantization step per axis plus the float rounding of
+// the frame), and the faceted prototype frame over the bounding box of canted facets.
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "shaders/HitEncoding.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    const int NUM_POINTS = 20000;
+
+    std::mt19937 rng(42u);
+
+    float uniform(float lo, float hi) {
+        return std::uniform_real_distribution<float>(lo, hi)(rng);
+    }
+
+    struct Basis {
+        float3 x, y, z;
+    };
+
+    // random right-handed orthonormal basis
+    Basis random_basis() {
+        const float3 a = normalize(make_float3(uniform(-1.0f, 1.0f), uniform(-1.0f, 1.0f), uniform(-1.0f, 1.0f)));
+        const float3 b = make_float3(uniform(-1.0f, 1.0f), uniform(-1.0f, 1.0f), uniform(-1.0f, 1.0f));
+        Basis basis;
+        basis.z = a;
+        basis.x = normalize(cross(b, a));
+        basis.y = cross(basis.z, basis.x);
+        return basis;
+    }
+
+    // heliostat far from the world origin, as in a large field
+    float3 random_origin() {
+        return make_float3(uniform(-800.0f, 800.0f), uniform(-800.0f, 800.0f), uniform(0.0f, 10.0f));
+    }
+
+    // float rounding of positions around p, the frame origin and the point are both rounded
+    float rounding(const float3& p, float size) {
+        return 4e-7f * (length(p) + size);
+    }
+
+    float half_step(float extent) {
+        return 0.5f * extent / HIT_UV_STEPS;
+    }
+
+    // error of the decoded point in the frame, per axis, worst over all the points relative to the bound
+    struct ErrorBound {
+        double worst = 0.0;
+        void check(double error, double bound) {
+            worst = std::max(worst, error / bound);
+            CHECK(error <= bound);
+        }
+    };
+
+    void test_rectangle_flat() {
+        ErrorBound eu, ev, en;
+        for (int i = 0; i < NUM_POINTS; i++) {
+            const Basis b = random_basis();
+            PackedRectangleFlat r = {};
+            r.center = random_origin();
+            r.x = b.x;
+            r.y = b.y;
+            r.normal = b.z;
+            r.d = dot(r.normal, r.center);
+            r.half_width = uniform(0.5f, 6.0f);
+            r.half_height = uniform(0.5f, 6.0f);
+            const HitFrame f = make_hit_frame(r);
+
+            const float x = uniform(-r.half_width, r.half_width), y = uniform(-r.half_height, r.half_height);
+            const float3 p = r.center + x * r.x + y * r.y;
+            const float3 q = decode_hit_uv(f, encode_hit_uv(f, p));
+            const float3 d = q - r.center;
+            const float eps = rounding(r.center, 2.0f * r.half_width);
+            eu.check(std::fabs(dot(d, r.x) - x), half_step(f.extent_u) + eps);
+            ev.check(std::fabs(dot(d, r.y) - y), half_step(f.extent_v) + eps);
+            en.check(std::fabs(dot(d, r.normal)), eps);
+        }
+        std::printf("flat: worst error / bound u %.3f, v %.3f, normal %.3f\n", eu.worst, ev.worst, en.worst);
+    }
+
+    // the decoded point is on the paraboloid, u and v within half a step
+    void test_rectangle_parabolic() {
+        ErrorBound eu, ev, ez;
+        for (int i = 0; i < NUM_POINTS; i++) {
+            const Basis b = random_basis();
+            PackedRectangleParabolic r = {};
+            r.center = random_origin();
+            r.e1 = b.x;
+            r.e2 = b.y;
+            r.normal = b.z;
+            r.half_l1 = uniform(0.5f, 6.0f);
+            r.half_l2 = uniform(0.5f, 6.0f);
+            r.curv_x = uniform(0.0f, 0.05f);
+            r.curv_y = uniform(0.0f, 0.05f);
+            const HitFrame f = make_hit_frame(r);
+
+            const float x = uniform(-r.half_l1, r.half_l1), y = uniform(-r.half_l2, r.half_l2);
+            const float3 p = r.center + x * r.e1 + y * r.e2 + (0.5f * (r.curv_x * x * x + r.curv_y * y * y)) * r.normal;
+            const float3 q = decode_hit_uv(f, encode_hit_uv(f, p));
+            const float3 d = q - r.center;
+            const float qx = dot(d, r.e1), qy = dot(d, r.e2);
+            const float eps = rounding(r.center, 2.0f * r.half_l1);
+            eu.check(std::fabs(qx - x), half_step(f.extent_u) + eps);
+            ev.check(std::fabs(qy - y), half_step(f.extent_v) + eps);
+            ez.check(std::fabs(dot(d, r.normal) - 0.5f * (r.curv_x * qx * qx + r.curv_y * qy * qy)), eps);
+        }
+        std::printf("parabolic: worst error / bound u %.3f, v %.3f, surface %.3f\n", eu.worst, ev.worst, ez.worst);
+    }
+
+    // arc length error within pi * radius / Q, axial within half a step, the decoded point on the side surface
+    void test_cylinder() {
+        ErrorBound ea, ev, er;
+        for (int i = 0; i < NUM_POINTS; i++) {
+            const Basis b = random_basis();
+            PackedCylinderY c = {};
+            c.center = random_origin();
+            c.base_x = b.x;
+            c.base_y = b.y;
+            c.base_z = b.z;
+            c.radius = uniform(1.0f, 10.0f);
+            c.half_height = uniform(1.0f, 12.0f);
+            const HitFrame f = make_hit_frame(c);
+
+            const float theta = uniform(-3.14159f, 3.14159f), y = uniform(-c.half_height, c.half_height);
+            const float3 p = c.center + (c.radius * std::cos(theta)) * c.base_x + y * c.base_y + (c.radius * std::sin(theta)) * c.base_z;
+            const float3 q = decode_hit_uv(f, encode_hit_uv(f, p));
+            const float3 d = q - c.center;
+            const float qx = dot(d, c.base_x), qz = dot(d, c.base_z);
+            const float eps = rounding(c.center, c.radius + c.half_height);
+            ea.check(std::fabs(std::atan2(qz, qx) - theta) * c.radius, 3.14159265f * c.radius / HIT_UV_STEPS + eps);
+            ev.check(std::fabs(dot(d, c.base_y) - y), half_step(f.extent_v) + eps);
+            er.check(std::fabs(std::sqrt(qx * qx + qz * qz) - c.radius), eps);
+        }
+        std::printf("cylinder: worst error / bound arc %.3f, axial %.3f, radial %.3f\n", ea.worst, ev.worst, er.worst);
+    }
+
+    // triangles use the bounding rectangle of the triangle in its plane
+    void test_triangle() {
+        ErrorBound eu, ev, en;
+        for (int i = 0; i < NUM_POINTS; i++) {
+            PackedTriangleFlat t = {};
+            t.v0 = random_origin();
+            t.e1 = make_float3(uniform(-3.0f, 3.0f), uniform(-3.0f, 3.0f), uniform(-3.0f, 3.0f));
+            t.e2 = make_float3(uniform(-3.0f, 3.0f), uniform(-3.0f, 3.0f), uniform(-3.0f, 3.0f));
+            if (length(cross(t.e1, t.e2)) < 0.1f) continue;
+            t.normal = normalize(cross(t.e1, t.e2));
+            const HitFrame f = make_hit_frame(t);
+
+            float a = uniform(0.0f, 1.0f), c = uniform(0.0f, 1.0f);
+            if (a + c > 1.0f) {
+                a = 1.0f - a;
+                c = 1.0f - c;
+            }
+            const float3 p = t.v0 + a * t.e1 + c * t.e2;
+            const float3 q = decode_hit_uv(f, encode_hit_uv(f, p));
+            const float eps = rounding(t.v0, f.extent_u + f.extent_v);
+            eu.check(std::fabs(dot(q - p, f.basis_x)), half_step(f.extent_u) + eps);
+            ev.check(std::fabs(dot(q - p, f.basis_y)), half_step(f.extent_v) + eps);
+            en.check(std::fabs(dot(q - p, t.normal)), eps);
+        }
+        std::printf("triangle: worst error / bound u %.3f, v %.3f, normal %.3f\n", eu.worst, ev.worst, en.worst);
+    }
+
+    // facet of a faceted prototype, local frame of the prototype
+    struct Facet {
+        float3 center;
+        Basis basis;
+        float half_size;
+    };
+
+    // 8 x 8 facets of 1.2 m on a 10 m heliostat, centered in the plane of the prototype and canted on axis
+    // for a slant range
+    std::vector<Facet> make_canted_facets(float slant_range) {
+        std::vector<Facet> facets;
+        const float pitch = 1.25f;
+        for (int row = 0; row < 8; row++) {
+            for (int col = 0; col < 8; col++) {
+                Facet facet;
+                const float x = (col - 3.5f) * pitch, y = (row - 3.5f) * pitch;
+                facet.center = make_float3(x, y, 0.0f);
+                facet.basis.z = normalize(make_float3(-x, -y, 2.0f * slant_range));
+                facet.basis.x = normalize(cross(make_float3(0.0f, 1.0f, 0.0f), facet.basis.z));
+                facet.basis.y = cross(facet.basis.z, facet.basis.x);
+                facet.half_size = 0.6f;
+                facets.push_back(facet);
+            }
+        }
+        return facets;
+    }
+
+    // hits over all the facets, in one flat frame over their bounding box: u and v within half a step of the
+    // box extent, along the normal within half the z depth of the box
+    void test_faceted_prototype() {
+        const float slant_range = 500.0f;
+        const std::vector<Facet> facets = make_canted_facets(slant_range);
+
+        // bounding box of the facet corners, as the facet aabbs of collect_prototype_info
+        float3 box_min = make_float3(1e30f, 1e30f, 1e30f), box_max = make_float3(-1e30f, -1e30f, -1e30f);
+        for (const Facet& facet : facets) {
+            for (int k = 0; k < 4; k++) {
+                const float su = (k & 1) ? 1.0f : -1.0f, sv = (k & 2) ? 1.0f : -1.0f;
+                const float3 corner = facet.center + (su * facet.half_size) * facet.basis.x + (sv * facet.half_size) * facet.basis.y;
+                box_min = make_float3(fminf(box_min.x, corner.x), fminf(box_min.y, corner.y), fminf(box_min.z, corner.z));
+                box_max = make_float3(fmaxf(box_max.x, corner.x), fmaxf(box_max.y, corner.y), fmaxf(box_max.z, corner.z));
+            }
+        }
+        const HitFrame local = make_bounding_hit_frame(box_min, box_max);
+        CHECK(local.shape == HIT_FRAME_PLANE);
+        CHECK_NEAR(local.extent_u, box_max.x - box_min.x, 0.0);
+        CHECK_NEAR(local.origin.z, 0.5f * (box_min.z + box_max.z), 0.0);
+        const float half_depth = 0.5f * (box_max.z - box_min.z);
+        std::printf("faceted prototype: extent %.4f x %.4f m, half depth %.4f mm\n", local.extent_u, local.extent_v, half_depth * 1e3f);
+        // the bound of HitEncoding.h: half the facet diagonal times the sine of the largest canting angle,
+        // reached by the corner facets, about 5 mm
+        const float max_tilt = std::atan(length(make_float3(3.5f * 1.25f, 3.5f * 1.25f, 0.0f)) / (2.0f * slant_range));
+        const float bound = std::sqrt(2.0f) * 0.6f * std::sin(max_tilt);
+        CHECK(half_depth <= bound + 1e-6f);
+        CHECK(half_depth >= 0.99f * bound);
+        CHECK(half_depth > 4e-3f && half_depth < 6e-3f);
+
+        ErrorBound eu, ev, en;
+        for (int i = 0; i < NUM_POINTS; i++) {
+            // instance transform, row-major 3x4
+            const Basis b = random_basis();
+            const float3 t = random_origin();
+            const float m[12] = { b.x.x, b.y.x, b.z.x, t.x,
+                                  b.x.y, b.y.y, b.z.y, t.y,
+                                  b.x.z, b.y.z, b.z.z, t.z };
+            const HitFrame f = transform_hit_frame(local, m);
+
+            const Facet& facet = facets[i % facets.size()];
+            const float3 p_local = facet.center + uniform(-facet.half_size, facet.half_size) * facet.basis.x
+                + uniform(-facet.half_size, facet.half_size) * facet.basis.y;
+            const float3 p = rotate_by_transform(m, p_local) + t;
+            const float3 q = decode_hit_uv(f, encode_hit_uv(f, p));
+            const float eps = rounding(t, local.extent_u);
+            eu.check(std::fabs(dot(q - p, f.basis_x)), half_step(f.extent_u) + eps);
+            ev.check(std::fabs(dot(q - p, f.basis_y)), half_step(f.extent_v) + eps);
+            en.check(std::fabs(dot(q - p, f.basis_z)), half_depth + eps);
+        }
+        std::printf("faceted prototype: worst error / bound u %.3f, v %.3f, normal %.3f\n", eu.worst, ev.worst, en.worst);
+    }
+
+    // points outside the extent are clamped to its border, the corners are exact codes
+    void test_clamp() {
+        PackedRectangleFlat r = {};
+        r.x = make_float3(1.0f, 0.0f, 0.0f);
+        r.y = make_float3(0.0f, 1.0f, 0.0f);
+        r.normal = make_float3(0.0f, 0.0f, 1.0f);
+        r.half_width = 2.0f;
+        r.half_height = 1.0f;
+        const HitFrame f = make_hit_frame(r);
+
+        CHECK(encode_hit_uv(f, make_float3(-2.0f, -1.0f, 0.0f)) == 0u);
+        CHECK(encode_hit_uv(f, make_float3(2.0f, 1.0f, 0.0f)) == 0xFFFFFFFFu);
+        CHECK(encode_hit_uv(f, make_float3(0.0f, 0.0f, 0.0f)) == ((32768u << 16) | 32768u));
+        CHECK(encode_hit_uv(f, make_float3(5.0f, -3.0f, 0.2f)) == 0xFFFF0000u);
+
+        const float3 q = decode_hit_uv(f, encode_hit_uv(f, make_float3(5.0f, -3.0f, 0.2f)));
+        CHECK(q.x == 2.0f && q.y == -1.0f && q.z == 0.0f);
+    }
+}
+
+int main() {
+    test_rectangle_flat();
+    test_rectangle_parabolic();
+    test_cylinder();
+    test_triangle();
+    test_faceted_prototype();
+    test_clamp();
+    return OptixCSP::test::test_result();
+}
@@ -0,0 +1,106 @@
+// sample_hits: sampled entries are non-empty, unique and sorted, uniform over the hits, stable for a seed,
+// nested across sample sizes, and bounded per stratum with hit_to_stratum.
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "core/hit_path.h"
+#include "core/hit_sample.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    // every third entry empty, hit ids 0..3 in turn, some of them with the direct sun tag
+    std::vector<uint32_t> make_hits(size_t count) {
+        std::vector<uint32_t> hits(count, 0);
+        for (size_t k = 0; k < count; k++) {
+            if (k % 3 == 2) continue;
+            hits[k] = static_cast<uint32_t>(k % 4 + 1) | ((k % 5 == 0) ? HIT_DIRECT_SUN : 0u);
+        }
+        return hits;
+    }
+
+    bool is_valid_sample(const std::vector<size_t>& sample, const std::vector<uint32_t>& hits) {
+        for (size_t i = 0; i < sample.size(); i++) {
+            if (sample[i] >= hits.size() || hits[sample[i]] == 0) return false;
+            if (i > 0 && sample[i] <= sample[i - 1]) return false;
+        }
+        return true;
+    }
+
+    void test_uniform() {
+        const std::vector<uint32_t> hits = make_hits(30000);
+        const size_t num_hits = 20000;
+
+        const std::vector<size_t> sample = sample_hits(hits, 500, 1);
+        CHECK(sample.size() == 500);
+        CHECK(is_valid_sample(sample, hits));
+        CHECK(sample_hits(hits, 500, 1) == sample);
+        CHECK(sample_hits(hits, 500, 2) != sample);
+
+        // the 500 lowest priorities are among the 1000 lowest
+        const std::vector<size_t> larger = sample_hits(hits, 1000, 1);
+        CHECK(std::includes(larger.begin(), larger.end(), sample.begin(), sample.end()));
+
+        // asking for more than there is returns every hit
+        const std::vector<size_t> every = sample_hits(hits, 2 * num_hits, 1);
+        CHECK(every.size() == num_hits && is_valid_sample(every, hits));
+        CHECK(sample_hits(hits, 0, 1).empty());
+        CHECK(sample_hits(std::vector<uint32_t>(100, 0), 10, 1).empty());
+    }
+
+    // every hit is drawn with probability sample_size / num_hits, over many seeds
+    void test_inclusion_frequency() {
+        const std::vector<uint32_t> hits = make_hits(150);
+        const size_t num_hits = 100, sample_size = 10, num_seeds = 4000;
+
+        std::vector<size_t> drawn(hits.size(), 0);
+        for (uint64_t seed = 0; seed < num_seeds; seed++) {
+            for (size_t k : sample_hits(hits, sample_size, seed)) drawn[k]++;
+        }
+        // expected 400 draws per hit, binomial standard deviation 19
+        const double expected = static_cast<double>(num_seeds * sample_size) / num_hits;
+        size_t min_drawn = num_seeds, max_drawn = 0;
+        for (size_t k = 0; k < hits.size(); k++) {
+            if (hits[k] == 0) {
+                CHECK(drawn[k] == 0);
+                continue;
+            }
+            min_drawn = std::min(min_drawn, drawn[k]);
+            max_drawn = std::max(max_drawn, drawn[k]);
+        }
+        CHECK_NEAR(static_cast<double>(min_drawn), expected, 100.0);
+        CHECK_NEAR(static_cast<double>(max_drawn), expected, 100.0);
+    }
+
+    void test_stratified() {
+        const std::vector<uint32_t> hits = make_hits(30000);
+        // hit ids 0 and 1 in their own strata, 2 shares stratum 1, 3 is dropped
+        const std::vector<int32_t> hit_to_stratum = { 0, 1, 1, -1 };
+
+        const std::vector<size_t> sample = sample_hits(hits, 300, 5, hit_to_stratum, 2);
+        CHECK(sample.size() == 600);
+        CHECK(is_valid_sample(sample, hits));
+        size_t per_stratum[2] = { 0, 0 };
+        for (size_t k : sample) {
+            const uint32_t hit_id = get_stored_hit_id(hits[k]) - 1;
+            CHECK(hit_id != 3);
+            if (hit_id < 3) per_stratum[hit_to_stratum[hit_id]]++;
+        }
+        CHECK(per_stratum[0] == 300 && per_stratum[1] == 300);
+
+        // a stratum with fewer hits than sample_size keeps all of them, hit ids past the table are dropped
+        const std::vector<int32_t> small = { 0 };
+        std::vector<uint32_t> few = { 1, 0, 2, 1 | HIT_DIRECT_SUN, 3 };
+        CHECK(sample_hits(few, 10, 5, small, 1) == std::vector<size_t>({ 0, 3 }));
+    }
+}
+
+int main() {
+    test_uniform();
+    test_inclusion_frequency();
+    test_stratified();
+    return OptixCSP::test::test_result();
+}
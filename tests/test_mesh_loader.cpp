@@ -0,0 +1,257 @@
+// OBJ and binary STL parsing from in-memory fixtures, the vertex weld and load_mesh on small files:
+// relative indices, "v/vt/vn" corners, polygon fans, +0/-0 welding and the STL face count check.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <vector_functions.h>
+
+#include "core/mesh_loader.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    bool same_face(const uint3& face, unsigned int a, unsigned int b, unsigned int c) {
+        return face.x == a && face.y == b && face.z == c;
+    }
+
+    bool same_vertex(const float3& v, float x, float y, float z) {
+        return v.x == x && v.y == y && v.z == z;
+    }
+
+    TriangleMesh parse_obj(const std::string& text) {
+        return OptixCSP::parse_obj(text.data(), text.size());
+    }
+
+    // binary STL with the given header text, face count and triangles (9 floats each)
+    std::string make_stl(const char* header, uint32_t num_faces, const std::vector<std::vector<float>>& triangles) {
+        std::string data(80, '\0');
+        std::memcpy(&data[0], header, std::strlen(header));
+        data.append(reinterpret_cast<const char*>(&num_faces), sizeof(num_faces));
+        for (const std::vector<float>& triangle : triangles) {
+            const float normal[3] = { 0.0f, 0.0f, 1.0f };
+            const uint16_t attribute = 0;
+            data.append(reinterpret_cast<const char*>(normal), sizeof(normal));
+            data.append(reinterpret_cast<const char*>(triangle.data()), 9 * sizeof(float));
+            data.append(reinterpret_cast<const char*>(&attribute), sizeof(attribute));
+        }
+        return data;
+    }
+
+    // two triangles of the unit square sharing the diagonal
+    const std::vector<std::vector<float>> SQUARE = {
+        { 0.0f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,  1.0f, 1.0f, 0.0f },
+        { 0.0f, 0.0f, 0.0f,  1.0f, 1.0f, 0.0f,  0.0f, 1.0f, 0.0f },
+    };
+
+    void test_obj_indices() {
+        const TriangleMesh mesh = parse_obj(
+            "# unit square\n"
+            "o square\n"
+            "v 0 0 0\n"
+            "v 1 0 0\n"
+            "v +1 1 0\n"
+            "v 0 1.0e0 0\n"
+            "f -4 -3 -2\n"
+            "f 1 3 -1\n");
+        CHECK(mesh.get_num_vertices() == 4 && mesh.get_num_faces() == 2);
+        if (mesh.get_num_faces() != 2) return;
+        CHECK(same_vertex(mesh.vertices[2], 1.0f, 1.0f, 0.0f));
+        CHECK(same_vertex(mesh.vertices[3], 0.0f, 1.0f, 0.0f));
+        CHECK(same_face(mesh.indices[0], 0, 1, 2));
+        CHECK(same_face(mesh.indices[1], 0, 2, 3));
+
+        // relative indices count back from the last vertex read so far, not from the end of the file
+        const TriangleMesh interleaved = parse_obj(
+            "v 0 0 0\nv 1 0 0\nv 1 1 0\nf -3 -2 -1\n"
+            "v 0 1 0\nf -4 -2 -1\n");
+        CHECK(interleaved.get_num_faces() == 2);
+        if (interleaved.get_num_faces() == 2) {
+            CHECK(same_face(interleaved.indices[0], 0, 1, 2));
+            CHECK(same_face(interleaved.indices[1], 0, 2, 3));
+        }
+    }
+
+    void test_obj_corners() {
+        // texture and normal indices are ignored, CRLF line endings and tabs are accepted
+        const TriangleMesh mesh = parse_obj(
+            "v 0 0 0\r\nv 1 0 0\r\nv 1 1 0\r\nv 0 1 0\r\n"
+            "vt 0 0\r\nvt 1 0\r\nvt 1 1\r\n"
+            "vn 0 0 1\r\n"
+            "f 1/1/1 2/2/1 3/3/1\r\n"
+            "f 1//1\t3//1 4//1\r\n"
+            "f -4/1 -2/3 -1/2\r\n");
+        CHECK(mesh.get_num_vertices() == 4 && mesh.get_num_faces() == 3);
+        if (mesh.get_num_faces() != 3) return;
+        CHECK(same_face(mesh.indices[0], 0, 1, 2));
+        CHECK(same_face(mesh.indices[1], 0, 2, 3));
+        CHECK(same_face(mesh.indices[2], 0, 2, 3));
+    }
+
+    void test_obj_fan() {
+        // pentagon and hexagon, fanned around their first corner
+        const TriangleMesh mesh = parse_obj(
+            "v 0 0 0\nv 1 0 0\nv 2 1 0\nv 1 2 0\nv 0 2 0\nv -1 1 0\n"
+            "f 1 2 3 4 5\n"
+            "f 6/1 5/1 4/1 3/1 2/1 -6/1\n");
+        CHECK(mesh.get_num_faces() == 7);
+        if (mesh.get_num_faces() != 7) return;
+        CHECK(same_face(mesh.indices[0], 0, 1, 2));
+        CHECK(same_face(mesh.indices[1], 0, 2, 3));
+        CHECK(same_face(mesh.indices[2], 0, 3, 4));
+        CHECK(same_face(mesh.indices[3], 5, 4, 3));
+        CHECK(same_face(mesh.indices[4], 5, 3, 2));
+        CHECK(same_face(mesh.indices[5], 5, 2, 1));
+        CHECK(same_face(mesh.indices[6], 5, 1, 0));
+    }
+
+    void test_obj_errors() {
+        CHECK_THROWS(parse_obj("v 0 0 0\nv 1 0 0\nf 1 2\n"));            // face with two corners
+        CHECK_THROWS(parse_obj("v 0 0\n"));                             // vertex with two coordinates
+        CHECK_THROWS(parse_obj("v 0 0 0\nv 1 0 0\nv 1 1 0\nf 0 1 2\n"));   // indices are 1-based
+        CHECK_THROWS(parse_obj("v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1 2 4\n"));   // missing vertex
+        CHECK_THROWS(parse_obj("v 0 0 0\nv 1 0 0\nf -3 -2 -1\nv 1 1 0\n")); // relative index before its vertex
+        CHECK(parse_obj("# nothing\n\nvt 0 0\n").get_num_faces() == 0);
+    }
+
+    // large enough to be split into several byte ranges (one per host thread, so only with several threads),
+    // every face refers back to the vertices before it
+    void test_obj_ranges() {
+        const size_t num_faces = 40000;
+        std::string text;
+        for (size_t f = 0; f < num_faces; f++) {
+            const std::string x = std::to_string(f);
+            text += "v " + x + " 0 0\nv " + x + " 1 0\nv " + x + " 0 1\n";
+            text += (f % 2 == 0) ? "f -3/1/1 -2/1/1 -1/1/1\n" : "f " + std::to_string(3 * f + 1) + " -2 -1\n";
+            text += "# padding so that the ranges split lines at various positions\n";
+        }
+        CHECK(text.size() > (size_t(2) << 20));
+
+        const TriangleMesh mesh = parse_obj(text);
+        CHECK(mesh.get_num_vertices() == 3 * num_faces && mesh.get_num_faces() == num_faces);
+        if (mesh.get_num_faces() != num_faces) return;
+        size_t wrong = 0;
+        for (size_t f = 0; f < num_faces; f++) {
+            const unsigned int first = static_cast<unsigned int>(3 * f);
+            if (!same_face(mesh.indices[f], first, first + 1, first + 2)) wrong++;
+            if (!same_vertex(mesh.vertices[first + 2], static_cast<float>(f), 0.0f, 1.0f)) wrong++;
+        }
+        CHECK(wrong == 0);
+    }
+
+    void test_weld() {
+        TriangleMesh mesh;
+        mesh.vertices = {
+            make_float3(0.0f, 0.0f, 0.0f),
+            make_float3(1.0f, 0.0f, 0.0f),
+            make_float3(-0.0f, 0.0f, -0.0f),    // same as vertex 0
+            make_float3(1.0f, 1.0f, 0.0f),
+            make_float3(1.0f, 0.0f, -0.0f),     // same as vertex 1
+            make_float3(1e-45f, 0.0f, 0.0f),    // denormal, not welded with 0
+        };
+        mesh.indices = { make_uint3(0, 1, 3), make_uint3(2, 4, 3), make_uint3(5, 4, 3) };
+
+        CHECK(weld_vertices(mesh) == 2);
+        CHECK(mesh.get_num_vertices() == 4);
+        if (mesh.get_num_vertices() != 4) return;
+        // welded vertices keep the order of their first occurrence
+        CHECK(same_vertex(mesh.vertices[0], 0.0f, 0.0f, 0.0f) && !std::signbit(mesh.vertices[0].x));
+        CHECK(same_vertex(mesh.vertices[1], 1.0f, 0.0f, 0.0f));
+        CHECK(same_vertex(mesh.vertices[2], 1.0f, 1.0f, 0.0f));
+        CHECK(mesh.vertices[3].x == 1e-45f);
+        CHECK(same_face(mesh.indices[0], 0, 1, 2));
+        CHECK(same_face(mesh.indices[1], 0, 1, 2));
+        CHECK(same_face(mesh.indices[2], 3, 1, 2));
+
+        // nothing to weld
+        CHECK(weld_vertices(mesh) == 0);
+        CHECK(mesh.get_num_vertices() == 4);
+    }
+
+    void test_stl() {
+        // binary STL headers may start with "solid" too
+        const std::string stl = make_stl("solid exported by some CAD tool", 2, SQUARE);
+        CHECK(stl.size() == 84 + 2 * 50);
+        CHECK(detect_mesh_file_format(stl.data(), stl.size()) == MeshFileFormat::STL_BINARY);
+
+        TriangleMesh mesh = parse_stl_binary(stl.data(), stl.size());
+        CHECK(mesh.get_num_vertices() == 6 && mesh.get_num_faces() == 2);
+        if (mesh.get_num_faces() != 2) return;
+        CHECK(same_face(mesh.indices[1], 3, 4, 5));
+        CHECK(same_vertex(mesh.vertices[4], 1.0f, 1.0f, 0.0f));
+        CHECK(same_vertex(mesh.vertices[5], 0.0f, 1.0f, 0.0f));
+
+        CHECK(weld_vertices(mesh) == 2);
+        CHECK(same_face(mesh.indices[1], 0, 2, 3));
+
+        const std::string empty = make_stl("", 0, {});
+        CHECK(detect_mesh_file_format(empty.data(), empty.size()) == MeshFileFormat::STL_BINARY);
+        CHECK(parse_stl_binary(empty.data(), empty.size()).get_num_faces() == 0);
+    }
+
+    void test_stl_face_count() {
+        // the size has to match the face count exactly, otherwise the file is not binary STL
+        const std::string longer = make_stl("mesh", 1, SQUARE);
+        const std::string shorter = make_stl("mesh", 3, SQUARE);
+        CHECK(detect_mesh_file_format(longer.data(), longer.size()) == MeshFileFormat::OBJ);
+        CHECK(detect_mesh_file_format(shorter.data(), shorter.size()) == MeshFileFormat::OBJ);
+
+        // a mismatching "solid" file is taken for ASCII STL
+        const std::string solid = make_stl("solid mesh", 3, SQUARE);
+        CHECK_THROWS(detect_mesh_file_format(solid.data(), solid.size()));
+        const std::string ascii = "solid mesh\nfacet normal 0 0 1\n";
+        CHECK_THROWS(detect_mesh_file_format(ascii.data(), ascii.size()));
+
+        // trailing bytes are ignored by the parser, missing records are not
+        CHECK(parse_stl_binary(longer.data(), longer.size()).get_num_faces() == 1);
+        CHECK_THROWS(parse_stl_binary(shorter.data(), shorter.size()));
+        CHECK_THROWS(parse_stl_binary(longer.data(), 83));
+        const std::string cut = make_stl("mesh", 2, SQUARE);
+        CHECK_THROWS(parse_stl_binary(cut.data(), cut.size() - 1));
+    }
+
+    std::string write_file(const std::string& filename, const std::string& data) {
+        std::ofstream out(filename, std::ios::binary);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        return filename;
+    }
+
+    void test_load_mesh() {
+        const std::string stl = write_file("test_mesh_loader.stl", make_stl("solid square", 2, SQUARE));
+        const std::string obj = write_file("test_mesh_loader.obj", "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 0 0\nf 1 2 3\nf 4 3 2\n");
+        const std::string truncated = write_file("test_mesh_loader_truncated.stl",
+            make_stl("solid square", 2, SQUARE).substr(0, 84 + 50 + 20));
+        const std::string empty = write_file("test_mesh_loader_empty.obj", "");
+
+        auto square = load_mesh(stl);
+        CHECK(square->get_num_vertices() == 4 && square->get_num_faces() == 2);
+        CHECK(load_mesh(stl, false)->get_num_vertices() == 6);
+
+        auto triangles = load_mesh(obj);
+        CHECK(triangles->get_num_vertices() == 3 && triangles->get_num_faces() == 2);
+        if (triangles->get_num_faces() == 2) CHECK(same_face(triangles->indices[1], 0, 2, 1));
+
+        CHECK_THROWS(load_mesh(truncated));
+        CHECK_THROWS(load_mesh(empty));
+        CHECK_THROWS(load_mesh("test_mesh_loader_missing.obj"));
+
+        for (const std::string& filename : { stl, obj, truncated, empty }) std::remove(filename.c_str());
+    }
+}
+
+int main() {
+    test_obj_indices();
+    test_obj_corners();
+    test_obj_fan();
+    test_obj_errors();
+    test_obj_ranges();
+    test_weld();
+    test_stl();
+    test_stl_face_count();
+    test_load_mesh();
+    return OptixCSP::test::test_result();
+}
@@ -0,0 +1,109 @@
+// OpticsTable: optics by name, shared records, and a rejected optic leaving the table as it was.
+#include <string>
+
+#include "core/optics_table.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    Optic make_optic(const std::string& name, double reflectivity) {
+        Optic optic;
+        optic.name = name;
+        optic.front.reflectivity = reflectivity;
+        optic.front.slope_error = 0.95;
+        return optic;
+    }
+
+    MaterialData element_material(float reflectivity) {
+        MaterialData material = { reflectivity, 0.0f, 0.0f, 0.0f, false };
+        return material;
+    }
+
+    // elements with the same optic and interaction, or the same properties, share a record
+    void test_records() {
+        OpticsTable table;
+        const uint16_t mirror = table.add_optic(make_optic("mirror", 0.9));
+        const uint16_t glass = table.add_optic(make_optic("glass", 0.5));
+        CHECK(table.find_optic("mirror") == mirror);
+        CHECK(table.find_optic("glass") == glass);
+        CHECK(table.find_optic("none") == -1);
+
+        MaterialData reflect = element_material(0.0f);
+        MaterialData refract = reflect;
+        refract.use_refraction = true;
+        const uint16_t a = table.intern(mirror, reflect);
+        CHECK(table.intern(mirror, reflect) == a);
+        CHECK(table.intern(mirror, refract) != a);
+        CHECK(table.intern(glass, reflect) != a);
+
+        const uint16_t own = table.intern(-1, element_material(0.8f));
+        CHECK(table.intern(-1, element_material(0.8f)) == own);
+        CHECK(table.intern(-1, element_material(0.7f)) != own);
+        CHECK(table.get_num_records() == 5);
+        CHECK(table.get_records()[a].reflectivity == 0.9f);
+
+        // adding an optic under an existing name replaces it and rewrites its records
+        table.clear_dirty();
+        CHECK(table.add_optic(make_optic("mirror", 0.8)) == mirror);
+        CHECK(table.get_num_optics() == 2);
+        CHECK(table.get_records()[a].reflectivity == 0.8f);
+        CHECK(table.is_dirty());
+        CHECK_THROWS(table.intern(7, reflect));
+    }
+
+    // set_optic checks the new optic before anything changes
+    void test_rejected_set_optic() {
+        OpticsTable table;
+        const uint16_t mirror = table.add_optic(make_optic("mirror", 0.9));
+        table.add_optic(make_optic("glass", 0.5));
+        const uint16_t record = table.intern(mirror, element_material(0.0f));
+        table.clear_dirty();
+
+        // a renamed optic with a broken table
+        Optic broken = make_optic("silver", 0.95);
+        broken.front.reflectivity_angles = { 0.0, 500.0 };
+        broken.front.reflectivity_values = { 0.9 };
+        CHECK_THROWS(table.set_optic(mirror, broken));
+
+        // renamed to an existing optic
+        CHECK_THROWS(table.set_optic(mirror, make_optic("glass", 0.95)));
+
+        CHECK(table.find_optic("mirror") == mirror);
+        CHECK(table.find_optic("silver") == -1);
+        CHECK(table.find_optic("glass") == 1);
+        CHECK(table.get_optic(mirror).name == "mirror");
+        CHECK(table.get_optic(mirror).front.reflectivity == 0.9);
+        CHECK(table.get_records()[record].reflectivity == 0.9f);
+        CHECK(table.get_angle_tables().empty());
+        CHECK(!table.is_dirty());
+
+        // the same through add_optic under the old name
+        broken.name = "mirror";
+        CHECK_THROWS(table.add_optic(broken));
+        CHECK(table.get_optic(mirror).front.reflectivity == 0.9);
+        CHECK(!table.is_dirty());
+
+        // a new optic with a broken table is not added
+        broken.name = "silver";
+        CHECK_THROWS(table.add_optic(broken));
+        CHECK(table.find_optic("silver") == -1);
+        CHECK(table.get_num_optics() == 2);
+
+        // a valid rename goes through and keeps the records of the optic
+        broken.front.reflectivity_values = { 0.9, 0.8 };
+        table.set_optic(mirror, broken);
+        CHECK(table.find_optic("mirror") == -1);
+        CHECK(table.find_optic("silver") == mirror);
+        CHECK(table.get_records()[record].reflectivity_table == 0);
+        CHECK(table.get_angle_tables().size() == ANGLE_TABLE_SIZE);
+        CHECK(table.is_dirty());
+    }
+}
+
+int main() {
+    test_records();
+    test_rejected_set_optic();
+    return OptixCSP::test::test_result();
+}
@@ -0,0 +1,376 @@
+// The packed device geometry (pack_geometry + the intersection functions of Intersection.h) must give the
+// same hits, t and normals as the GeometryDataST intersection programs it replaced. The reference functions
+// below are those programs, with the ray read from the arguments instead of the OptiX intrinsics.
+#include <random>
+
+#include "shaders/GeometryDataST.h"
+#include "shaders/PackedGeometry.h"
+#include "shaders/Intersection.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    bool reference_rectangle_flat(const GeometryDataST::Rectangle_Flat& rectangle, const float3& ray_orig, const float3& ray_dir,
+        float ray_tmin, float ray_tmax, float& t, float3& normal)
+    {
+        float3 n = make_float3(rectangle.plane);
+        float dt = dot(ray_dir, n);
+        t = (rectangle.plane.w - dot(n, ray_orig)) / dt;
+        if (t > ray_tmin && t < ray_tmax)
+        {
+            float3 p = ray_orig + ray_dir * t;
+            float3 v = p - rectangle.center;
+            float x = dot(rectangle.x, v);
+            float y = dot(rectangle.y, v);
+            if (x >= -rectangle.width / 2 && x <= rectangle.width / 2 &&
+                y >= -rectangle.height / 2 && y <= rectangle.height / 2)
+            {
+                normal = n;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void reference_cylinder_local_ray(const GeometryDataST::Cylinder_Y& cyl, const float3& ray_orig, const float3& ray_dir,
+        float3& local_x, float3& local_y, float3& local_z, float3& local_ray_orig, float3& local_ray_dir)
+    {
+        local_x = cyl.base_x;
+        local_z = cyl.base_z;
+        local_y = cross(local_z, local_x);
+        const float3 d = ray_orig - cyl.center;
+        local_ray_orig = make_float3(dot(d, local_x), dot(d, local_y), dot(d, local_z));
+        local_ray_dir = make_float3(dot(ray_dir, local_x), dot(ray_dir, local_y), dot(ray_dir, local_z));
+    }
+
+    bool reference_cylinder_y(const GeometryDataST::Cylinder_Y& cyl, const float3& ray_orig, const float3& ray_dir_in,
+        float ray_tmin, float ray_tmax, float& t, float3& normal)
+    {
+        const float3 ray_dir = normalize(ray_dir_in);
+        float3 local_x, local_y, local_z, local_ray_orig, local_ray_dir;
+        reference_cylinder_local_ray(cyl, ray_orig, ray_dir, local_x, local_y, local_z, local_ray_orig, local_ray_dir);
+
+        float A = local_ray_dir.x * local_ray_dir.x + local_ray_dir.z * local_ray_dir.z;
+        float B = 2.0f * (local_ray_orig.x * local_ray_dir.x + local_ray_orig.z * local_ray_dir.z);
+        float C = local_ray_orig.x * local_ray_orig.x + local_ray_orig.z * local_ray_orig.z - cyl.radius * cyl.radius;
+        float determinant = B * B - 4.0f * A * C;
+        if (determinant < 0.0f) return false;
+
+        float t1 = (-B - sqrtf(determinant)) / (2.0f * A);
+        float t2 = (-B + sqrtf(determinant)) / (2.0f * A);
+        t = t1 > 0.0f ? t1 : t2;
+        if (t < ray_tmin || t > ray_tmax) return false;
+
+        float3 local_hit_point = local_ray_orig + t * local_ray_dir;
+        if (fabsf(local_hit_point.y) > cyl.half_height)
+        {
+            t = t2;
+            local_hit_point = local_ray_orig + t * local_ray_dir;
+            if (t < ray_tmin || t > ray_tmax || fabsf(local_hit_point.y) > cyl.half_height) return false;
+        }
+        float3 local_normal = normalize(make_float3(local_hit_point.x, 0.0f, local_hit_point.z));
+        normal = local_normal.x * local_x + local_normal.y * local_y + local_normal.z * local_z;
+        return true;
+    }
+
+    bool reference_cylinder_y_capped(const GeometryDataST::Cylinder_Y& cyl, const float3& ray_orig, const float3& ray_dir_in,
+        float ray_tmin, float ray_tmax, float& t, float3& normal)
+    {
+        const float3 ray_dir = normalize(ray_dir_in);
+        float3 local_x, local_y, local_z, local_ray_orig, local_ray_dir;
+        reference_cylinder_local_ray(cyl, ray_orig, ray_dir, local_x, local_y, local_z, local_ray_orig, local_ray_dir);
+
+        float A = local_ray_dir.x * local_ray_dir.x + local_ray_dir.z * local_ray_dir.z;
+        float B = 2.0f * (local_ray_orig.x * local_ray_dir.x + local_ray_orig.z * local_ray_dir.z);
+        float C = local_ray_orig.x * local_ray_orig.x + local_ray_orig.z * local_ray_orig.z - cyl.radius * cyl.radius;
+        float determinant = B * B - 4.0f * A * C;
+
+        float t_curved = ray_tmax + 1.0f;
+        if (determinant >= 0.0f)
+        {
+            float t1 = (-B - sqrtf(determinant)) / (2.0f * A);
+            float t2 = (-B + sqrtf(determinant)) / (2.0f * A);
+            if (t1 > ray_tmin && t1 < ray_tmax && fabsf(local_ray_orig.y + t1 * local_ray_dir.y) <= cyl.half_height)
+                t_curved = t1;
+            else if (t2 > ray_tmin && t2 < ray_tmax && fabsf(local_ray_orig.y + t2 * local_ray_dir.y) <= cyl.half_height)
+                t_curved = t2;
+        }
+
+        float t_caps = ray_tmax + 1.0f;
+        if (fabsf(local_ray_dir.y) > 1e-6f)
+        {
+            float tb = (-cyl.half_height - local_ray_orig.y) / local_ray_dir.y;
+            float2 hb = make_float2(local_ray_orig.x + tb * local_ray_dir.x, local_ray_orig.z + tb * local_ray_dir.z);
+            if (tb > ray_tmin && tb < ray_tmax && dot(hb, hb) <= cyl.radius * cyl.radius) t_caps = tb;
+        }
+        if (fabsf(local_ray_dir.y) > 1e-6f)
+        {
+            float tt = (cyl.half_height - local_ray_orig.y) / local_ray_dir.y;
+            float2 ht = make_float2(local_ray_orig.x + tt * local_ray_dir.x, local_ray_orig.z + tt * local_ray_dir.z);
+            if (tt > ray_tmin && tt < ray_tmax && dot(ht, ht) <= cyl.radius * cyl.radius) t_caps = fminf(t_caps, tt);
+        }
+
+        t = fminf(t_curved, t_caps);
+        if (t >= ray_tmax || t <= ray_tmin) return false;
+
+        float3 local_hit_point = local_ray_orig + t * local_ray_dir;
+        float3 local_normal;
+        if (t == t_curved) local_normal = normalize(make_float3(local_hit_point.x, 0.0f, local_hit_point.z));
+        else local_normal = make_float3(0.0f, std::signbit(local_hit_point.y) ? -1.0f : 1.0f, 0.0f);
+        normal = local_normal.x * local_x + local_normal.y * local_y + local_normal.z * local_z;
+        return true;
+    }
+
+    bool reference_rectangle_parabolic(const GeometryDataST::Rectangle_Parabolic& rect, const float3& ray_orig, const float3& ray_dir,
+        float ray_tmin, float ray_tmax, float& t, float3& normal)
+    {
+        // v1 and v2 are stored scaled by the inverse of their squared length
+        float L1 = 1.0f / length(rect.v1);
+        float L2 = 1.0f / length(rect.v2);
+        float3 e1 = rect.v1 * L1;
+        float3 e2 = rect.v2 * L2;
+        float3 n = normalize(cross(e2, e1));
+        float3 rect_center = rect.anchor + (L1 / 2.0f) * e1 + (L2 / 2.0f) * e2;
+
+        float3 d = ray_orig - rect_center;
+        float ox = dot(d, e1), oy = dot(d, e2), oz = dot(d, n);
+        float dx = dot(ray_dir, e1), dy = dot(ray_dir, e2), dz = dot(ray_dir, n);
+        const float curv_x = rect.curv_x;
+        const float curv_y = rect.curv_y;
+
+        float A = (curv_x * 0.5f) * (dx * dx) + (curv_y * 0.5f) * (dy * dy);
+        float B = curv_x * (ox * dx) + curv_y * (oy * dy) - dz;
+        float C = (curv_x * 0.5f) * (ox * ox) + (curv_y * 0.5f) * (oy * oy) - oz;
+
+        t = 0.0f;
+        bool valid = false;
+        if (fabsf(A) < 1e-12f) {
+            t = -C / B;
+            valid = (t > 0.0f);
+        }
+        else {
+            float discr = B * B - 4.0f * A * C;
+            if (discr >= 0.0f) {
+                float sqrt_discr = sqrtf(discr);
+                float t1 = (-B - sqrt_discr) / (2.0f * A);
+                float t2 = (-B + sqrt_discr) / (2.0f * A);
+                if (t1 > 0.0f && t1 < t2) { t = t1; valid = true; }
+                else if (t2 > 0.0f) { t = t2; valid = true; }
+            }
+        }
+        if (!valid || t < ray_tmin || t > ray_tmax) return false;
+
+        float x_hit = ox + t * dx;
+        float y_hit = oy + t * dy;
+        float a1 = x_hit / (L1 / 2.);
+        float a2 = y_hit / (L2 / 2.);
+        if (a1 < -1.0f || a1 > 1.0f || a2 < -1.0f || a2 > 1.0f) return false;
+
+        float3 N_local = normalize(make_float3(-curv_x * x_hit, -curv_y * y_hit, 1.0f));
+        normal = normalize(N_local.x * e1 + N_local.y * e2 + N_local.z * n);
+        return true;
+    }
+
+    bool reference_triangle_flat(const GeometryDataST::Triangle_Flat& tri, const float3& ro, const float3& rd,
+        float ray_tmin, float ray_tmax, float& t, float3& normal)
+    {
+        const float3 pvec = cross(rd, tri.e2);
+        const float det = dot(tri.e1, pvec);
+        if (det <= 1e-8f) return false;
+        const float inv_det = 1.0f / det;
+        const float3 tvec = ro - tri.v0;
+        const float u = dot(tvec, pvec) * inv_det;
+        if (u < 0.0f || u > 1.0f) return false;
+        const float3 qvec = cross(tvec, tri.e1);
+        const float v = dot(rd, qvec) * inv_det;
+        if (v < 0.0f || (u + v) > 1.0f) return false;
+        t = dot(tri.e2, qvec) * inv_det;
+        if (t < ray_tmin || t > ray_tmax) return false;
+        normal = tri.normal;
+        return true;
+    }
+
+    std::mt19937 rng(20261018u);
+
+    float uniform(float a, float b) {
+        return std::uniform_real_distribution<float>(a, b)(rng);
+    }
+
+    // coordinate in [-limit, limit] of a target point, kept away from the edge at +-edge so that the hit or
+    // miss does not depend on the last bit of the bounds test
+    float sample_coordinate(float edge, float limit) {
+        for (;;) {
+            const float c = uniform(-limit, limit);
+            if (fabsf(fabsf(c) - edge) > 1e-3f * edge) return c;
+        }
+    }
+
+    float3 random_unit() {
+        for (;;) {
+            const float3 v = make_float3(uniform(-1.0f, 1.0f), uniform(-1.0f, 1.0f), uniform(-1.0f, 1.0f));
+            const float l = length(v);
+            if (l > 0.1f && l <= 1.0f) return v * (1.0f / l);
+        }
+    }
+
+    // orthonormal frame with a random orientation
+    void random_frame(float3& x, float3& y, float3& z) {
+        z = random_unit();
+        x = normalize(cross(fabsf(z.x) > 0.9f ? make_float3(0.0f, 1.0f, 0.0f) : make_float3(1.0f, 0.0f, 0.0f), z));
+        y = cross(z, x);
+    }
+
+    // ray from a random point on the side of normal towards target, tilted by up to 60 degrees
+    void ray_towards(const float3& target, const float3& normal, float3& orig, float3& dir) {
+        float3 away = random_unit();
+        if (dot(away, normal) < 0.5f) away = normalize(away + 2.0f * normal);
+        orig = target + uniform(1.0f, 50.0f) * away;
+        dir = normalize(target - orig);
+    }
+
+    template <typename Reference, typename Packed>
+    void compare(const char* name, Reference reference, Packed packed, const float3& orig, const float3& dir, int& hits) {
+        const float tmin = 1e-3f, tmax = 1e16f;
+        float t_ref = 0.0f, t_new = 0.0f;
+        float3 n_ref = make_float3(0.0f, 0.0f, 0.0f), n_new = make_float3(0.0f, 0.0f, 0.0f);
+        const bool hit_ref = reference(orig, dir, tmin, tmax, t_ref, n_ref);
+        const bool hit_new = packed(orig, dir, tmin, tmax, t_new, n_new);
+        if (hit_ref != hit_new) {
+            std::fprintf(stderr, "%s: hit %d vs %d\n", name, hit_ref, hit_new);
+        }
+        CHECK(hit_ref == hit_new);
+        if (!hit_ref || !hit_new) return;
+        hits++;
+        CHECK_NEAR(t_new, t_ref, 1e-5 * fmaxf(1.0f, fabsf(t_ref)));
+        CHECK_NEAR(length(n_new - n_ref), 0.0, 1e-5);
+    }
+
+    const int NUM_SHAPES = 200;
+    const int RAYS_PER_SHAPE = 500;
+
+    void test_rectangle_flat() {
+        int hits = 0;
+        for (int s = 0; s < NUM_SHAPES; s++) {
+            float3 x, y, z;
+            random_frame(x, y, z);
+            const float3 center = make_float3(uniform(-100.0f, 100.0f), uniform(-100.0f, 100.0f), uniform(0.0f, 50.0f));
+            const float width = uniform(0.5f, 10.0f), height = uniform(0.5f, 10.0f);
+            const GeometryDataST::Rectangle_Flat reference(center, x, y, width, height);
+            const PackedRectangleFlat packed = pack_geometry(reference);
+
+            for (int r = 0; r < RAYS_PER_SHAPE; r++) {
+                const float3 target = center + sample_coordinate(width / 2, width) * x + sample_coordinate(height / 2, height) * y;
+                float3 orig, dir;
+                ray_towards(target, z, orig, dir);
+                compare("rectangle_flat",
+                    [&](auto&... a) { return reference_rectangle_flat(reference, a...); },
+                    [&](auto&... a) { return intersect_rectangle_flat(packed, a...); }, orig, dir, hits);
+            }
+        }
+        CHECK(hits > NUM_SHAPES * RAYS_PER_SHAPE / 8);
+        std::printf("rectangle_flat: %d hits\n", hits);
+    }
+
+    void test_rectangle_parabolic() {
+        int hits = 0;
+        for (int s = 0; s < NUM_SHAPES; s++) {
+            float3 x, y, z;
+            random_frame(x, y, z);
+            const float3 center = make_float3(uniform(-100.0f, 100.0f), uniform(-100.0f, 100.0f), uniform(0.0f, 50.0f));
+            const float width = uniform(0.5f, 10.0f), height = uniform(0.5f, 10.0f);
+            const float curv_x = uniform(0.0f, 0.05f), curv_y = uniform(0.0f, 0.05f);
+
+            // same construction as CspElement::toDeviceGeometryData
+            const float3 v1 = x * -width;
+            const float3 v2 = y * height;
+            const GeometryDataST::Rectangle_Parabolic reference(v1, v2, center - v1 * 0.5f - v2 * 0.5f, curv_x, curv_y);
+            const PackedRectangleParabolic packed = pack_geometry(reference);
+
+            for (int r = 0; r < RAYS_PER_SHAPE; r++) {
+                const float u = sample_coordinate(width / 2, width), v = sample_coordinate(height / 2, height);
+                // on the paraboloid, whose vertex normal is cross(v2, v1) = z
+                const float3 target = center + u * x + v * y + 0.5f * (curv_x * u * u + curv_y * v * v) * z;
+                float3 orig, dir;
+                ray_towards(target, z, orig, dir);
+                compare("rectangle_parabolic",
+                    [&](auto&... a) { return reference_rectangle_parabolic(reference, a...); },
+                    [&](auto&... a) { return intersect_rectangle_parabolic(packed, a...); }, orig, dir, hits);
+            }
+        }
+        CHECK(hits > NUM_SHAPES * RAYS_PER_SHAPE / 8);
+        std::printf("rectangle_parabolic: %d hits\n", hits);
+    }
+
+    void test_cylinder_y() {
+        int hits = 0, hits_capped = 0;
+        for (int s = 0; s < NUM_SHAPES; s++) {
+            float3 x, y, z;
+            random_frame(x, y, z);
+            const float3 center = make_float3(uniform(-100.0f, 100.0f), uniform(-100.0f, 100.0f), uniform(0.0f, 50.0f));
+            const float radius = uniform(0.5f, 5.0f), half_height = uniform(0.5f, 10.0f);
+            const GeometryDataST::Cylinder_Y reference(center, radius, half_height, x, z);
+            const PackedCylinderY packed = pack_geometry(reference);
+            const float3 axis = cross(z, x);
+
+            for (int r = 0; r < RAYS_PER_SHAPE; r++) {
+                // around the mantle (and past the caps), from outside and from inside
+                const float angle = uniform(0.0f, 2.0f * M_PIf);
+                const float3 radial = cosf(angle) * x + sinf(angle) * z;
+                const float3 target = center + radius * radial + sample_coordinate(half_height, 1.5f * half_height) * axis;
+                float3 orig, dir;
+                ray_towards(target, r % 4 == 0 ? -radial : radial, orig, dir);
+                if (r % 4 == 0) orig = center + uniform(-0.5f, 0.5f) * half_height * axis;  // inside
+                dir = normalize(target - orig);
+                compare("cylinder_y",
+                    [&](auto&... a) { return reference_cylinder_y(reference, a...); },
+                    [&](auto&... a) { return intersect_cylinder_y(packed, a...); }, orig, dir, hits);
+                compare("cylinder_y_capped",
+                    [&](auto&... a) { return reference_cylinder_y_capped(reference, a...); },
+                    [&](auto&... a) { return intersect_cylinder_y_capped(packed, a...); }, orig, dir, hits_capped);
+            }
+        }
+        CHECK(hits > NUM_SHAPES * RAYS_PER_SHAPE / 8);
+        CHECK(hits_capped > NUM_SHAPES * RAYS_PER_SHAPE / 8);
+        std::printf("cylinder_y: %d hits, capped: %d hits\n", hits, hits_capped);
+    }
+
+    void test_triangle_flat() {
+        int hits = 0;
+        for (int s = 0; s < NUM_SHAPES; s++) {
+            const float3 a = make_float3(uniform(-100.0f, 100.0f), uniform(-100.0f, 100.0f), uniform(0.0f, 50.0f));
+            const float3 b = a + uniform(0.5f, 10.0f) * random_unit();
+            const float3 c = a + uniform(0.5f, 10.0f) * random_unit();
+            const GeometryDataST::Triangle_Flat reference(a, b, c);
+            const PackedTriangleFlat packed = pack_geometry(reference);
+            if (length(cross(reference.e1, reference.e2)) < 1e-2f) continue;
+
+            for (int r = 0; r < RAYS_PER_SHAPE; r++) {
+                // barycentric coordinates away from the edges, inside and outside the triangle
+                float u, v;
+                do {
+                    u = uniform(-0.3f, 1.3f);
+                    v = uniform(-0.3f, 1.3f);
+                } while (fabsf(u) < 1e-3f || fabsf(v) < 1e-3f || fabsf(u + v - 1.0f) < 1e-3f);
+                const float3 target = a + u * reference.e1 + v * reference.e2;
+                float3 orig, dir;
+                // front and back faces, the back face is culled
+                ray_towards(target, r % 3 == 0 ? -reference.normal : reference.normal, orig, dir);
+                compare("triangle_flat",
+                    [&](auto&... x) { return reference_triangle_flat(reference, x...); },
+                    [&](auto&... x) { return intersect_triangle_flat(packed, x...); }, orig, dir, hits);
+            }
+        }
+        CHECK(hits > NUM_SHAPES * RAYS_PER_SHAPE / 8);
+        std::printf("triangle_flat: %d hits\n", hits);
+    }
+}
+
+int main() {
+    test_rectangle_flat();
+    test_rectangle_parabolic();
+    test_cylinder_y();
+    test_triangle_flat();
+    return OptixCSP::test::test_result();
+}
@@ -0,0 +1,76 @@
+// radix_sort_pairs against std::stable_sort: several tiles, keys sorted by their lower bits only,
+// and passes skipped when all the keys share a digit.
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "utils/radix_sort.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    // sort (key, index) pairs with radix_sort_pairs and compare with a stable sort by the masked key
+    template <typename Key>
+    void check_sort(std::vector<Key> keys, int key_bits, size_t tile_size) {
+        const Key mask = (key_bits >= static_cast<int>(8 * sizeof(Key))) ? ~Key(0) : (Key(1) << key_bits) - 1;
+
+        std::vector<uint32_t> expected(keys.size());
+        std::iota(expected.begin(), expected.end(), 0u);
+        std::stable_sort(expected.begin(), expected.end(),
+            [&](uint32_t a, uint32_t b) { return (keys[a] & mask) < (keys[b] & mask); });
+
+        const std::vector<Key> original = keys;
+        std::vector<uint32_t> values(keys.size());
+        std::iota(values.begin(), values.end(), 0u);
+        radix_sort_pairs(keys, values, key_bits, tile_size);
+
+        CHECK(values == expected);
+        bool keys_follow = keys.size() == original.size();
+        for (size_t i = 0; keys_follow && i < keys.size(); i++) keys_follow = keys[i] == original[values[i]];
+        CHECK(keys_follow);
+    }
+
+    void test_sort() {
+        std::mt19937_64 rng(7);
+        std::vector<uint32_t> keys(100000);
+
+        for (auto& k : keys) k = static_cast<uint32_t>(rng());
+        check_sort(keys, 32, 1000);
+        check_sort(keys, 32, size_t(1) << 16);
+
+        // many duplicates, the order of equal keys must be kept across tiles
+        for (auto& k : keys) k = static_cast<uint32_t>(rng() % 50);
+        check_sort(keys, 32, 777);
+
+        // only the lower bits are sorted, the upper bits keep the input order
+        for (auto& k : keys) k = static_cast<uint32_t>(rng());
+        check_sort(keys, 16, 1000);
+
+        // segment in the upper bits of 64 bit keys, as ray_order builds them
+        std::vector<uint64_t> codes(50000);
+        for (auto& c : codes) c = ((rng() % 3) << 32) | static_cast<uint32_t>(rng());
+        check_sort(codes, 34, 4096);
+    }
+
+    void test_edge_cases() {
+        // all the keys share every digit, or all but the last one: every pass but one is skipped
+        check_sort(std::vector<uint32_t>(5000, 0x12345678u), 32, 1000);
+        std::vector<uint32_t> keys(5000, 0xAB000000u);
+        for (size_t i = 0; i < keys.size(); i += 3) keys[i] = 0x01000000u;
+        check_sort(keys, 32, 1000);
+
+        check_sort(std::vector<uint32_t>(), 32, 1000);
+        check_sort(std::vector<uint32_t>({ 42u }), 32, 1000);
+        check_sort(std::vector<uint32_t>({ 3u, 1u, 2u, 1u }), 32, 1);
+    }
+}
+
+int main() {
+    test_sort();
+    test_edge_cases();
+    return OptixCSP::test::test_result();
+}
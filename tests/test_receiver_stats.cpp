@@ -0,0 +1,111 @@
+// count_receiver_hits on hit buffers laid out as the trace writes them: the path filter selects receiver
+// hits by their direct sun tag, mirrors are never tagged and keep their hits in every filter.
+#include <cstdint>
+#include <vector>
+
+#include "core/receiver_stats.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    const size_t MAX_DEPTH = 3;
+    const uint32_t HELIOSTAT_0 = 0, HELIOSTAT_1 = 1, RECEIVER = 2, TOWER = 3;
+
+    // entry of hit_element_buffer
+    uint32_t entry(uint32_t hit_id, bool direct_sun = false) {
+        return (hit_id + 1) | (direct_sun ? HIT_DIRECT_SUN : 0u);
+    }
+
+    // one ray per line, MAX_DEPTH entries per ray (entry 0 is the sun sample and stays empty)
+    std::vector<uint32_t> make_hits() {
+        return {
+            0, entry(HELIOSTAT_0), entry(RECEIVER),            // sun -> heliostat 0 -> receiver
+            0, entry(HELIOSTAT_1), entry(RECEIVER),            // sun -> heliostat 1 -> receiver
+            0, entry(RECEIVER, true), 0,                       // sun -> receiver
+            0, entry(HELIOSTAT_0), 0,                          // absorbed by heliostat 0
+            0, entry(HELIOSTAT_1), entry(TOWER),               // sun -> heliostat 1 -> tower, not a receiver
+            0, entry(RECEIVER, true), 0,                       // sun -> receiver
+            0, entry(HELIOSTAT_0), entry(HELIOSTAT_1),         // blocked by heliostat 1
+            0, 0, 0,                                           // missed everything
+        };
+    }
+
+    BatchLayout make_layout(const std::vector<uint32_t>& hits, uint32_t num_batches) {
+        BatchLayout layout;
+        layout.num_batches = num_batches;
+        layout.entries_per_ray = MAX_DEPTH;
+        layout.num_rays = hits.size() / MAX_DEPTH;
+        return layout;
+    }
+
+    // one slot per hit id, as compute_element_hit_stats counts them
+    std::vector<uint64_t> count_per_id(const std::vector<uint32_t>& hits, PathFilter filter) {
+        std::vector<int32_t> hit_to_slot = { 0, 1, 2, 3 };
+        std::vector<uint64_t> counts;
+        std::vector<double> power;
+        count_receiver_hits(hits, {}, hit_to_slot, hit_to_slot.size(), make_layout(hits, 1), filter, counts, power);
+        return counts;
+    }
+
+    void test_path_filter() {
+        const std::vector<uint32_t> hits = make_hits();
+        const std::vector<int32_t> hit_to_receiver = { -1, -1, 0, -1 };
+
+        const PathFilter filters[3] = { PathFilter::ALL, PathFilter::REFLECTED, PathFilter::DIRECT_SUN };
+        const uint64_t expected[3] = { 4, 2, 2 };
+        for (int f = 0; f < 3; f++) {
+            std::vector<uint64_t> counts, direct;
+            std::vector<double> power;
+            count_receiver_hits(hits, {}, hit_to_receiver, 1, make_layout(hits, 1), filters[f], counts, power, &direct);
+            CHECK(counts.size() == 1 && power.size() == 1);
+            CHECK(counts[0] == expected[f]);
+            CHECK(power[0] == static_cast<double>(expected[f]));
+            // the direct sun count does not depend on the filter
+            CHECK(direct.size() == 1 && direct[0] == 2);
+        }
+
+        // the untagged heliostats keep their hits when the receivers are filtered
+        const std::vector<uint64_t> all = count_per_id(hits, PathFilter::ALL);
+        const std::vector<uint64_t> reflected = count_per_id(hits, PathFilter::REFLECTED);
+        const std::vector<uint64_t> heliostats = { 3, 3 };
+        CHECK(std::vector<uint64_t>(all.begin(), all.begin() + 2) == heliostats);
+        CHECK(std::vector<uint64_t>(reflected.begin(), reflected.begin() + 2) == heliostats);
+        CHECK(all[RECEIVER] == 4 && reflected[RECEIVER] == 2);
+        CHECK(all[TOWER] == 1 && reflected[TOWER] == 1);
+    }
+
+    // power of weighted rays, and the split of the counts into batches of rays
+    void test_weights_and_batches() {
+        const std::vector<uint32_t> hits = make_hits();
+        std::vector<float> weights(hits.size(), 0.0f);
+        for (size_t k = 0; k < hits.size(); k++) {
+            if (hits[k] != 0) weights[k] = 1.0f + static_cast<float>(k);
+        }
+        const std::vector<int32_t> hit_to_receiver = { -1, -1, 0, 1 };
+
+        std::vector<uint64_t> counts;
+        std::vector<double> power;
+        count_receiver_hits(hits, weights, hit_to_receiver, 2, make_layout(hits, 4), PathFilter::REFLECTED, counts, power);
+        // entry r * num_batches + b, two rays per batch
+        CHECK(counts.size() == 8 && power.size() == 8);
+        const std::vector<uint64_t> expected_counts = { 2, 0, 0, 0, 0, 0, 1, 0 };
+        CHECK(counts == expected_counts);
+        CHECK(power[0] == (1.0 + 2) + (1.0 + 5));
+        CHECK(power[6] == 1.0 + 14);
+        CHECK(power[1] == 0.0 && power[2] == 0.0);
+
+        // hit ids beyond hit_to_receiver are skipped
+        std::vector<uint32_t> stray = hits;
+        stray[1] = entry(17);
+        count_receiver_hits(stray, {}, hit_to_receiver, 2, make_layout(stray, 1), PathFilter::ALL, counts, power);
+        CHECK(counts[0] == 4 && counts[1] == 1);
+    }
+}
+
+int main() {
+    test_path_filter();
+    test_weights_and_batches();
+    return OptixCSP::test::test_result();
+}
@@ -0,0 +1,167 @@
+// ResultPipeline on its own: slots are reused, reducers see the batches in submit order, a reducer
+// exception comes out of finish() once and the pipeline keeps working afterwards.
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "core/result_pipeline.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    HitBatch make_batch(uint32_t index, size_t num_rays) {
+        HitBatch batch;
+        batch.index = index;
+        batch.first_ray = index * num_rays;
+        batch.num_rays = num_rays;
+        return batch;
+    }
+
+    // slots come from the allocator once and are handed out again
+    void test_slot_reuse() {
+        const size_t num_slots = 3, slot_entries = 16;
+        std::atomic<int> allocations(0), deallocations(0);
+        {
+            ResultPipeline pipeline(num_slots, slot_entries, true,
+                [&](size_t bytes) { allocations++; return std::malloc(bytes); },
+                [&](void* ptr) { deallocations++; std::free(ptr); });
+            CHECK(pipeline.get_num_slots() == num_slots);
+            CHECK(pipeline.get_slot_entries() == slot_entries);
+            CHECK(allocations == 3 * static_cast<int>(num_slots));    // points, ids, weights
+
+            std::set<const float4*> slot_points;
+            for (size_t s = 0; s < num_slots; s++) {
+                CHECK(pipeline.get_slot(s).hit_weights != nullptr);
+                slot_points.insert(pipeline.get_slot(s).hit_points);
+            }
+            CHECK(slot_points.size() == num_slots);
+
+            // the reducer sees the memory of the submitted slot
+            std::atomic<int> wrong_slot(0);
+            pipeline.add_reducer([&](const HitBatch& batch) {
+                if (!slot_points.count(batch.hit_points)) wrong_slot++;
+                if (batch.hit_ids[0] != batch.index) wrong_slot++;
+            });
+
+            std::set<size_t> used;
+            for (uint32_t b = 0; b < 50; b++) {
+                const size_t s = pipeline.acquire();
+                CHECK(s < num_slots);
+                used.insert(s);
+                pipeline.get_slot(s).hit_ids[0] = b;
+                pipeline.submit(s, make_batch(b, 4));
+            }
+            pipeline.finish();
+            CHECK(wrong_slot == 0);
+            CHECK(used.size() <= num_slots);
+            CHECK(allocations == 3 * static_cast<int>(num_slots));
+        }
+        CHECK(deallocations == allocations);
+
+        // without weighted rays there is no weight buffer
+        ResultPipeline unweighted(1, slot_entries, false);
+        CHECK(unweighted.get_slot(0).hit_weights == nullptr);
+    }
+
+    // batches are reduced in submit order even when later batches become ready first
+    void test_ordering() {
+        const uint32_t num_batches = 20;
+        ResultPipeline pipeline(4, 8, false);
+        std::vector<uint32_t> first, second;
+        pipeline.add_reducer([&](const HitBatch& batch) { first.push_back(batch.index); });
+        pipeline.add_reducer([&](const HitBatch& batch) {
+            // every reducer runs on a batch before the next batch starts
+            CHECK(first.size() == second.size() + 1);
+            second.push_back(batch.index);
+        });
+
+        for (uint32_t b = 0; b < num_batches; b++) {
+            const size_t s = pipeline.acquire();
+            const auto delay = std::chrono::milliseconds((num_batches - b) % 4);
+            pipeline.submit(s, make_batch(b, 2), [delay] { std::this_thread::sleep_for(delay); });
+        }
+        pipeline.finish();
+
+        CHECK(first.size() == num_batches);
+        CHECK(second.size() == num_batches);
+        for (uint32_t b = 0; b < first.size(); b++) CHECK(first[b] == b);
+        CHECK(first == second);
+    }
+
+    // the first reducer exception is rethrown by finish(), the remaining batches are drained
+    // without the reducers and their slots come back
+    void test_reducer_exception() {
+        const size_t num_slots = 2;
+        ResultPipeline pipeline(num_slots, 8, false);
+        std::vector<uint32_t> reduced;
+        bool fail = true;
+        pipeline.add_reducer([&](const HitBatch& batch) {
+            if (fail && batch.index == 3) throw std::runtime_error("reducer failed");
+            if (fail && batch.index == 5) throw std::logic_error("second failure");
+            reduced.push_back(batch.index);
+        });
+
+        for (uint32_t b = 0; b < 10; b++) pipeline.submit(pipeline.acquire(), make_batch(b, 1));
+
+        bool caught = false;
+        try {
+            pipeline.finish();
+        }
+        catch (const std::runtime_error& e) {
+            caught = std::string(e.what()) == "reducer failed";
+        }
+        CHECK(caught);
+        CHECK((reduced == std::vector<uint32_t>{0, 1, 2}));
+
+        // an exception of wait_ready is reported the same way
+        pipeline.submit(pipeline.acquire(), make_batch(10, 1), [] { throw std::runtime_error("copy failed"); });
+        CHECK_THROWS(pipeline.finish());
+
+        // the error is reported once, all slots are free again and the next run goes through
+        fail = false;
+        reduced.clear();
+        std::vector<size_t> slots;
+        for (size_t s = 0; s < num_slots; s++) slots.push_back(pipeline.acquire());
+        for (uint32_t b = 0; b < num_slots; b++) pipeline.submit(slots[b], make_batch(b, 1));
+        pipeline.finish();
+        CHECK((reduced == std::vector<uint32_t>{0, 1}));
+    }
+
+    // finish() returns only after every submitted batch went through the reducers, and the
+    // destructor drains batches that were never waited for
+    void test_finish() {
+        std::atomic<int> reduced(0);
+        {
+            ResultPipeline pipeline(2, 8, false);
+            pipeline.add_reducer([&](const HitBatch&) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                reduced++;
+            });
+
+            // nothing submitted
+            pipeline.finish();
+            CHECK(reduced == 0);
+
+            for (uint32_t b = 0; b < 6; b++) pipeline.submit(pipeline.acquire(), make_batch(b, 1));
+            pipeline.finish();
+            CHECK(reduced == 6);
+
+            for (uint32_t b = 0; b < 2; b++) pipeline.submit(pipeline.acquire(), make_batch(b, 1));
+        }
+        CHECK(reduced == 8);
+    }
+}
+
+int main() {
+    test_slot_reuse();
+    test_ordering();
+    test_reducer_exception();
+    test_finish();
+    return OptixCSP::test::test_result();
+}
@@ -0,0 +1,193 @@
+// Slope / specularity errors of SurfaceError.h drawn from the inverse CDF tables of build_error_tables:
+// the statistics of the tilted directions against the gaussian and pillbox distributions.
+#include <random>
+#include <vector>
+
+#include "core/optics_table.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    const int NUM_DRAWS = 400000;
+
+    std::mt19937 rng(48u);
+
+    float uniform() {
+        // [0, 1) as drawn on the device
+        return std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+    }
+
+    // tilt of the drawn directions in the frame of tilt_direction, as angles (radians) along u and v
+    struct TiltSamples {
+        std::vector<double> x, y;
+    };
+
+    TiltSamples draw(const std::vector<float>& tables, ErrorDistribution distribution, float error, const float3& dir) {
+        const float3 a = fabsf(dir.x) > 0.9f ? make_float3(0.0f, 1.0f, 0.0f) : make_float3(1.0f, 0.0f, 0.0f);
+        const float3 u = normalize(cross(a, dir));
+        const float3 v = cross(dir, u);
+
+        TiltSamples samples;
+        for (int i = 0; i < NUM_DRAWS; i++) {
+            const float u_radius = uniform();
+            const float u_phi = uniform();
+            const float3 d = apply_surface_error(tables.data(), distribution, error, dir, u_radius, u_phi);
+            const double along = dot(d, dir);
+            samples.x.push_back(std::atan2(static_cast<double>(dot(d, u)), along));
+            samples.y.push_back(std::atan2(static_cast<double>(dot(d, v)), along));
+        }
+        return samples;
+    }
+
+    double mean(const std::vector<double>& values) {
+        double sum = 0.0;
+        for (double value : values) sum += value;
+        return sum / values.size();
+    }
+
+    double standard_deviation(const std::vector<double>& values) {
+        const double m = mean(values);
+        double sum = 0.0;
+        for (double value : values) sum += (value - m) * (value - m);
+        return std::sqrt(sum / values.size());
+    }
+
+    // the tilt is normal with the error as standard deviation per axis
+    void test_gaussian(const std::vector<float>& tables) {
+        const float sigma = 4e-3f;
+        const TiltSamples s = draw(tables, ERROR_GAUSSIAN, sigma, normalize(make_float3(0.3f, -0.5f, 0.8f)));
+
+        const double sx = standard_deviation(s.x) / sigma, sy = standard_deviation(s.y) / sigma;
+        std::printf("gaussian: std x %.4f sigma, std y %.4f sigma\n", sx, sy);
+        CHECK_NEAR(sx, 1.0, 0.01);
+        CHECK_NEAR(sy, 1.0, 0.01);
+        CHECK_NEAR(mean(s.x) / sigma, 0.0, 0.01);
+        CHECK_NEAR(mean(s.y) / sigma, 0.0, 0.01);
+
+        // radial distribution: P(r < k sigma) = 1 - exp(-k^2 / 2), fraction of the 1D tilt within one sigma
+        int within[3] = { 0, 0, 0 };
+        int within_x = 0;
+        double covariance = 0.0;
+        for (int i = 0; i < NUM_DRAWS; i++) {
+            const double r = std::sqrt(s.x[i] * s.x[i] + s.y[i] * s.y[i]) / sigma;
+            for (int k = 0; k < 3; k++) within[k] += r < k + 1;
+            within_x += std::fabs(s.x[i]) < sigma;
+            covariance += s.x[i] * s.y[i];
+        }
+        for (int k = 0; k < 3; k++) {
+            CHECK_NEAR(static_cast<double>(within[k]) / NUM_DRAWS, 1.0 - std::exp(-0.5 * (k + 1) * (k + 1)), 3e-3);
+        }
+        CHECK_NEAR(static_cast<double>(within_x) / NUM_DRAWS, 0.682689, 3e-3);
+        CHECK_NEAR(covariance / NUM_DRAWS / (sigma * sigma), 0.0, 0.01);
+    }
+
+    // the tilt is uniform on the disk of radius error
+    void test_pillbox(const std::vector<float>& tables) {
+        const float half_width = 6e-3f;
+        const TiltSamples s = draw(tables, ERROR_PILLBOX, half_width, make_float3(0.0f, 0.0f, 1.0f));
+
+        double max_r = 0.0;
+        int rings[4] = { 0, 0, 0, 0 };
+        int quadrants[4] = { 0, 0, 0, 0 };
+        for (int i = 0; i < NUM_DRAWS; i++) {
+            const double r = std::sqrt(s.x[i] * s.x[i] + s.y[i] * s.y[i]) / half_width;
+            max_r = std::max(max_r, r);
+            rings[std::min(3, static_cast<int>(r * r * 4.0))]++;
+            quadrants[(s.x[i] < 0.0 ? 1 : 0) + (s.y[i] < 0.0 ? 2 : 0)]++;
+        }
+        CHECK(max_r <= 1.0 + 1e-4);
+
+        // rings of equal area hold a quarter of the draws each, and so do the quadrants
+        for (int k = 0; k < 4; k++) {
+            CHECK_NEAR(static_cast<double>(rings[k]) / NUM_DRAWS, 0.25, 3e-3);
+            CHECK_NEAR(static_cast<double>(quadrants[k]) / NUM_DRAWS, 0.25, 3e-3);
+        }
+
+        // uniform on the disk of radius R: standard deviation R / 2 per axis
+        const double sx = standard_deviation(s.x) / half_width, sy = standard_deviation(s.y) / half_width;
+        std::printf("pillbox: std x %.4f, std y %.4f half widths, max radius %.6f\n", sx, sy, max_r);
+        CHECK_NEAR(sx, 0.5, 0.005);
+        CHECK_NEAR(sy, 0.5, 0.005);
+    }
+
+    // the last gaussian cell has the mean of the rayleigh tail beyond its start, the table as a whole
+    // the mean and second moment of the rayleigh distribution
+    void test_gaussian_table(const std::vector<float>& tables) {
+        const float* gaussian = tables.data() + ERROR_GAUSSIAN * ERROR_TABLE_SIZE;
+        const float* pillbox = tables.data() + ERROR_PILLBOX * ERROR_TABLE_SIZE;
+        CHECK(gaussian[0] == 0.0f);
+        CHECK(pillbox[0] == 0.0f);
+        CHECK(pillbox[ERROR_TABLE_SIZE - 1] == 1.0f);
+        for (unsigned int i = 1; i < ERROR_TABLE_SIZE; i++) {
+            CHECK(gaussian[i] > gaussian[i - 1]);
+            CHECK(pillbox[i] > pillbox[i - 1]);
+        }
+
+        // E[r | r > a] by numerical integration of the rayleigh density r exp(-r^2 / 2)
+        const double a = gaussian[ERROR_TABLE_SIZE - 2];
+        double integral = 0.0;
+        const double dr = 1e-5;
+        for (double r = a + 0.5 * dr; r < a + 20.0; r += dr) integral += r * r * std::exp(-0.5 * r * r) * dr;
+        const double tail_mean = integral / std::exp(-0.5 * a * a);
+        const double cell_mean = 0.5 * (static_cast<double>(gaussian[ERROR_TABLE_SIZE - 2]) + gaussian[ERROR_TABLE_SIZE - 1]);
+        std::printf("last gaussian cell [%.4f, %.4f]: mean %.6f, tail mean %.6f\n",
+            gaussian[ERROR_TABLE_SIZE - 2], gaussian[ERROR_TABLE_SIZE - 1], cell_mean, tail_mean);
+        CHECK_NEAR(cell_mean, tail_mean, 1e-5);
+
+        // the same cell through sample_error_radius
+        double sum = 0.0;
+        const int n = 100000;
+        const double u0 = static_cast<double>(ERROR_TABLE_SIZE - 2) / (ERROR_TABLE_SIZE - 1);
+        for (int i = 0; i < n; i++) {
+            sum += sample_error_radius(tables.data(), ERROR_GAUSSIAN, static_cast<float>(u0 + (1.0 - u0) * (i + 0.5) / n));
+        }
+        CHECK_NEAR(sum / n, tail_mean, 1e-3);
+
+        // moments of the piecewise linear inverse CDF, rayleigh: E[r] = sqrt(pi / 2), E[r^2] = 2
+        double m1 = 0.0, m2 = 0.0;
+        for (unsigned int i = 0; i + 1 < ERROR_TABLE_SIZE; i++) {
+            const double lo = gaussian[i], hi = gaussian[i + 1];
+            m1 += 0.5 * (lo + hi);
+            m2 += (lo * lo + lo * hi + hi * hi) / 3.0;
+        }
+        m1 /= ERROR_TABLE_SIZE - 1;
+        m2 /= ERROR_TABLE_SIZE - 1;
+        std::printf("gaussian table: E[r] %.6f, E[r^2] %.6f\n", m1, m2);
+        CHECK_NEAR(m1, 1.2533141373155, 1e-4);
+        CHECK_NEAR(m2, 2.0, 5e-3);
+    }
+
+    // errors of 0 (or less) leave the direction untouched
+    void test_no_error(const std::vector<float>& tables) {
+        const float3 dir = normalize(make_float3(-0.2f, 0.7f, 0.4f));
+        for (int i = 0; i < 1000; i++) {
+            const float u_radius = uniform(), u_phi = uniform();
+            for (unsigned int distribution = 0; distribution < NUM_ERROR_DISTRIBUTIONS; distribution++) {
+                for (float error : { 0.0f, -1e-3f }) {
+                    const float3 d = apply_surface_error(tables.data(), distribution, error, dir, u_radius, u_phi);
+                    CHECK(d.x == dir.x && d.y == dir.y && d.z == dir.z);
+                }
+            }
+        }
+        // the draw only sees the error tables when there is an error
+        const float3 d = apply_surface_error(nullptr, ERROR_GAUSSIAN, 0.0f, dir, 0.5f, 0.5f);
+        CHECK(d.x == dir.x && d.y == dir.y && d.z == dir.z);
+
+        CHECK(error_distribution('g') == ERROR_GAUSSIAN);
+        CHECK(error_distribution('p') == ERROR_PILLBOX);
+        CHECK(error_distribution('P') == ERROR_PILLBOX);
+    }
+}
+
+int main() {
+    const std::vector<float> tables = build_error_tables();
+    CHECK(tables.size() == NUM_ERROR_DISTRIBUTIONS * ERROR_TABLE_SIZE);
+
+    test_gaussian(tables);
+    test_pillbox(tables);
+    test_gaussian_table(tables);
+    test_no_error(tables);
+    return OptixCSP::test::test_result();
+}
@@ -0,0 +1,129 @@
+// Stage -> row -> element hierarchy of TransformGroup: composed global frames, and the dirty flags that let
+// update_transforms skip the subtrees nothing touched and report only the elements whose frame changed.
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "core/CspElement.h"
+#include "core/transform_group.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    struct Field {
+        std::shared_ptr<TransformGroup> stage;
+        std::shared_ptr<TransformGroup> row_a;
+        std::shared_ptr<TransformGroup> row_b;
+        std::vector<std::shared_ptr<CspElement>> elements;  // ids 0, 1 in row a, 2 in row b, 3 on the stage
+    };
+
+    std::shared_ptr<CspElement> make_element(int id, const Vec3d& origin) {
+        auto e = std::make_shared<CspElement>();
+        e->set_origin(origin);
+        e->set_aim_point(origin + Vec3d(0.0, 0.0, 1.0));
+        e->set_id(id);
+        return e;
+    }
+
+    Field make_field() {
+        Field field;
+        field.stage = std::make_shared<TransformGroup>(Vec3d(10.0, 0.0, 0.0), Vec3d(10.0, 0.0, 1.0), 0.0);
+        field.row_a = std::make_shared<TransformGroup>(Vec3d(0.0, 5.0, 0.0), Vec3d(0.0, 5.0, 1.0), 0.0);
+        field.row_b = std::make_shared<TransformGroup>(Vec3d(0.0, -5.0, 0.0), Vec3d(0.0, -5.0, 1.0), 0.0);
+        field.stage->add_group(field.row_a);
+        field.stage->add_group(field.row_b);
+
+        field.elements = { make_element(0, Vec3d(1.0, 0.0, 0.0)), make_element(1, Vec3d(2.0, 0.0, 0.0)),
+                           make_element(2, Vec3d(1.0, 0.0, 0.0)), make_element(3, Vec3d(0.0, 0.0, 0.0)) };
+        field.row_a->add_element(field.elements[0]);
+        field.row_a->add_element(field.elements[1]);
+        field.row_b->add_element(field.elements[2]);
+        field.stage->add_element(field.elements[3]);
+        return field;
+    }
+
+    // update as SolTraceSystem::update does, the geometry manager then clears the element flags
+    std::vector<int> update(Field& field, bool force = false) {
+        std::vector<int> changed_ids;
+        field.stage->update_transforms(changed_ids, force);
+        for (const auto& e : field.elements) e->clear_dirty();
+        std::sort(changed_ids.begin(), changed_ids.end());
+        return changed_ids;
+    }
+
+    void check_origin(const Vec3d& actual, const Vec3d& expected) {
+        CHECK_NEAR(actual[0], expected[0], 1e-12);
+        CHECK_NEAR(actual[1], expected[1], 1e-12);
+        CHECK_NEAR(actual[2], expected[2], 1e-12);
+    }
+
+    void test_compose() {
+        Field field = make_field();
+        CHECK(field.stage->is_dirty());
+        CHECK(update(field, true) == std::vector<int>({ 0, 1, 2, 3 }));
+        CHECK(!field.stage->is_dirty() && !field.row_a->is_dirty() && !field.row_b->is_dirty());
+
+        check_origin(field.row_a->get_global_origin(), Vec3d(10.0, 5.0, 0.0));
+        check_origin(field.elements[1]->get_global_origin(), Vec3d(12.0, 5.0, 0.0));
+        check_origin(field.elements[2]->get_global_origin(), Vec3d(11.0, -5.0, 0.0));
+        check_origin(field.elements[3]->get_global_origin(), Vec3d(10.0, 0.0, 0.0));
+
+        // turning the stage turns the rows and their elements around the stage origin
+        field.stage->set_zrot(90.0);
+        CHECK(update(field) == std::vector<int>({ 0, 1, 2, 3 }));
+        const Matrix33d& rotation = field.stage->get_rotation_matrix();
+        const Vec3d expected = rotation * Vec3d(2.0, 5.0, 0.0) + Vec3d(10.0, 0.0, 0.0);
+        check_origin(field.elements[1]->get_global_origin(), expected);
+        const Vec3d x_axis = rotation * Vec3d(1.0, 0.0, 0.0);
+        CHECK_NEAR(x_axis[0], 0.0, 1e-12);
+        CHECK_NEAR(std::fabs(x_axis[1]), 1.0, 1e-12);
+    }
+
+    void test_dirty_propagation() {
+        Field field = make_field();
+        update(field, true);
+        CHECK(update(field).empty());
+
+        // a row move flags its parents but not its sibling, only the elements of the row are refreshed
+        field.row_a->set_origin(Vec3d(0.0, 6.0, 0.0));
+        field.row_a->set_aim_point(Vec3d(0.0, 6.0, 1.0));
+        CHECK(field.row_a->is_dirty() && field.stage->is_dirty());
+        CHECK(!field.row_b->is_dirty());
+        CHECK(update(field) == std::vector<int>({ 0, 1 }));
+        check_origin(field.elements[0]->get_global_origin(), Vec3d(11.0, 6.0, 0.0));
+        check_origin(field.elements[2]->get_global_origin(), Vec3d(11.0, -5.0, 0.0));
+        CHECK(!field.stage->is_dirty());
+
+        // an element edit flags its row and the stage, its siblings are not reported
+        field.elements[2]->set_zrot(30.0);
+        CHECK(field.row_b->is_dirty() && field.stage->is_dirty());
+        CHECK(!field.row_a->is_dirty());
+        CHECK(update(field) == std::vector<int>({ 2 }));
+
+        field.elements[3]->set_aim_point(Vec3d(1.0, 0.0, 1.0));
+        CHECK(!field.row_a->is_dirty() && !field.row_b->is_dirty());
+        CHECK(update(field) == std::vector<int>({ 3 }));
+
+        // a group added below a row moves with it, elements without an id are refreshed but not reported
+        auto facet_group = std::make_shared<TransformGroup>();
+        auto unregistered = make_element(-1, Vec3d(0.0, 0.0, 1.0));
+        facet_group->add_element(unregistered);
+        field.row_a->add_group(facet_group);
+        CHECK(field.row_a->is_dirty() && field.stage->is_dirty());
+        CHECK(update(field).empty());
+        check_origin(unregistered->get_global_origin(), Vec3d(10.0, 6.0, 1.0));
+
+        field.row_a->update_pose(Vec3d(0.0, 7.0, 0.0), Vec3d(0.0, 7.0, 1.0), 0.0);
+        CHECK(update(field) == std::vector<int>({ 0, 1 }));
+        check_origin(unregistered->get_global_origin(), Vec3d(10.0, 7.0, 1.0));
+    }
+}
+
+int main() {
+    test_compose();
+    test_dirty_propagation();
+    return OptixCSP::test::test_result();
+}
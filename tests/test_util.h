@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+
+// Minimal checks for the host tests: a failed check prints its location and the test keeps going,
+// main returns test_result() so that ctest sees the failure.
+namespace OptixCSP {
+    namespace test {
+        inline int& failures() {
+            static int count = 0;
+            return count;
+        }
+
+        inline int test_result() {
+            if (failures() > 0) {
+                std::fprintf(stderr, "%d check(s) failed\n", failures());
+                return 1;
+            }
+            std::printf("all checks passed\n");
+            return 0;
+        }
+    }
+}
+
+#define CHECK(cond)                                                                            \
+    do {                                                                                       \
+        if (!(cond)) {                                                                         \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);      \
+            ++OptixCSP::test::failures();                                                      \
+        }                                                                                      \
+    } while (0)
+
+#define CHECK_NEAR(a, b, tol)                                                                  \
+    do {                                                                                       \
+        const double check_a_ = (a), check_b_ = (b);                                           \
+        if (!(std::fabs(check_a_ - check_b_) <= (tol))) {                                      \
+            std::fprintf(stderr, "%s:%d: CHECK_NEAR(%s, %s) failed: %.9g vs %.9g (tolerance %g)\n", \
+                __FILE__, __LINE__, #a, #b, check_a_, check_b_, static_cast<double>(tol));     \
+            ++OptixCSP::test::failures();                                                      \
+        }                                                                                      \
+    } while (0)
+
+#define CHECK_THROWS(expr)                                                                     \
+    do {                                                                                       \
+        bool check_thrown_ = false;                                                            \
+        try { expr; } catch (...) { check_thrown_ = true; }                                    \
+        if (!check_thrown_) {                                                                  \
+            std::fprintf(stderr, "%s:%d: %s did not throw\n", __FILE__, __LINE__, #expr);      \
+            ++OptixCSP::test::failures();                                                      \
+        }                                                                                      \
+    } while (0)
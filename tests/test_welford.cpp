@@ -0,0 +1,111 @@
+// WelfordAccumulator: streaming mean and variance against the two-pass values, merges of partial
+// accumulators in any split, and the batch estimates of BatchLayout and accumulate_batches.
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "utils/welford.h"
+#include "test_util.h"
+
+using namespace OptixCSP;
+
+namespace {
+
+    std::vector<double> make_samples(size_t count) {
+        // large offset, so that a naive sum of squares would lose the variance
+        std::mt19937_64 rng(11);
+        std::normal_distribution<double> normal(1.0e6, 2.0);
+        std::vector<double> samples(count);
+        for (double& x : samples) x = normal(rng);
+        return samples;
+    }
+
+    void two_pass(const std::vector<double>& samples, double& mean, double& variance) {
+        mean = 0.0;
+        for (double x : samples) mean += x;
+        mean /= samples.size();
+        variance = 0.0;
+        for (double x : samples) variance += (x - mean) * (x - mean);
+        variance /= samples.size() - 1;
+    }
+
+    void test_add() {
+        const std::vector<double> samples = make_samples(10000);
+        WelfordAccumulator acc;
+        for (double x : samples) acc.add(x);
+
+        double mean, variance;
+        two_pass(samples, mean, variance);
+        CHECK(acc.count == samples.size());
+        CHECK_NEAR(acc.mean, mean, 1e-6);
+        CHECK_NEAR(acc.get_variance(), variance, 1e-9 * variance);
+        CHECK_NEAR(acc.get_standard_error(), std::sqrt(variance / samples.size()), 1e-9);
+
+        WelfordAccumulator one;
+        CHECK(one.get_variance() == 0.0 && one.get_standard_error() == 0.0);
+        one.add(3.0);
+        CHECK(one.mean == 3.0 && one.get_variance() == 0.0);
+    }
+
+    void test_merge() {
+        const std::vector<double> samples = make_samples(10000);
+        WelfordAccumulator all;
+        for (double x : samples) all.add(x);
+
+        // uneven splits, including empty parts on either side of merge
+        const size_t splits[] = { 0, 1, 37, 5000, 9999, 10000 };
+        for (size_t split : splits) {
+            WelfordAccumulator a, b;
+            for (size_t i = 0; i < split; i++) a.add(samples[i]);
+            for (size_t i = split; i < samples.size(); i++) b.add(samples[i]);
+
+            WelfordAccumulator ab = a;
+            ab.merge(b);
+            WelfordAccumulator ba = b;
+            ba.merge(a);
+            for (const WelfordAccumulator& merged : { ab, ba }) {
+                CHECK(merged.count == all.count);
+                CHECK_NEAR(merged.mean, all.mean, 1e-6);
+                CHECK_NEAR(merged.m2, all.m2, 1e-9 * all.m2);
+            }
+        }
+
+        // many small parts merged in a tree, as per-thread and per-run accumulators are
+        std::vector<WelfordAccumulator> parts(64);
+        for (size_t i = 0; i < samples.size(); i++) parts[(i * 7) % parts.size()].add(samples[i]);
+        for (size_t stride = 1; stride < parts.size(); stride *= 2) {
+            for (size_t i = 0; i + stride < parts.size(); i += 2 * stride) parts[i].merge(parts[i + stride]);
+        }
+        CHECK(parts[0].count == all.count);
+        CHECK_NEAR(parts[0].mean, all.mean, 1e-6);
+        CHECK_NEAR(parts[0].get_variance(), all.get_variance(), 1e-9 * all.get_variance());
+    }
+
+    void test_batches() {
+        BatchLayout layout;
+        layout.num_batches = 4;
+        layout.entries_per_ray = 3;
+        layout.num_rays = 10;
+        // rays 0-2, 3-4, 5-7, 8-9
+        const uint32_t expected[10] = { 0, 0, 0, 1, 1, 2, 2, 2, 3, 3 };
+        bool all_match = true;
+        for (size_t k = 0; k < 30; k++) all_match = all_match && layout.batch_of(k) == expected[k / 3];
+        CHECK(all_match);
+        CHECK(BatchLayout().batch_of(12345) == 0);
+
+        const uint64_t batch_counts[4] = { 24, 26, 25, 25 };
+        const WelfordAccumulator acc = accumulate_batches(batch_counts, 4);
+        CHECK(acc.count == 4);
+        CHECK_NEAR(acc.mean, 100.0, 1e-12);
+        // estimates 96, 104, 100, 100: variance 32 / 3, standard error sqrt(8 / 3)
+        CHECK_NEAR(acc.get_standard_error(), std::sqrt(8.0 / 3.0), 1e-12);
+    }
+}
+
+int main() {
+    test_add();
+    test_merge();
+    test_batches();
+    return OptixCSP::test::test_result();
+}
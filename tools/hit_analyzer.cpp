@@ -0,0 +1,242 @@
+#include "core/hit_csv.h"
+#include "core/flux_map.h"
+#include "core/CspElement.h"
+#include "core/Aperture.h"
+#include "core/Surface.h"
+#include "core/timer.h"
+#include "utils/ks_statistic.h"
+
+#include <vector_functions.h>
+#include <array>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace OptixCSP;
+
+namespace {
+
+    void print_usage() {
+        std::cout <<
+            "usage: hit_analyzer <hits.csv> [options]\n"
+            "  reads a ray file of write_hp_output (OptiX) or of SolTrace, the format is taken from the header\n"
+            "  --receiver-stage s          receiver rows of OptiX files, default 2\n"
+            "  --receiver-element e        receiver rows of SolTrace files, default -1, and of OptiX files\n"
+            "                              with an element column if given\n"
+            "  --flat ox oy oz ax ay az zrot width height\n"
+            "  --cylinder ox oy oz ax ay az zrot diameter height\n"
+            "                              receiver frame as set on the CspElement (origin, aim point, z rotation)\n"
+            "  --grid nx ny                flux map resolution, default 100 100\n"
+            "  --power-per-ray p           W per ray (DNI * sun plane area / number of rays), default 1\n"
+            "  --flux out.csv              write the flux map of the receiver\n"
+            "  --compare other.csv         two-sample KS test of the receiver hits against another ray file,\n"
+            "                              on the receiver (u, v) with a receiver, on global x, y, z otherwise\n";
+    }
+
+    struct Options {
+        std::string input;
+        std::string compare;
+        std::string flux_file;
+        int receiver_stage = 2;
+        int receiver_element = -1;
+        bool receiver_element_set = false;
+        int nx = 100;
+        int ny = 100;
+        double power_per_ray = 1.0;
+        std::shared_ptr<CspElement> receiver;
+    };
+
+    // rows of a (stage, element, instance, mesh)
+    using HitKey = std::array<int32_t, 4>;
+
+    // receiver hits and per object counts of one ray file
+    struct FileSummary {
+        HitFileFormat format = HitFileFormat::OPTIX;
+        std::map<HitKey, uint64_t> counts;
+        std::vector<float4> receiver_hits;  // layout of the device hit buffer, (depth, x, y, z)
+        uint64_t num_rows = 0;
+        uint64_t num_malformed = 0;
+        size_t size_bytes = 0;
+        double seconds = 0.0;
+    };
+
+    std::shared_ptr<CspElement> make_receiver(char* argv[], bool cylinder) {
+        double v[9];
+        for (int k = 0; k < 9; k++) v[k] = std::atof(argv[k]);
+
+        auto receiver = std::make_shared<CspElement>();
+        receiver->set_origin(Vec3d(v[0], v[1], v[2]));
+        receiver->update_element(Vec3d(v[3], v[4], v[5]), v[6]);
+        receiver->set_aperture(std::make_shared<ApertureRectangle>(v[7], v[8]));
+        if (cylinder) receiver->set_surface(std::make_shared<SurfaceCylinder>());
+        else receiver->set_surface(std::make_shared<SurfaceFlat>());
+        receiver->set_receiver(true);
+        return receiver;
+    }
+
+    FileSummary read_hits(const std::string& filename, const Options& options) {
+        Timer timer;
+        timer.start();
+
+        HitCsvReader reader(filename);
+        FileSummary summary;
+        summary.format = reader.get_format();
+        summary.size_bytes = reader.get_size_bytes();
+
+        // receiver rows by element where the file has it and it was asked for, by stage otherwise
+        const bool by_stage = summary.format == HitFileFormat::OPTIX
+            && !(options.receiver_element_set && reader.get_columns().has(HitField::ELEMENT));
+        std::vector<std::map<HitKey, uint64_t>> counts(get_num_host_threads());
+        std::vector<std::vector<float4>> receiver_hits(get_num_host_threads());
+
+        summary.num_malformed = reader.for_each_record([&](const HitRecord& r, unsigned int t) {
+            counts[t][{ r.stage, r.element, r.instance, r.mesh }]++;
+            bool is_receiver = by_stage ? r.stage == options.receiver_stage : r.element == options.receiver_element;
+            if (is_receiver) {
+                receiver_hits[t].push_back(make_float4(static_cast<float>(r.stage),
+                    static_cast<float>(r.x), static_cast<float>(r.y), static_cast<float>(r.z)));
+            }
+        });
+
+        for (size_t t = 0; t < counts.size(); t++) {
+            for (const auto& c : counts[t]) {
+                summary.counts[c.first] += c.second;
+                summary.num_rows += c.second;
+            }
+            summary.receiver_hits.insert(summary.receiver_hits.end(), receiver_hits[t].begin(), receiver_hits[t].end());
+        }
+
+        timer.stop();
+        summary.seconds = timer.get_time_sec();
+        return summary;
+    }
+
+    void print_summary(const std::string& filename, const FileSummary& s) {
+        std::cout << "file, " << filename
+            << ", format, " << (s.format == HitFileFormat::OPTIX ? "optix" : "soltrace")
+            << ", rows, " << s.num_rows
+            << ", malformed_rows, " << s.num_malformed
+            << ", receiver_hits, " << s.receiver_hits.size()
+            << ", timing, " << s.seconds
+            << ", MB_per_sec, " << (s.seconds > 0.0 ? s.size_bytes / s.seconds / 1.0e6 : 0.0) << std::endl;
+
+        // rows of OptiX files written without the element column are counted per trace depth only
+        std::cout << "stage,element,instance,mesh,hits" << std::endl;
+        for (const auto& c : s.counts) {
+            std::cout << c.first[0] << "," << c.first[1] << "," << c.first[2] << "," << c.first[3] << "," << c.second << std::endl;
+        }
+    }
+
+    // coordinates to compare: receiver (u, v) with a receiver, global x, y, z otherwise
+    std::vector<std::vector<double>> get_coordinates(const FileSummary& s, const FluxMap* flux_map) {
+        std::vector<std::vector<double>> coords(flux_map ? 2 : 3);
+        for (const float4& hp : s.receiver_hits) {
+            if (flux_map) {
+                double u, v;
+                if (!flux_map->get_surface_coordinates(Vec3d(hp.y, hp.z, hp.w), u, v)) continue;
+                coords[0].push_back(u);
+                coords[1].push_back(v);
+            }
+            else {
+                coords[0].push_back(hp.y);
+                coords[1].push_back(hp.z);
+                coords[2].push_back(hp.w);
+            }
+        }
+        return coords;
+    }
+}
+
+// offline post-processing of archived ray files: per element hit counts, receiver flux map and
+// OptiX versus SolTrace comparison, without a GPU
+int main(int argc, char* argv[]) {
+
+    if (argc < 2) {
+        print_usage();
+        return 1;
+    }
+
+    Options options;
+    options.input = argv[1];
+    for (int a = 2; a < argc; a++) {
+        std::string arg = argv[a];
+        auto has = [&](int n) { return a + n < argc; };
+        if (arg == "--receiver-stage" && has(1)) options.receiver_stage = std::atoi(argv[++a]);
+        else if (arg == "--receiver-element" && has(1)) {
+            options.receiver_element = std::atoi(argv[++a]);
+            options.receiver_element_set = true;
+        }
+        else if ((arg == "--flat" || arg == "--cylinder") && has(9)) {
+            options.receiver = make_receiver(argv + a + 1, arg == "--cylinder");
+            a += 9;
+        }
+        else if (arg == "--grid" && has(2)) {
+            options.nx = std::atoi(argv[++a]);
+            options.ny = std::atoi(argv[++a]);
+        }
+        else if (arg == "--power-per-ray" && has(1)) options.power_per_ray = std::atof(argv[++a]);
+        else if (arg == "--flux" && has(1)) options.flux_file = argv[++a];
+        else if (arg == "--compare" && has(1)) options.compare = argv[++a];
+        else {
+            std::cerr << "Unknown or incomplete option " << arg << std::endl;
+            print_usage();
+            return 1;
+        }
+    }
+
+    try {
+        FileSummary summary = read_hits(options.input, options);
+        print_summary(options.input, summary);
+
+        std::unique_ptr<FluxMap> flux_map;
+        if (options.receiver) {
+            flux_map = std::make_unique<FluxMap>(options.nx, options.ny);
+            flux_map->set_receiver(*options.receiver);
+
+            // every selected row is a receiver hit, give them all receiver hit id 0 (stored as 1)
+            std::vector<uint32_t> hit_ids(summary.receiver_hits.size(), 1);
+            flux_map->accumulate(summary.receiver_hits, hit_ids, 0, options.power_per_ray);
+
+            std::cout << "flux_hits, " << flux_map->get_num_hits()
+                << ", total_power, " << flux_map->get_total_power()
+                << ", peak_flux, " << flux_map->get_peak_flux()
+                << ", mean_flux, " << flux_map->get_mean_flux()
+                << ", centroid_u, " << flux_map->get_centroid_u()
+                << ", centroid_v, " << flux_map->get_centroid_v() << std::endl;
+
+            if (!options.flux_file.empty()) flux_map->write_csv(options.flux_file);
+        }
+        else if (!options.flux_file.empty()) {
+            std::cerr << "A flux map needs --flat or --cylinder" << std::endl;
+            return 1;
+        }
+
+        if (!options.compare.empty()) {
+            FileSummary other = read_hits(options.compare, options);
+            print_summary(options.compare, other);
+
+            std::vector<std::vector<double>> a = get_coordinates(summary, flux_map.get());
+            std::vector<std::vector<double>> b = get_coordinates(other, flux_map.get());
+            const char* names_uv[] = { "u", "v" };
+            const char* names_xyz[] = { "x", "y", "z" };
+
+            std::cout << "coordinate,ks_statistic,p_value,n1,n2" << std::endl;
+            for (size_t c = 0; c < a.size(); c++) {
+                size_t n1 = a[c].size(), n2 = b[c].size();
+                KsResult ks = ks_two_sample(a[c], b[c]);
+                std::cout << (flux_map ? names_uv[c] : names_xyz[c]) << ","
+                    << ks.statistic << "," << ks.p_value << "," << n1 << "," << n2 << std::endl;
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}